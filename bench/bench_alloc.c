@@ -0,0 +1,163 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/os.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchalloc.tmp";
+
+#define BENCH_EDGE_PAGES 20000
+#define BENCH_CACHE_SIZE 2000
+#define BENCH_ROUNDS 200
+#define BENCH_OPS_PER_ROUND 200
+
+static void remove_bench_files() {
+    remove(BENCHFILENAME);
+    remove("./benchalloc.tmp-journal");
+}
+
+/* Edge pages are not referred to by anything in the benchmark */
+static int count_move(void *arg, uint8_t pageType, uint32_t fromPageNo, uint32_t toPageNo) {
+    (void)pageType;
+    (void)fromPageNo;
+    (void)toPageNo;
+    (*(uint32_t*)arg)++;
+    return FABRICDB_OK;
+}
+
+/* Fills a new database with edge pages in one transaction */
+static int fill_edges(Pager *pager, uint32_t *live, uint32_t count) {
+    Page *page;
+    uint32_t i;
+    int rc;
+
+    rc = fdb_pager_begin_write(pager);
+    for (i = 0; i < count && rc == FABRICDB_OK; i++) {
+        rc = fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page);
+        if (rc == FABRICDB_OK) {
+            live[i] = page->pageNo;
+        }
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_commit(pager);
+    } else {
+        fdb_pager_rollback(pager);
+    }
+
+    return rc;
+}
+
+/* Frees random edge pages and allocates new ones in equal measure, a
+   transaction at a time.  New pages are asked for next to a random
+   live page, as an edge insert would ask for a page near its vertex. */
+static void run_churn(const char *label, uint8_t useHints) {
+    Pager *pager;
+    Page *page;
+    uint32_t *live;
+    uint32_t liveCount = BENCH_EDGE_PAGES;
+    uint32_t round;
+    uint32_t op;
+    uint32_t pick;
+    uint32_t hint;
+    uint64_t state = 88172645463325252ULL;
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint32_t moved = 0;
+    uint32_t pagesBefore;
+    double distance = 0;
+    double start;
+    double elapsed;
+    int rc;
+
+    remove_bench_files();
+    live = malloc(sizeof(uint32_t) * BENCH_EDGE_PAGES * 2);
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        free(live);
+        return;
+    }
+    rc = fdb_pager_init_file(pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_set_cache_size(pager, BENCH_CACHE_SIZE);
+    }
+    start = fdb_bench_now();
+    if (rc == FABRICDB_OK) {
+        rc = fill_edges(pager, live, liveCount);
+    }
+    elapsed = fdb_bench_now() - start;
+    if (rc != FABRICDB_OK) {
+        printf("    could not fill benchmark file\n");
+        goto cleanup;
+    }
+
+    printf("    %s\n", label);
+    fdb_report("fill: allocations / sec", "%.0f", BENCH_EDGE_PAGES / elapsed);
+
+    start = fdb_bench_now();
+    for (round = 0; round < BENCH_ROUNDS && rc == FABRICDB_OK; round++) {
+        rc = fdb_pager_begin_write(pager);
+        for (op = 0; op < BENCH_OPS_PER_ROUND && rc == FABRICDB_OK; op++) {
+            pick = (uint32_t)(fdb_bench_rand(&state) % liveCount);
+            if (fdb_bench_rand(&state) & 1) {
+                rc = fdb_pager_free_page(pager, live[pick]);
+                live[pick] = live[--liveCount];
+                frees++;
+            } else {
+                hint = useHints ? live[pick] : 0;
+                rc = fdb_pager_allocate_page(pager, EDGE_PAGE, hint, &page);
+                if (rc == FABRICDB_OK) {
+                    distance += page->pageNo > live[pick] ? page->pageNo - live[pick] : live[pick] - page->pageNo;
+                    live[liveCount++] = page->pageNo;
+                    allocs++;
+                }
+            }
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_commit(pager);
+        }
+    }
+    elapsed = fdb_bench_now() - start;
+    if (rc != FABRICDB_OK) {
+        printf("    churn failed\n");
+        goto cleanup;
+    }
+
+    fdb_report("churn: operations / sec", "%.0f", (allocs + frees) / elapsed);
+    fdb_report("churn: mean distance from the edge's page", "%.1f", allocs ? distance / allocs : 0.0);
+    fdb_report("file pages", "%u", pager->dbstate.filePageCount);
+    fdb_report("free pages", "%u", pager->dbstate.fileFreePageCount);
+
+    /* Give the free pages back to the file system */
+    pagesBefore = pager->dbstate.filePageCount;
+    fdb_pager_set_relocator(pager, count_move, &moved);
+    start = fdb_bench_now();
+    rc = fdb_pager_begin_write(pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_incremental_vacuum(pager, 0);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_commit(pager);
+    }
+    elapsed = fdb_bench_now() - start;
+    if (rc != FABRICDB_OK) {
+        printf("    vacuum failed\n");
+        goto cleanup;
+    }
+    fdb_report("vacuum: pages cut off", "%u", pagesBefore - pager->dbstate.filePageCount);
+    fdb_report("vacuum: pages moved", "%u", moved);
+    fdb_report("vacuum: pages cut off / sec", "%.0f", (pagesBefore - pager->dbstate.filePageCount) / elapsed);
+
+cleanup:
+    fdb_pager_destroy(pager);
+    free(live);
+    remove_bench_files();
+}
+
+void bench_alloc() {
+    run_churn("without hints", 0);
+    run_churn("with hints", 1);
+}
@@ -0,0 +1,158 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/byteorder.h"
+#include "../src/document.h"
+#include "../src/fstring.h"
+
+#define BENCH_MAX_THREADS 16
+#define BENCH_ENTRIES 256
+#define BENCH_STRING_SLOT 128
+#define BENCH_QUERIES 40000
+
+/* A document whose entries each hold a string, laid out as they are on
+   disk.  Entry and string ids start at 1, so 0 ends the entry chain. */
+typedef struct BenchDocument {
+    uint8_t entries[BENCH_ENTRIES * FDB_DOCUMENT_DISKSIZE];
+    uint8_t strings[BENCH_ENTRIES * BENCH_STRING_SLOT];
+} BenchDocument;
+
+typedef struct ArenaWorker {
+    pthread_t thread;
+    BenchDocument *doc;
+    uint32_t queries;
+    uint32_t failed;
+    uint8_t arena;
+} ArenaWorker;
+
+static void build_document(BenchDocument *bdoc) {
+    Document doc;
+    FString str;
+    char text[BENCH_STRING_SLOT];
+    uint64_t state = 88172645463325252ULL;
+    uint64_t stringId;
+    uint32_t i;
+
+    memset(text, 'x', sizeof(text));
+    for (i = 0; i < BENCH_ENTRIES; i++) {
+        str.id = i + 1;
+        str.size = 8 + fdb_bench_rand(&state) % (BENCH_STRING_SLOT - FDB_FSTRING_DATA_OFFSET - 8);
+        str.data = (uint8_t*)text;
+        fdb_fstring_unload(&str, bdoc->strings + i * BENCH_STRING_SLOT);
+
+        stringId = htoleu64(str.id);
+        doc.id = i + 1;
+        doc.entry.labelId = i;
+        doc.entry.prop.dataType = DATATYPE_STRING;
+        memcpy(doc.entry.prop.data, &stringId, 8);
+        doc.nextEntryId = i + 1 < BENCH_ENTRIES ? i + 2 : 0;
+        fdb_document_unload(&doc, bdoc->entries + i * FDB_DOCUMENT_DISKSIZE);
+    }
+}
+
+/* Walks the document's entries and decodes every string into a c string
+   the caller keeps until the end of the query, as a query returning
+   them would.  The strings come from malloc and are freed one by one,
+   or from the thread's arena, which is reset once per query. */
+static void* traverse_worker(void *arg) {
+    ArenaWorker *worker = arg;
+    FdbArena *arena = fabricdb_arena_thread();
+    char *results[BENCH_ENTRIES];
+    Document doc;
+    FString str;
+    uint64_t entryId;
+    uint64_t stringId;
+    uint32_t count;
+    uint32_t q;
+    uint32_t i;
+    int rc;
+
+    for (q = 0; q < worker->queries; q++) {
+        count = 0;
+        for (entryId = 1; entryId != 0; entryId = doc.nextEntryId) {
+            fdb_document_load(&doc, entryId, worker->doc->entries + (entryId - 1) * FDB_DOCUMENT_DISKSIZE);
+            stringId = fdb_property_tou64(&doc.entry.prop);
+            fdb_fstring_load(&str, stringId, worker->doc->strings + (stringId - 1) * BENCH_STRING_SLOT);
+            if (worker->arena) {
+                rc = fdb_fstring_tocstring_arena(&str, arena, &results[count]);
+            } else {
+                rc = fdb_fstring_tocstring(&str, &results[count]);
+            }
+            if (rc != FABRICDB_OK) {
+                worker->failed++;
+                continue;
+            }
+            count++;
+        }
+
+        if (worker->arena) {
+            fabricdb_arena_reset(arena);
+        } else {
+            for (i = 0; i < count; i++) {
+                fdbfree(results[i]);
+            }
+        }
+    }
+
+    fabricdb_arena_thread_free();
+    return NULL;
+}
+
+static void run_threads(BenchDocument *doc, uint32_t nthreads, uint8_t arena) {
+    ArenaWorker workers[BENCH_MAX_THREADS];
+    uint32_t failed = 0;
+    uint32_t i;
+    double start;
+    double elapsed;
+    double strings;
+    char label[64];
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].doc = doc;
+        workers[i].queries = BENCH_QUERIES / nthreads;
+        workers[i].failed = 0;
+        workers[i].arena = arena;
+    }
+
+    start = fdb_bench_now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i].thread, NULL, traverse_worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed += workers[i].failed;
+    }
+    elapsed = fdb_bench_now() - start;
+    strings = (double)nthreads * (BENCH_QUERIES / nthreads) * BENCH_ENTRIES;
+
+    snprintf(label, sizeof(label), "%u threads, %s", nthreads, arena ? "arena" : "fdbmalloc");
+    printf("    %s\n", label);
+    fdb_report("traversals / sec", "%.0f", nthreads * (BENCH_QUERIES / nthreads) / elapsed);
+    fdb_report("ns / decoded string", "%.1f", 1e9 * elapsed / strings);
+    if (failed > 0) {
+        fdb_report("failed", "%u", failed);
+    }
+}
+
+void bench_arena() {
+    BenchDocument *doc = malloc(sizeof(BenchDocument));
+    uint32_t nthreads;
+
+    if (doc == NULL) {
+        printf("    could not allocate benchmark document\n");
+        return;
+    }
+    build_document(doc);
+
+    for (nthreads = 1; nthreads <= BENCH_MAX_THREADS; nthreads *= 4) {
+        run_threads(doc, nthreads, 0);
+        run_threads(doc, nthreads, 1);
+    }
+
+    free(doc);
+}
@@ -0,0 +1,194 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../src/fabric.h"
+#include "../src/os.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchbusy.tmp";
+
+#define BENCH_MAX_PROCESSES 32
+#define BENCH_MAX_COMMITS 20000
+#define BENCH_SECONDS 0.5
+#define BENCH_BUSY_TIMEOUT 5000
+
+/* What a process sends back to the parent */
+typedef struct BusyResult {
+    uint32_t commits;
+    uint32_t failed;
+    double p99;
+} BusyResult;
+
+static void remove_bench_files() {
+    remove(BENCHFILENAME);
+    remove("./benchbusy.tmp-journal");
+}
+
+static int create_bench_file() {
+    Pager *pager;
+    int rc;
+
+    remove_bench_files();
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init_file(pager);
+    }
+    fdb_pager_destroy(pager);
+
+    return rc;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Commits a one page transaction to the process's own page until the
+   deadline.  Without a busy handler a busy lock is retried at once. */
+static void commit_loop(uint32_t id, uint8_t backoff, double deadline, BusyResult *result) {
+    Pager *pager;
+    Page *page;
+    double *latencies = malloc(BENCH_MAX_COMMITS * sizeof(double));
+    double start;
+    int rc;
+
+    memset(result, 0, sizeof(BusyResult));
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK) {
+        free(latencies);
+        return;
+    }
+    if (backoff) {
+        fdb_pager_set_busy_timeout(pager, BENCH_BUSY_TIMEOUT);
+    }
+    if (fdb_pager_init(pager) != FABRICDB_OK) {
+        fdb_pager_destroy(pager);
+        free(latencies);
+        return;
+    }
+
+    while (result->commits < BENCH_MAX_COMMITS && fdb_bench_now() < deadline) {
+        start = fdb_bench_now();
+        while ((rc = fdb_pager_begin_write(pager)) == FABRICDB_BUSY) {
+            sched_yield();
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_fetch_page(pager, 2 + id, &page);
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(pager, page);
+        }
+        if (rc != FABRICDB_OK) {
+            fdb_pager_rollback(pager);
+            result->failed++;
+            continue;
+        }
+        page->data[0]++;
+        while ((rc = fdb_pager_commit(pager)) == FABRICDB_BUSY) {
+            sched_yield();
+        }
+        if (rc != FABRICDB_OK) {
+            result->failed++;
+            continue;
+        }
+        latencies[result->commits++] = fdb_bench_now() - start;
+    }
+
+    qsort(latencies, result->commits, sizeof(double), compare_doubles);
+    result->p99 = result->commits ? latencies[(uint32_t)(result->commits * 0.99)] : 0.0;
+    fdb_pager_destroy(pager);
+    free(latencies);
+}
+
+/* Forks nprocs processes that commit to the same journal mode file at
+   once, spinning on a busy lock or backing off, and reports throughput,
+   latency and the CPU time the processes burnt. */
+static void run_contention(uint32_t nprocs, uint8_t backoff) {
+    int fds[2];
+    pid_t pids[BENCH_MAX_PROCESSES];
+    BusyResult result;
+    BusyResult total;
+    struct rusage before;
+    struct rusage after;
+    double cpu;
+    double start;
+    double elapsed;
+    double p99 = 0;
+    uint32_t fewest = BENCH_MAX_COMMITS;
+    uint32_t started = 0;
+    uint32_t i;
+    char label[64];
+
+    if (pipe(fds) != 0) {
+        printf("    could not create pipe\n");
+        return;
+    }
+
+    getrusage(RUSAGE_CHILDREN, &before);
+    start = fdb_bench_now();
+    for (i = 0; i < nprocs; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            close(fds[0]);
+            commit_loop(i, backoff, start + BENCH_SECONDS, &result);
+            if (write(fds[1], &result, sizeof(BusyResult)) != sizeof(BusyResult)) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+        if (pids[i] < 0) {
+            break;
+        }
+        started++;
+    }
+    close(fds[1]);
+
+    memset(&total, 0, sizeof(BusyResult));
+    while (read(fds[0], &result, sizeof(BusyResult)) == sizeof(BusyResult)) {
+        total.commits += result.commits;
+        total.failed += result.failed;
+        p99 = result.p99 > p99 ? result.p99 : p99;
+        fewest = result.commits < fewest ? result.commits : fewest;
+    }
+    close(fds[0]);
+    for (i = 0; i < started; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    elapsed = fdb_bench_now() - start;
+    getrusage(RUSAGE_CHILDREN, &after);
+    cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+          1e-6 * ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec));
+
+    snprintf(label, sizeof(label), "%u processes, %s", nprocs, backoff ? "backoff" : "spinning");
+    printf("    %s\n", label);
+    fdb_report("commits / sec", "%.0f", total.commits / elapsed);
+    fdb_report("worst process p99 latency (us)", "%.1f", 1e6 * p99);
+    fdb_report("fewest commits by one process", "%u", fewest);
+    fdb_report("CPU time / commit (us)", "%.1f", total.commits ? 1e6 * cpu / total.commits : 0.0);
+    if (total.failed > 0) {
+        fdb_report("failed transactions", "%u", total.failed);
+    }
+}
+
+void bench_busy() {
+    uint32_t nprocs;
+
+    if (create_bench_file() != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        return;
+    }
+
+    for (nprocs = 2; nprocs <= BENCH_MAX_PROCESSES; nprocs *= 4) {
+        run_contention(nprocs, 0);
+        run_contention(nprocs, 1);
+    }
+
+    remove_bench_files();
+}
@@ -0,0 +1,147 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/os.h"
+#include "../src/crc32c.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchchecksum.tmp";
+
+#define BENCH_PAGE_COUNT 20000
+#define BENCH_CACHE_SIZE 2000
+#define BENCH_SCANS 10
+#define BENCH_BUFFER_SIZE (1 << 20)
+#define BENCH_CRC_BYTES (1ULL << 30)
+
+static const double GB = 1024.0 * 1024.0 * 1024.0;
+
+static int create_bench_file() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    int rc;
+
+    remove(BENCHFILENAME);
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_set_page_checksums(pager, 1);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init_file(pager);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_set_cache_size(pager, BENCH_PAGE_COUNT + 1);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_begin_write(pager);
+    }
+    for (pageNo = 2; pageNo <= BENCH_PAGE_COUNT && rc == FABRICDB_OK; pageNo++) {
+        rc = fdb_pager_fetch_page(pager, pageNo, &page);
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(pager, page);
+        }
+        if (rc == FABRICDB_OK) {
+            memset(page->data, (int)pageNo, page->usableSize);
+        }
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_commit(pager);
+    }
+    fdb_pager_destroy(pager);
+
+    return rc;
+}
+
+/* Checksums a 1MB buffer over and over until 1GB has gone through */
+static void run_crc(const char *label, uint32_t (*crc)(uint32_t, const uint8_t*, size_t)) {
+    uint8_t *buffer;
+    uint64_t done;
+    uint32_t sum = 0;
+    double start;
+    double elapsed;
+    uint32_t i;
+
+    buffer = malloc(BENCH_BUFFER_SIZE);
+    for (i = 0; i < BENCH_BUFFER_SIZE; i++) {
+        buffer[i] = (uint8_t)(i * 2654435761U >> 24);
+    }
+
+    start = fdb_bench_now();
+    for (done = 0; done < BENCH_CRC_BYTES; done += BENCH_BUFFER_SIZE) {
+        sum = crc(sum, buffer, BENCH_BUFFER_SIZE);
+    }
+    elapsed = fdb_bench_now() - start;
+
+    printf("    %s\n", label);
+    fdb_report("GB / sec", "%.2f", BENCH_CRC_BYTES / GB / elapsed);
+    fdb_report("ms / GB", "%.1f", 1e3 * elapsed / (BENCH_CRC_BYTES / GB));
+    fdb_report("checksum (ignore)", "%08x", sum);
+
+    free(buffer);
+}
+
+/* Scans every page of the file through a cache a tenth of its size,
+   so every pass reads the whole file again.  Returns the seconds
+   taken per GB read. */
+static double run_scan(const char *label, uint8_t verify) {
+    Pager *pager;
+    Page *page;
+    uint32_t pass;
+    uint32_t pageNo;
+    uint64_t bytes = 0;
+    double start;
+    double elapsed;
+    int failures = 0;
+
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK || fdb_pager_init(pager) != FABRICDB_OK) {
+        printf("    could not open benchmark file\n");
+        return 0;
+    }
+    fdb_pager_set_cache_size(pager, BENCH_CACHE_SIZE);
+    fdb_pager_set_verify_checksums(pager, verify);
+
+    start = fdb_bench_now();
+    for (pass = 0; pass < BENCH_SCANS; pass++) {
+        for (pageNo = 2; pageNo <= BENCH_PAGE_COUNT; pageNo++) {
+            if (fdb_pager_fetch_page(pager, pageNo, &page) != FABRICDB_OK) {
+                failures++;
+            }
+        }
+    }
+    elapsed = fdb_bench_now() - start;
+    bytes = pager->pageCache->misses * (uint64_t)pager->pageCache->frames.pageSize +
+            pager->pageCache->prefetches * (uint64_t)pager->pageCache->frames.pageSize;
+
+    printf("    %s\n", label);
+    fdb_report("GB read", "%.2f", bytes / GB);
+    fdb_report("GB / sec", "%.2f", bytes / GB / elapsed);
+    fdb_report("failed fetches", "%d", failures);
+
+    fdb_pager_destroy(pager);
+    return bytes ? elapsed / (bytes / GB) : 0;
+}
+
+void bench_checksum() {
+    double off;
+    double on;
+
+    if (fdb_crc32c_hw_available()) {
+        run_crc("crc32c, hardware", fdb_crc32c);
+    }
+    run_crc("crc32c, slicing-by-8", fdb_crc32c_sw);
+
+    if (create_bench_file() != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        return;
+    }
+    off = run_scan("scan, checksums not verified", 0);
+    on = run_scan("scan, checksums verified", 1);
+    printf("    verification overhead\n");
+    fdb_report("ms / GB read", "%.1f", 1e3 * (on - off));
+
+    remove(BENCHFILENAME);
+}
@@ -0,0 +1,181 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/os.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchcommit.tmp";
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_COMMITS 100000
+#define BENCH_SECONDS 0.3
+#define BENCH_COMMIT_DELAY 200
+
+typedef struct CommitWorker {
+    pthread_t thread;
+    Pager *pager;
+    uint32_t pageNo;
+    double deadline;
+    uint32_t commits;
+    double *latencies;
+} CommitWorker;
+
+static void remove_bench_files() {
+    remove(BENCHFILENAME);
+    remove("./benchcommit.tmp-wal");
+    remove("./benchcommit.tmp-shm");
+}
+
+static int create_bench_file() {
+    Pager *pager;
+    int rc;
+
+    remove_bench_files();
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_set_file_format_write_version(pager, 2);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init_file(pager);
+    }
+    fdb_pager_destroy(pager);
+
+    return rc;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Commits a one page transaction to the worker's own page over and
+   over until the deadline, timing each commit from begin to done. */
+static void *commit_worker(void *arg) {
+    CommitWorker *worker = (CommitWorker*)arg;
+    Page *page;
+    double start;
+    int rc;
+
+    while (worker->commits < BENCH_MAX_COMMITS && fdb_bench_now() < worker->deadline) {
+        start = fdb_bench_now();
+        while ((rc = fdb_pager_begin_write(worker->pager)) == FABRICDB_BUSY) {
+            sched_yield();
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_fetch_page(worker->pager, worker->pageNo, &page);
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(worker->pager, page);
+        }
+        if (rc != FABRICDB_OK) {
+            fdb_pager_rollback(worker->pager);
+            break;
+        }
+        page->data[0]++;
+        if (fdb_pager_commit(worker->pager) != FABRICDB_OK) {
+            break;
+        }
+        worker->latencies[worker->commits++] = fdb_bench_now() - start;
+    }
+
+    return NULL;
+}
+
+/* Runs nthreads committers, each on its own connection, with group
+   commit on or off, and reports throughput and commit latency. */
+static void run_commits(uint32_t nthreads, uint8_t groupCommit) {
+    CommitWorker workers[BENCH_MAX_THREADS];
+    Pager *syncPager;
+    double *latencies;
+    double start;
+    double elapsed;
+    double total = 0;
+    uint64_t syncs;
+    uint32_t commits = 0;
+    uint32_t opened = 0;
+    uint32_t i;
+    char label[64];
+
+    for (i = 0; i < nthreads; i++) {
+        if (fdb_pager_create(BENCHFILENAME, &workers[i].pager) != FABRICDB_OK) {
+            break;
+        }
+        if (fdb_pager_init(workers[i].pager) != FABRICDB_OK) {
+            fdb_pager_destroy(workers[i].pager);
+            break;
+        }
+        fdb_pager_set_group_commit(workers[i].pager, BENCH_COMMIT_DELAY, groupCommit ? nthreads : 0);
+        workers[i].pageNo = 2 + i;
+        workers[i].commits = 0;
+        workers[i].latencies = malloc(BENCH_MAX_COMMITS * sizeof(double));
+        opened++;
+    }
+    if (opened == 0 || opened < nthreads) {
+        printf("    could not open benchmark file\n");
+        goto cleanup;
+    }
+
+    /* Every connection shares the journal's inode, so one pager's count
+       covers all of them. */
+    syncPager = workers[0].pager;
+    syncs = fdb_sync_count(syncPager->jfh);
+    start = fdb_bench_now();
+    for (i = 0; i < nthreads; i++) {
+        workers[i].deadline = start + BENCH_SECONDS;
+        pthread_create(&workers[i].thread, NULL, commit_worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        commits += workers[i].commits;
+    }
+    elapsed = fdb_bench_now() - start;
+    syncs = fdb_sync_count(syncPager->jfh) - syncs;
+
+    latencies = malloc((commits ? commits : 1) * sizeof(double));
+    commits = 0;
+    for (i = 0; i < nthreads; i++) {
+        memcpy(latencies + commits, workers[i].latencies, workers[i].commits * sizeof(double));
+        commits += workers[i].commits;
+    }
+    for (i = 0; i < commits; i++) {
+        total += latencies[i];
+    }
+    qsort(latencies, commits, sizeof(double), compare_doubles);
+
+    snprintf(label, sizeof(label), "%u threads, group commit %s", nthreads, groupCommit ? "on" : "off");
+    printf("    %s\n", label);
+    fdb_report("commits / sec", "%.0f", commits / elapsed);
+    fdb_report("mean latency (us)", "%.1f", commits ? 1e6 * total / commits : 0.0);
+    fdb_report("p99 latency (us)", "%.1f", commits ? 1e6 * latencies[(uint32_t)(commits * 0.99)] : 0.0);
+    fdb_report("commits / sync", "%.2f", syncs ? commits / (double)syncs : 0.0);
+    free(latencies);
+
+cleanup:
+    for (i = 0; i < opened; i++) {
+        free(workers[i].latencies);
+        fdb_pager_destroy(workers[i].pager);
+    }
+}
+
+void bench_commit() {
+    uint32_t nthreads;
+
+    if (create_bench_file() != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        return;
+    }
+
+    for (nthreads = 1; nthreads <= BENCH_MAX_THREADS; nthreads *= 2) {
+        run_commits(nthreads, 0);
+        run_commits(nthreads, 1);
+    }
+
+    remove_bench_files();
+}
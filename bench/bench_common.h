@@ -0,0 +1,88 @@
+#ifndef __FABRICDB_BENCHCOMMON_H
+#define __FABRICDB_BENCHCOMMON_H
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#define PLAIN "\033[0m"
+#define BLUE "\033[1;34m"
+#define GRAY "\033[1;37m"
+
+#define fdb_runbench(name, bench) do { printf("\n%s%s%s\n", BLUE, name, PLAIN); bench(); } while (0)
+#define fdb_report(label, format, value) printf("    %s%-44s%s " format "\n", GRAY, label, PLAIN, value)
+
+static inline double fdb_bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* xorshift64* - good enough for generating workloads */
+static inline uint64_t fdb_bench_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double fdb_bench_rand_double(uint64_t *state) {
+    return (double)(fdb_bench_rand(state) >> 11) / (double)(1ULL << 53);
+}
+
+/* Zipfian generator over [0, n) as described by Gray et al. in
+   "Quickly Generating Billion-Record Synthetic Databases". */
+typedef struct ZipfGen {
+    uint32_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    uint64_t state;
+} ZipfGen;
+
+static inline void fdb_zipf_init(ZipfGen *gen, uint32_t n, double theta, uint64_t seed) {
+    uint32_t i;
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    gen->n = n;
+    gen->theta = theta;
+    gen->zetan = 0;
+    for (i = 1; i <= n; i++) {
+        gen->zetan += 1.0 / pow((double)i, theta);
+    }
+    gen->alpha = 1.0 / (1.0 - theta);
+    gen->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / gen->zetan);
+    gen->state = seed ? seed : 88172645463325252ULL;
+}
+
+static inline uint32_t fdb_zipf_next(ZipfGen *gen) {
+    double u = fdb_bench_rand_double(&gen->state);
+    double uz = u * gen->zetan;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, gen->theta)) {
+        return 1;
+    }
+    return (uint32_t)(gen->n * pow(gen->eta * u - gen->eta + 1.0, gen->alpha));
+}
+
+void bench_alloc();
+void bench_arena();
+void bench_busy();
+void bench_checksum();
+void bench_commit();
+void bench_inode();
+void bench_mem();
+void bench_open();
+void bench_pager();
+void bench_pagetable();
+
+#endif /* __FABRICDB_BENCHCOMMON_H */
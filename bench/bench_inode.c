@@ -0,0 +1,126 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../src/fabric.h"
+#include "../src/os.h"
+
+#define BENCH_MAX_THREADS 16
+#define BENCH_OPENS 200000
+#define BENCH_LOCKS 1000000
+
+typedef struct InodeWorker {
+    pthread_t thread;
+    char fileName[32];
+    uint32_t iterations;
+    uint32_t failed;
+} InodeWorker;
+
+static void bench_file_name(char *dest, uint32_t fileNo) {
+    snprintf(dest, 32, "./benchinode%u.tmp", fileNo);
+}
+
+/* Opens the file, takes and drops a shared lock and closes it again, as
+   a connection that runs one read transaction would. */
+static void* open_worker(void *arg) {
+    InodeWorker *worker = arg;
+    FileHandle *fh;
+    uint32_t i;
+
+    for (i = 0; i < worker->iterations; i++) {
+        if (fdb_open_file_rdwr(worker->fileName, &fh) != FABRICDB_OK) {
+            worker->failed++;
+            continue;
+        }
+        if (fdb_acquire_shared_lock(fh) != FABRICDB_OK || fdb_unlock(fh) != FABRICDB_OK) {
+            worker->failed++;
+        }
+        fdb_close_file(fh);
+    }
+    return NULL;
+}
+
+/* Takes and drops a shared lock on a file that stays open */
+static void* lock_worker(void *arg) {
+    InodeWorker *worker = arg;
+    FileHandle *fh;
+    uint32_t i;
+
+    if (fdb_open_file_rdwr(worker->fileName, &fh) != FABRICDB_OK) {
+        worker->failed = worker->iterations;
+        return NULL;
+    }
+    for (i = 0; i < worker->iterations; i++) {
+        if (fdb_acquire_shared_lock(fh) != FABRICDB_OK || fdb_unlock(fh) != FABRICDB_OK) {
+            worker->failed++;
+        }
+    }
+    fdb_close_file(fh);
+    return NULL;
+}
+
+/* Splits the iterations over threads that each use their own file, so
+   the only state they share is the registry of open files. */
+static void run_threads(uint32_t nthreads, uint8_t reopen) {
+    InodeWorker workers[BENCH_MAX_THREADS];
+    uint32_t total = reopen ? BENCH_OPENS : BENCH_LOCKS;
+    uint32_t failed = 0;
+    uint32_t i;
+    double start;
+    double elapsed;
+    char label[64];
+
+    for (i = 0; i < nthreads; i++) {
+        bench_file_name(workers[i].fileName, i);
+        workers[i].iterations = total / nthreads;
+        workers[i].failed = 0;
+    }
+
+    start = fdb_bench_now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i].thread, NULL, reopen ? open_worker : lock_worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed += workers[i].failed;
+    }
+    elapsed = fdb_bench_now() - start;
+
+    snprintf(label, sizeof(label), "%u threads", nthreads);
+    printf("    %s\n", label);
+    fdb_report(reopen ? "open/lock/unlock/close / sec" : "lock/unlock / sec", "%.0f",
+               (nthreads * (total / nthreads) - failed) / elapsed);
+    if (failed > 0) {
+        fdb_report("failed", "%u", failed);
+    }
+}
+
+void bench_inode() {
+    FileHandle *fh;
+    char fileName[32];
+    uint32_t nthreads;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_MAX_THREADS; i++) {
+        bench_file_name(fileName, i);
+        if (fdb_open_or_create_file(fileName, &fh) != FABRICDB_OK) {
+            printf("    could not create benchmark files\n");
+            return;
+        }
+        fdb_close_file(fh);
+    }
+
+    for (nthreads = 1; nthreads <= BENCH_MAX_THREADS; nthreads *= 4) {
+        run_threads(nthreads, 1);
+    }
+    for (nthreads = 1; nthreads <= BENCH_MAX_THREADS; nthreads *= 4) {
+        run_threads(nthreads, 0);
+    }
+
+    for (i = 0; i < BENCH_MAX_THREADS; i++) {
+        bench_file_name(fileName, i);
+        remove(fileName);
+    }
+}
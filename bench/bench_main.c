@@ -0,0 +1,28 @@
+#include "bench_common.h"
+
+#include "../src/mutex.h"
+
+void all_benches() {
+    fdb_runbench("Pager", bench_pager);
+    fdb_runbench("pagetable", bench_pagetable);
+    fdb_runbench("Group commit", bench_commit);
+    fdb_runbench("Lock contention", bench_busy);
+    fdb_runbench("File registry", bench_inode);
+    fdb_runbench("Checksums", bench_checksum);
+    fdb_runbench("Page allocator", bench_alloc);
+    fdb_runbench("Memory accounting", bench_mem);
+    fdb_runbench("Scratch arena", bench_arena);
+    fdb_runbench("Open", bench_open);
+}
+
+int main(int argc, char** argv) {
+
+    printf("Running benchmarks...\n");
+    fdb_init_mutexes();
+
+    all_benches();
+
+    printf("\nFinished benchmarks.\n");
+
+    return 0;
+}
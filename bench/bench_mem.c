@@ -0,0 +1,113 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../src/mem.h"
+
+#define BENCH_MAX_THREADS 16
+#define BENCH_ALLOCS 4000000
+#define BENCH_LIVE 64
+
+/* How the workers allocate */
+#define BENCH_MALLOC 0
+#define BENCH_FDBMALLOC 1
+#define BENCH_OBJPOOL 2
+
+static const char* BENCH_MODE_NAMES[] = {"malloc", "fdbmalloc", "object pool"};
+
+typedef struct MemWorker {
+    pthread_t thread;
+    uint32_t allocs;
+    uint8_t mode;
+} MemWorker;
+
+static inline void bench_free(uint8_t mode, void *ptr, size_t size) {
+    switch (mode) {
+        case BENCH_MALLOC:
+            free(ptr);
+            break;
+        case BENCH_FDBMALLOC:
+            fdbfree(ptr);
+            break;
+        default:
+            fdbobjfree(ptr, size, FDB_MEM_RECORD);
+    }
+}
+
+/* Keeps BENCH_LIVE small allocations live, replacing one at a time */
+static void* alloc_worker(void *arg) {
+    MemWorker *worker = arg;
+    void *live[BENCH_LIVE];
+    size_t sizes[BENCH_LIVE];
+    uint64_t state = 88172645463325252ULL + (uintptr_t)worker;
+    uint32_t i;
+    uint32_t j;
+
+    memset(live, 0, sizeof(live));
+    memset(sizes, 0, sizeof(sizes));
+    for (i = 0; i < worker->allocs; i++) {
+        j = i % BENCH_LIVE;
+        bench_free(worker->mode, live[j], sizes[j]);
+        sizes[j] = 16 + fdb_bench_rand(&state) % 240;
+        switch (worker->mode) {
+            case BENCH_MALLOC:
+                live[j] = malloc(sizes[j]);
+                break;
+            case BENCH_FDBMALLOC:
+                live[j] = fdbmalloctag(sizes[j], FDB_MEM_RECORD);
+                break;
+            default:
+                live[j] = fdbobjalloc(sizes[j], FDB_MEM_RECORD);
+        }
+    }
+    for (j = 0; j < BENCH_LIVE; j++) {
+        bench_free(worker->mode, live[j], sizes[j]);
+    }
+    return NULL;
+}
+
+/* Splits BENCH_ALLOCS allocations over threads, through malloc, the
+   library's counted allocator or its object pool */
+static void run_threads(uint32_t nthreads, uint8_t mode) {
+    MemWorker workers[BENCH_MAX_THREADS];
+    FdbMemStats stats;
+    uint32_t i;
+    double start;
+    double elapsed;
+    char label[64];
+
+    fabricdb_mem_reset_highwater();
+    for (i = 0; i < nthreads; i++) {
+        workers[i].allocs = BENCH_ALLOCS / nthreads;
+        workers[i].mode = mode;
+    }
+
+    start = fdb_bench_now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i].thread, NULL, alloc_worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = fdb_bench_now() - start;
+
+    snprintf(label, sizeof(label), "%u threads, %s", nthreads, BENCH_MODE_NAMES[mode]);
+    printf("    %s\n", label);
+    fdb_report("ns / malloc+free", "%.1f", 1e9 * elapsed / (nthreads * (BENCH_ALLOCS / nthreads)));
+    if (mode != BENCH_MALLOC) {
+        fabricdb_mem_stats(&stats);
+        fdb_report("record high-water mark (bytes)", "%zu", stats.highwaterByTag[FDB_MEM_RECORD]);
+    }
+}
+
+void bench_mem() {
+    uint32_t nthreads;
+
+    for (nthreads = 1; nthreads <= BENCH_MAX_THREADS; nthreads *= 4) {
+        run_threads(nthreads, BENCH_MALLOC);
+        run_threads(nthreads, BENCH_FDBMALLOC);
+        run_threads(nthreads, BENCH_OBJPOOL);
+    }
+}
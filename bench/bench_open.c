@@ -0,0 +1,168 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/fabric.h"
+#include "../src/byteorder.h"
+#include "../src/mem.h"
+#include "../src/os.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchopen.tmp";
+
+#define BENCH_PAGE_SIZE 4096
+#define BENCH_HEADER_SIZE 100
+#define BENCH_PAGE_COUNT_OFFSET 36
+
+static void remove_bench_files() {
+    remove(BENCHFILENAME);
+    remove("./benchopen.tmp-journal");
+}
+
+/* Builds a sparse file of numPages vertex pages.  Only the front page
+   and the page type map pages are written, as allocating every page
+   through the pager would take far longer than what is measured. */
+static int create_bench_file(uint32_t numPages) {
+    Pager *pager;
+    FileHandle *fh;
+    uint8_t *page;
+    uint32_t frontPages = BENCH_PAGE_SIZE - BENCH_HEADER_SIZE;
+    uint32_t mapPageNo;
+    uint32_t count;
+    uint32_t pageCount;
+    int rc;
+
+    remove_bench_files();
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    rc = fdb_pager_set_page_size(pager, BENCH_PAGE_SIZE);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init_file(pager);
+    }
+    fdb_pager_destroy(pager);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    rc = fdb_open_file_rdwr(BENCHFILENAME, &fh);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    page = malloc(BENCH_PAGE_SIZE);
+    rc = fdb_read(fh, page, 0, BENCH_PAGE_SIZE);
+
+    /* The front page maps the first pages, and the last byte of each
+       map page is the type of the next map page */
+    if (rc == FABRICDB_OK) {
+        pageCount = htoleu32(numPages);
+        memcpy(page + BENCH_PAGE_COUNT_OFFSET, &pageCount, 4);
+        count = numPages < frontPages ? numPages : frontPages;
+        memset(page + BENCH_HEADER_SIZE + 1, VERTEX_PAGE, count - 1);
+        if (numPages >= frontPages) {
+            page[BENCH_PAGE_SIZE - 1] = P_PAGE;
+        }
+        rc = fdb_write(fh, page, 0, BENCH_PAGE_SIZE);
+    }
+    memset(page, VERTEX_PAGE, BENCH_PAGE_SIZE);
+    for (mapPageNo = frontPages; mapPageNo <= numPages && rc == FABRICDB_OK; mapPageNo += BENCH_PAGE_SIZE) {
+        count = numPages - mapPageNo < BENCH_PAGE_SIZE ? numPages - mapPageNo : BENCH_PAGE_SIZE;
+        memset(page + count, UNUSED_PAGE, BENCH_PAGE_SIZE - count);
+        if (count == BENCH_PAGE_SIZE) {
+            page[BENCH_PAGE_SIZE - 1] = P_PAGE;
+        }
+        rc = fdb_write(fh, page, (off_t)(mapPageNo - 1) * BENCH_PAGE_SIZE, BENCH_PAGE_SIZE);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_truncate_file(fh, (off_t)numPages * BENCH_PAGE_SIZE);
+    }
+
+    free(page);
+    fdb_close_file(fh);
+    return rc;
+}
+
+/* The memory the page type cache holds */
+static size_t type_cache_bytes(PageTypeCache *cache) {
+    size_t bytes = fabricdb_mem_size(cache->types) + fabricdb_mem_size(cache->loaded);
+    uint32_t i;
+
+    for (i = 0; i < cache->capacity / 4096; i++) {
+        bytes += fabricdb_mem_size(cache->types[i]);
+    }
+    for (i = 0; i < PAGE_TYPE_COUNT; i++) {
+        bytes += fabricdb_mem_size(cache->blocks[i]);
+    }
+    return bytes;
+}
+
+/* Times opening a file and reading one page from the middle of it,
+   then a scan that visits every page of a type and so reads the whole
+   page type map, which is what opening the file used to cost. */
+static void run_open(uint32_t numPages) {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo = 0;
+    uint32_t found = 0;
+    double start;
+    double opened;
+    double queried;
+    double scanned;
+    size_t firstBytes = 0;
+    char label[64];
+    int rc;
+
+    if (create_bench_file(numPages) != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        remove_bench_files();
+        return;
+    }
+
+    start = fdb_bench_now();
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc != FABRICDB_OK) {
+        printf("    could not open benchmark file\n");
+        remove_bench_files();
+        return;
+    }
+    rc = fdb_pager_init(pager);
+    opened = fdb_bench_now();
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_begin_read(pager);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_fetch_page(pager, numPages / 2, &page);
+    }
+    queried = fdb_bench_now();
+    firstBytes = type_cache_bytes(&pager->pageTypeCache);
+    while (rc == FABRICDB_OK && (rc = fdb_pager_next_page(pager, VERTEX_PAGE, pageNo, &pageNo)) == FABRICDB_OK && pageNo != 0) {
+        found++;
+    }
+    scanned = fdb_bench_now();
+    if (rc != FABRICDB_OK) {
+        printf("    benchmark failed\n");
+        goto cleanup;
+    }
+
+    snprintf(label, sizeof(label), "%uM pages", numPages / 1000000);
+    printf("    %s\n", label);
+    fdb_report("open (ms)", "%.3f", 1e3 * (opened - start));
+    fdb_report("open to first page read (ms)", "%.3f", 1e3 * (queried - start));
+    fdb_report("scan of every vertex page (ms)", "%.1f", 1e3 * (scanned - queried));
+    fdb_report("vertex pages found", "%u", found);
+    fdb_report("page type cache after first read (KB)", "%.1f", firstBytes / 1024.0);
+    fdb_report("page type cache after scan (bytes / page)", "%.2f", (double)type_cache_bytes(&pager->pageTypeCache) / numPages);
+
+cleanup:
+    fdb_pager_end_read(pager);
+    fdb_pager_destroy(pager);
+    remove_bench_files();
+}
+
+void bench_open() {
+    run_open(1000000);
+    run_open(10000000);
+    run_open(100000000);
+}
@@ -0,0 +1,387 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/os.h"
+#include "../src/pager.h"
+
+static const char* BENCHFILENAME = "./benchfile.tmp";
+
+#define BENCH_PAGE_COUNT 20000
+#define BENCH_CACHE_SIZE 2000
+#define BENCH_FETCHES 500000
+#define BENCH_SCANS 10
+#define BENCH_MAX_THREADS 16
+#define BENCH_MAX_CONNECTIONS 16
+
+typedef struct ReadWorker {
+    pthread_t thread;
+    Pager *pager;
+    ZipfGen gen;
+    uint32_t fetches;
+} ReadWorker;
+
+static int create_bench_file(uint32_t numPages) {
+    Pager *pager;
+    uint8_t *buffer;
+    uint32_t pageNo;
+    uint32_t pageSize;
+    int rc;
+
+    remove(BENCHFILENAME);
+    rc = fdb_pager_create(BENCHFILENAME, &pager);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    rc = fdb_pager_init_file(pager);
+    if (rc != FABRICDB_OK) {
+        fdb_pager_destroy(pager);
+        return rc;
+    }
+
+    pageSize = fdb_pager_get_page_size(pager) + fdb_pager_get_bytes_reserved_space(pager);
+    buffer = fdbmalloczero(pageSize);
+    for (pageNo = 2; pageNo <= numPages && rc == FABRICDB_OK; pageNo++) {
+        memcpy(buffer, &pageNo, sizeof(pageNo));
+        rc = fdb_write(pager->dbfh, buffer, (off_t)(pageNo - 1) * pageSize, pageSize);
+    }
+    fdbfree(buffer);
+    fdb_pager_destroy(pager);
+
+    return rc;
+}
+
+static uint64_t cache_hits(Pager *pager) {
+    uint64_t hits = 0;
+    uint32_t i;
+
+    for (i = 0; i < pager->pageCache->numShards; i++) {
+        hits += pager->pageCache->shards[i].hits;
+    }
+    return hits;
+}
+
+static uint32_t cached_pages(Pager *pager) {
+    uint32_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < pager->pageCache->numShards; i++) {
+        count += pagetable_count(&pager->pageCache->shards[i].map);
+    }
+    return count;
+}
+
+/* Runs a Zipfian page access pattern against a pager with the given
+   cache size.  When scanEvery is non-zero, a sequential scan of
+   scanLength cold pages is interleaved every scanEvery fetches.
+   In mmap mode pages are read through a mapping of the file. */
+static void run_zipf(const char *label, uint32_t cacheSize, uint32_t scanEvery, uint32_t scanLength, uint8_t mmapMode) {
+    Pager *pager;
+    Page *page;
+    ZipfGen gen;
+    uint32_t i;
+    uint32_t j;
+    uint32_t pageNo;
+    uint32_t scanNext = 2;
+    uint32_t maxCached = 0;
+    double start;
+    double elapsed;
+    char line[128];
+
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK || fdb_pager_init(pager) != FABRICDB_OK) {
+        printf("    could not open benchmark file\n");
+        return;
+    }
+    fdb_pager_set_mmap_mode(pager, mmapMode);
+    fdb_pager_set_cache_size(pager, cacheSize);
+    fdb_zipf_init(&gen, BENCH_PAGE_COUNT - 1, 0.99, 42);
+
+    start = fdb_bench_now();
+    for (i = 0; i < BENCH_FETCHES; i++) {
+        /* Scatter the hot pages across the file */
+        pageNo = 2 + (uint32_t)((fdb_zipf_next(&gen) * 2654435761ULL) % (BENCH_PAGE_COUNT - 1));
+        fdb_pager_fetch_page(pager, pageNo, &page);
+
+        if (scanEvery && i % scanEvery == 0) {
+            for (j = 0; j < scanLength; j++) {
+                fdb_pager_fetch_page(pager, scanNext, &page);
+                scanNext = scanNext >= BENCH_PAGE_COUNT ? 2 : scanNext + 1;
+            }
+        }
+        if (cached_pages(pager) > maxCached) {
+            maxCached = cached_pages(pager);
+        }
+    }
+    elapsed = fdb_bench_now() - start;
+
+    printf("    %s\n", label);
+    fdb_report("cache size (pages)", "%u", cacheSize);
+    snprintf(line, sizeof(line), "%.2f%%", 100.0 * cache_hits(pager) / (double)(cache_hits(pager) + pager->pageCache->misses));
+    fdb_report("hit rate", "%s", line);
+    fdb_report("fetches / sec", "%.0f", (cache_hits(pager) + pager->pageCache->misses) / elapsed);
+    fdb_report("evictions", "%llu", (unsigned long long)pager->pageCache->evictions);
+    fdb_report("max cached pages", "%u", maxCached);
+    fdb_report("library memory (bytes)", "%zu", fabricdb_mem_used());
+
+    fdb_pager_destroy(pager);
+}
+
+/* Scans every page of the file in order, the way a full scan of one
+   page type would, with read-ahead off, on, or driven by explicit
+   prefetches of the next chunk of the scan. */
+static void run_scan(const char *label, uint32_t readAhead, uint32_t prefetchChunk) {
+    Pager *pager;
+    Page *page;
+    uint32_t pass;
+    uint32_t pageNo;
+    double start;
+    double elapsed;
+    uint64_t fetches = 0;
+
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK || fdb_pager_init(pager) != FABRICDB_OK) {
+        printf("    could not open benchmark file\n");
+        return;
+    }
+    pager->dbstate.filePageCount = BENCH_PAGE_COUNT;
+    fdb_pager_set_cache_size(pager, BENCH_CACHE_SIZE);
+    fdb_pager_set_read_ahead(pager, readAhead);
+
+    start = fdb_bench_now();
+    for (pass = 0; pass < BENCH_SCANS; pass++) {
+        for (pageNo = 2; pageNo <= BENCH_PAGE_COUNT; pageNo++) {
+            if (prefetchChunk && (pageNo - 2) % prefetchChunk == 0) {
+                fdb_pager_prefetch(pager, pageNo, prefetchChunk);
+            }
+            fdb_pager_fetch_page(pager, pageNo, &page);
+            fetches++;
+        }
+    }
+    elapsed = fdb_bench_now() - start;
+
+    printf("    %s\n", label);
+    fdb_report("pages / sec", "%.0f", fetches / elapsed);
+    fdb_report("misses", "%llu", (unsigned long long)pager->pageCache->misses);
+    fdb_report("pages read ahead", "%llu", (unsigned long long)pager->pageCache->prefetches);
+
+    fdb_pager_destroy(pager);
+}
+
+/* Fetches Zipfian pages from a pager shared with the other workers */
+static void *read_worker(void *arg) {
+    ReadWorker *worker = (ReadWorker*)arg;
+    Page *page;
+    uint32_t pageNo;
+    uint32_t i;
+
+    for (i = 0; i < worker->fetches; i++) {
+        pageNo = 2 + (uint32_t)((fdb_zipf_next(&worker->gen) * 2654435761ULL) % (BENCH_PAGE_COUNT - 1));
+        if (fdb_pager_fetch_page(worker->pager, pageNo, &page) == FABRICDB_OK) {
+            fdb_pager_release_page(worker->pager, page);
+        }
+    }
+    return NULL;
+}
+
+/* Splits BENCH_FETCHES Zipfian fetches over threads that share one
+   pager whose cache is split into the given number of shards. */
+static void run_concurrent(uint32_t nthreads, uint32_t numShards) {
+    Pager *pager;
+    ReadWorker workers[BENCH_MAX_THREADS];
+    uint32_t i;
+    double start;
+    double elapsed;
+    char label[64];
+
+    if (fdb_pager_create(BENCHFILENAME, &pager) != FABRICDB_OK || fdb_pager_init(pager) != FABRICDB_OK) {
+        printf("    could not open benchmark file\n");
+        return;
+    }
+    fdb_pager_set_cache_size(pager, BENCH_CACHE_SIZE);
+    fdb_pager_set_cache_shards(pager, numShards);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].pager = pager;
+        workers[i].fetches = BENCH_FETCHES / nthreads;
+        fdb_zipf_init(&workers[i].gen, BENCH_PAGE_COUNT - 1, 0.99, 42 + i);
+    }
+
+    start = fdb_bench_now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&workers[i].thread, NULL, read_worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = fdb_bench_now() - start;
+
+    snprintf(label, sizeof(label), "%u threads, %u shards", nthreads, numShards);
+    printf("    %s\n", label);
+    fdb_report("fetches / sec", "%.0f", (cache_hits(pager) + pager->pageCache->misses) / elapsed);
+    snprintf(label, sizeof(label), "%.2f%%", 100.0 * cache_hits(pager) / (double)(cache_hits(pager) + pager->pageCache->misses));
+    fdb_report("hit rate", "%s", label);
+
+    fdb_pager_destroy(pager);
+}
+
+/* Opens connections to the file that take turns fetching Zipfian pages,
+   each in its own read transaction, and reports the memory they hold
+   with and without a shared cache. */
+static void run_connections(uint32_t nconnections, uint8_t sharedCache) {
+    Pager *pagers[BENCH_MAX_CONNECTIONS];
+    Page *page;
+    ZipfGen gen;
+    uint32_t opened = 0;
+    uint32_t pageNo;
+    uint32_t i;
+    uint64_t fetches = 0;
+    uint64_t misses = 0;
+    double start;
+    double elapsed;
+    char label[64];
+
+    for (i = 0; i < nconnections; i++) {
+        if (fdb_pager_create(BENCHFILENAME, &pagers[i]) != FABRICDB_OK) {
+            break;
+        }
+        fdb_pager_set_shared_cache(pagers[i], sharedCache);
+        if (fdb_pager_init(pagers[i]) != FABRICDB_OK) {
+            fdb_pager_destroy(pagers[i]);
+            break;
+        }
+        fdb_pager_set_cache_size(pagers[i], BENCH_CACHE_SIZE);
+        fdb_pager_begin_read(pagers[i]);
+        opened++;
+    }
+    if (opened < nconnections) {
+        printf("    could not open benchmark file\n");
+        goto cleanup;
+    }
+
+    fdb_zipf_init(&gen, BENCH_PAGE_COUNT - 1, 0.99, 42);
+    start = fdb_bench_now();
+    for (fetches = 0; fetches < BENCH_FETCHES; fetches++) {
+        pageNo = 2 + (uint32_t)((fdb_zipf_next(&gen) * 2654435761ULL) % (BENCH_PAGE_COUNT - 1));
+        i = (uint32_t)(fetches % nconnections);
+        if (fdb_pager_fetch_page(pagers[i], pageNo, &page) == FABRICDB_OK) {
+            fdb_pager_release_page(pagers[i], page);
+        }
+    }
+    elapsed = fdb_bench_now() - start;
+    for (i = 0; i < nconnections; i++) {
+        if (!sharedCache || i == 0) {
+            misses += pagers[i]->pageCache->misses;
+        }
+    }
+
+    snprintf(label, sizeof(label), "%u connections, %s cache", nconnections, sharedCache ? "shared" : "private");
+    printf("    %s\n", label);
+    fdb_report("fetches / sec", "%.0f", fetches / elapsed);
+    fdb_report("misses", "%llu", (unsigned long long)misses);
+    fdb_report("library memory (bytes)", "%zu", fabricdb_mem_used());
+
+cleanup:
+    for (i = 0; i < opened; i++) {
+        fdb_pager_end_read(pagers[i]);
+        fdb_pager_destroy(pagers[i]);
+    }
+}
+
+/* Opens connections with caches big enough for the whole file that take
+   turns fetching Zipfian pages, under a soft heap limit of limit bytes
+   (0 for none), and reports how close memory stayed to the limit. */
+static void run_soft_limit(uint32_t nconnections, size_t limit) {
+    Pager *pagers[BENCH_MAX_CONNECTIONS];
+    Page *page;
+    ZipfGen gen;
+    FdbMemStats stats;
+    uint32_t opened = 0;
+    uint32_t pageNo;
+    uint32_t i;
+    uint64_t fetches;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double start;
+    double elapsed;
+    char label[64];
+
+    for (i = 0; i < nconnections; i++) {
+        if (fdb_pager_create(BENCHFILENAME, &pagers[i]) != FABRICDB_OK) {
+            break;
+        }
+        if (fdb_pager_init(pagers[i]) != FABRICDB_OK) {
+            fdb_pager_destroy(pagers[i]);
+            break;
+        }
+        fdb_pager_set_cache_size(pagers[i], BENCH_PAGE_COUNT + 1);
+        opened++;
+    }
+    if (opened < nconnections) {
+        printf("    could not open benchmark file\n");
+        goto cleanup;
+    }
+
+    fabricdb_set_soft_heap_limit(limit);
+    fabricdb_mem_reset_highwater();
+    fdb_zipf_init(&gen, BENCH_PAGE_COUNT - 1, 0.99, 42);
+    start = fdb_bench_now();
+    for (fetches = 0; fetches < BENCH_FETCHES; fetches++) {
+        pageNo = 2 + (uint32_t)((fdb_zipf_next(&gen) * 2654435761ULL) % (BENCH_PAGE_COUNT - 1));
+        fdb_pager_fetch_page(pagers[fetches % nconnections], pageNo, &page);
+    }
+    elapsed = fdb_bench_now() - start;
+    fabricdb_mem_stats(&stats);
+    for (i = 0; i < nconnections; i++) {
+        hits += cache_hits(pagers[i]);
+        misses += pagers[i]->pageCache->misses;
+    }
+
+    if (limit > 0) {
+        snprintf(label, sizeof(label), "%u connections, %zuMB soft heap limit", nconnections, limit >> 20);
+    } else {
+        snprintf(label, sizeof(label), "%u connections, no soft heap limit", nconnections);
+    }
+    printf("    %s\n", label);
+    fdb_report("fetches / sec", "%.0f", fetches / elapsed);
+    snprintf(label, sizeof(label), "%.2f%%", 100.0 * hits / (double)(hits + misses));
+    fdb_report("hit rate", "%s", label);
+    fdb_report("library memory high-water mark (bytes)", "%zu", stats.highwater);
+    fdb_report("cache memory (bytes)", "%zu", stats.usedByTag[FDB_MEM_CACHE]);
+
+cleanup:
+    fabricdb_set_soft_heap_limit(0);
+    for (i = 0; i < opened; i++) {
+        fdb_pager_destroy(pagers[i]);
+    }
+}
+
+void bench_pager() {
+    if (create_bench_file(BENCH_PAGE_COUNT) != FABRICDB_OK) {
+        printf("    could not create benchmark file\n");
+        return;
+    }
+
+    run_zipf("zipf 0.99, unbounded cache", BENCH_PAGE_COUNT + 1, 0, 0, 0);
+    run_zipf("zipf 0.99, bounded cache", BENCH_CACHE_SIZE, 0, 0, 0);
+    run_zipf("zipf 0.99 + scans, unbounded cache", BENCH_PAGE_COUNT + 1, 1000, 500, 0);
+    run_zipf("zipf 0.99 + scans, bounded cache", BENCH_CACHE_SIZE, 1000, 500, 0);
+    run_zipf("zipf 0.99, unbounded cache, mmap", BENCH_PAGE_COUNT + 1, 0, 0, 1);
+    run_zipf("zipf 0.99, bounded cache, mmap", BENCH_CACHE_SIZE, 0, 0, 1);
+    run_scan("sequential scan, no read-ahead", 0, 0);
+    run_scan("sequential scan, read-ahead", 32, 0);
+    run_scan("sequential scan, prefetch 64 pages at a time", 0, 64);
+    run_concurrent(1, 0);
+    run_concurrent(1, 1);
+    run_concurrent(4, 1);
+    run_concurrent(4, 16);
+    run_concurrent(16, 16);
+    run_connections(8, 0);
+    run_connections(8, 1);
+    run_soft_limit(4, 0);
+    run_soft_limit(4, 32 << 20);
+    run_soft_limit(4, 8 << 20);
+
+    remove(BENCHFILENAME);
+}
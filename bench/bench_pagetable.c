@@ -0,0 +1,126 @@
+#include "bench_common.h"
+
+#include <stdlib.h>
+
+#include "../src/fabric.h"
+#include "../src/mem.h"
+#include "../src/ptrmap.h"
+#include "../src/pagetable.h"
+
+#define BENCH_KEYS 100000
+#define BENCH_LOOKUPS 5000000
+
+/* Keys are drawn from a zipfian distribution over the page numbers,
+   the same shape as the page cache sees from a real workload. */
+static uint32_t* make_lookups(uint32_t count, uint32_t numKeys) {
+    ZipfGen gen;
+    uint32_t i;
+    uint32_t *keys = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    if (keys == NULL) {
+        return NULL;
+    }
+
+    fdb_zipf_init(&gen, numKeys, 0.99, 42);
+    for (i = 0; i < count; i++) {
+        keys[i] = 1 + (uint32_t)((fdb_zipf_next(&gen) * 2654435761ULL) % numKeys);
+    }
+    return keys;
+}
+
+static void report_rate(const char *label, uint32_t ops, double elapsed) {
+    char line[64];
+    snprintf(line, sizeof(line), "%.2fM", ops / elapsed / 1e6);
+    fdb_report(label, "%s ops/sec", line);
+}
+
+static void bench_ptrmap_ops(uint32_t *lookups) {
+    ptrmap map;
+    uint32_t i;
+    uint64_t found = 0;
+    double start;
+
+    map.count = 0;
+    map.items = NULL;
+    map.size = 0;
+    ptrmap_set_size(&map, 1);
+
+    start = fdb_bench_now();
+    for (i = 1; i <= BENCH_KEYS; i++) {
+        ptrmap_set(&map, i, (void*)(uintptr_t)i);
+    }
+    report_rate("ptrmap insert", BENCH_KEYS, fdb_bench_now() - start);
+
+    start = fdb_bench_now();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        found += (uintptr_t)ptrmap_get_or(&map, lookups[i], NULL);
+    }
+    report_rate("ptrmap lookup", BENCH_LOOKUPS, fdb_bench_now() - start);
+
+    start = fdb_bench_now();
+    for (i = 1; i <= BENCH_KEYS; i += 2) {
+        ptrmap_remove(&map, i);
+    }
+    report_rate("ptrmap remove", BENCH_KEYS / 2, fdb_bench_now() - start);
+
+    fdb_report("ptrmap memory used (bytes)", "%zu", fabricdb_mem_used());
+    ptrmap_deinit(&map);
+
+    /* Keep the lookups from being optimised away */
+    if (found == 0) {
+        printf("    no keys found\n");
+    }
+}
+
+static void bench_pagetable_ops(uint32_t *lookups) {
+    pagetable map;
+    uint32_t i;
+    uint64_t found = 0;
+    double start;
+
+    map.slots = NULL;
+    map.oldSlots = NULL;
+    map.size = 0;
+    map.count = 0;
+    map.oldSize = 0;
+    map.oldCount = 0;
+    map.migrated = 0;
+    pagetable_set_size(&map, 1);
+
+    start = fdb_bench_now();
+    for (i = 1; i <= BENCH_KEYS; i++) {
+        pagetable_set(&map, i, (void*)(uintptr_t)i);
+    }
+    report_rate("pagetable insert", BENCH_KEYS, fdb_bench_now() - start);
+
+    start = fdb_bench_now();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        found += (uintptr_t)pagetable_get_or(&map, lookups[i], NULL);
+    }
+    report_rate("pagetable lookup", BENCH_LOOKUPS, fdb_bench_now() - start);
+
+    start = fdb_bench_now();
+    for (i = 1; i <= BENCH_KEYS; i += 2) {
+        pagetable_remove(&map, i);
+    }
+    report_rate("pagetable remove", BENCH_KEYS / 2, fdb_bench_now() - start);
+
+    fdb_report("pagetable memory used (bytes)", "%zu", fabricdb_mem_used());
+    pagetable_deinit(&map);
+
+    if (found == 0) {
+        printf("    no keys found\n");
+    }
+}
+
+void bench_pagetable() {
+    uint32_t *lookups = make_lookups(BENCH_LOOKUPS, BENCH_KEYS);
+    if (lookups == NULL) {
+        printf("    could not allocate lookups\n");
+        return;
+    }
+
+    bench_ptrmap_ops(lookups);
+    bench_pagetable_ops(lookups);
+
+    free(lookups);
+}
@@ -168,7 +168,7 @@ t_template = %Q~/***************************************************************
 \#include "test_common.h"
 
 void test_#{N}_set_size() {
-    #{N} arr;
+    #{N} arr = {0};
 
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
@@ -229,13 +229,9 @@ void test_#{N}_set_size() {
 }
 
 void test_#{N}_has() {
-    #{N} arr;
+    #{N} arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", #{N}_has(&arr, 0) == 0);
 
     fdb_assert("Could not add a value", #{N}_set(&arr, 0, 100) == FABRICDB_OK);
@@ -254,13 +250,9 @@ void test_#{N}_has() {
 }
 
 void test_#{N}_get_or() {
-    #{N} arr;
+    #{N} arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", #{N}_get_or(&arr, 0, 1) == 1);
 
     fdb_assert("Could not add a value", #{N}_set(&arr, 0, 100) == FABRICDB_OK);
@@ -279,14 +271,10 @@ void test_#{N}_get_or() {
 }
 
 void test_#{N}_get_ref() {
-    #{N} arr;
+    #{N} arr = {0};
     #{T}* v;
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", #{N}_get_ref(&arr, 0) == NULL);
 
     fdb_assert("Could not add a value", #{N}_set(&arr, 0, 100) == FABRICDB_OK);
@@ -311,7 +299,7 @@ void test_#{N}_get_ref() {
 }
 
 void test_#{N}_pop_or() {
-    #{N} arr;
+    #{N} arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
     fdb_assert("Could not push value", #{N}_push(&arr, 1) == FABRICDB_OK);
@@ -82,7 +82,7 @@ static void #{N}_free_item(#{N}_entry* item) {
         #{N}_free_item(item->next);
     }
 
-    fdbfree(item);
+    fdbobjfree(item, sizeof(#{N}_entry), FDB_MEM_GENERAL);
 }
 
 void #{N}_deinit(#{N}* map) {
@@ -164,7 +164,7 @@ int #{N}_set(#{N}* map, uint32_t key, #{T} value) {
     uint32_t index;
     int rc = FABRICDB_OK;
 
-    entry = fdbmalloc(sizeof(#{N}_entry));
+    entry = fdbobjalloc(sizeof(#{N}_entry), FDB_MEM_GENERAL);
     if (entry == NULL) {
         return FABRICDB_ENOMEM;
     }
@@ -172,7 +172,7 @@ int #{N}_set(#{N}* map, uint32_t key, #{T} value) {
     if (map->resizeRatio < map->fillRatio) {
         rc = #{N}_set_size(map, map->size * 2 + 1);
         if (rc != FABRICDB_OK) {
-            fdbfree(entry);
+            fdbobjfree(entry, sizeof(#{N}_entry), FDB_MEM_GENERAL);
             return rc;
         }
     }
@@ -211,6 +211,34 @@ int #{N}_set(#{N}* map, uint32_t key, #{T} value) {
     return FABRICDB_OK;
 }
 
+int #{N}_remove(#{N}* map, uint32_t key) {
+    uint32_t index;
+    #{N}_entry* current;
+    #{N}_entry* prev;
+
+    index = key % map->size;
+    current = map->items[index];
+    prev = NULL;
+
+    while(current != NULL) {
+        if(current->key == key) {
+            if (prev == NULL) {
+                map->items[index] = current->next;
+            } else {
+                prev->next = current->next;
+            }
+            fdbobjfree(current, sizeof(#{N}_entry), FDB_MEM_GENERAL);
+            map->count--;
+            map->fillRatio = (float) map->count / (float) map->size;
+            return 1;
+        }
+        prev = current;
+        current = current->next;
+    }
+
+    return 0;
+}
+
 \#ifdef FABRICDB_TESTING
 \#include "../test/test_#{N}.c"
 \#endif
@@ -254,13 +282,14 @@ int #{N}_has(#{N}* map, uint32_t key);
 #{T} #{N}_get_or(#{N}* map, uint32_t key, #{T} def);
 #{T}* #{N}_get_ref(#{N}* map, uint32_t key);
 int #{N}_set(#{N}* map, uint32_t key, #{T} value);
+int #{N}_remove(#{N}* map, uint32_t key);
 
 \#endif /* __FABRICDB_#{N}_H */
 ~
 
 t_template = %Q~\#include "test_common.h"
 void test_#{N}_set_size() {
-    #{N} map;
+    #{N} map = {0};
     int memUsed;
     int testV;
 
@@ -328,7 +357,7 @@ void test_#{N}_set_size() {
 }
 
 void test_#{N}_get_ref() {
-    #{N} map;
+    #{N} map = {0};
     #{T}* v;
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
     fdb_assert("Count is set", map.count == 0);
@@ -365,9 +394,45 @@ void test_#{N}_get_ref() {
     fdb_passed;
 }
 
+void test_#{N}_remove() {
+    #{N} map = {0};
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    map.items = NULL;
+    map.count = 0;
+    map.size = 0;
+    fdb_assert("Resize failed", #{N}_set_size(&map, 3) == FABRICDB_OK);
+
+    fdb_assert("Insert failed", #{N}_set(&map, 1, (#{T})2) == FABRICDB_OK);
+    fdb_assert("Insert failed", #{N}_set(&map, 4, (#{T})8) == FABRICDB_OK);
+    fdb_assert("Insert failed", #{N}_set(&map, 7, (#{T})1) == FABRICDB_OK);
+    fdb_assert("Count not set", map.count == 3);
+
+    /* remove from the middle of a chain */
+    fdb_assert("Did not remove key", #{N}_remove(&map, 4) == 1);
+    fdb_assert("Count not decremented", map.count == 2);
+    fdb_assert("Still has removed key", #{N}_has(&map, 4) == 0);
+    fdb_assert("Lost value 1", #{N}_get_or(&map, 1, 0) == (#{T})2);
+    fdb_assert("Lost value 7", #{N}_get_or(&map, 7, 0) == (#{T})1);
+
+    /* remove a missing key */
+    fdb_assert("Removed missing key", #{N}_remove(&map, 4) == 0);
+    fdb_assert("Count changed", map.count == 2);
+
+    /* remove the head of a chain */
+    fdb_assert("Did not remove key", #{N}_remove(&map, 1) == 1);
+    fdb_assert("Did not remove key", #{N}_remove(&map, 7) == 1);
+    fdb_assert("Count not zero", map.count == 0);
+
+    #{N}_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
 void test_#{N}() {
     fdb_runtest("#{N} set size", test_#{N}_set_size);
     fdb_runtest("#{N} get ref", test_#{N}_get_ref);
+    fdb_runtest("#{N} remove", test_#{N}_remove);
 }
 ~
 
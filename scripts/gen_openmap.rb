@@ -0,0 +1,604 @@
+#!/usr/bin/env ruby
+
+require "date"
+
+N = ARGV[-2]
+T = ARGV[-1]
+
+cfilename = "./src/#{N}.c"
+hfilename = "./src/#{N}.h"
+tfilename = "./test/test_#{N}.c"
+
+c_template = %Q~/*****************************************************************
+ * FabricDB Library #{N} Implementation
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Generated: #{Date::today()}
+ * Author: Mark Wardle
+ *
+ ******************************************************************/
+\#include <stdint.h>
+\#include <stdlib.h>
+\#include "#{N}.h"
+\#include "fabric.h"
+\#include "mem.h"
+
+/* Slots store their probe distance plus one so that zero means empty.
+   Slots in the old table that have been migrated or removed keep their
+   distance, so lookups can still probe past them, but are flagged. */
+\#define #{N}_MOVED 0x80000000
+\#define #{N}_DIST(s) ((s)->dist & \~#{N}_MOVED)
+\#define #{N}_MIN_SIZE 8
+\#define #{N}_MIGRATE_STEP 4
+
+/* Maximum fill before growing, in eighths */
+\#define #{N}_MAX_FILL 7
+
+static inline uint32_t #{N}_index(uint32_t key, uint32_t shift) {
+    /* Fibonacci hashing spreads sequential page numbers apart */
+    return (uint32_t)(key * 2654435769u) >> shift;
+}
+
+/* Rounds up to a power of 2 that can hold count items */
+static inline uint32_t #{N}_round_size(uint32_t size, uint32_t count, uint32_t *shift) {
+    uint32_t rounded = #{N}_MIN_SIZE;
+    *shift = 29;
+    while ((rounded < size || (uint64_t)count * 8 >= (uint64_t)rounded * #{N}_MAX_FILL) && rounded < 0x80000000u) {
+        rounded <<= 1;
+        (*shift)--;
+    }
+    return rounded;
+}
+
+/* Inserts into the current table, which must have room.
+   The key must not already be in the current table. */
+static void #{N}_insert_slot(#{N}* map, uint32_t key, #{T} value) {
+    uint32_t mask = map->size - 1;
+    uint32_t index = #{N}_index(key, map->shift);
+    #{N}_slot entry;
+    #{N}_slot tmp;
+    #{N}_slot* slot;
+
+    entry.key = key;
+    entry.dist = 1;
+    entry.value = value;
+
+    while (1) {
+        slot = &map->slots[index];
+        if (slot->dist == 0) {
+            *slot = entry;
+            map->count++;
+            return;
+        }
+        if (slot->dist < entry.dist) {
+            /* Rob from the rich: the resident is closer to home */
+            tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+        }
+        entry.dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+static #{N}_slot* #{N}_find_current(#{N}* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t dist = 1;
+    #{N}_slot* slot;
+
+    if (map->slots == NULL) {
+        return NULL;
+    }
+
+    mask = map->size - 1;
+    index = #{N}_index(key, map->shift);
+    while (1) {
+        slot = &map->slots[index];
+        if (slot->dist < dist) {
+            return NULL;
+        }
+        if (slot->key == key) {
+            return slot;
+        }
+        dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+static #{N}_slot* #{N}_find_old(#{N}* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t dist = 1;
+    #{N}_slot* slot;
+
+    if (map->oldSlots == NULL) {
+        return NULL;
+    }
+
+    mask = map->oldSize - 1;
+    index = #{N}_index(key, map->oldShift);
+    while (1) {
+        slot = &map->oldSlots[index];
+        if (#{N}_DIST(slot) < dist) {
+            return NULL;
+        }
+        if (slot->key == key && !(slot->dist & #{N}_MOVED)) {
+            return slot;
+        }
+        dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+/* Moves up to num slots from the old table into the current one. */
+static void #{N}_migrate(#{N}* map, uint32_t num) {
+    #{N}_slot* slot;
+
+    while (map->oldSlots != NULL && num > 0) {
+        if (map->migrated == map->oldSize || map->oldCount == 0) {
+            fdbfree(map->oldSlots);
+            map->oldSlots = NULL;
+            map->oldSize = 0;
+            map->oldCount = 0;
+            map->migrated = 0;
+            break;
+        }
+
+        slot = &map->oldSlots[map->migrated];
+        if (slot->dist != 0 && !(slot->dist & #{N}_MOVED)) {
+            #{N}_insert_slot(map, slot->key, slot->value);
+            slot->dist |= #{N}_MOVED;
+            map->oldCount--;
+        }
+        map->migrated++;
+        num--;
+    }
+}
+
+int #{N}_set_size(#{N}* map, uint32_t size) {
+    uint32_t index;
+    uint32_t oldSize;
+    uint32_t shift;
+    #{N}_slot* oldSlots;
+    #{N}_slot* newSlots;
+    #{N}_slot* slot;
+
+    /* Finish any resize that is in progress */
+    #{N}_migrate(map, 0xFFFFFFFF);
+
+    size = #{N}_round_size(size, map->slots != NULL ? map->count : 0, &shift);
+    newSlots = (#{N}_slot*)fdbmalloczerotag(sizeof(#{N}_slot) * size, FDB_MEM_CACHE);
+    if (newSlots == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    oldSlots = map->slots;
+    oldSize = map->size;
+
+    map->slots = newSlots;
+    map->size = size;
+    map->shift = shift;
+    map->count = 0;
+
+    if (oldSlots != NULL) {
+        for (index = 0; index < oldSize; index++) {
+            slot = &oldSlots[index];
+            if (slot->dist != 0) {
+                #{N}_insert_slot(map, slot->key, slot->value);
+            }
+        }
+        fdbfree(oldSlots);
+    }
+
+    return FABRICDB_OK;
+}
+
+void #{N}_deinit(#{N}* map) {
+    fdbfree(map->slots);
+    fdbfree(map->oldSlots);
+    map->slots = NULL;
+    map->oldSlots = NULL;
+    map->size = 0;
+    map->count = 0;
+    map->oldSize = 0;
+    map->oldCount = 0;
+    map->migrated = 0;
+}
+
+int #{N}_reinit(#{N}* map, uint32_t size) {
+    #{N}_deinit(map);
+    return #{N}_set_size(map, size);
+}
+
+int #{N}_has(#{N}* map, uint32_t key) {
+    return #{N}_find_current(map, key) != NULL || #{N}_find_old(map, key) != NULL;
+}
+
+#{T} #{N}_get_or(#{N}* map, uint32_t key, #{T} def) {
+    #{N}_slot* slot = #{N}_find_current(map, key);
+    if (slot == NULL) {
+        slot = #{N}_find_old(map, key);
+        if (slot == NULL) {
+            return def;
+        }
+    }
+
+    return slot->value;
+}
+
+#{T}* #{N}_get_ref(#{N}* map, uint32_t key) {
+    #{N}_slot* slot = #{N}_find_current(map, key);
+    if (slot == NULL) {
+        slot = #{N}_find_old(map, key);
+        if (slot == NULL) {
+            return NULL;
+        }
+    }
+
+    return &slot->value;
+}
+
+/* Starts an incremental resize.  The current slots become the old
+   table and are moved over a few at a time by later writes. */
+static int #{N}_grow(#{N}* map) {
+    uint32_t shift;
+    uint32_t size;
+    #{N}_slot* newSlots;
+
+    /* Only one resize can be in progress at a time */
+    #{N}_migrate(map, 0xFFFFFFFF);
+
+    size = #{N}_round_size(map->size * 2, 0, &shift);
+    newSlots = (#{N}_slot*)fdbmalloczerotag(sizeof(#{N}_slot) * size, FDB_MEM_CACHE);
+    if (newSlots == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    map->oldSlots = map->slots;
+    map->oldSize = map->size;
+    map->oldShift = map->shift;
+    map->oldCount = map->count;
+    map->migrated = 0;
+
+    map->slots = newSlots;
+    map->size = size;
+    map->shift = shift;
+    map->count = 0;
+
+    return FABRICDB_OK;
+}
+
+int #{N}_set(#{N}* map, uint32_t key, #{T} value) {
+    int rc;
+    #{N}_slot* slot;
+
+    if (map->slots == NULL) {
+        rc = #{N}_set_size(map, #{N}_MIN_SIZE);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    slot = #{N}_find_current(map, key);
+    if (slot != NULL) {
+        slot->value = value;
+        return FABRICDB_OK;
+    }
+
+    slot = #{N}_find_old(map, key);
+    if (slot != NULL) {
+        slot->dist |= #{N}_MOVED;
+        map->oldCount--;
+    }
+
+    if ((map->count + map->oldCount + 1) * 8 > map->size * #{N}_MAX_FILL) {
+        rc = #{N}_grow(map);
+        if (rc != FABRICDB_OK) {
+            if (slot != NULL) {
+                /* Put the old entry back */
+                slot->dist &= \~#{N}_MOVED;
+                map->oldCount++;
+            }
+            return rc;
+        }
+    }
+
+    #{N}_insert_slot(map, key, value);
+    #{N}_migrate(map, #{N}_MIGRATE_STEP);
+
+    return FABRICDB_OK;
+}
+
+int #{N}_remove(#{N}* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t next;
+    #{N}_slot* slot = #{N}_find_current(map, key);
+
+    if (slot == NULL) {
+        slot = #{N}_find_old(map, key);
+        if (slot == NULL) {
+            return 0;
+        }
+        slot->dist |= #{N}_MOVED;
+        map->oldCount--;
+        #{N}_migrate(map, #{N}_MIGRATE_STEP);
+        return 1;
+    }
+
+    /* Shift the following displaced entries back by one */
+    mask = map->size - 1;
+    index = (uint32_t)(slot - map->slots);
+    next = (index + 1) & mask;
+    while (map->slots[next].dist > 1) {
+        map->slots[index] = map->slots[next];
+        map->slots[index].dist--;
+        index = next;
+        next = (next + 1) & mask;
+    }
+    map->slots[index].dist = 0;
+    map->count--;
+
+    #{N}_migrate(map, #{N}_MIGRATE_STEP);
+
+    return 1;
+}
+
+\#ifdef FABRICDB_TESTING
+\#include "../test/test_#{N}.c"
+\#endif
+
+~
+
+h_template = %Q~/*****************************************************************
+ * FabricDB Library #{N} Interface
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Generated: #{Date::today()}
+ * Author: Mark Wardle
+ *
+ ******************************************************************/
+\#ifndef __FABRICDB_#{N}_H
+\#define __FABRICDB_#{N}_H
+
+/*
+ * An open addressed hash map using Robin Hood hashing.
+ *
+ * Items are stored inline in a single array of slots, so inserts
+ * never allocate and lookups touch as few cache lines as possible.
+ * When the map needs to grow, the old slots are kept and moved into
+ * the new array a few at a time by later writes instead of all at once.
+ */
+typedef struct #{N}_slot {
+    uint32_t key;
+    uint32_t dist;         /* Probe distance + 1, 0 when the slot is empty */
+    #{T} value;
+} #{N}_slot;
+
+typedef struct #{N} {
+    uint32_t size;         /* Number of slots, always a power of 2 */
+    uint32_t count;        /* Count of items in the current slots */
+    uint32_t shift;        /* Hash shift for the current slots */
+    #{N}_slot* slots;      /* The current slots */
+    uint32_t oldSize;      /* Number of slots being migrated */
+    uint32_t oldCount;     /* Count of items not yet migrated */
+    uint32_t oldShift;     /* Hash shift for the old slots */
+    uint32_t migrated;     /* Index of the next old slot to migrate */
+    #{N}_slot* oldSlots;   /* Slots being migrated, NULL if not resizing */
+} #{N};
+
+\#define #{N}_count(map) ((map)->count + (map)->oldCount)
+
+int #{N}_set_size(#{N}* map, uint32_t size);
+void #{N}_deinit(#{N}* map);
+int #{N}_reinit(#{N}* map, uint32_t size);
+int #{N}_has(#{N}* map, uint32_t key);
+#{T} #{N}_get_or(#{N}* map, uint32_t key, #{T} def);
+#{T}* #{N}_get_ref(#{N}* map, uint32_t key);
+int #{N}_set(#{N}* map, uint32_t key, #{T} value);
+int #{N}_remove(#{N}* map, uint32_t key);
+
+\#endif /* __FABRICDB_#{N}_H */
+~
+
+t_template = %Q~\#include "test_common.h"
+
+static void test_#{N}_init(#{N}* map) {
+    map->slots = NULL;
+    map->oldSlots = NULL;
+    map->size = 0;
+    map->count = 0;
+    map->oldSize = 0;
+    map->oldCount = 0;
+    map->migrated = 0;
+}
+
+void test_#{N}_set_size() {
+    #{N} map;
+    uint32_t key;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_#{N}_init(&map);
+
+    fdb_assert("Set size failed", #{N}_set_size(&map, 5) == FABRICDB_OK);
+    fdb_assert("Did not allocate memory", fabricdb_mem_used() > 0);
+    fdb_assert("Did not round size", map.size == 8);
+    fdb_assert("Set count", map.count == 0);
+
+    fdb_assert("Set size failed", #{N}_set_size(&map, 20) == FABRICDB_OK);
+    fdb_assert("Did not round size", map.size == 32);
+
+    for (key = 1; key <= 20; key++) {
+        fdb_assert("Insert failed", #{N}_set(&map, key, (#{T})(uintptr_t)(key * 2)) == FABRICDB_OK);
+    }
+    fdb_assert("Count not set", #{N}_count(&map) == 20);
+    fdb_assert("Was resized", map.size == 32);
+
+    /* shrinking rehashes everything at once */
+    fdb_assert("Set size failed", #{N}_set_size(&map, 24) == FABRICDB_OK);
+    fdb_assert("Size not set", map.size == 32);
+    fdb_assert("Set size failed", #{N}_set_size(&map, 64) == FABRICDB_OK);
+    fdb_assert("Size not set", map.size == 64);
+    fdb_assert("Count was changed", #{N}_count(&map) == 20);
+
+    for (key = 1; key <= 20; key++) {
+        fdb_assert("Lost a value", #{N}_get_or(&map, key, 0) == (#{T})(uintptr_t)(key * 2));
+    }
+    fdb_assert("Has missing value", #{N}_has(&map, 21) == 0);
+    fdb_assert("Has missing value", #{N}_has(&map, 0) == 0);
+
+    #{N}_deinit(&map);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_#{N}_get_ref() {
+    #{N} map;
+    #{T}* v;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_#{N}_init(&map);
+
+    fdb_assert("Resize failed", #{N}_set_size(&map, 8) == FABRICDB_OK);
+
+    fdb_assert("Insert failed", #{N}_set(&map, 1, (#{T})2) == FABRICDB_OK);
+    fdb_assert("Insert failed", #{N}_set(&map, 3, (#{T})8) == FABRICDB_OK);
+    fdb_assert("Insert failed", #{N}_set(&map, 9, (#{T})1) == FABRICDB_OK);
+
+    v = #{N}_get_ref(&map, 1);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (#{T})2);
+    v = #{N}_get_ref(&map, 3);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (#{T})8);
+    v = #{N}_get_ref(&map, 9);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (#{T})1);
+    *v = (#{T})3;
+    fdb_assert("Did not update reference value", #{N}_get_or(&map, 9, 0) == (#{T})3);
+    v = #{N}_get_ref(&map, 2);
+    fdb_assert("Did not return null", v == NULL);
+    v = #{N}_get_ref(&map, 6);
+    fdb_assert("Did not return null", v == NULL);
+
+    /* setting an existing key replaces its value */
+    fdb_assert("Insert failed", #{N}_set(&map, 3, (#{T})5) == FABRICDB_OK);
+    fdb_assert("Did not replace value", #{N}_get_or(&map, 3, 0) == (#{T})5);
+    fdb_assert("Duplicated key", #{N}_count(&map) == 3);
+
+    #{N}_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_#{N}_remove() {
+    #{N} map;
+    uint32_t key;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_#{N}_init(&map);
+
+    fdb_assert("Resize failed", #{N}_set_size(&map, 64) == FABRICDB_OK);
+    for (key = 1; key <= 40; key++) {
+        fdb_assert("Insert failed", #{N}_set(&map, key, (#{T})(uintptr_t)key) == FABRICDB_OK);
+    }
+
+    for (key = 1; key <= 40; key += 2) {
+        fdb_assert("Did not remove key", #{N}_remove(&map, key) == 1);
+    }
+    fdb_assert("Removed missing key", #{N}_remove(&map, 1) == 0);
+    fdb_assert("Count not decremented", #{N}_count(&map) == 20);
+
+    for (key = 1; key <= 40; key++) {
+        if (key % 2) {
+            fdb_assert("Still has removed key", #{N}_has(&map, key) == 0);
+        } else {
+            fdb_assert("Lost a key", #{N}_get_or(&map, key, 0) == (#{T})(uintptr_t)key);
+        }
+    }
+
+    #{N}_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_#{N}_incremental_resize() {
+    #{N} map;
+    uint32_t key;
+    uint32_t size;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_#{N}_init(&map);
+
+    fdb_assert("Resize failed", #{N}_set_size(&map, 16) == FABRICDB_OK);
+    for (key = 1; key <= 14; key++) {
+        fdb_assert("Insert failed", #{N}_set(&map, key * 7, (#{T})(uintptr_t)key) == FABRICDB_OK);
+    }
+    fdb_assert("Resized too early", map.oldSlots == NULL);
+
+    /* this insert starts a resize */
+    fdb_assert("Insert failed", #{N}_set(&map, 15 * 7, (#{T})15) == FABRICDB_OK);
+    size = map.size;
+    fdb_assert("Did not grow", size == 32);
+    fdb_assert("Did not keep the old slots", map.oldSlots != NULL);
+    fdb_assert("Migrated everything at once", map.oldCount > 0);
+    fdb_assert("Lost count", #{N}_count(&map) == 15);
+
+    /* every key is visible while the resize is in progress */
+    for (key = 1; key <= 15; key++) {
+        fdb_assert("Lost a key during resize", #{N}_get_or(&map, key * 7, 0) == (#{T})(uintptr_t)key);
+    }
+
+    /* updates and removes work on keys that have not been migrated */
+    fdb_assert("Remove failed", #{N}_remove(&map, 14 * 7) == 1);
+    fdb_assert("Insert failed", #{N}_set(&map, 13 * 7, (#{T})99) == FABRICDB_OK);
+    fdb_assert("Did not update", #{N}_get_or(&map, 13 * 7, 0) == (#{T})99);
+    fdb_assert("Did not remove", #{N}_has(&map, 14 * 7) == 0);
+
+    for (key = 200; key <= 210; key++) {
+        fdb_assert("Insert failed", #{N}_set(&map, key, (#{T})(uintptr_t)key) == FABRICDB_OK);
+    }
+    fdb_assert("Did not finish resize", map.oldSlots == NULL);
+    fdb_assert("Lost count", #{N}_count(&map) == 25);
+    fdb_assert("Did not update", #{N}_get_or(&map, 13 * 7, 0) == (#{T})99);
+    for (key = 1; key <= 12; key++) {
+        fdb_assert("Lost a key after resize", #{N}_get_or(&map, key * 7, 0) == (#{T})(uintptr_t)key);
+    }
+
+    #{N}_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_#{N}() {
+    fdb_runtest("#{N} set size", test_#{N}_set_size);
+    fdb_runtest("#{N} get ref", test_#{N}_get_ref);
+    fdb_runtest("#{N} remove", test_#{N}_remove);
+    fdb_runtest("#{N} incremental resize", test_#{N}_incremental_resize);
+}
+~
+
+File.open(cfilename, "w") do |f|
+    f.write(c_template)
+end
+
+File.open(hfilename, "w") do |f|
+    f.write(h_template)
+end
+
+File.open(tfilename, "w") do |f|
+    f.write(t_template)
+end
+
+puts "Generated #{cfilename} #{hfilename} #{tfilename}"
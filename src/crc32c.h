@@ -0,0 +1,29 @@
+/*****************************************************************
+ * FabricDB CRC32C Routines
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Created: October 17, 2026
+ * Modified: October 17, 2026
+ * Author: Mark Wardle
+ * Description:
+ *     Declares the CRC32C (Castagnoli) checksum used to detect
+ *     damaged pages.
+ *
+ ******************************************************************/
+#ifndef __FABRICDB_CRC32C_H
+#define __FABRICDB_CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t fdb_crc32c(uint32_t crc, const uint8_t *data, size_t len);
+uint32_t fdb_crc32c_sw(uint32_t crc, const uint8_t *data, size_t len);
+int fdb_crc32c_hw_available();
+
+#endif /* __FABRICDB_CRC32C_H */
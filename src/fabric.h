@@ -86,9 +86,11 @@ int fabricdb_close(FabricDB *db);
 
 #define FABRICDB_BUSY (FABRICDB_OK | 1)
 #define FABRICDB_CACHE_FULL (FABRICDB_OK | 2)
+#define FABRICDB_SNAPSHOT_EXPIRED (FABRICDB_OK | 3)
 
 #define FABRICDB_EMISUSE_NULLPTR (FABRICDB_EMISUSE | 1)
 #define FABRICDB_EMISUSE_PRAGMA (FABRICDB_EMISUSE | 2)
+#define FABRICDB_EMISUSE_TRANSACTION (FABRICDB_EMISUSE | 3)
 
 #define FABRICDB_ENOENT (FABRICDB_EIO | 1)
 #define FABRICDB_EINVALID_FILE (FABRICDB_EIO | 2)
@@ -109,6 +111,9 @@ int fabricdb_close(FabricDB *db);
 #define FABRICDB_ENXIO (FABRICDB_EIO | 17)
 #define FABRICDB_ESHORTREAD (FABRICDB_EIO | 18)
 #define FABRICDB_ESHORTWRITE (FABRICDB_EIO | 19)
+#define FABRICDB_ECANCELED (FABRICDB_EIO | 20)
+#define FABRICDB_ECHECKSUM (FABRICDB_EIO | 21)
+#define FABRICDB_ECORRUPT (FABRICDB_EIO | 22)
 
 
 #define FABRICDB_ENOMEM (FABRICDB_EMEM | 1)
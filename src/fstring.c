@@ -37,9 +37,7 @@ void fdb_fstring_unload(FString* fstring, uint8_t* dest) {
     // TODO: fill the rest of chunk with null bytes
 }
 
-int fdb_fstring_tocstring(FString* fstring, char** out) {
-    char* cstring = fabricdb_malloc((size_t)fstring->size + 1);
-
+static int fstring_copy(FString* fstring, char* cstring, char** out) {
     if (cstring == NULL) {
         return FABRICDB_ENOMEM;
     }
@@ -51,6 +49,14 @@ int fdb_fstring_tocstring(FString* fstring, char** out) {
     return FABRICDB_OK;
 }
 
+int fdb_fstring_tocstring(FString* fstring, char** out) {
+    return fstring_copy(fstring, fabricdb_malloc_tagged((size_t)fstring->size + 1, FDB_MEM_STRING), out);
+}
+
+int fdb_fstring_tocstring_arena(FString* fstring, FdbArena* arena, char** out) {
+    return fstring_copy(fstring, fabricdb_arena_alloc(arena, (size_t)fstring->size + 1), out);
+}
+
 
 #ifdef FABRICDB_TESTING
 #include "../test/test_fstring.c"
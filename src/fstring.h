@@ -21,6 +21,8 @@
 
 #include <stdint.h>
 
+#include "mem.h"
+
 /******************************************************
  * FSTRING FORMAT
  *
@@ -47,4 +49,8 @@ void fdb_fstring_load(FString* fstring, uint64_t id, uint8_t* source);
 void fdb_fstring_unload(FString* fstring, uint8_t* dest);
 int fdb_fstring_tocstring(FString* fstring, char** out);
 
+/* Like fdb_fstring_tocstring(), but the c string comes from an arena and
+   is freed when the arena is reset */
+int fdb_fstring_tocstring_arena(FString* fstring, FdbArena* arena, char** out);
+
 #endif /* __FABRICDB_FSTRING_H */
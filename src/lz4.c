@@ -0,0 +1,242 @@
+/*****************************************************************
+ * FabricDB LZ4 Routines
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Created: October 17, 2026
+ * Modified: October 17, 2026
+ * Author: Mark Wardle
+ * Description:
+ *     Defines a small compressor and decompressor for the LZ4 block
+ *     format, enough to squeeze pages without an outside library.
+ *     The compressor is the greedy single probe kind, which is fast
+ *     and does well on the runs of zeros and repeated records that
+ *     pages are made of.  Its output can be read by any LZ4 block
+ *     decoder, and the decoder checks every length and offset so a
+ *     damaged block can not take it outside its buffers.
+ *
+ *     A block is a list of sequences.  Each starts with a token, the
+ *     high four bits counting literals and the low four bits the
+ *     match length less four, a value of 15 meaning more length bytes
+ *     follow.  Then come the literals, a two byte little endian
+ *     offset back to the match and any extra match length bytes.  The
+ *     last sequence has literals only.
+ *
+ ******************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+#include "fabric.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5        /* The last bytes are always literals */
+#define LZ4_MFLIMIT 12             /* The last match starts this far from the end */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Writes a length that did not fit in its token nibble */
+static inline uint8_t *write_length(uint8_t *op, uint32_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* Emits the literals from anchor up to ip, followed by a match unless
+   matchLen is 0.  Returns NULL if the output would not fit. */
+static uint8_t *write_sequence(uint8_t *op, uint8_t *opEnd, const uint8_t *anchor, uint32_t litLen,
+                               uint32_t offset, uint32_t matchLen) {
+    uint8_t *token;
+
+    /* token, length bytes, literals, offset and match length bytes */
+    if ((size_t)(opEnd - op) < 1 + (size_t)litLen + litLen / 255 + 1 + (matchLen ? 2 + matchLen / 255 + 1 : 0)) {
+        return NULL;
+    }
+    token = op++;
+
+    if (litLen >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, litLen - 15);
+    } else {
+        *token = (uint8_t)(litLen << 4);
+    }
+    memcpy(op, anchor, litLen);
+    op += litLen;
+
+    if (matchLen == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    matchLen -= LZ4_MIN_MATCH;
+    if (matchLen >= 15) {
+        *token |= 15;
+        op = write_length(op, matchLen - 15);
+    } else {
+        *token |= (uint8_t)matchLen;
+    }
+
+    return op;
+}
+
+/* Compresses srcLen bytes into dst.  Returns the size of the block,
+   or 0 if it would not fit in dstCapacity bytes. */
+uint32_t fdb_lz4_compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity) {
+    uint32_t table[1 << LZ4_HASH_BITS];
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t ref;
+    uint32_t len;
+    uint32_t h;
+    uint8_t *op = dst;
+    uint8_t *opEnd = dst + dstCapacity;
+
+    if (srcLen > LZ4_MFLIMIT) {
+        uint32_t ipLimit = srcLen - LZ4_MFLIMIT;
+        uint32_t matchLimit = srcLen - LZ4_LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+        ip = 1;
+        while (ip <= ipLimit) {
+            h = hash4(read32(src + ip));
+            ref = table[h];
+            table[h] = ip;
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(src + ref) != read32(src + ip)) {
+                ip++;
+                continue;
+            }
+
+            /* Take in any matching bytes just before the match */
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            len = LZ4_MIN_MATCH;
+            while (ip + len < matchLimit && src[ip + len] == src[ref + len]) {
+                len++;
+            }
+
+            op = write_sequence(op, opEnd, src + anchor, ip - anchor, ip - ref, len);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+
+            /* Remember a position inside the match for the next search */
+            if (ip - 2 <= ipLimit) {
+                table[hash4(read32(src + ip - 2))] = ip - 2;
+            }
+        }
+    }
+
+    op = write_sequence(op, opEnd, src + anchor, srcLen - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (uint32_t)(op - dst);
+}
+
+/* Reads a length that did not fit in its token nibble.  Returns 0 if
+   the block ends first. */
+static inline int read_length(const uint8_t **ipp, const uint8_t *ipEnd, uint32_t *len) {
+    const uint8_t *ip = *ipp;
+    uint8_t b;
+
+    do {
+        if (ip >= ipEnd || *len > UINT32_MAX - 255) {
+            return 0;
+        }
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+
+    *ipp = ip;
+    return 1;
+}
+
+/* Decompresses a block that must expand to exactly dstLen bytes */
+int fdb_lz4_decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen) {
+    const uint8_t *ip = src;
+    const uint8_t *ipEnd = src + srcLen;
+    uint8_t *op = dst;
+    uint8_t *opEnd = dst + dstLen;
+    uint32_t litLen;
+    uint32_t matchLen;
+    uint32_t offset;
+    uint8_t token;
+
+    while (ip < ipEnd) {
+        token = *ip++;
+
+        litLen = token >> 4;
+        if (litLen == 15 && !read_length(&ip, ipEnd, &litLen)) {
+            return FABRICDB_ECORRUPT;
+        }
+        if (litLen > (uint32_t)(ipEnd - ip) || litLen > (uint32_t)(opEnd - op)) {
+            return FABRICDB_ECORRUPT;
+        }
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        if (ip == ipEnd) {
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return FABRICDB_ECORRUPT;
+        }
+        offset = (uint32_t)ip[0] | (uint32_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return FABRICDB_ECORRUPT;
+        }
+
+        matchLen = token & 15;
+        if (matchLen == 15 && !read_length(&ip, ipEnd, &matchLen)) {
+            return FABRICDB_ECORRUPT;
+        }
+        matchLen += LZ4_MIN_MATCH;
+        if (matchLen > (uint32_t)(opEnd - op)) {
+            return FABRICDB_ECORRUPT;
+        }
+
+        /* The match may overlap the bytes it produces */
+        if (offset >= matchLen) {
+            memcpy(op, op - offset, matchLen);
+            op += matchLen;
+        } else {
+            while (matchLen-- > 0) {
+                *op = *(op - offset);
+                op++;
+            }
+        }
+    }
+
+    return op == opEnd ? FABRICDB_OK : FABRICDB_ECORRUPT;
+}
+
+#ifdef FABRICDB_TESTING
+#include "../test/test_lz4.c"
+#endif
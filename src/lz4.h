@@ -0,0 +1,26 @@
+/*****************************************************************
+ * FabricDB LZ4 Routines
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Created: October 17, 2026
+ * Modified: October 17, 2026
+ * Author: Mark Wardle
+ * Description:
+ *     Declares compression of pages in the LZ4 block format.
+ *
+ ******************************************************************/
+#ifndef __FABRICDB_LZ4_H
+#define __FABRICDB_LZ4_H
+
+#include <stdint.h>
+
+uint32_t fdb_lz4_compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity);
+int fdb_lz4_decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen);
+
+#endif /* __FABRICDB_LZ4_H */
@@ -19,46 +19,260 @@
  ******************************************************************/
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "mem.h"
 
 #define FABRICDB_MEM_PREFIX_SIZE (sizeof(size_t))
 
+/* The prefix holds the allocation's size, with its tag in the top byte */
+#define FABRICDB_MEM_TAG_SHIFT ((sizeof(size_t) - 1) * 8)
+#define FABRICDB_MEM_SIZE_MASK (((size_t)1 << FABRICDB_MEM_TAG_SHIFT) - 1)
+
+/* The first threads to allocate get a counter slot each and any more
+   share the last one */
+#define FABRICDB_MEM_SLOTS 64
+
+/* A thread samples the high-water marks after allocating this much */
+#define FABRICDB_MEM_SAMPLE_INTERVAL (64 * 1024)
+
+/* Arena allocations are aligned as fabricdb_malloc()'s are */
+#define FABRICDB_ARENA_ALIGNMENT 8
+#define FABRICDB_ARENA_DEFAULT_BLOCK (16 * 1024)
+
+/* Object pool size classes.  Objects larger than the largest class are
+   malloced. */
+#define FABRICDB_OBJ_CLASSES 8
+#define FABRICDB_OBJ_MAX_SIZE 256
+#define FABRICDB_OBJ_SLAB_SIZE (16 * 1024)
+
+/* The free objects a thread keeps for each class, and the number that
+   move between it and the class's shared free list at once */
+#define FABRICDB_OBJ_MAGAZINE 32
+#define FABRICDB_OBJ_BATCH 16
+
 /**
- * Total amount of memory used by the library.
+ * The memory counted by the threads that use a slot.  Memory freed by
+ * another thread than the one that allocated it is taken off the
+ * freeing thread's slot, so a single slot's count can wrap below zero;
+ * only the sum over all slots is meaningful.  Each slot has a cache
+ * line of its own so threads do not write to each other's lines.
+ *
+ * A slot with one thread is updated with plain atomic stores, which
+ * cost no more than the old global counter did, and only the shared
+ * slot pays for locked read-modify-writes.
  */
-static size_t used_memory = 0;
+typedef struct MemSlot {
+	size_t used[FDB_MEM_TAG_COUNT];
+	size_t sinceSample;
+	int shared;
+} __attribute__((aligned(64))) MemSlot;
+
+static MemSlot memSlots[FABRICDB_MEM_SLOTS] = {
+	[FABRICDB_MEM_SLOTS - 1] = { .shared = 1 }
+};
+static uint32_t nextMemSlot = 0;
+static __thread MemSlot *threadMemSlot = NULL;
+
+static size_t memHighwater = 0;
+static size_t memHighwaterByTag[FDB_MEM_TAG_COUNT];
+
+static size_t memSoftLimit = 0;
+static int memOverLimit = 0;
+
+static __thread FdbArena threadArena;
+
+static const uint32_t objClassSizes[FABRICDB_OBJ_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256};
+
+/* The size class of an object, indexed by its size in 16 byte units */
+static const uint8_t objClassIndex[FABRICDB_OBJ_MAX_SIZE / 16 + 1] = {0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7};
+
+typedef struct ObjFree {
+	struct ObjFree *next;
+} ObjFree;
+
+/* The free objects of a size class that no thread holds.  Slabs are
+   never given back, their objects are reused by the class. */
+typedef struct ObjClass {
+	pthread_mutex_t lock;
+	ObjFree *freeList;
+} __attribute__((aligned(64))) ObjClass;
+
+/* A thread's own free objects of one size class */
+typedef struct ObjMagazine {
+	uint32_t count;
+	void *objs[FABRICDB_OBJ_MAGAZINE];
+} ObjMagazine;
+
+static ObjClass objClasses[FABRICDB_OBJ_CLASSES] = {
+	{ PTHREAD_MUTEX_INITIALIZER, NULL }, { PTHREAD_MUTEX_INITIALIZER, NULL },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL }, { PTHREAD_MUTEX_INITIALIZER, NULL },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL }, { PTHREAD_MUTEX_INITIALIZER, NULL },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL }, { PTHREAD_MUTEX_INITIALIZER, NULL }
+};
+static __thread ObjMagazine threadMagazines[FABRICDB_OBJ_CLASSES];
+static __thread int threadMagazinesRegistered = 0;
+static pthread_key_t objThreadKey;
+static pthread_once_t objThreadOnce = PTHREAD_ONCE_INIT;
+
+static inline MemSlot* mem_slot() {
+	uint32_t i;
 
-static inline void update_memused_alloc(size_t num_bytes) {
-	used_memory += num_bytes;
+	if (threadMemSlot == NULL) {
+		i = __atomic_fetch_add(&nextMemSlot, 1, __ATOMIC_RELAXED);
+		threadMemSlot = &memSlots[i < FABRICDB_MEM_SLOTS - 1 ? i : FABRICDB_MEM_SLOTS - 1];
+	}
+	return threadMemSlot;
+}
+
+static inline size_t slot_add(MemSlot *slot, size_t *counter, size_t num_bytes) {
+	size_t value;
+
+	if (slot->shared) {
+		return __atomic_add_fetch(counter, num_bytes, __ATOMIC_RELAXED);
+	}
+	value = __atomic_load_n(counter, __ATOMIC_RELAXED) + num_bytes;
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+	return value;
+}
+
+/* Sums the slots into stats->used and stats->usedByTag.  A sum can be
+   caught between a free on one slot and the allocation it undoes on
+   another, so a negative one is reported as zero. */
+static void mem_sum(FdbMemStats *stats) {
+	uint32_t i;
+	int tag;
+
+	memset(stats->usedByTag, 0, sizeof(stats->usedByTag));
+	for (i = 0; i < FABRICDB_MEM_SLOTS; i++) {
+		for (tag = 0; tag < FDB_MEM_TAG_COUNT; tag++) {
+			stats->usedByTag[tag] += __atomic_load_n(&memSlots[i].used[tag], __ATOMIC_RELAXED);
+		}
+	}
+
+	stats->used = 0;
+	for (tag = 0; tag < FDB_MEM_TAG_COUNT; tag++) {
+		if ((intptr_t)stats->usedByTag[tag] < 0) {
+			stats->usedByTag[tag] = 0;
+		}
+		stats->used += stats->usedByTag[tag];
+	}
 }
 
-static inline void update_memused_free(size_t num_bytes) {
-	used_memory -= num_bytes;
+static inline void raise_highwater(size_t *highwater, size_t used) {
+	size_t seen = __atomic_load_n(highwater, __ATOMIC_RELAXED);
+	while (used > seen &&
+	       !__atomic_compare_exchange_n(highwater, &seen, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Raises the high-water marks to the memory in use now and checks it
+   against the soft heap limit */
+static void mem_sample(FdbMemStats *stats) {
+	size_t limit = __atomic_load_n(&memSoftLimit, __ATOMIC_RELAXED);
+	int tag;
+
+	mem_sum(stats);
+	__atomic_store_n(&memOverLimit, limit > 0 && stats->used > limit, __ATOMIC_RELAXED);
+	raise_highwater(&memHighwater, stats->used);
+	for (tag = 0; tag < FDB_MEM_TAG_COUNT; tag++) {
+		raise_highwater(&memHighwaterByTag[tag], stats->usedByTag[tag]);
+	}
+}
+
+static inline void update_memused_alloc(size_t num_bytes, int tag) {
+	MemSlot *slot = mem_slot();
+	FdbMemStats stats;
+
+	slot_add(slot, &slot->used[tag], num_bytes);
+	if (slot_add(slot, &slot->sinceSample, num_bytes) >= FABRICDB_MEM_SAMPLE_INTERVAL) {
+		__atomic_store_n(&slot->sinceSample, 0, __ATOMIC_RELAXED);
+		mem_sample(&stats);
+	}
+}
+
+static inline void update_memused_free(size_t num_bytes, int tag) {
+	MemSlot *slot = mem_slot();
+
+	slot_add(slot, &slot->used[tag], -num_bytes);
+}
+
+static inline int mem_tag(void *realptr) {
+	return (int)(*((size_t*)realptr) >> FABRICDB_MEM_TAG_SHIFT);
 }
 
 size_t fabricdb_mem_used() {
-	return used_memory;
+	FdbMemStats stats;
+
+	mem_sum(&stats);
+	return stats.used;
 }
 
-void* fabricdb_malloc(size_t num_bytes) {
+void fabricdb_mem_stats(FdbMemStats *stats) {
+	int tag;
+
+	mem_sample(stats);
+	stats->highwater = __atomic_load_n(&memHighwater, __ATOMIC_RELAXED);
+	for (tag = 0; tag < FDB_MEM_TAG_COUNT; tag++) {
+		stats->highwaterByTag[tag] = __atomic_load_n(&memHighwaterByTag[tag], __ATOMIC_RELAXED);
+	}
+}
+
+void fabricdb_mem_reset_highwater() {
+	FdbMemStats stats;
+	int tag;
+
+	mem_sum(&stats);
+	__atomic_store_n(&memHighwater, stats.used, __ATOMIC_RELAXED);
+	for (tag = 0; tag < FDB_MEM_TAG_COUNT; tag++) {
+		__atomic_store_n(&memHighwaterByTag[tag], stats.usedByTag[tag], __ATOMIC_RELAXED);
+	}
+}
+
+size_t fabricdb_set_soft_heap_limit(size_t limit) {
+	FdbMemStats stats;
+	size_t previous = __atomic_exchange_n(&memSoftLimit, limit, __ATOMIC_RELAXED);
+
+	mem_sample(&stats);
+	return previous;
+}
+
+size_t fabricdb_get_soft_heap_limit() {
+	return __atomic_load_n(&memSoftLimit, __ATOMIC_RELAXED);
+}
+
+int fabricdb_mem_over_limit() {
+	FdbMemStats stats;
+
+	if (!__atomic_load_n(&memOverLimit, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	mem_sample(&stats);
+	return __atomic_load_n(&memOverLimit, __ATOMIC_RELAXED);
+}
+
+void* fabricdb_malloc_tagged(size_t num_bytes, int tag) {
     if (num_bytes == 0) {
         return NULL;
     }
-    
+
 	void *ptr = malloc(num_bytes + FABRICDB_MEM_PREFIX_SIZE);
 	if (ptr == NULL) {
 		return ptr;
 	}
 
-	*((size_t*)ptr) = num_bytes;
-	update_memused_alloc(num_bytes + FABRICDB_MEM_PREFIX_SIZE);
+	*((size_t*)ptr) = num_bytes | ((size_t)tag << FABRICDB_MEM_TAG_SHIFT);
+	update_memused_alloc(num_bytes + FABRICDB_MEM_PREFIX_SIZE, tag);
 	return (uint8_t*)ptr + FABRICDB_MEM_PREFIX_SIZE;
 }
 
-void* fabricdb_malloc_zero(size_t num_bytes) {
-	void *ptr = fabricdb_malloc(num_bytes);
+void* fabricdb_malloc(size_t num_bytes) {
+	return fabricdb_malloc_tagged(num_bytes, FDB_MEM_GENERAL);
+}
+
+void* fabricdb_malloc_zero_tagged(size_t num_bytes, int tag) {
+	void *ptr = fabricdb_malloc_tagged(num_bytes, tag);
 	if (ptr == NULL) {
 		return ptr;
 	}
@@ -68,19 +282,24 @@ void* fabricdb_malloc_zero(size_t num_bytes) {
 	return ptr;
 }
 
+void* fabricdb_malloc_zero(size_t num_bytes) {
+	return fabricdb_malloc_zero_tagged(num_bytes, FDB_MEM_GENERAL);
+}
+
 void *fabricdb_realloc(void *ptr, size_t num_bytes) {
 	size_t old_num_bytes = fabricdb_mem_size(ptr);
 	void *realptr = (uint8_t*)ptr - FABRICDB_MEM_PREFIX_SIZE;
+	int tag = mem_tag(realptr);
 	void *newptr = realloc(realptr, num_bytes + FABRICDB_MEM_PREFIX_SIZE);
 
 	if (newptr == NULL) {
 		return newptr;
 	}
 
-	*((size_t*)newptr) = num_bytes;
+	*((size_t*)newptr) = num_bytes | ((size_t)tag << FABRICDB_MEM_TAG_SHIFT);
 
-	update_memused_free(old_num_bytes);
-	update_memused_alloc(num_bytes);
+	update_memused_free(old_num_bytes, tag);
+	update_memused_alloc(num_bytes, tag);
 
 	return (uint8_t*)newptr + FABRICDB_MEM_PREFIX_SIZE;
 }
@@ -103,9 +322,10 @@ void fabricdb_free(void *ptr) {
 	}
 
 	void *realptr = (uint8_t*)ptr - FABRICDB_MEM_PREFIX_SIZE;
-	size_t num_bytes = *((size_t*)realptr);
+	size_t num_bytes = *((size_t*)realptr) & FABRICDB_MEM_SIZE_MASK;
+	int tag = mem_tag(realptr);
 	free(realptr);
-	update_memused_free(num_bytes + FABRICDB_MEM_PREFIX_SIZE);
+	update_memused_free(num_bytes + FABRICDB_MEM_PREFIX_SIZE, tag);
 }
 
 size_t fabricdb_mem_size(void *ptr) {
@@ -113,7 +333,227 @@ size_t fabricdb_mem_size(void *ptr) {
         return 0;
     }
 	void *realptr = (uint8_t*)ptr - FABRICDB_MEM_PREFIX_SIZE;
-	return *((size_t*)realptr);
+	return *((size_t*)realptr) & FABRICDB_MEM_SIZE_MASK;
+}
+
+void fabricdb_arena_init(FdbArena *arena, size_t blockSize, int tag) {
+	arena->blocks = NULL;
+	arena->next = NULL;
+	arena->end = NULL;
+	arena->blockSize = blockSize > 0 ? blockSize : FABRICDB_ARENA_DEFAULT_BLOCK;
+	arena->tag = tag;
+}
+
+/* Adds a block to an arena that does not have room for num_bytes.  A
+   large allocation gets a block of its own, linked in behind the
+   current block so the rest of that block is not wasted. */
+static void *arena_alloc_block(FdbArena *arena, size_t num_bytes) {
+	FdbArenaBlock *block;
+	size_t size = num_bytes > arena->blockSize / 4 ? num_bytes : arena->blockSize;
+	uint8_t *data;
+
+	block = fabricdb_malloc_tagged(sizeof(FdbArenaBlock) + size, arena->tag);
+	if (block == NULL) {
+		return NULL;
+	}
+	block->size = size;
+	data = (uint8_t*)(block + 1);
+
+	if (size != arena->blockSize && arena->blocks != NULL) {
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+		return data;
+	}
+
+	block->next = arena->blocks;
+	arena->blocks = block;
+	arena->next = data + num_bytes;
+	arena->end = data + size;
+	return data;
+}
+
+void *fabricdb_arena_alloc(FdbArena *arena, size_t num_bytes) {
+	uint8_t *ptr;
+
+	num_bytes = (num_bytes + FABRICDB_ARENA_ALIGNMENT - 1) & ~(size_t)(FABRICDB_ARENA_ALIGNMENT - 1);
+	if (num_bytes > (size_t)(arena->end - arena->next)) {
+		return arena_alloc_block(arena, num_bytes);
+	}
+	ptr = arena->next;
+	arena->next += num_bytes;
+	return ptr;
+}
+
+void fabricdb_arena_reset(FdbArena *arena) {
+	FdbArenaBlock *block = arena->blocks;
+	FdbArenaBlock *kept = NULL;
+	FdbArenaBlock *next;
+
+	while (block != NULL) {
+		next = block->next;
+		if (kept == NULL && block->size == arena->blockSize) {
+			kept = block;
+		} else {
+			fabricdb_free(block);
+		}
+		block = next;
+	}
+
+	arena->blocks = kept;
+	if (kept == NULL) {
+		arena->next = NULL;
+		arena->end = NULL;
+		return;
+	}
+	kept->next = NULL;
+	arena->next = (uint8_t*)(kept + 1);
+	arena->end = arena->next + kept->size;
+}
+
+void fabricdb_arena_free(FdbArena *arena) {
+	fabricdb_arena_reset(arena);
+	fabricdb_free(arena->blocks);
+	arena->blocks = NULL;
+	arena->next = NULL;
+	arena->end = NULL;
+}
+
+FdbArena *fabricdb_arena_thread() {
+	if (threadArena.blockSize == 0) {
+		fabricdb_arena_init(&threadArena, 0, FDB_MEM_SCRATCH);
+	}
+	return &threadArena;
+}
+
+void fabricdb_arena_thread_free() {
+	fabricdb_arena_free(&threadArena);
+	threadArena.blockSize = 0;
+}
+
+/* Moves count objects from the top of a magazine to its class's free
+   list */
+static void obj_flush(ObjMagazine *mag, uint32_t cls, uint32_t count) {
+	ObjClass *oc = &objClasses[cls];
+	ObjFree *first;
+	ObjFree *last;
+	uint32_t i;
+
+	if (count == 0) {
+		return;
+	}
+	first = mag->objs[mag->count - count];
+	last = first;
+	for (i = mag->count - count + 1; i < mag->count; i++) {
+		last->next = mag->objs[i];
+		last = last->next;
+	}
+	mag->count -= count;
+
+	pthread_mutex_lock(&oc->lock);
+	last->next = oc->freeList;
+	oc->freeList = first;
+	pthread_mutex_unlock(&oc->lock);
+}
+
+/* Hands the free objects of an exiting thread back to their classes */
+static void obj_thread_exit(void *arg) {
+	ObjMagazine *mags = arg;
+	uint32_t cls;
+
+	for (cls = 0; cls < FABRICDB_OBJ_CLASSES; cls++) {
+		obj_flush(&mags[cls], cls, mags[cls].count);
+	}
+}
+
+static void obj_create_key() {
+	pthread_key_create(&objThreadKey, obj_thread_exit);
+}
+
+static inline ObjMagazine* obj_magazine(uint32_t cls) {
+	if (!threadMagazinesRegistered) {
+		pthread_once(&objThreadOnce, obj_create_key);
+		pthread_setspecific(objThreadKey, threadMagazines);
+		threadMagazinesRegistered = 1;
+	}
+	return &threadMagazines[cls];
+}
+
+/* Carves a new slab into objects on the class's free list.  The caller
+   holds the class's lock. */
+static void obj_add_slab(ObjClass *oc, uint32_t size) {
+	uint8_t *slab = malloc(FABRICDB_OBJ_SLAB_SIZE);
+	ObjFree *obj;
+	uint32_t i;
+
+	if (slab == NULL) {
+		return;
+	}
+	/* Push in reverse so objects are handed out in address order */
+	for (i = FABRICDB_OBJ_SLAB_SIZE / size; i > 0; i--) {
+		obj = (ObjFree*)(slab + (size_t)size * (i - 1));
+		obj->next = oc->freeList;
+		oc->freeList = obj;
+	}
+}
+
+/* Fills an empty magazine with up to FABRICDB_OBJ_BATCH objects from its
+   class, and returns the number it got */
+static uint32_t obj_refill(ObjMagazine *mag, uint32_t cls) {
+	ObjClass *oc = &objClasses[cls];
+	ObjFree *obj;
+
+	pthread_mutex_lock(&oc->lock);
+	if (oc->freeList == NULL) {
+		obj_add_slab(oc, objClassSizes[cls]);
+	}
+	while (mag->count < FABRICDB_OBJ_BATCH && (obj = oc->freeList) != NULL) {
+		oc->freeList = obj->next;
+		mag->objs[mag->count++] = obj;
+	}
+	pthread_mutex_unlock(&oc->lock);
+
+	return mag->count;
+}
+
+void *fabricdb_obj_alloc(size_t num_bytes, int tag) {
+	ObjMagazine *mag;
+	uint32_t cls;
+
+	if (num_bytes == 0) {
+		return NULL;
+	}
+	if (num_bytes > FABRICDB_OBJ_MAX_SIZE) {
+		return fabricdb_malloc_tagged(num_bytes, tag);
+	}
+
+	cls = objClassIndex[(num_bytes + 15) / 16];
+	mag = obj_magazine(cls);
+	if (mag->count == 0 && obj_refill(mag, cls) == 0) {
+		return NULL;
+	}
+	update_memused_alloc(objClassSizes[cls], tag);
+	return mag->objs[--mag->count];
+}
+
+void fabricdb_obj_free(void *ptr, size_t num_bytes, int tag) {
+	ObjMagazine *mag;
+	uint32_t cls;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if (num_bytes > FABRICDB_OBJ_MAX_SIZE) {
+		fabricdb_free(ptr);
+		return;
+	}
+
+	cls = objClassIndex[(num_bytes + 15) / 16];
+	mag = obj_magazine(cls);
+	if (mag->count == FABRICDB_OBJ_MAGAZINE) {
+		obj_flush(mag, cls, FABRICDB_OBJ_BATCH);
+	}
+	mag->objs[mag->count++] = ptr;
+	update_memused_free(objClassSizes[cls], tag);
 }
 
 #ifdef FABRICDB_TESTING
@@ -21,6 +21,47 @@
 #define __FABRICDB_MEM_H
 
 #include <stdlib.h>
+#include <stdint.h>
+
+/* Memory tags, the subsystem an allocation is counted against */
+#define FDB_MEM_GENERAL 0
+#define FDB_MEM_PAGER 1
+#define FDB_MEM_CACHE 2
+#define FDB_MEM_RECORD 3
+#define FDB_MEM_STRING 4
+#define FDB_MEM_SCRATCH 5
+
+#define FDB_MEM_TAG_COUNT 6
+
+/* A snapshot of the library's memory use, see fabricdb_mem_stats() */
+typedef struct FdbMemStats {
+    size_t used;                              /* Bytes allocated now */
+    size_t highwater;                         /* Most bytes allocated at once */
+    size_t usedByTag[FDB_MEM_TAG_COUNT];      /* Bytes allocated now for each tag */
+    size_t highwaterByTag[FDB_MEM_TAG_COUNT]; /* Most bytes allocated at once for each tag */
+} FdbMemStats;
+
+/* One block of memory an arena hands out allocations from */
+typedef struct FdbArenaBlock {
+    struct FdbArenaBlock *next;
+    size_t size;                              /* Usable bytes after the header */
+} FdbArenaBlock;
+
+/**
+ * A region of short-lived allocations that are freed all at once.
+ *
+ * Allocating bumps a pointer through the current block, so it costs no
+ * lock, no size prefix and no free.  Everything is given back together
+ * by fabricdb_arena_reset(), as at the end of a query or transaction.
+ * An arena is not thread safe; each thread uses its own.
+ */
+typedef struct FdbArena {
+    FdbArenaBlock *blocks;                    /* The current block first */
+    uint8_t *next;                            /* Next free byte of the current block */
+    uint8_t *end;                             /* End of the current block */
+    size_t blockSize;                         /* Usable bytes in each block */
+    int tag;                                  /* Tag the blocks are counted against */
+} FdbArena;
 
 /**
  * Attempts to allocate the specified number of bytes.
@@ -44,6 +85,31 @@ void *fabricdb_malloc(size_t num_bytes);
  */
 void *fabricdb_malloc_zero(size_t num_bytes);
 
+/**
+ * Allocates memory that is counted against a subsystem.
+ *
+ * The tag stays with the memory, so a later realloc or free updates
+ * the same subsystem's count.
+ *
+ * @see fabricdb_malloc
+ *
+ * @param num_bytes The number of bytes to allocate.
+ * @param tag One of the FDB_MEM_* tags.
+ * @return A pointer to the allocated memory or NULL on failure.
+ */
+void *fabricdb_malloc_tagged(size_t num_bytes, int tag);
+
+/**
+ * Allocates zeroed memory that is counted against a subsystem.
+ *
+ * @see fabricdb_malloc_tagged
+ *
+ * @param num_bytes The number of bytes to allocate.
+ * @param tag One of the FDB_MEM_* tags.
+ * @return A pointer to the allocated memory or NULL on failure.
+ */
+void *fabricdb_malloc_zero_tagged(size_t num_bytes, int tag);
+
 /**
  * Attempts to reallocate a ptr to the specified number of bytes
  *
@@ -90,15 +156,161 @@ size_t fabricdb_mem_size(void* ptr);
 /**
  * Returns the total amount of memory used by the library.
  *
+ * Each thread counts its allocations in its own slot and the slots are
+ * only added up here, so while other threads allocate the result is a
+ * close estimate rather than an exact figure.
+ *
  * @return The number of bytes the library has allocated.
  */
 size_t fabricdb_mem_used();
 
+/**
+ * Fills in the memory used by the library as a whole and by each tag,
+ * and the high-water marks of both.
+ *
+ * High-water marks are sampled: by each thread after every 64KB it
+ * allocates, and by this function.  A peak that rises and falls between
+ * samples can be missed by up to that much per thread.
+ *
+ * @param stats The stats to fill in.
+ * @return void
+ */
+void fabricdb_mem_stats(FdbMemStats *stats);
+
+/**
+ * Lowers the high-water marks to the memory in use now.
+ *
+ * @return void
+ */
+void fabricdb_mem_reset_highwater();
+
+/**
+ * Sets a soft limit on the memory used by the library as a whole.
+ *
+ * Allocations never fail because of the limit.  Instead, once it is
+ * crossed every pager sheds memory the next time it misses its cache
+ * or ends a transaction, until the library is back under the limit or
+ * the pager has nothing left it can let go of.  Use is checked after
+ * every 64KB a thread allocates, so the library can overshoot the
+ * limit by about that much per thread before pagers react.
+ *
+ * @param limit The limit in bytes, or 0 for no limit.
+ * @return The previous limit.
+ */
+size_t fabricdb_set_soft_heap_limit(size_t limit);
+
+/**
+ * Returns the soft heap limit, 0 if there is none.
+ */
+size_t fabricdb_get_soft_heap_limit();
+
+/**
+ * Returns 1 if the library is over its soft heap limit.
+ *
+ * This is cheap while the library is under the limit, as only the last
+ * sample is looked at.  Once a sample found it over, the memory in use
+ * is added up again so the answer changes as soon as memory is freed.
+ *
+ * @return 1 if memory should be released, 0 otherwise.
+ */
+int fabricdb_mem_over_limit();
+
+/**
+ * Sets up an empty arena.  No memory is allocated until the first
+ * allocation.
+ *
+ * @param arena The arena to set up.
+ * @param blockSize The usable size of each block, or 0 for the default.
+ * @param tag The FDB_MEM_* tag the arena's blocks are counted against.
+ * @return void
+ */
+void fabricdb_arena_init(FdbArena *arena, size_t blockSize, int tag);
+
+/**
+ * Allocates memory from an arena.
+ *
+ * The memory is 8 byte aligned and stays valid until the arena is
+ * reset or freed; it can not be passed to fabricdb_free().  An
+ * allocation that does not fit in the current block gets a block of
+ * its own if it is more than a quarter of a block, and starts a new
+ * current block otherwise.
+ *
+ * @param arena The arena to allocate from.
+ * @param num_bytes The number of bytes to allocate.
+ * @return A pointer to the allocated memory or NULL on failure.
+ */
+void *fabricdb_arena_alloc(FdbArena *arena, size_t num_bytes);
+
+/**
+ * Frees everything allocated from an arena at once.  One block is kept
+ * for the allocations that come after, so an arena that is reset after
+ * every query does not go back to malloc once it has warmed up.
+ *
+ * @param arena The arena to reset.
+ * @return void
+ */
+void fabricdb_arena_reset(FdbArena *arena);
+
+/**
+ * Frees all of an arena's memory, including the block reset keeps.
+ *
+ * @param arena The arena to free.
+ * @return void
+ */
+void fabricdb_arena_free(FdbArena *arena);
+
+/**
+ * Returns the calling thread's scratch arena, setting it up on first
+ * use.  Its blocks are counted against FDB_MEM_SCRATCH.  Whoever uses
+ * it resets it when done, and a thread that used it calls
+ * fabricdb_arena_thread_free() before it exits.
+ *
+ * @return The calling thread's arena.
+ */
+FdbArena *fabricdb_arena_thread();
+
+/**
+ * Frees the calling thread's scratch arena.
+ *
+ * @return void
+ */
+void fabricdb_arena_thread_free();
+
+/**
+ * Allocates a small fixed-size object from the object pool.
+ *
+ * Objects of up to 256 bytes are carved out of slabs shared by every
+ * object of the same size class, with no size prefix, and each thread
+ * keeps a few free objects of each class so most allocations and frees
+ * take no lock.  Objects are counted at the size of their class; the
+ * free objects the pool holds are not counted.  Larger objects are
+ * passed on to fabricdb_malloc_tagged().
+ *
+ * @param num_bytes The size of the object.
+ * @param tag One of the FDB_MEM_* tags.
+ * @return A pointer to the object or NULL on failure.
+ */
+void *fabricdb_obj_alloc(size_t num_bytes, int tag);
+
+/**
+ * Returns an object to the object pool.  Any thread may free an object.
+ *
+ * @param ptr An object returned by fabricdb_obj_alloc(), or NULL.
+ * @param num_bytes The size it was allocated with.
+ * @param tag The tag it was allocated with.
+ * @return void
+ */
+void fabricdb_obj_free(void *ptr, size_t num_bytes, int tag);
+
 /** Shorthand macros for common memory functions */
 #define fdbmalloc(n) fabricdb_malloc(n)
 #define fdbmalloczero(n) fabricdb_malloc_zero(n)
+#define fdbmalloctag(n,t) fabricdb_malloc_tagged(n,t)
+#define fdbmalloczerotag(n,t) fabricdb_malloc_zero_tagged(n,t)
 #define fdbrealloc(p,n) fabricdb_realloc(p,n)
 #define fdbrealloczero(p,n) fabricdb_realloc_zero(p,n)
 #define fdbfree(p) fabricdb_free(p)
+#define fdbobjalloc(n,t) fabricdb_obj_alloc(n,t)
+#define fdbobjfree(p,n,t) fabricdb_obj_free(p,n,t)
 
 #endif /* __FABRICDB_MEM_H */
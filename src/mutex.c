@@ -16,17 +16,25 @@
  *
  ******************************************************************/
 
+/* Needed for recursive mutexes and clock_gettime */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <time.h>
 
+#include "mem.h"
 #include "mutex.h"
 
-typedef struct FdbMutex {
+struct FdbMutex {
     pthread_mutex_t mutex;
+    pthread_cond_t cond;     /* Signalled by fdb_notify_mutex */
     int refCount;
     pthread_t owner;
-} FdbMutex;
+};
 
 static int mutexes_initialized = 0;
 static FdbMutex mutexes[FDB_MUTEX_COUNT];
@@ -45,6 +53,7 @@ void fdb_init_mutexes() {
 
     for(i = 0; i < FDB_MUTEX_COUNT; i++) {
         pthread_mutex_init(&(mutexes[i].mutex), &attr);
+        pthread_cond_init(&(mutexes[i].cond), NULL);
         mutexes[i].refCount = 0;
         mutexes[i].owner = 0;
     }
@@ -64,6 +73,7 @@ void fdb_enter_mutex(int mutexId) {
 
     rc = pthread_mutex_lock(&(m->mutex));
     assert(rc == 0);
+    (void)rc;
 
     if (m->refCount > 0 && m->owner == self) {
         /* Simply increment the count */
@@ -79,15 +89,81 @@ void fdb_leave_mutex(int mutexId) {
     assert(mutexes_initialized);
     assert(mutexId < FDB_MUTEX_COUNT);
 
-    pthread_t self = pthread_self();
     FdbMutex *m = &(mutexes[mutexId]);
 
-    assert(m->owner == self && m->refCount > 0);
+    assert(m->owner == pthread_self() && m->refCount > 0);
     m->refCount--;
     pthread_mutex_unlock(&m->mutex);
 
 }
 
+int fdb_wait_mutex(int mutexId, uint64_t timeoutUs) {
+    int rc;
+    struct timespec deadline;
+    assert(mutexes_initialized);
+    assert(mutexId < FDB_MUTEX_COUNT);
+
+    pthread_t self = pthread_self();
+    FdbMutex *m = &(mutexes[mutexId]);
+
+    /* A recursive mutex is only released by the wait if it was
+       entered once */
+    assert(m->owner == self && m->refCount == 1);
+    m->refCount = 0;
+
+    if (timeoutUs == 0) {
+        rc = pthread_cond_wait(&m->cond, &m->mutex);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)(timeoutUs / 1000000);
+        deadline.tv_nsec += (long)(timeoutUs % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        rc = pthread_cond_timedwait(&m->cond, &m->mutex, &deadline);
+    }
+
+    m->owner = self;
+    m->refCount = 1;
+    return rc != ETIMEDOUT;
+}
+
+void fdb_notify_mutex(int mutexId) {
+    assert(mutexes_initialized);
+    assert(mutexId < FDB_MUTEX_COUNT);
+
+    pthread_cond_broadcast(&(mutexes[mutexId].cond));
+}
+
+FdbMutex *fdb_alloc_mutex() {
+    FdbMutex *m = fdbmalloczero(sizeof(FdbMutex));
+
+    if (m != NULL && pthread_mutex_init(&m->mutex, NULL) != 0) {
+        fdbfree(m);
+        m = NULL;
+    }
+
+    return m;
+}
+
+void fdb_free_mutex(FdbMutex *m) {
+    if (m != NULL) {
+        pthread_mutex_destroy(&m->mutex);
+        fdbfree(m);
+    }
+}
+
+void fdb_lock_mutex(FdbMutex *m) {
+    int rc = pthread_mutex_lock(&m->mutex);
+    assert(rc == 0);
+    (void)rc;
+}
+
+void fdb_unlock_mutex(FdbMutex *m) {
+    pthread_mutex_unlock(&m->mutex);
+}
+
 
 #ifdef FABRICDB_TESTING
 #include "../test/test_mutex.c"
@@ -19,10 +19,20 @@
 #ifndef __FABRICDB_MUTEX_H
 #define __FABRICDB_MUTEX_H
 
+#include <stdint.h>
+
 /* Mutex ids */
-#define FDB_INODE_MUTEX 0
+#define FDB_SYNC_MUTEX 0
+
+/* Open files are spread over this many mutexes by their inode, so that
+   connections to different files do not wait for each other */
+#define FDB_INODE_MUTEX_COUNT 32
+#define FDB_INODE_MUTEX(shard) (1 + (shard))
 
-#define FDB_MUTEX_COUNT 1
+#define FDB_MUTEX_COUNT (1 + FDB_INODE_MUTEX_COUNT)
+
+/* A mutex that belongs to a single object rather than the library */
+typedef struct FdbMutex FdbMutex;
 
 /**
  * This method must be called to initialize
@@ -52,9 +62,56 @@ void fdb_enter_mutex(int mutexId);
  */
 void fdb_leave_mutex(int mutexId);
 
+/**
+ * Leave a mutex, wait to be notified and enter it again.
+ *
+ * The calling thread must have entered the mutex exactly once.  A
+ * thread may wake without being notified, so callers should check the
+ * condition they are waiting for in a loop.
+ *
+ * @param mutexId The mutex to wait on.
+ * @param timeoutUs The longest time to wait in microseconds, or 0 to
+ *        wait until notified.
+ * @return 0 if the wait timed out, 1 otherwise.
+ */
+int fdb_wait_mutex(int mutexId, uint64_t timeoutUs);
+
+/**
+ * Wakes every thread waiting on a mutex.
+ *
+ * The calling thread should have entered the mutex.
+ */
+void fdb_notify_mutex(int mutexId);
+
 /**
  * Returns 1 if the current thread has the mutex, 0 otherwise.
  */
 // int fdb_has_mutex(int mutexId);
 
+/**
+ * Creates a mutex for an object that is shared between threads.
+ *
+ * Unlike the library mutexes it may not be entered again by the thread
+ * that holds it, which keeps entering and leaving it cheap.
+ *
+ * @return The new mutex, or NULL if there is not enough memory.
+ */
+FdbMutex *fdb_alloc_mutex();
+
+/**
+ * Destroys a mutex created with fdb_alloc_mutex().  Nothing may hold it.
+ */
+void fdb_free_mutex(FdbMutex *mutex);
+
+/**
+ * Blocks until the calling thread holds a mutex created with
+ * fdb_alloc_mutex().
+ */
+void fdb_lock_mutex(FdbMutex *mutex);
+
+/**
+ * Releases a mutex created with fdb_alloc_mutex().
+ */
+void fdb_unlock_mutex(FdbMutex *mutex);
+
 #endif /* __FABRICDB_MUTEX_H */
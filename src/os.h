@@ -19,9 +19,29 @@
 #ifndef __FABRICDB_OS_H
 #define __FABRICDB_OS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct FileHandle FileHandle;
+typedef struct ShmHandle ShmHandle;
+typedef struct FdbIoQueue FdbIoQueue;
+
+/* Hints about how a range of a file is about to be used */
+#define FDB_ADVISE_NORMAL 0
+#define FDB_ADVISE_SEQUENTIAL 1
+#define FDB_ADVISE_WILLNEED 2
+
+/* One buffer of a vectored read or write */
+typedef struct FdbIoVec {
+    uint8_t *base;
+    size_t len;
+} FdbIoVec;
+
+/* How an asynchronous request turned out */
+typedef struct FdbIoCompletion {
+    uint64_t tag;            /* The tag the request was queued with */
+    int rc;                  /* FABRICDB_OK or the error the request hit */
+} FdbIoCompletion;
 
 #define FDB_NO_LOCK 0
 #define FDB_SHARED_LOCK 1
@@ -29,15 +49,47 @@ typedef struct FileHandle FileHandle;
 #define FDB_PENDING_LOCK 3
 #define FDB_EXCLUSIVE_LOCK 4
 
+/* Shared memory lock types */
+#define FDB_SHM_UNLOCK 0
+#define FDB_SHM_SHARED 1
+#define FDB_SHM_EXCLUSIVE 2
+
 int fdb_open_file_rdwr(const char *filepath, FileHandle **fhp);
 int fdb_open_file_rdonly(const char *filepath, FileHandle **fhp);
 int fdb_create_file(const char *filepath, FileHandle **fhp);
+int fdb_open_or_create_file(const char *filepath, FileHandle **fhp);
 int fdb_close_file(FileHandle *fh);
+void fdb_enter_file_mutex(FileHandle *fh);
+void fdb_leave_file_mutex(FileHandle *fh);
+void *fdb_get_file_data(FileHandle *fh);
+void fdb_set_file_data(FileHandle *fh, void *data);
 int fdb_truncate_file(FileHandle *fh, off_t size);
 int fdb_file_size(FileHandle *fh, off_t *out);
 int fdb_read(FileHandle *fh, uint8_t *dest, off_t offset, size_t num_bytes);
+int fdb_readv(FileHandle *fh, FdbIoVec *vecs, int count, off_t offset);
+int fdb_advise(FileHandle *fh, off_t offset, off_t len, int advice);
+int fdb_punch_hole(FileHandle *fh, off_t offset, off_t len);
 int fdb_write(FileHandle *fh, uint8_t *content, off_t offset, size_t num_bytes);
+int fdb_writev(FileHandle *fh, FdbIoVec *vecs, int count, off_t offset);
 int fdb_sync(FileHandle *fh);
+int fdb_datasync(FileHandle *fh);
+uint64_t fdb_sync_ticket(FileHandle *fh);
+int fdb_group_sync(FileHandle *fh, uint64_t ticket, uint32_t maxDelayUs, uint32_t maxBatch);
+uint64_t fdb_sync_count(FileHandle *fh);
+#ifdef FABRICDB_TESTING
+void fdb_set_sync_fault(FileHandle *fh, int rc);
+#endif
+int fdb_ioqueue_open(uint32_t depth, FdbIoQueue **queuep);
+void fdb_ioqueue_close(FdbIoQueue *queue);
+int fdb_ioqueue_is_async(FdbIoQueue *queue);
+uint32_t fdb_ioqueue_space(FdbIoQueue *queue);
+int fdb_read_async(FdbIoQueue *queue, FileHandle *fh, FdbIoVec *vecs, int count, off_t offset, uint64_t tag);
+int fdb_write_async(FdbIoQueue *queue, FileHandle *fh, FdbIoVec *vecs, int count, off_t offset, uint64_t tag);
+int fdb_sync_async(FdbIoQueue *queue, FileHandle *fh, uint64_t tag);
+int fdb_ioqueue_submit(FdbIoQueue *queue);
+int fdb_ioqueue_wait(FdbIoQueue *queue, uint32_t minCount, FdbIoCompletion *completions, uint32_t maxCount, uint32_t *countp);
+int fdb_map_file(FileHandle *fh, off_t size, uint8_t **mapp);
+int fdb_unmap_file(uint8_t *map, off_t size);
 
 int fdb_acquire_shared_lock(FileHandle *fh);
 int fdb_acquire_reserved_lock(FileHandle *fh);
@@ -46,5 +98,15 @@ int fdb_unlock(FileHandle *fh);
 int fdb_downgrade_lock(FileHandle *fh);
 int fdb_get_lock_level(FileHandle *fh);
 
+uint64_t fdb_now_us();
+void fdb_sleep_us(uint64_t us);
+
+int fdb_shm_open(const char *filepath, ShmHandle **shmp);
+void fdb_shm_close(ShmHandle *shm);
+int fdb_shm_truncate(ShmHandle *shm);
+int fdb_shm_map(ShmHandle *shm, uint32_t region, size_t regionSize, uint8_t **mapp);
+int fdb_shm_lock(ShmHandle *shm, uint32_t slot, uint32_t count, int lockType);
+void fdb_memory_barrier();
+
 
 #endif /* __FABRICDB_OS_H */
@@ -18,14 +18,24 @@
  *
  ******************************************************************/
 
+/* Needed for pread, pwrite, ftruncate and open file description locks */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
+#include <sched.h>
 
 #include "fabric.h"
 #include "os.h"
@@ -132,6 +142,9 @@ static int fdb_ioerror_from_errno() {
         case ENOMEM:
             fdberrno = FABRICDB_ENOMEM;
             break;
+        case ECANCELED:
+            fdberrno = FABRICDB_ECANCELED;
+            break;
     }
 
     return fdberrno;
@@ -208,12 +221,23 @@ typedef struct InodeInfo {
     int refCount;
     int lockCount;
     UnusedFileHandle *unusedFiles;   /* singley-linked list of unused files */
+    uint64_t syncTickets;            /* Tickets handed out for writes that need syncing */
+    uint64_t syncedTickets;          /* Every ticket up to this one is durable */
+    int syncError;                   /* Set by the first group sync that failed, see fdb_group_sync() */
+    uint64_t syncCount;              /* Number of fdb_datasync calls on the file */
+    uint32_t syncWaiters;            /* Threads waiting in fdb_group_sync */
+    int syncLeader;                  /* 1 while a thread is gathering or running a sync */
+#ifdef FABRICDB_TESTING
+    int syncFault;                   /* Returned by every fdb_datasync on the file, see fdb_set_sync_fault() */
+#endif
+    void *sharedData;                /* Set by the library for every connection to the file */
+    int mutexId;                     /* Guards the fields above, see fdb_inodeinfo_mutex() */
     struct InodeInfo* next;
     struct InodeInfo* prev;
 } InodeInfo;
 
-InodeInfo* fdb_inodeinfo_new(FileId fileId) {
-    InodeInfo* info = fdbmalloc(sizeof(InodeInfo));
+InodeInfo* fdb_inodeinfo_new(FileId fileId, int mutexId) {
+    InodeInfo* info = fdbobjalloc(sizeof(InodeInfo), FDB_MEM_GENERAL);
     if (info == NULL) {
         return NULL;
     }
@@ -224,27 +248,42 @@ InodeInfo* fdb_inodeinfo_new(FileId fileId) {
     info->refCount = 0;
     info->lockCount = 0;
     info->unusedFiles = NULL;
+    info->syncTickets = 0;
+    info->syncedTickets = 0;
+    info->syncError = FABRICDB_OK;
+    info->syncCount = 0;
+    info->syncWaiters = 0;
+    info->syncLeader = 0;
+#ifdef FABRICDB_TESTING
+    info->syncFault = FABRICDB_OK;
+#endif
+    info->sharedData = NULL;
+    info->mutexId = mutexId;
     info->next = NULL;
     info->prev = NULL;
 
     return info;
 }
 
-static InodeInfo* inodeInfoList = NULL;
+/* The inode infos of open files, hashed by FileId into one list per
+   inode mutex.  A list and the inode infos on it are only touched by
+   the thread that holds its mutex. */
+static InodeInfo* inodeInfoLists[FDB_INODE_MUTEX_COUNT];
 
-static int fdb_inodeinfo_fetch(int fd, InodeInfo** iip) {
-    /* The inode info mutex must be held before calling this function */
+static inline uint32_t fdb_fileid_shard(FileId fileId) {
+    uint64_t h = ((uint64_t)fileId.inodeNumber ^ ((uint64_t)fileId.deviceNumber << 32)) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) & (FDB_INODE_MUTEX_COUNT - 1);
+}
 
-    stat_t st;
-    FileId fileId;
-    InodeInfo *info = inodeInfoList;
+static inline int fdb_inodeinfo_mutex(FileId fileId) {
+    return FDB_INODE_MUTEX(fdb_fileid_shard(fileId));
+}
 
-    if (fstat(fd, &st) == -1){
-        return FABRICDB_EIO;
-    }
+static int fdb_inodeinfo_fetch(FileId fileId, InodeInfo** iip) {
+    /* The mutex of the file id must be held before calling this function */
 
-    fileId.deviceNumber = st.st_dev;
-    fileId.inodeNumber = st.st_ino;
+    InodeInfo **list = &inodeInfoLists[fdb_fileid_shard(fileId)];
+    InodeInfo *info = *list;
 
     while(info != NULL) {
         if (
@@ -259,15 +298,15 @@ static int fdb_inodeinfo_fetch(int fd, InodeInfo** iip) {
     }
 
     /* The inode info wasn't found, so we make a new one. */
-    info = fdb_inodeinfo_new(fileId);
+    info = fdb_inodeinfo_new(fileId, fdb_inodeinfo_mutex(fileId));
     if (info == NULL) {
         return FABRICDB_ENOMEM;
     }
-    if (inodeInfoList != NULL) {
-        inodeInfoList->prev = info;
+    if (*list != NULL) {
+        (*list)->prev = info;
     }
-    info->next = inodeInfoList;
-    inodeInfoList = info;
+    info->next = *list;
+    *list = info;
 
     *iip = info;
 
@@ -282,8 +321,8 @@ static void fdb_inodeinfo_remove_reference(InodeInfo *info) {
     info->refCount--;
 
     if (info->refCount < 1) {
-        if (inodeInfoList == info) {
-            inodeInfoList = info->next;
+        if (inodeInfoLists[fdb_fileid_shard(info->fileId)] == info) {
+            inodeInfoLists[fdb_fileid_shard(info->fileId)] = info->next;
         }
         if (info->next != NULL) {
             info->next->prev = info->prev;
@@ -292,7 +331,7 @@ static void fdb_inodeinfo_remove_reference(InodeInfo *info) {
             info->prev->next = info->next;
         }
 
-        fdbfree(info);
+        fdbobjfree(info, sizeof(InodeInfo), FDB_MEM_GENERAL);
     }
 }
 
@@ -302,7 +341,7 @@ static void fdb_inodeinfo_close_unused_files(InodeInfo *info) {
     while(ufh != NULL) {
         close(ufh->fd);
         next = ufh->next;
-        fdbfree(ufh);
+        fdbobjfree(ufh, sizeof(UnusedFileHandle), FDB_MEM_GENERAL);
         ufh = next;
     }
 
@@ -325,7 +364,7 @@ static FileHandle* fdb_filehandle_new(int fd, const char* filePath, InodeInfo* i
         return NULL;
     }
 
-    char* filePathCopy = fdbmalloc(strlen(filePath));
+    char* filePathCopy = fdbmalloc(strlen(filePath) + 1);
     if (filePathCopy == NULL) {
         fdbfree(fh);
         return NULL;
@@ -353,6 +392,9 @@ static int fdb_filehandle_open(const char* filePath, int flags, FileHandle **fhp
     *fhp = NULL;
     int rc = FABRICDB_OK;
     int fd = fdb_fd_open(filePath, flags, DEFAULT_FILE_PERMS);
+    int mutexId;
+    stat_t st;
+    FileId fileId;
     FileHandle* fh = NULL;
     if (fd < 0) {
         return fdb_ioerror_from_errno();
@@ -363,12 +405,19 @@ static int fdb_filehandle_open(const char* filePath, int flags, FileHandle **fhp
         return FABRICDB_EINVALID_FILE;
     }
 
+    if (fstat(fd, &st) == -1){
+        close(fd);
+        return FABRICDB_EIO;
+    }
+    fileId.deviceNumber = st.st_dev;
+    fileId.inodeNumber = st.st_ino;
 
     /* Secure the inode info mutex */
-    fdb_enter_mutex(FDB_INODE_MUTEX);
+    mutexId = fdb_inodeinfo_mutex(fileId);
+    fdb_enter_mutex(mutexId);
 
     /* Determine the inode structure */
-    rc = fdb_inodeinfo_fetch(fd, &info);
+    rc = fdb_inodeinfo_fetch(fileId, &info);
     if (rc != FABRICDB_OK) {
         goto filehandle_open_done;
     }
@@ -385,11 +434,35 @@ static int fdb_filehandle_open(const char* filePath, int flags, FileHandle **fhp
     fh->inodeInfo = info;
 
     filehandle_open_done:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(mutexId);
     *fhp = fh;
     return rc;
 }
 
+/******************************************************************
+ * SHARED DATA
+ *
+ * Every handle the process has open on a file can reach one pointer
+ * that belongs to the file rather than the handle.  The caller holds
+ * the file's mutex while it reads or sets the pointer, and clears it
+ * before the last handle on the file is closed.
+ ******************************************************************/
+void fdb_enter_file_mutex(FileHandle *fh) {
+    fdb_enter_mutex(fh->inodeInfo->mutexId);
+}
+
+void fdb_leave_file_mutex(FileHandle *fh) {
+    fdb_leave_mutex(fh->inodeInfo->mutexId);
+}
+
+void *fdb_get_file_data(FileHandle *fh) {
+    return fh->inodeInfo->sharedData;
+}
+
+void fdb_set_file_data(FileHandle *fh, void *data) {
+    fh->inodeInfo->sharedData = data;
+}
+
 /******************************************************************
  * PUBLIC FILE OPS API
  ******************************************************************/
@@ -405,6 +478,10 @@ int fdb_create_file(const char *filePath, FileHandle **fhp) {
     return fdb_filehandle_open(filePath, O_RDWR|O_CREAT|O_EXCL, fhp);
 }
 
+int fdb_open_or_create_file(const char *filePath, FileHandle **fhp) {
+    return fdb_filehandle_open(filePath, O_RDWR|O_CREAT, fhp);
+}
+
 int fdb_close_file(FileHandle *fh) {
     /* It may not be correct to actually close the file immediately
        since it can screw with the file locks held by the process.
@@ -417,20 +494,21 @@ int fdb_close_file(FileHandle *fh) {
     int fd = fh->fd;
     UnusedFileHandle *ufh;
     InodeInfo *info = fh->inodeInfo;
+    int mutexId = info->mutexId;
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
+    fdb_enter_mutex(mutexId);
 
     if (info->lockCount < 1) {
         close(fd);
         fdb_filehandle_destroy(fh);
         fdb_inodeinfo_remove_reference(info);
-        fdb_leave_mutex(FDB_INODE_MUTEX);
+        fdb_leave_mutex(mutexId);
         return FABRICDB_OK;
     }
 
-    ufh = fdbmalloc(sizeof(UnusedFileHandle));
+    ufh = fdbobjalloc(sizeof(UnusedFileHandle), FDB_MEM_GENERAL);
     if (ufh == NULL) {
-       fdb_leave_mutex(FDB_INODE_MUTEX);
+       fdb_leave_mutex(mutexId);
        return FABRICDB_ENOMEM;
     }
 
@@ -440,7 +518,7 @@ int fdb_close_file(FileHandle *fh) {
     fdb_filehandle_destroy(fh);
     fdb_inodeinfo_remove_reference(info);
 
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(mutexId);
 
     return FABRICDB_OK;
 }
@@ -502,6 +580,131 @@ int fdb_write(FileHandle *fh, uint8_t *content, off_t offset, size_t num_bytes)
     }
 }
 
+#ifdef IOV_MAX
+#define FDB_IOV_MAX IOV_MAX
+#else
+#define FDB_IOV_MAX 1024
+#endif
+
+/* Writes the buffers back to back starting at offset, in as few
+   system calls as the platform's limit on buffers per call allows. */
+int fdb_writev(FileHandle *fh, FdbIoVec *vecs, int count, off_t offset) {
+    struct iovec iov[FDB_IOV_MAX];
+    ssize_t nWritten;
+    size_t expected;
+    int n;
+    int i;
+
+    while (count > 0) {
+        n = count < FDB_IOV_MAX ? count : FDB_IOV_MAX;
+        expected = 0;
+        for (i = 0; i < n; i++) {
+            iov[i].iov_base = vecs[i].base;
+            iov[i].iov_len = vecs[i].len;
+            expected += vecs[i].len;
+        }
+
+        nWritten = pwritev(fh->fd, iov, n, offset);
+        if (nWritten == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return fdb_ioerror_from_errno();
+        }
+        if ((size_t)nWritten < expected) {
+            return FABRICDB_ESHORTWRITE;
+        }
+
+        vecs += n;
+        count -= n;
+        offset += (off_t)expected;
+    }
+
+    return FABRICDB_OK;
+}
+
+/* Fills the buffers back to back from the file starting at offset.
+   Like fdb_read, running into the end of the file is an error. */
+int fdb_readv(FileHandle *fh, FdbIoVec *vecs, int count, off_t offset) {
+    struct iovec iov[FDB_IOV_MAX];
+    ssize_t nRead;
+    size_t expected;
+    int n;
+    int i;
+
+    while (count > 0) {
+        n = count < FDB_IOV_MAX ? count : FDB_IOV_MAX;
+        expected = 0;
+        for (i = 0; i < n; i++) {
+            iov[i].iov_base = vecs[i].base;
+            iov[i].iov_len = vecs[i].len;
+            expected += vecs[i].len;
+        }
+
+        nRead = preadv(fh->fd, iov, n, offset);
+        if (nRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return fdb_ioerror_from_errno();
+        }
+        if ((size_t)nRead < expected) {
+            return FABRICDB_ESHORTREAD;
+        }
+
+        vecs += n;
+        count -= n;
+        offset += (off_t)expected;
+    }
+
+    return FABRICDB_OK;
+}
+
+/* Tells the operating system how a range of the file is about to be
+   read.  This is only a hint, platforms without posix_fadvise ignore it. */
+int fdb_advise(FileHandle *fh, off_t offset, off_t len, int advice) {
+#if defined(POSIX_FADV_WILLNEED)
+    int flag;
+
+    switch (advice) {
+        case FDB_ADVISE_SEQUENTIAL:
+            flag = POSIX_FADV_SEQUENTIAL;
+            break;
+        case FDB_ADVISE_WILLNEED:
+            flag = POSIX_FADV_WILLNEED;
+            break;
+        default:
+            flag = POSIX_FADV_NORMAL;
+            break;
+    }
+
+    /* posix_fadvise returns the error instead of setting errno */
+    errno = posix_fadvise(fh->fd, offset, len, flag);
+    if (errno != 0) {
+        return fdb_ioerror_from_errno();
+    }
+#endif
+    return FABRICDB_OK;
+}
+
+/* Gives the blocks wholly inside a zero filled range of the file back
+   to the file system.  The range reads as zeros either way, so file
+   systems and platforms without holes simply keep the blocks. */
+int fdb_punch_hole(FileHandle *fh, off_t offset, off_t len) {
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    while (fallocate(fh->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset, len) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            break;
+        }
+        return fdb_ioerror_from_errno();
+    }
+#endif
+    return FABRICDB_OK;
+}
+
 int fdb_sync(FileHandle *fh) {
     while(fsync(fh->fd) == -1) {
         if (errno == EINTR) {
@@ -513,6 +716,691 @@ int fdb_sync(FileHandle *fh) {
     return FABRICDB_OK;
 }
 
+/* Like fdb_sync, but metadata that is not needed to read the file
+   back (such as the modification time) is not flushed.  Every call is
+   counted in the file's fdb_sync_count(). */
+int fdb_datasync(FileHandle *fh) {
+    int rc = FABRICDB_OK;
+
+#if defined(__APPLE__)
+    rc = fdb_sync(fh);
+#else
+    while(fdatasync(fh->fd) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        rc = fdb_ioerror_from_errno();
+        break;
+    }
+#endif
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    fh->inodeInfo->syncCount++;
+#ifdef FABRICDB_TESTING
+    if (fh->inodeInfo->syncFault != FABRICDB_OK) {
+        rc = fh->inodeInfo->syncFault;
+    }
+#endif
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    return rc;
+}
+
+#ifdef FABRICDB_TESTING
+void fdb_set_sync_fault(FileHandle *fh, int rc) {
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    fh->inodeInfo->syncFault = rc;
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+}
+#endif
+
+/******************************************************************
+ * TIME
+ ******************************************************************/
+uint64_t fdb_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void fdb_sleep_us(uint64_t us) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(us / 1000000);
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        /* Sleep for whatever is left */
+    }
+}
+
+/******************************************************************
+ * GROUP SYNC
+ *
+ * Threads that write to the same file can share one sync.  A thread
+ * takes a ticket once its writes have returned and then waits in
+ * fdb_group_sync until a sync that started after the ticket was taken
+ * has finished.  The first waiter becomes the leader, it waits up to
+ * maxDelayUs for up to maxBatch threads to join and then syncs on
+ * behalf of all of them.  Threads that arrive while the sync is
+ * running are picked up by the next leader.
+ *
+ * A failed sync may have dropped written pages that a later sync would
+ * then report as durable, so the first failure sticks to the file.
+ * Every ticket that was not durable before it fails with that error,
+ * until every handle to the file has been closed.
+ ******************************************************************/
+uint64_t fdb_sync_ticket(FileHandle *fh) {
+    uint64_t ticket;
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    ticket = ++fh->inodeInfo->syncTickets;
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    return ticket;
+}
+
+int fdb_group_sync(FileHandle *fh, uint64_t ticket, uint32_t maxDelayUs, uint32_t maxBatch) {
+    int rc = FABRICDB_OK;
+    uint64_t target;
+    uint64_t now;
+    uint64_t deadline;
+    InodeInfo *info = fh->inodeInfo;
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    info->syncWaiters++;
+    /* A leader that is gathering a batch wants to know */
+    fdb_notify_mutex(FDB_SYNC_MUTEX);
+
+    while (info->syncedTickets < ticket && info->syncError == FABRICDB_OK) {
+        if (info->syncLeader) {
+            fdb_wait_mutex(FDB_SYNC_MUTEX, 0);
+            continue;
+        }
+
+        info->syncLeader = 1;
+        deadline = fdb_now_us() + maxDelayUs;
+        while (info->syncWaiters < maxBatch && (now = fdb_now_us()) < deadline) {
+            fdb_wait_mutex(FDB_SYNC_MUTEX, deadline - now);
+        }
+
+        /* Every ticket handed out so far belongs to a write that has
+           already returned, so this sync covers it */
+        target = info->syncTickets;
+        fdb_leave_mutex(FDB_SYNC_MUTEX);
+        rc = fdb_datasync(fh);
+        fdb_enter_mutex(FDB_SYNC_MUTEX);
+
+        if (rc != FABRICDB_OK) {
+            info->syncError = rc;
+        } else if (target > info->syncedTickets) {
+            info->syncedTickets = target;
+        }
+        info->syncLeader = 0;
+        fdb_notify_mutex(FDB_SYNC_MUTEX);
+    }
+
+    rc = info->syncedTickets >= ticket ? FABRICDB_OK : info->syncError;
+    info->syncWaiters--;
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    return rc;
+}
+
+uint64_t fdb_sync_count(FileHandle *fh) {
+    uint64_t count;
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    count = fh->inodeInfo->syncCount;
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    return count;
+}
+
+/******************************************************************
+ * ASYNCHRONOUS I/O
+ *
+ * An I/O queue keeps many reads, writes and syncs in flight at once.
+ * Requests are queued, handed over together by fdb_ioqueue_submit and
+ * collected by fdb_ioqueue_wait, each completion carrying the tag its
+ * request was queued with.  At most depth requests may be queued or
+ * in flight or waiting to be collected; queuing more returns
+ * FABRICDB_BUSY until some have been collected.
+ *
+ * On Linux the queue is an io_uring, driven through the raw system
+ * calls.  Where io_uring is not available (old kernels, seccomp
+ * filters, other platforms, or builds with FABRICDB_NO_IO_URING)
+ * fdb_ioqueue_submit runs each request with the blocking calls above,
+ * so callers need only one code path.
+ *
+ * A sync is linked to the requests queued before it since the last
+ * submit or sync: it only starts once they have all succeeded and
+ * fails with FABRICDB_ECANCELED if one of them did not.  Requests
+ * queued after the sync do not wait for it.
+ ******************************************************************/
+#if defined(__linux__) && !defined(FABRICDB_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define FDB_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#define IOQ_READ 0
+#define IOQ_WRITE 1
+#define IOQ_SYNC 2
+
+typedef struct IoRequest {
+    uint64_t tag;
+    FileHandle *fh;
+    struct iovec *iov;       /* Kept until the request finishes */
+    int count;
+    off_t offset;
+    size_t expected;         /* Bytes a read or write has to transfer */
+    uint8_t op;              /* IOQ_READ, IOQ_WRITE or IOQ_SYNC */
+    uint8_t linked;          /* A sync queued later depends on this one */
+    int rc;                  /* Result of a request run synchronously */
+} IoRequest;
+
+struct FdbIoQueue {
+    uint32_t depth;
+    IoRequest *requests;     /* One slot per request the queue can hold */
+    uint32_t *freeSlots;     /* Stack of unused slots */
+    uint32_t freeCount;
+    uint32_t *queued;        /* Slots queued but not submitted, in order */
+    uint32_t queuedCount;
+    uint32_t linkStart;      /* First queued slot the next sync links to */
+    uint32_t *finished;      /* Slots run synchronously, not yet collected */
+    uint32_t finishedHead;
+    uint32_t finishedCount;
+    uint32_t inflight;       /* Submitted but not yet collected */
+    int ringFd;              /* -1 when requests run synchronously */
+#ifdef FDB_HAVE_IO_URING
+    uint8_t *sqRing;
+    uint8_t *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t sqMask;
+    uint32_t *sqArray;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    struct io_uring_cqe *cqes;
+#endif
+};
+
+#ifdef FDB_HAVE_IO_URING
+static void ioqueue_ring_close(FdbIoQueue *queue) {
+    if (queue->sqes != NULL) {
+        munmap(queue->sqes, queue->sqesSize);
+    }
+    if (queue->cqRing != NULL && queue->cqRing != queue->sqRing) {
+        munmap(queue->cqRing, queue->cqRingSize);
+    }
+    if (queue->sqRing != NULL) {
+        munmap(queue->sqRing, queue->sqRingSize);
+    }
+    if (queue->ringFd >= 0) {
+        close(queue->ringFd);
+    }
+    queue->sqes = NULL;
+    queue->sqRing = queue->cqRing = NULL;
+    queue->ringFd = -1;
+}
+
+/* Sets up an io_uring with room for depth requests.  On failure the
+   queue is left to run requests synchronously. */
+static void ioqueue_ring_open(FdbIoQueue *queue) {
+    struct io_uring_params params;
+    void *map;
+    int fd;
+
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, queue->depth, &params);
+    if (fd < 0) {
+        return;
+    }
+    queue->ringFd = fd;
+
+    queue->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    queue->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (queue->cqRingSize > queue->sqRingSize) {
+            queue->sqRingSize = queue->cqRingSize;
+        }
+        queue->cqRingSize = queue->sqRingSize;
+    }
+
+    map = mmap(NULL, queue->sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {
+        ioqueue_ring_close(queue);
+        return;
+    }
+    queue->sqRing = (uint8_t*)map;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        queue->cqRing = queue->sqRing;
+    } else {
+        map = mmap(NULL, queue->cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED) {
+            ioqueue_ring_close(queue);
+            return;
+        }
+        queue->cqRing = (uint8_t*)map;
+    }
+
+    queue->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, queue->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (map == MAP_FAILED) {
+        ioqueue_ring_close(queue);
+        return;
+    }
+    queue->sqes = (struct io_uring_sqe*)map;
+
+    queue->sqHead = (uint32_t*)(queue->sqRing + params.sq_off.head);
+    queue->sqTail = (uint32_t*)(queue->sqRing + params.sq_off.tail);
+    queue->sqMask = *(uint32_t*)(queue->sqRing + params.sq_off.ring_mask);
+    queue->sqArray = (uint32_t*)(queue->sqRing + params.sq_off.array);
+    queue->cqHead = (uint32_t*)(queue->cqRing + params.cq_off.head);
+    queue->cqTail = (uint32_t*)(queue->cqRing + params.cq_off.tail);
+    queue->cqMask = *(uint32_t*)(queue->cqRing + params.cq_off.ring_mask);
+    queue->cqes = (struct io_uring_cqe*)(queue->cqRing + params.cq_off.cqes);
+}
+#endif
+
+int fdb_ioqueue_open(uint32_t depth, FdbIoQueue **queuep) {
+    FdbIoQueue *queue;
+    uint32_t i;
+
+    *queuep = NULL;
+    if (depth == 0) {
+        depth = 1;
+    }
+
+    queue = fdbmalloczero(sizeof(FdbIoQueue));
+    if (queue == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+    queue->depth = depth;
+    queue->ringFd = -1;
+    queue->requests = fdbmalloczero(sizeof(IoRequest) * depth);
+    queue->freeSlots = fdbmalloc(sizeof(uint32_t) * depth);
+    queue->queued = fdbmalloc(sizeof(uint32_t) * depth);
+    queue->finished = fdbmalloc(sizeof(uint32_t) * depth);
+    if (queue->requests == NULL || queue->freeSlots == NULL || queue->queued == NULL || queue->finished == NULL) {
+        fdb_ioqueue_close(queue);
+        return FABRICDB_ENOMEM;
+    }
+
+    /* Pop slots from the bottom up so the lowest is used first */
+    for (i = 0; i < depth; i++) {
+        queue->freeSlots[i] = depth - 1 - i;
+    }
+    queue->freeCount = depth;
+
+#ifdef FDB_HAVE_IO_URING
+    ioqueue_ring_open(queue);
+#endif
+
+    *queuep = queue;
+    return FABRICDB_OK;
+}
+
+/* Closes the queue.  Requests still in flight are waited for first,
+   their buffers may not be released before then. */
+void fdb_ioqueue_close(FdbIoQueue *queue) {
+    FdbIoCompletion completion;
+    uint32_t count;
+    uint32_t i;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    if (queue->requests != NULL) {
+        while (queue->inflight > 0) {
+            if (fdb_ioqueue_wait(queue, 1, &completion, 1, &count) != FABRICDB_OK) {
+                break;
+            }
+        }
+        for (i = 0; i < queue->depth; i++) {
+            fdbfree(queue->requests[i].iov);
+        }
+    }
+
+#ifdef FDB_HAVE_IO_URING
+    ioqueue_ring_close(queue);
+#endif
+
+    fdbfree(queue->requests);
+    fdbfree(queue->freeSlots);
+    fdbfree(queue->queued);
+    fdbfree(queue->finished);
+    fdbfree(queue);
+}
+
+/* Whether requests really run in the background, rather than one
+   after the other inside fdb_ioqueue_submit. */
+int fdb_ioqueue_is_async(FdbIoQueue *queue) {
+    return queue->ringFd >= 0;
+}
+
+/* Number of requests that can be queued before some must be collected */
+uint32_t fdb_ioqueue_space(FdbIoQueue *queue) {
+    return queue->freeCount;
+}
+
+static int ioqueue_add(FdbIoQueue *queue, uint8_t op, FileHandle *fh, FdbIoVec *vecs, int count, off_t offset, uint64_t tag) {
+    IoRequest *req;
+    uint32_t slot;
+    int i;
+
+    if (count < 0 || count > FDB_IOV_MAX) {
+        return FABRICDB_EINVAL;
+    }
+    if (queue->freeCount == 0) {
+        return FABRICDB_BUSY;
+    }
+
+    slot = queue->freeSlots[queue->freeCount - 1];
+    req = &queue->requests[slot];
+    req->iov = NULL;
+    if (count > 0) {
+        req->iov = fdbmalloc(sizeof(struct iovec) * count);
+        if (req->iov == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+    }
+
+    req->expected = 0;
+    for (i = 0; i < count; i++) {
+        req->iov[i].iov_base = vecs[i].base;
+        req->iov[i].iov_len = vecs[i].len;
+        req->expected += vecs[i].len;
+    }
+    req->tag = tag;
+    req->fh = fh;
+    req->count = count;
+    req->offset = offset;
+    req->op = op;
+    req->linked = 0;
+    req->rc = FABRICDB_OK;
+
+    queue->freeCount--;
+    queue->queued[queue->queuedCount++] = slot;
+    return FABRICDB_OK;
+}
+
+int fdb_read_async(FdbIoQueue *queue, FileHandle *fh, FdbIoVec *vecs, int count, off_t offset, uint64_t tag) {
+    return ioqueue_add(queue, IOQ_READ, fh, vecs, count, offset, tag);
+}
+
+int fdb_write_async(FdbIoQueue *queue, FileHandle *fh, FdbIoVec *vecs, int count, off_t offset, uint64_t tag) {
+    return ioqueue_add(queue, IOQ_WRITE, fh, vecs, count, offset, tag);
+}
+
+int fdb_sync_async(FdbIoQueue *queue, FileHandle *fh, uint64_t tag) {
+    uint32_t i;
+    int rc;
+
+    rc = ioqueue_add(queue, IOQ_SYNC, fh, NULL, 0, 0, tag);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    for (i = queue->linkStart; i + 1 < queue->queuedCount; i++) {
+        queue->requests[queue->queued[i]].linked = 1;
+    }
+    queue->linkStart = queue->queuedCount;
+
+    return FABRICDB_OK;
+}
+
+/* Runs the queued requests one after the other.  A failure cancels the
+   rest of its link chain, as io_uring would. */
+static void ioqueue_run_sync(FdbIoQueue *queue) {
+    IoRequest *req;
+    FdbIoVec *vecs;
+    int chainFailed = 0;
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < queue->queuedCount; i++) {
+        req = &queue->requests[queue->queued[i]];
+
+        if (chainFailed) {
+            req->rc = FABRICDB_ECANCELED;
+        } else if (req->op == IOQ_SYNC) {
+            req->rc = fdb_sync(req->fh);
+        } else {
+            /* Both layouts match, but fill them in field by field rather
+               than count on it */
+            vecs = fdbmalloc(sizeof(FdbIoVec) * (req->count ? req->count : 1));
+            if (vecs == NULL) {
+                req->rc = FABRICDB_ENOMEM;
+            } else {
+                for (j = 0; j < req->count; j++) {
+                    vecs[j].base = (uint8_t*)req->iov[j].iov_base;
+                    vecs[j].len = req->iov[j].iov_len;
+                }
+                if (req->op == IOQ_READ) {
+                    req->rc = fdb_readv(req->fh, vecs, req->count, req->offset);
+                } else {
+                    req->rc = fdb_writev(req->fh, vecs, req->count, req->offset);
+                }
+                fdbfree(vecs);
+            }
+        }
+
+        if (req->rc != FABRICDB_OK && req->linked) {
+            chainFailed = 1;
+        } else if (!req->linked) {
+            chainFailed = 0;
+        }
+        queue->finished[(queue->finishedHead + queue->finishedCount++) % queue->depth] = queue->queued[i];
+    }
+}
+
+#ifdef FDB_HAVE_IO_URING
+static void ioqueue_prep_sqe(FdbIoQueue *queue, struct io_uring_sqe *sqe, uint32_t slot) {
+    IoRequest *req = &queue->requests[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = req->fh->fd;
+    sqe->user_data = slot;
+    if (req->linked) {
+        sqe->flags = IOSQE_IO_LINK;
+    }
+
+    switch (req->op) {
+        case IOQ_READ:
+            sqe->opcode = IORING_OP_READV;
+            break;
+        case IOQ_WRITE:
+            sqe->opcode = IORING_OP_WRITEV;
+            break;
+        default:
+            sqe->opcode = IORING_OP_FSYNC;
+            return;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)req->iov;
+    sqe->len = (uint32_t)req->count;
+    sqe->off = (uint64_t)req->offset;
+}
+
+static int ioqueue_ring_submit(FdbIoQueue *queue) {
+    uint32_t tail;
+    uint32_t index;
+    uint32_t i;
+    int toSubmit;
+    int n;
+
+    tail = *queue->sqTail;
+    for (i = 0; i < queue->queuedCount; i++) {
+        index = tail & queue->sqMask;
+        ioqueue_prep_sqe(queue, &queue->sqes[index], queue->queued[i]);
+        queue->sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(queue->sqTail, tail, __ATOMIC_RELEASE);
+
+    /* The entries are in the ring now, whatever happens below */
+    toSubmit = (int)queue->queuedCount;
+    while (toSubmit > 0) {
+        n = (int)syscall(__NR_io_uring_enter, queue->ringFd, toSubmit, 0, 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                sched_yield();
+                continue;
+            }
+            return fdb_ioerror_from_errno();
+        }
+        toSubmit -= n;
+    }
+
+    return FABRICDB_OK;
+}
+#endif
+
+int fdb_ioqueue_submit(FdbIoQueue *queue) {
+    int rc = FABRICDB_OK;
+
+    if (queue->queuedCount == 0) {
+        return FABRICDB_OK;
+    }
+
+#ifdef FDB_HAVE_IO_URING
+    if (queue->ringFd >= 0) {
+        rc = ioqueue_ring_submit(queue);
+    } else {
+        ioqueue_run_sync(queue);
+    }
+#else
+    ioqueue_run_sync(queue);
+#endif
+
+    queue->inflight += queue->queuedCount;
+    queue->queuedCount = 0;
+    queue->linkStart = 0;
+    return rc;
+}
+
+/* Hands a finished request back to the caller and frees its slot */
+static void ioqueue_complete(FdbIoQueue *queue, uint32_t slot, int rc, FdbIoCompletion *completion) {
+    IoRequest *req = &queue->requests[slot];
+
+    completion->tag = req->tag;
+    completion->rc = rc;
+
+    fdbfree(req->iov);
+    req->iov = NULL;
+    queue->freeSlots[queue->freeCount++] = slot;
+    queue->inflight--;
+}
+
+#ifdef FDB_HAVE_IO_URING
+static int ioqueue_cqe_result(IoRequest *req, int32_t res) {
+    if (res < 0) {
+        errno = -res;
+        return fdb_ioerror_from_errno();
+    }
+    if (req->op == IOQ_READ && (size_t)res < req->expected) {
+        return FABRICDB_ESHORTREAD;
+    }
+    if (req->op == IOQ_WRITE && (size_t)res < req->expected) {
+        return FABRICDB_ESHORTWRITE;
+    }
+    return FABRICDB_OK;
+}
+#endif
+
+/* Collects up to maxCount finished requests into completions, waiting
+   until at least minCount have finished.  minCount is capped at the
+   number of requests in flight, so the call never waits for a request
+   that was not submitted. */
+int fdb_ioqueue_wait(FdbIoQueue *queue, uint32_t minCount, FdbIoCompletion *completions, uint32_t maxCount, uint32_t *countp) {
+    uint32_t count = 0;
+    uint32_t slot;
+#ifdef FDB_HAVE_IO_URING
+    struct io_uring_cqe *cqe;
+    uint32_t head;
+    uint32_t tail;
+#endif
+
+    *countp = 0;
+    if (minCount > queue->inflight) {
+        minCount = queue->inflight;
+    }
+    if (minCount > maxCount) {
+        minCount = maxCount;
+    }
+
+#ifdef FDB_HAVE_IO_URING
+    while (queue->ringFd >= 0) {
+        head = *queue->cqHead;
+        tail = __atomic_load_n(queue->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail && count < maxCount) {
+            cqe = &queue->cqes[head & queue->cqMask];
+            slot = (uint32_t)cqe->user_data;
+            ioqueue_complete(queue, slot, ioqueue_cqe_result(&queue->requests[slot], cqe->res), &completions[count++]);
+            head++;
+        }
+        __atomic_store_n(queue->cqHead, head, __ATOMIC_RELEASE);
+
+        if (count >= minCount) {
+            *countp = count;
+            return FABRICDB_OK;
+        }
+        if (syscall(__NR_io_uring_enter, queue->ringFd, 0, minCount - count, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            *countp = count;
+            return fdb_ioerror_from_errno();
+        }
+    }
+#endif
+
+    while (queue->finishedCount > 0 && count < maxCount) {
+        slot = queue->finished[queue->finishedHead];
+        queue->finishedHead = (queue->finishedHead + 1) % queue->depth;
+        queue->finishedCount--;
+        ioqueue_complete(queue, slot, queue->requests[slot].rc, &completions[count++]);
+    }
+
+    *countp = count;
+    return FABRICDB_OK;
+}
+
+/* Maps size bytes from the start of the file as a shared, read only
+   view.  The mapping may be larger than the file, but touching a page
+   of the mapping past the end of the file raises SIGBUS. */
+int fdb_map_file(FileHandle *fh, off_t size, uint8_t **mapp) {
+    void *map;
+
+    *mapp = NULL;
+    map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fh->fd, 0);
+    if (map == MAP_FAILED) {
+        return fdb_ioerror_from_errno();
+    }
+
+    *mapp = (uint8_t*)map;
+    return FABRICDB_OK;
+}
+
+int fdb_unmap_file(uint8_t *map, off_t size) {
+    if (munmap(map, (size_t)size) != 0) {
+        return fdb_ioerror_from_errno();
+    }
+
+    return FABRICDB_OK;
+}
+
 /******************************************************************
  * PUBLIC FILE LOCKING ROUTINES
  ******************************************************************/
@@ -528,8 +1416,8 @@ int fdb_acquire_shared_lock(FileHandle *fh) {
         return FABRICDB_OK;
     }
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
     info = fh->inodeInfo;
+    fdb_enter_mutex(info->mutexId);
 
     if (info->lockLevel >= FDB_PENDING_LOCK) {
         rc = FABRICDB_BUSY;
@@ -575,7 +1463,7 @@ int fdb_acquire_shared_lock(FileHandle *fh) {
     }
 
     end_acquire_shared_lock:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(info->mutexId);
     return rc;
 }
 
@@ -592,8 +1480,8 @@ int fdb_acquire_reserved_lock(FileHandle *fh) {
         return FABRICDB_OK;
     }
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
     info = fh->inodeInfo;
+    fdb_enter_mutex(info->mutexId);
 
     if(info->lockLevel >= FDB_RESERVED_LOCK) {
         rc = FABRICDB_BUSY;
@@ -614,7 +1502,7 @@ int fdb_acquire_reserved_lock(FileHandle *fh) {
     }
 
     end_acquire_reserved_lock:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(info->mutexId);
     return rc;
 }
 
@@ -631,8 +1519,8 @@ int fdb_acquire_exclusive_lock(FileHandle *fh) {
         return FABRICDB_OK;
     }
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
     info = fh->inodeInfo;
+    fdb_enter_mutex(info->mutexId);
 
     if (info->lockLevel != fh->lockLevel && info->lockLevel >= FDB_RESERVED_LOCK) {
         rc = FABRICDB_BUSY;
@@ -672,7 +1560,7 @@ int fdb_acquire_exclusive_lock(FileHandle *fh) {
     }
 
     end_acquire_exclusive_lock:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(info->mutexId);
     return rc;
 }
 
@@ -686,8 +1574,8 @@ int fdb_downgrade_lock(FileHandle *fh) {
         return FABRICDB_OK;
     }
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
     info = fh->inodeInfo;
+    fdb_enter_mutex(info->mutexId);
 
     assert(fh->lockLevel == info->lockLevel);
 
@@ -704,7 +1592,7 @@ int fdb_downgrade_lock(FileHandle *fh) {
     info->lockLevel = FDB_SHARED_LOCK;
 
     end_downgrade_lock:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(info->mutexId);
     return rc;
 }
 
@@ -725,8 +1613,8 @@ int fdb_unlock(FileHandle *fh) {
         }
     }
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
     info = fh->inodeInfo;
+    fdb_enter_mutex(info->mutexId);
 
     assert(info->sharedLockCount != 0);
 
@@ -749,7 +1637,7 @@ int fdb_unlock(FileHandle *fh) {
     fh->lockLevel = FDB_NO_LOCK;
 
     // end_unlock:
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(info->mutexId);
     return rc;
 }
 
@@ -757,6 +1645,182 @@ int fdb_get_lock_level(FileHandle *fh) {
     return fh->lockLevel;
 }
 
+/******************************************************************
+ * SHARED MEMORY
+ *
+ * Shared memory is a file that every connection maps read/write.
+ * It is mapped in fixed size regions so that a region never moves
+ * once it is mapped, even when the file grows.
+ *
+ * Locks on shared memory are taken on single bytes past the data
+ * the caller is using (SHM_LOCK_BASE + slot).  Where open file
+ * description locks are available they are used, so that two
+ * connections in the same process exclude each other.  Otherwise
+ * the locks only work between processes.
+ ******************************************************************/
+#define SHM_LOCK_BASE 4096
+
+#ifdef F_OFD_SETLK
+#define SHM_SETLK F_OFD_SETLK
+#else
+#define SHM_SETLK F_SETLK
+#endif
+
+struct ShmHandle {
+    int fd;
+    uint32_t numRegions;   /* Size of the regions array */
+    size_t regionSize;
+    uint8_t **regions;     /* Mapped regions, NULL if not mapped yet */
+};
+
+int fdb_shm_open(const char *filePath, ShmHandle **shmp) {
+    ShmHandle *shm;
+    int fd;
+
+    *shmp = NULL;
+    fd = fdb_fd_open(filePath, O_RDWR|O_CREAT, DEFAULT_FILE_PERMS);
+    if (fd < 0) {
+        return fdb_ioerror_from_errno();
+    }
+    else if (fd < MIN_FILE_DESCRIPTOR) {
+        close(fd);
+        return FABRICDB_EINVALID_FILE;
+    }
+
+    shm = fdbmalloc(sizeof(ShmHandle));
+    if (shm == NULL) {
+        close(fd);
+        return FABRICDB_ENOMEM;
+    }
+
+    shm->fd = fd;
+    shm->numRegions = 0;
+    shm->regionSize = 0;
+    shm->regions = NULL;
+    *shmp = shm;
+
+    return FABRICDB_OK;
+}
+
+/* Unmaps every region and closes the file.  Any locks held through
+   this handle are released. */
+void fdb_shm_close(ShmHandle *shm) {
+    uint32_t i;
+
+    for (i = 0; i < shm->numRegions; i++) {
+        if (shm->regions[i] != NULL) {
+            munmap(shm->regions[i], shm->regionSize);
+        }
+    }
+    fdbfree(shm->regions);
+    close(shm->fd);
+    fdbfree(shm);
+}
+
+/* Empties the file.  This must only be done while no other
+   connection has it mapped, and before this handle maps anything. */
+int fdb_shm_truncate(ShmHandle *shm) {
+    assert(shm->numRegions == 0);
+
+    if (ftruncate(shm->fd, 0) != 0) {
+        return fdb_ioerror_from_errno();
+    }
+    return FABRICDB_OK;
+}
+
+/* Maps region number region (of regionSize bytes), growing the file
+   if it is not big enough yet.  The contents of a new region are
+   zero.  Every call for a handle must use the same regionSize. */
+int fdb_shm_map(ShmHandle *shm, uint32_t region, size_t regionSize, uint8_t **mapp) {
+    stat_t st;
+    off_t minSize;
+    uint8_t **regions;
+    void *map;
+
+    assert(shm->regionSize == 0 || shm->regionSize == regionSize);
+    *mapp = NULL;
+
+    if (region < shm->numRegions && shm->regions[region] != NULL) {
+        *mapp = shm->regions[region];
+        return FABRICDB_OK;
+    }
+
+    if (region >= shm->numRegions) {
+        if (shm->regions == NULL) {
+            regions = fdbmalloc(sizeof(uint8_t*) * (region + 1));
+        } else {
+            regions = fdbrealloc(shm->regions, sizeof(uint8_t*) * (region + 1));
+        }
+        if (regions == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+        memset(regions + shm->numRegions, 0, sizeof(uint8_t*) * (region + 1 - shm->numRegions));
+        shm->regions = regions;
+        shm->numRegions = region + 1;
+    }
+    shm->regionSize = regionSize;
+
+    /* Only ever grow the file, another connection may be using it */
+    minSize = (off_t)regionSize * (region + 1);
+    if (fstat(shm->fd, &st) == -1) {
+        return fdb_ioerror_from_errno();
+    }
+    if (st.st_size < minSize && ftruncate(shm->fd, minSize) != 0) {
+        return fdb_ioerror_from_errno();
+    }
+
+    map = mmap(NULL, regionSize, PROT_READ|PROT_WRITE, MAP_SHARED, shm->fd, (off_t)regionSize * region);
+    if (map == MAP_FAILED) {
+        return fdb_ioerror_from_errno();
+    }
+
+    shm->regions[region] = (uint8_t*)map;
+    *mapp = (uint8_t*)map;
+    return FABRICDB_OK;
+}
+
+/* Locks count slots starting at slot, without waiting.
+   Returns FABRICDB_BUSY if another connection holds a conflicting
+   lock.  Taking a lock on a slot that is already locked through this
+   handle converts it to the new type. */
+int fdb_shm_lock(ShmHandle *shm, uint32_t slot, uint32_t count, int lockType) {
+    struct flock lock;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_whence = SEEK_SET;
+    lock.l_start = SHM_LOCK_BASE + slot;
+    lock.l_len = count;
+    lock.l_pid = 0;
+    switch (lockType) {
+        case FDB_SHM_SHARED:
+            lock.l_type = F_RDLCK;
+            break;
+        case FDB_SHM_EXCLUSIVE:
+            lock.l_type = F_WRLCK;
+            break;
+        default:
+            lock.l_type = F_UNLCK;
+            break;
+    }
+
+    while (fcntl(shm->fd, SHM_SETLK, &lock) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EACCES || errno == EAGAIN) {
+            return FABRICDB_BUSY;
+        }
+        return fdb_ioerror_from_errno();
+    }
+
+    return FABRICDB_OK;
+}
+
+/* Orders memory accesses to shared memory */
+void fdb_memory_barrier() {
+    __sync_synchronize();
+}
+
 #ifdef FABRICDB_TESTING
 #include "../test/test_os_unix.c"
 #endif
@@ -25,13 +25,14 @@
 
 
 #include "byteorder.h"
+#include "crc32c.h"
+#include "lz4.h"
 #include "pager.h"
 #include "os.h"
 #include "mem.h"
 #include "fabric.h"
-#include "ptrmap.h"
-#include "u8array.h"
-#include "u32array.h"
+#include "pagetable.h"
+#include "wal.h"
 
 /*******************************************************************
  * FABRICDB HEADER FORMAT
@@ -57,8 +58,10 @@
  * |  48 |    4 | Default Cache Size
  * |  52 |    1 | Default Auto Vacuum Enabled
  * |  53 |    1 | Default Auto Vacuum Threshold
- * |  54 |    2 | RESERVED / UNUSED
- * |  56 |   46 | Free space for future expansion
+ * |  54 |    1 | Page Checksums Enabled
+ * |  55 |    1 | Page Compression
+ * |  56 |    4 | First Free List Trunk Page
+ * |  60 |   40 | Free space for future expansion
  * +-----+------+--------------------------------
  *******************************************************************/
 #define FDB_FILE_HEADER_SIZE 100
@@ -75,10 +78,61 @@
 #define FDB_DEFAULT_CACHE_SIZE_OFFSET 48
 #define FDB_DEFAULT_AUTO_VACUUM_OFFSET 52
 #define FDB_DEFAULT_AUTO_VACUUM_THRESHOLD_OFFSET 53
+#define FDB_PAGE_CHECKSUMS_OFFSET 54
+#define FDB_COMPRESSION_OFFSET 55
+#define FDB_FREE_TRUNK_OFFSET 56
+
+/* Size of the checksum at the very end of each page */
+#define FDB_CHECKSUM_SIZE 4
+
+/* A compressed page starts with the magic number "FDBZ", the size of
+   the compressed data and a CRC32C of that data, each 4 bytes */
+#define FDB_COMPRESSED_MAGIC 0x5a424446
+#define FDB_COMPRESSED_HEADER_SIZE 12
+
+/* In a compressed file the reserved byte just before the checksum, or
+   the last byte of the page without checksums, records how the page is
+   stored.  A page stored whole has it set, a compressed image never
+   reaches it, so there it reads as zero. */
+#define FDB_STORAGE_FLAG_SIZE 1
+#define FDB_PAGE_STORED_WHOLE 1
+
+/* File system blocks are assumed to be this size when the unused end
+   of a compressed page is turned into a hole */
+#define PAGER_HOLE_ALIGN 4096
 
 #define FDB_MIN_PAGE_SIZE 512
 #define FDB_DEFAULT_PAGE_SIZE 1024
 #define FDB_DEFAULT_CACHE_SIZE 200
+#define FDB_DEFAULT_WAL_AUTO_CHECKPOINT 1000
+#define FDB_DEFAULT_GROUP_COMMIT_DELAY 0
+#define FDB_DEFAULT_GROUP_COMMIT_BATCH 64
+#define FDB_DEFAULT_READ_AHEAD 32
+
+/* The range of delays the default busy handler backs off over, in
+   microseconds */
+#define FDB_BUSY_MIN_DELAY 50
+#define FDB_BUSY_MAX_DELAY 20000
+
+/* The first read-ahead window, and how many misses in a row have to
+   continue a scan before anything is read ahead */
+#define READ_AHEAD_MIN_WINDOW 4
+#define READ_AHEAD_TRIGGER 2
+
+/* Most reads and writes a pager keeps in flight, and most pages one
+   of them carries.  Longer runs are split so that their parts can be
+   serviced in parallel. */
+#define FDB_IO_QUEUE_DEPTH 64
+#define PAGER_MAX_IO_RUN 32
+
+/* File format versions */
+#define FDB_FORMAT_JOURNAL 1
+#define FDB_FORMAT_WAL 2
+
+/* Transaction states */
+#define TXN_NONE 0
+#define TXN_READ 1
+#define TXN_WRITE 2
 
 /*****************************************************************
  * The standard header string that starts every FabricDB file.
@@ -87,501 +141,3918 @@ static const uint8_t HEADER_STRING[16] =
     {'F','a','b','r','i','c','D','B',' ','v','e','r','s',' ','0','1'};
 
 #define VALID_PAGE_SIZE(v) (v >= 512 && v <= 65536)
-#define VALID_FILE_FORMAT_WRITE_VERSION(v) (v == 1)
-#define VALID_FILE_FORMAT_READ_VERSION(v) (v == 1)
+#define VALID_FILE_FORMAT_WRITE_VERSION(v) (v == FDB_FORMAT_JOURNAL || v == FDB_FORMAT_WAL)
+#define VALID_FILE_FORMAT_READ_VERSION(v) (v == FDB_FORMAT_JOURNAL || v == FDB_FORMAT_WAL)
 #define VALID_CACHE_SIZE(v) (1)
 #define PAGER_INITIALIZED(p) (p->dbfh != NULL)
 
+/* Compressed pages can not be used straight from a mapping, and a
+   shared cache can outlive the mapping of any one connection */
+#define PAGER_MAPS_PAGES(p) ((p)->pragma.mmapMode && (p)->pragma.compression == FDB_COMPRESSION_NONE && \
+                             (p)->sharedCache == NULL)
+
+/* The most pages the cache pages are fetched from may hold */
+#define PAGER_CACHE_SIZE(p) ((p)->pageCache == &(p)->localCache ? (p)->pragma.cacheSize : (p)->sharedCache->cacheSize)
+
+/* Little endian integers stored inside pages */
+static inline void pager_put32(uint8_t *dest, uint32_t v) {
+    v = htoleu32(v);
+    memcpy(dest, &v, 4);
+}
+
+static inline uint32_t pager_get32(const uint8_t *src) {
+    uint32_t v;
+    memcpy(&v, src, 4);
+    return letohu32(v);
+}
+
 
 /*****************************************************************
- * Page types.
+ * Frame pool routines.
  *****************************************************************/
-#define HEADER_PAGE 1  /* The type of the first page of the file */
-#define TYPE_PAGE 2    /* A page of type definitions (unused) */
-#define RECORD_PAGE 3  /* A page of record data (unused) */
-#define VERTEX_PAGE 4  /* A page of vertex data */
-#define EDGE_PAGE 5    /* A page of edge data */
-#define SYMBOL_PAGE 6  /* A page of symbol data */
-#define STRING_PAGE 7  /* A page for string data */
-#define DOC_PAGE 8     /* For document data */
-#define ARR_PAGE 9     /* For array data */
-#define IND_PAGE 10    /* For indexes */
-#define P_PAGE   11    /* Keeps track of page types */
-#define CONT_PAGE 12   /* A continuation page */
-#define FREE_PAGE 13   /* A free page */
-
-#define UNUSED_PAGE 0  /* A page that has never been used */
-#define PAGE_TYPE_COUNT 14
+
+/* Page buffers start on an OS page boundary.  Frames are spaced by a
+   multiple of FRAME_STRIDE, so with the usual power of 2 page sizes
+   every buffer is itself page (or at least sector) aligned. */
+#define FRAME_ALIGNMENT 4096
+#define FRAME_STRIDE 64
+
+/* The most frames preallocated when the pool is created and the
+   number of frames in every slab after that. */
+#define FRAMEPOOL_MAX_PREALLOC 1024
+#define FRAMEPOOL_SLAB_FRAMES 64
+
+/* The replacement list a page is on.  Frames in the pool are on none. */
+#define LRU_NONE 0
+#define LRU_PROBATION 1
+#define LRU_PROTECTED 2
+
+static int framepool_add_slab(FramePool *pool, uint32_t numFrames) {
+    FrameSlab *slab;
+    Page *pages;
+    uint8_t *data;
+    uint32_t i;
+    size_t headerSize = sizeof(FrameSlab) + sizeof(Page) * numFrames;
+    size_t dataSize = 0;
+
+    /* A pool with no frame size only hands out Page headers */
+    if (pool->frameSize > 0) {
+        dataSize = FRAME_ALIGNMENT + (size_t)pool->frameSize * numFrames;
+    }
+
+    slab = fdbmalloctag(headerSize + dataSize, FDB_MEM_CACHE);
+    if (slab == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    slab->numFrames = numFrames;
+    slab->numFree = numFrames;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    pages = (Page*)(slab + 1);
+    data = (uint8_t*)(((uintptr_t)slab + headerSize + FRAME_ALIGNMENT - 1) & ~(uintptr_t)(FRAME_ALIGNMENT - 1));
+    /* Push in reverse so frames are handed out in address order */
+    for (i = numFrames; i > 0; i--) {
+        pages[i-1].data = dataSize > 0 ? data + (size_t)pool->frameSize * (i-1) : NULL;
+        pages[i-1].slab = slab;
+        pages[i-1].lruList = LRU_NONE;
+        pages[i-1].lruNext = pool->freeList;
+        pool->freeList = &pages[i-1];
+    }
+    pool->numFrames += numFrames;
+    pool->numFree += numFrames;
+
+    return FABRICDB_OK;
+}
+
+/* Preallocates frames until the pool could fill a cache of cacheSize
+   pages, up to FRAMEPOOL_MAX_PREALLOC frames. */
+static int framepool_reserve(FramePool *pool, uint32_t cacheSize) {
+    int rc = FABRICDB_OK;
+    uint32_t wanted;
+    uint32_t slabFrames;
+
+    wanted = cacheSize < FRAMEPOOL_MAX_PREALLOC ? cacheSize : FRAMEPOOL_MAX_PREALLOC;
+    while (pool->numFrames < wanted && rc == FABRICDB_OK) {
+        slabFrames = wanted - pool->numFrames;
+        if (slabFrames > FRAMEPOOL_SLAB_FRAMES) {
+            slabFrames = FRAMEPOOL_SLAB_FRAMES;
+        }
+        rc = framepool_add_slab(pool, slabFrames);
+    }
+
+    return rc;
+}
+
+/* Sets up a pool for pages of pageSize bytes */
+static int framepool_init(FramePool *pool, uint32_t pageSize, uint32_t cacheSize) {
+    pool->pageSize = pageSize;
+    pool->frameSize = (pageSize + FRAME_STRIDE - 1) & ~(uint32_t)(FRAME_STRIDE - 1);
+    pool->numFrames = 0;
+    pool->numFree = 0;
+    pool->freeList = NULL;
+    pool->slabs = NULL;
+
+    return framepool_reserve(pool, cacheSize);
+}
+
+static void framepool_deinit(FramePool *pool) {
+    FrameSlab *slab = pool->slabs;
+    FrameSlab *next;
+
+    while (slab != NULL) {
+        next = slab->next;
+        fdbfree(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->freeList = NULL;
+    pool->numFrames = 0;
+    pool->numFree = 0;
+}
+
+/* Takes a frame off the free list, growing the pool if it is empty.
+   The contents of the frame's buffer are undefined. */
+static inline Page* framepool_alloc(FramePool *pool) {
+    Page *page;
+
+    if (pool->freeList == NULL) {
+        if (framepool_add_slab(pool, FRAMEPOOL_SLAB_FRAMES) != FABRICDB_OK) {
+            return NULL;
+        }
+    }
+
+    page = pool->freeList;
+    pool->freeList = page->lruNext;
+    pool->numFree--;
+    page->slab->numFree--;
+    return page;
+}
+
+static inline void framepool_release(FramePool *pool, Page *page) {
+    page->lruList = LRU_NONE;
+    page->lruNext = pool->freeList;
+    pool->freeList = page;
+    pool->numFree++;
+    page->slab->numFree++;
+}
+
+/* Frees the slabs whose frames are all on the free list.  Memory goes
+   back a slab at a time, so a cache that evicted pages here and there
+   may not be able to free any.
+   Returns the number of frames freed. */
+static uint32_t framepool_trim(FramePool *pool) {
+    FrameSlab **link;
+    FrameSlab *slab;
+    Page **pageLink;
+    uint32_t freed = 0;
+
+    /* Take the frames of slabs that are about to go off the free list */
+    pageLink = &pool->freeList;
+    while (*pageLink != NULL) {
+        slab = (*pageLink)->slab;
+        if (slab->numFree == slab->numFrames) {
+            *pageLink = (*pageLink)->lruNext;
+        } else {
+            pageLink = &(*pageLink)->lruNext;
+        }
+    }
+
+    link = &pool->slabs;
+    while ((slab = *link) != NULL) {
+        if (slab->numFree == slab->numFrames) {
+            *link = slab->next;
+            pool->numFrames -= slab->numFrames;
+            pool->numFree -= slab->numFrames;
+            freed += slab->numFrames;
+            fdbfree(slab);
+        } else {
+            link = &slab->next;
+        }
+    }
+
+    return freed;
+}
 
 
 /*****************************************************************
  * IO / Paging utility functions
  *****************************************************************/
-static int read_page(FileHandle *fh, uint32_t pageno, uint32_t pagesize, uint32_t usablesize, uint8_t pageType, Page **pagep) {
+static inline void init_page(Page *page, uint32_t pageSize, uint32_t pageno, uint32_t usablesize, uint8_t pageType, uint8_t mapped) {
+    page->pageSize = pageSize;
+    page->usableSize = usablesize;
+    page->pageNo = pageno;
+    page->pageType = pageType;
+    page->dirty = 0;
+    page->refCount = 0;
+    page->lruList = 0;
+    page->mapped = mapped;
+    page->prefetched = 0;
+    page->lruPrev = NULL;
+    page->lruNext = NULL;
+    page->frame = NULL;
+}
+
+static int read_page(FramePool *pool, FileHandle *fh, uint32_t pageno, uint32_t usablesize, uint8_t pageType, Page **pagep) {
     Page *page = NULL;
     int rc;
     *pagep = NULL;
 
-    page = fdbmalloc(sizeof(Page));
+    page = framepool_alloc(pool);
     if (page == NULL) {
         return FABRICDB_ENOMEM;
     }
 
-    page->data = (fdbmalloczero(pagesize));
-    if (page->data == NULL) {
-        fdbfree(page);
+    /* No need to clear the buffer, a short read is an error */
+    rc = fdb_read(fh, page->data, (off_t)(pageno - 1) * pool->pageSize, pool->pageSize);
+    if (rc != FABRICDB_OK) {
+        framepool_release(pool, page);
+        return rc;
+    }
+
+    init_page(page, pool->pageSize, pageno, usablesize, pageType, 0);
+    *pagep = page;
+
+    return FABRICDB_OK;
+}
+
+/* Reads the version of a page held in a frame of the write-ahead log */
+static int read_wal_page(FramePool *pool, Wal *wal, uint32_t frame, uint32_t pageno, uint32_t usablesize, uint8_t pageType, Page **pagep) {
+    Page *page;
+    int rc;
+    *pagep = NULL;
+
+    page = framepool_alloc(pool);
+    if (page == NULL) {
         return FABRICDB_ENOMEM;
     }
 
-    rc = fdb_read(fh, page->data, (pageno - 1) * pagesize, pagesize);
+    rc = fdb_wal_read_frame(wal, frame, page->data);
     if (rc != FABRICDB_OK) {
-        fdbfree(page->data);
-        fdbfree(page);
+        framepool_release(pool, page);
         return rc;
     }
 
-    page->pageSize = pagesize;
-    page->usableSize = usablesize;
-    page->pageNo = pageno;
-    page->pageType = pageType;
-    page->dirty = 0;
-    page->refCount = 0;
+    init_page(page, pool->pageSize, pageno, usablesize, pageType, 0);
     *pagep = page;
 
     return FABRICDB_OK;
 }
 
-static int write_page(FileHandle *fh, Page *page) {
-    return fdb_write(fh, page->data, (page->pageNo - 1) * page->pageSize, page->pageSize);
-}
+/* Creates a zero filled page that is not in the file yet */
+static int new_page(FramePool *pool, uint32_t pageno, uint32_t usablesize, uint8_t pageType, Page **pagep) {
+    Page *page = framepool_alloc(pool);
+    *pagep = NULL;
+    if (page == NULL) {
+        return FABRICDB_ENOMEM;
+    }
 
-static void free_page(Page *page) {
-    fdbfree(page->data);
-    fdbfree(page);
-}
+    memset(page->data, 0, pool->pageSize);
+    init_page(page, pool->pageSize, pageno, usablesize, pageType, 0);
+    *pagep = page;
 
+    return FABRICDB_OK;
+}
 
-/*****************************************************************
- * PageCache routines.
- *****************************************************************/
-static inline int pagecache_create(PageCache *cache, uint32_t size) {
-    cache->count = 0;
-    return ptrmap_set_size(cache, size);
+/* Page checksums take the last FDB_CHECKSUM_SIZE bytes of the space
+   reserved at the end of each page and cover the rest of the page.
+   The page number is folded in so that a page written to the wrong
+   place does not pass either. */
+static uint32_t page_checksum(uint32_t pageNo, uint8_t *data, uint32_t pageSize) {
+    uint32_t v32 = htoleu32(pageNo);
+    uint32_t crc = fdb_crc32c(0, (uint8_t*)&v32, 4);
+    return fdb_crc32c(crc, data, pageSize - FDB_CHECKSUM_SIZE);
 }
 
-static inline int pagecache_has(PageCache *cache, uint32_t pageNo) {
-    return ptrmap_has(cache, pageNo);
+static void stamp_checksum(uint32_t pageNo, uint8_t *data, uint32_t pageSize) {
+    uint32_t v32 = htoleu32(page_checksum(pageNo, data, pageSize));
+    memcpy(data + pageSize - FDB_CHECKSUM_SIZE, &v32, 4);
 }
 
-static inline Page* pagecache_get(PageCache *cache, uint32_t pageNo) {
-    return (Page*)ptrmap_get_or(cache, pageNo, NULL);
+static inline uint32_t storage_flag_offset(Pager *pager, uint32_t pageSize) {
+    return pageSize - FDB_STORAGE_FLAG_SIZE - (pager->pragma.pageChecksums ? FDB_CHECKSUM_SIZE : 0);
 }
 
-static inline int pagecache_put(PageCache *cache, Page *page) {
-    Page *existing = ptrmap_get_or(cache, page->pageNo, NULL);
-    assert(existing == NULL);
-    return ptrmap_set(cache, page->pageNo, page);
+/* Marks a page as stored whole.  A page that is then compressed takes
+   the mark along inside its image, so it is back once it is expanded
+   and the checksum covers it either way. */
+static inline void stamp_storage(Pager *pager, uint8_t *data, uint32_t pageSize) {
+    if (pager->pragma.compression != FDB_COMPRESSION_NONE) {
+        data[storage_flag_offset(pager, pageSize)] = FDB_PAGE_STORED_WHOLE;
+    }
 }
 
-static inline uint32_t pagecache_count(PageCache *cache) {
-    return cache->count;
+static inline void stamp_page(Pager *pager, Page *page) {
+    stamp_storage(pager, page->data, page->pageSize);
+    if (pager->pragma.pageChecksums) {
+        stamp_checksum(page->pageNo, page->data, page->pageSize);
+    }
 }
 
-static inline void pagecache_deinit(PageCache *cache) {
-    ptrmap_deinit(cache);
+static int page_is_zero(Page *page) {
+    uint32_t i;
+    for (i = 0; i < page->pageSize; i++) {
+        if (page->data[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-static inline int pagecache_clear(PageCache *cache) {
-    /* Free the pages */
-    uint32_t index;
-    ptrmap_entry* current;
+/* Checks a page that was just read against its checksum.  A page
+   inside the file that nothing has written yet reads back as zeros
+   and has no checksum, so it passes too. */
+static int verify_page(Pager *pager, Page *page) {
+    uint32_t stored;
 
-    index = 0;
-    if (!cache) {
+    if (!pager->pragma.pageChecksums || !pager->pragma.verifyChecksums) {
         return FABRICDB_OK;
     }
 
-    while(index < cache->size) {
-        current = cache->items[index];
-        while (current != NULL) {
-            if (current->value) {
-                free_page(current->value);
-                current->value = NULL;
-            }
-            current = current->next;
-        }
-        index++;
+    memcpy(&stored, page->data + page->pageSize - FDB_CHECKSUM_SIZE, 4);
+    stored = letohu32(stored);
+    if (stored == page_checksum(page->pageNo, page->data, page->pageSize)) {
+        return FABRICDB_OK;
     }
+    if (stored == 0 && page_is_zero(page)) {
+        return FABRICDB_OK;
+    }
+    return FABRICDB_ECHECKSUM;
+}
 
-    return ptrmap_reinit(cache, cache->size);
+/* One page of scratch space, allocated the first time it is needed */
+static uint8_t *pager_scratch(Pager *pager) {
+    if (pager->compressBuffer == NULL) {
+        pager->compressBuffer = fdbmalloctag(pager->pageCache->frames.pageSize, FDB_MEM_PAGER);
+    }
+    return pager->compressBuffer;
 }
 
-/*****************************************************************
- * PageTypeCache routines.
- *****************************************************************/
-static int pagetypecache_init(PageTypeCache *cache) {
-    int rc = FABRICDB_OK;
-    int i = 0;
+/* Compresses a page image into out, which has room for one page.
+   Returns the bytes used, header included, or 0 if the page does not
+   shrink by at least an eighth. */
+static uint32_t compress_page_image(uint8_t *data, uint32_t pageSize, uint8_t *out) {
+    uint32_t limit = pageSize - pageSize / 8;
+    uint32_t size;
+    uint32_t v32;
 
-    rc = u8array_set_size(&cache->allPages, 16);
-    /* Do not use the first index since page numbers start with 1 */
-    if (rc == FABRICDB_OK) {
-        u8array_set(&cache->allPages, 0, 0);
-    }
-    while(i < PAGE_TYPE_COUNT && rc == FABRICDB_OK) {
-        rc = u32array_set_size(&(cache->pageTypes[i]), 16);
-        i++;
+    size = fdb_lz4_compress(data, pageSize, out + FDB_COMPRESSED_HEADER_SIZE, limit - FDB_COMPRESSED_HEADER_SIZE);
+    if (size == 0) {
+        return 0;
     }
 
-    return rc;
+    v32 = htoleu32(FDB_COMPRESSED_MAGIC);
+    memcpy(out, &v32, 4);
+    v32 = htoleu32(size);
+    memcpy(out + 4, &v32, 4);
+    v32 = htoleu32(fdb_crc32c(0, out + FDB_COMPRESSED_HEADER_SIZE, size));
+    memcpy(out + 8, &v32, 4);
+
+    return size + FDB_COMPRESSED_HEADER_SIZE;
 }
 
-static void pagetypecache_deinit(PageTypeCache *cache) {
-    int i = 0;
-    u8array_deinit(&cache->allPages);
-    while(i < PAGE_TYPE_COUNT) {
-        u32array_deinit(&(cache->pageTypes[i]));
-        i++;
+/* Expands a compressed page image in place.  An image whose header does
+   not hold up is damaged. */
+static int decompress_page_image(Pager *pager, uint8_t *data, uint32_t pageSize) {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+    uint8_t *scratch;
+
+    memcpy(&magic, data, 4);
+    memcpy(&size, data + 4, 4);
+    memcpy(&crc, data + 8, 4);
+    magic = letohu32(magic);
+    size = letohu32(size);
+    crc = letohu32(crc);
+    if (magic != FDB_COMPRESSED_MAGIC || size > pageSize - FDB_COMPRESSED_HEADER_SIZE ||
+        crc != fdb_crc32c(0, data + FDB_COMPRESSED_HEADER_SIZE, size)) {
+        return FABRICDB_ECORRUPT;
+    }
+
+    scratch = pager_scratch(pager);
+    if (scratch == NULL) {
+        return FABRICDB_ENOMEM;
     }
+    memcpy(scratch, data + FDB_COMPRESSED_HEADER_SIZE, size);
+    return fdb_lz4_decompress(scratch, size, data, pageSize);
 }
 
-static int pagetypecache_put(PageTypeCache* cache, uint32_t pageNo, uint8_t pageType) {
-    u8array_set(&cache->allPages, pageNo, pageType);
-    u32array_push(&cache->pageTypes[pageType], pageNo);
-    cache->dirty = 1;
+/* Expands a page that was just read from the database file, unless it
+   is stored whole.  A page inside the file that nothing has written
+   yet reads back as zeros and is left alone too. */
+static int expand_page(Pager *pager, Page *page) {
+    if (pager->pragma.compression == FDB_COMPRESSION_NONE ||
+        page->data[storage_flag_offset(pager, page->pageSize)] == FDB_PAGE_STORED_WHOLE || page_is_zero(page)) {
+        return FABRICDB_OK;
+    }
+    return decompress_page_image(pager, page->data, page->pageSize);
+}
 
-    return FABRICDB_OK;
+/* The front page is read piecemeal before the pager knows anything
+   about the file, so it is always stored whole */
+static inline int pager_compresses(Pager *pager, uint32_t pageNo) {
+    return pager->pragma.compression != FDB_COMPRESSION_NONE && pageNo != 1;
 }
 
-static int pagetypecache_load(PageTypeCache* cache, Pager *pager, Page *page, uint32_t pageNo, off_t offset) {
-    uint32_t pageSize;
-    off_t beginOffset;
-    uint8_t type;
-    int rc = FABRICDB_OK;
+/* Hands the blocks after the compressed image of a page back to the
+   file system.  They were written as zeros, so this only saves space. */
+static int punch_page_tail(Pager *pager, Page *page, uint32_t used) {
+    off_t pageStart = (off_t)(page->pageNo - 1) * page->pageSize;
+    off_t start = (pageStart + used + PAGER_HOLE_ALIGN - 1) / PAGER_HOLE_ALIGN * PAGER_HOLE_ALIGN;
+    off_t end = (pageStart + page->pageSize) / PAGER_HOLE_ALIGN * PAGER_HOLE_ALIGN;
 
-    pageSize = page->pageSize;
-    beginOffset = offset;
+    if (end <= start) {
+        return FABRICDB_OK;
+    }
+    return fdb_punch_hole(pager->dbfh, start, end - start);
+}
 
-    while(offset < pageSize) {
-        type = *(page->data + offset);
-        pagetypecache_put(cache, pageNo, type);
-        if (type == P_PAGE) {
-            /* read the next page type page */
-            assert(offset+1 == page->usableSize);
-            rc = read_page(pager->dbfh, pageNo, pageSize, page->usableSize, type, &page);
-            if (rc != FABRICDB_OK) {
-                return rc;
-            }
-            rc = pagetypecache_load(cache, pager, page, pageNo+1, 0);
-            free_page(page);
-            break;
-        } else if (type == UNUSED_PAGE) {
-            /* we have loaded all the used pages */
-            cache->dirty = 0;
-            break;
+static int write_page(Pager *pager, Page *page) {
+    int rc;
+    uint8_t *data = page->data;
+    uint8_t *scratch;
+    uint32_t used = 0;
+
+    stamp_page(pager, page);
+    if (pager_compresses(pager, page->pageNo) && (scratch = pager_scratch(pager)) != NULL) {
+        used = compress_page_image(page->data, page->pageSize, scratch);
+        if (used > 0) {
+            memset(scratch + used, 0, page->pageSize - used);
+            data = scratch;
         }
-        offset++;
-        pageNo++;
     }
 
+    rc = fdb_write(pager->dbfh, data, (off_t)(page->pageNo - 1) * page->pageSize, page->pageSize);
+    if (rc == FABRICDB_OK && used > 0) {
+        rc = punch_page_tail(pager, page, used);
+    }
     return rc;
 }
 
-static inline int pagetypecache_get_type(PageTypeCache *cache, uint32_t pageNo) {
-    return u8array_get_or(&cache->allPages, pageNo, UNUSED_PAGE);
+/* The pager's I/O queue, opened the first time it is needed */
+static int pager_ioqueue(Pager *pager, FdbIoQueue **queuep) {
+    int rc;
+
+    if (pager->ioq == NULL) {
+        rc = fdb_ioqueue_open(FDB_IO_QUEUE_DEPTH, &pager->ioq);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    *queuep = pager->ioq;
+    return FABRICDB_OK;
 }
 
+/* Submits the queued requests and waits for every request in flight.
+   Returns the first error any of them hit. */
+static int ioqueue_finish(FdbIoQueue *queue) {
+    int rc = FABRICDB_OK;
+    int waitRc;
+    FdbIoCompletion completions[FDB_IO_QUEUE_DEPTH];
+    uint32_t ncompleted;
+    uint32_t i;
 
+    waitRc = fdb_ioqueue_submit(queue);
+    while (waitRc == FABRICDB_OK) {
+        waitRc = fdb_ioqueue_wait(queue, 1, completions, FDB_IO_QUEUE_DEPTH, &ncompleted);
+        if (waitRc != FABRICDB_OK || ncompleted == 0) {
+            break;
+        }
+        for (i = 0; i < ncompleted; i++) {
+            if (completions[i].rc != FABRICDB_OK && rc == FABRICDB_OK) {
+                rc = completions[i].rc;
+            }
+        }
+    }
 
-/*******************************************************************
- * Pager creation and initialization routines.
- *******************************************************************/
+    return rc == FABRICDB_OK ? waitRc : rc;
+}
 
-int fdb_pager_create(const char* filepath, Pager **pagerp) {
-    *pagerp = NULL;
+/* Writes pages sorted by page number to the database file and syncs
+   it.  Each run of adjacent pages goes out as one vectored write, the
+   writes are kept in flight together and the sync is queued behind
+   them in the same submission, so it starts as soon as the last write
+   lands.  In a compressed file each page that shrinks is written as
+   its compressed image padded with zeros, and the padding is turned
+   into a hole before the sync. */
+static int write_pages(Pager *pager, Page **pages, uint32_t count) {
+    int rc;
+    int finishRc;
+    uint32_t start;
+    uint32_t end;
+    uint32_t i;
+    uint32_t pageSize;
+    FdbIoVec vecs[PAGER_MAX_IO_RUN];
+    FdbIoQueue *queue;
+    uint8_t *images = NULL;
+    uint32_t *used = NULL;
 
-    Pager *pager = fdbmalloczero(sizeof(Pager));
-    if (pager == NULL) {
-        return FABRICDB_ENOMEM;
+    rc = pager_ioqueue(pager, &queue);
+    if (rc != FABRICDB_OK) {
+        return rc;
     }
 
-    /* Copy the file path */
-    size_t path_len = strlen(filepath);
-    char* new_filepath = fdbmalloc(path_len + 1);
-    if (new_filepath == NULL) {
-        fdbfree(pager);
-        return FABRICDB_ENOMEM;
+    /* The images have to stay put until the writes finish */
+    if (pager->pragma.compression != FDB_COMPRESSION_NONE && count > 0) {
+        pageSize = pages[0]->pageSize;
+        images = fdbmalloctag((size_t)pageSize * count, FDB_MEM_PAGER);
+        used = fdbmalloczerotag(sizeof(uint32_t) * count, FDB_MEM_PAGER);
+        if (images == NULL || used == NULL) {
+            fdbfree(images);
+            fdbfree(used);
+            return FABRICDB_ENOMEM;
+        }
+        for (i = 0; i < count; i++) {
+            if (pager_compresses(pager, pages[i]->pageNo)) {
+                used[i] = compress_page_image(pages[i]->data, pageSize, images + (size_t)i * pageSize);
+                memset(images + (size_t)i * pageSize + used[i], 0, pageSize - used[i]);
+            }
+        }
     }
-    memcpy(new_filepath, filepath, path_len);
-    new_filepath[path_len] = '\0';
 
-    pager->filePath = new_filepath;
-    pager->dbfh = NULL;
-    pager->jfh = NULL;
+    for (start = 0; start < count && rc == FABRICDB_OK; start = end) {
+        end = start + 1;
+        while (end < count && end - start < PAGER_MAX_IO_RUN && pages[end]->pageNo == pages[end - 1]->pageNo + 1) {
+            end++;
+        }
+        for (i = start; i < end; i++) {
+            vecs[i - start].base = used != NULL && used[i] > 0 ? images + (size_t)i * pages[i]->pageSize : pages[i]->data;
+            vecs[i - start].len = pages[i]->pageSize;
+        }
 
-    /* Defaults */
-    pager->dbstate.fileChangeCounter = 0;
-    pager->dbstate.filePageCount = 0;
-    pager->dbstate.fileFreePageCount = 0;
-    pager->dbstate.schemaCookie = 0;
+        /* Keep a slot free for the sync */
+        if (fdb_ioqueue_space(queue) <= 1) {
+            rc = ioqueue_finish(queue);
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_write_async(queue, pager->dbfh, vecs, (int)(end - start),
+                                 (off_t)(pages[start]->pageNo - 1) * pages[start]->pageSize, start);
+        }
+    }
 
-    /* Defaults */
-    pager->pragma.applicationId = 0;
-    pager->pragma.applicationVersion = 0;
-    pager->pragma.pageSize = FDB_DEFAULT_PAGE_SIZE;
-    pager->pragma.fileFormatWriteVersion = 1;
-    pager->pragma.fileFormatReadVersion = 1;
-    pager->pragma.bytesReserved = 0;
-    pager->pragma.defCacheSize = FDB_DEFAULT_CACHE_SIZE;
-    pager->pragma.defAutoVacuum = 0;
-    pager->pragma.defAutoVacuumThreshold = 0;
-    pager->pragma.autoVacuum = 0;
-    pager->pragma.autoVacuumThreshold = 0;
-    pager->pragma.cacheSize = FDB_DEFAULT_CACHE_SIZE;
+    /* A hole can only be punched once the zeros are in the file */
+    if (rc == FABRICDB_OK && used != NULL) {
+        rc = ioqueue_finish(queue);
+        for (i = 0; i < count && rc == FABRICDB_OK; i++) {
+            if (used[i] > 0) {
+                rc = punch_page_tail(pager, pages[i], used[i]);
+            }
+        }
+    }
 
-    *pagerp = pager;
+    if (rc == FABRICDB_OK) {
+        rc = fdb_sync_async(queue, pager->dbfh, count);
+    }
 
-    return FABRICDB_OK;
+    /* Writes already queued still have to be waited for after a failure */
+    finishRc = ioqueue_finish(queue);
+    fdbfree(images);
+    fdbfree(used);
+    return rc == FABRICDB_OK ? finishRc : rc;
 }
 
-static int fdb_pager_init_from_file(Pager *pager) {
-    int rc = FABRICDB_OK;
-    Page *front_page = NULL;
-    uint8_t *fp_data;
-    int64_t file_size;
-    uint8_t header_string[16];
-    uint32_t page_size;
-    uint8_t num_reserved_bytes;
+static inline void free_page(FramePool *pool, Page *page) {
+    framepool_release(pool, page);
+}
 
-    page_size = 0;
 
-    /* Make sure the file is at least FABRICDB_MIN_PAGE_SIZE */
-    rc = fdb_file_size(pager->dbfh, &file_size);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+/*****************************************************************
+ * Compressed page tier.
+ *****************************************************************/
+
+static void compressed_cache_drop(CompressedCache *cache, CompressedPage *entry) {
+    if (entry->lruPrev != NULL) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    } else {
+        cache->head = entry->lruNext;
     }
-    if (file_size < FDB_MIN_PAGE_SIZE) {
-        rc = FABRICDB_EINVALID_FILE;
-        goto pager_init_done;
+    if (entry->lruNext != NULL) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    } else {
+        cache->tail = entry->lruPrev;
     }
+    pagetable_remove(&cache->map, entry->pageNo);
+    cache->bytes -= sizeof(CompressedPage) + entry->size;
+    fdbfree(entry);
+}
 
-    /* Verify that the 16 byte header string is valid */
-    rc = fdb_read(pager->dbfh, header_string, 0, 16);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+/* Drops the least recently stored pages until at most limit bytes are used */
+static void compressed_cache_shrink(CompressedCache *cache, uint64_t limit) {
+    while (cache->tail != NULL && cache->bytes > limit) {
+        compressed_cache_drop(cache, cache->tail);
     }
-    if (memcmp(header_string, HEADER_STRING, 16) != 0) {
-        rc = FABRICDB_EINVALID_FILE;
-        goto pager_init_done;
+}
+
+static inline void compressed_cache_clear(CompressedCache *cache) {
+    compressed_cache_shrink(cache, 0);
+}
+
+/* Keeps a compressed copy of a clean page that is being evicted.  This
+   is only an optimisation, a page that can not be kept is dropped. */
+static void compressed_cache_store(Pager *pager, Page *page) {
+    CompressedCache *cache = &pager->compressedCache;
+    CompressedPage *entry;
+    uint8_t *scratch;
+    uint32_t used;
+    uint64_t need;
+
+    if (pager->pragma.compressedCacheSize == 0 || (scratch = pager_scratch(pager)) == NULL) {
+        return;
+    }
+    used = compress_page_image(page->data, page->pageSize, scratch);
+    if (used == 0) {
+        return;
+    }
+    need = sizeof(CompressedPage) + used;
+    if (need > pager->pragma.compressedCacheSize) {
+        return;
     }
 
-    /* Seems to be a valid FabricDB file
-       Get a shared lock and make sure page size is valid */
-    rc = fdb_acquire_shared_lock(pager->dbfh);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+    entry = pagetable_get_or(&cache->map, page->pageNo, NULL);
+    if (entry != NULL) {
+        compressed_cache_drop(cache, entry);
+    }
+    compressed_cache_shrink(cache, pager->pragma.compressedCacheSize - need);
+
+    entry = fdbmalloctag(need, FDB_MEM_CACHE);
+    if (entry == NULL) {
+        return;
+    }
+    if (pagetable_set(&cache->map, page->pageNo, entry) != FABRICDB_OK) {
+        fdbfree(entry);
+        return;
+    }
+    entry->pageNo = page->pageNo;
+    entry->size = used;
+    memcpy(entry->data, scratch, used);
+    entry->lruPrev = NULL;
+    entry->lruNext = cache->head;
+    if (cache->head != NULL) {
+        cache->head->lruPrev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+    cache->bytes += need;
+    cache->stores++;
+}
+
+/* Moves a page held in the tier back into a frame.  *pagep is left
+   NULL if the tier does not have the page. */
+static int compressed_cache_take(Pager *pager, uint32_t pageNo, uint8_t pageType, Page **pagep) {
+    CompressedCache *cache = &pager->compressedCache;
+    CompressedPage *entry;
+    FramePool *pool = &pager->pageCache->frames;
+    Page *page;
+    int rc;
+
+    *pagep = NULL;
+    entry = pagetable_get_or(&cache->map, pageNo, NULL);
+    if (entry == NULL) {
+        return FABRICDB_OK;
+    }
+
+    page = framepool_alloc(pool);
+    if (page == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    /* The stored image was made by compress_page_image, header and all */
+    memcpy(page->data, entry->data, entry->size);
+    rc = decompress_page_image(pager, page->data, pool->pageSize);
+    compressed_cache_drop(cache, entry);
+    if (rc != FABRICDB_OK) {
+        framepool_release(pool, page);
+        return rc;
+    }
+
+    init_page(page, pool->pageSize, pageNo, pager->pragma.pageSize, pageType, 0);
+    cache->hits++;
+    *pagep = page;
+
+    return FABRICDB_OK;
+}
+
+
+/*****************************************************************
+ * PageCache routines.
+ *****************************************************************/
+/* The share of the cache (in percent) that pages that have been
+   referenced more than once are allowed to occupy. */
+#define PROTECTED_CACHE_PERCENT 80
+
+static inline void pagelist_init(PageList *list) {
+    list->head = NULL;
+    list->tail = NULL;
+    list->count = 0;
+}
+
+static inline void pagelist_push(PageList *list, Page *page) {
+    page->lruPrev = NULL;
+    page->lruNext = list->head;
+    if (list->head != NULL) {
+        list->head->lruPrev = page;
+    } else {
+        list->tail = page;
+    }
+    list->head = page;
+    list->count++;
+}
+
+static inline void pagelist_unlink(PageList *list, Page *page) {
+    if (page->lruPrev != NULL) {
+        page->lruPrev->lruNext = page->lruNext;
+    } else {
+        list->head = page->lruNext;
+    }
+    if (page->lruNext != NULL) {
+        page->lruNext->lruPrev = page->lruPrev;
+    } else {
+        list->tail = page->lruPrev;
+    }
+    page->lruPrev = NULL;
+    page->lruNext = NULL;
+    list->count--;
+}
+
+static inline PageList* pagecache_list(PageCacheShard *shard, Page *page) {
+    return page->lruList == LRU_PROTECTED ? &shard->protected : &shard->probation;
+}
+
+/* Most shards a cache can be split into */
+#define PAGECACHE_MAX_SHARDS 64
+
+/* Neighbouring pages are spread over the shards, so a scan does not
+   keep one shard's lock busy */
+static inline PageCacheShard* pagecache_shard(PageCache *cache, uint32_t pageNo) {
+    if (cache->shardBits == 0) {
+        return cache->shards;
+    }
+    return &cache->shards[(pageNo * 2654435761u) >> (32 - cache->shardBits)];
+}
+
+static inline void pagecache_lock(PageCacheShard *shard) {
+    if (shard->lock != NULL) {
+        fdb_lock_mutex(shard->lock);
+    }
+}
+
+static inline void pagecache_unlock(PageCacheShard *shard) {
+    if (shard->lock != NULL) {
+        fdb_unlock_mutex(shard->lock);
+    }
+}
+
+/* Frees the shards and their locks, not the pages in them */
+static void pagecache_free_shards(PageCacheShard *shards, uint32_t numShards) {
+    uint32_t i;
+
+    for (i = 0; shards != NULL && i < numShards; i++) {
+        pagetable_deinit(&shards[i].map);
+        fdb_free_mutex(shards[i].lock);
+    }
+    fdbfree(shards);
+}
+
+/* Makes the shards for a cache of size pages.  numShards is 0 for a
+   cache only one thread uses, which has a single shard and no locks. */
+static int pagecache_make_shards(PageCache *cache, uint32_t size, uint32_t numShards) {
+    PageCacheShard *shards;
+    uint32_t bits = 0;
+    uint32_t count;
+    uint32_t i;
+    int rc = FABRICDB_OK;
+
+    while ((1u << bits) < numShards) {
+        bits++;
+    }
+    count = 1u << bits;
+    shards = fdbmalloczerotag(sizeof(PageCacheShard) * count, FDB_MEM_CACHE);
+    if (shards == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    for (i = 0; i < count && rc == FABRICDB_OK; i++) {
+        pagelist_init(&shards[i].probation);
+        pagelist_init(&shards[i].protected);
+        rc = pagetable_set_size(&shards[i].map, size / count > 0 ? size / count : 1);
+        if (rc == FABRICDB_OK && numShards > 0) {
+            shards[i].lock = fdb_alloc_mutex();
+            rc = shards[i].lock == NULL ? FABRICDB_ENOMEM : FABRICDB_OK;
+        }
+    }
+    if (rc != FABRICDB_OK) {
+        pagecache_free_shards(shards, count);
+        return rc;
+    }
+
+    cache->shards = shards;
+    cache->numShards = count;
+    cache->shardBits = bits;
+    return FABRICDB_OK;
+}
+
+static inline int pagecache_create(PageCache *cache, uint32_t size, uint32_t pageSize, uint32_t numShards) {
+    int rc;
+    cache->shards = NULL;
+    cache->numShards = 0;
+    cache->shardBits = 0;
+    cache->loadLock = NULL;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->prefetches = 0;
+    rc = framepool_init(&cache->frames, pageSize, 0);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    rc = framepool_init(&cache->mapFrames, 0, 0);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    if (numShards > 0) {
+        cache->loadLock = fdb_alloc_mutex();
+        if (cache->loadLock == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+    }
+    return pagecache_make_shards(cache, size, numShards);
+}
+
+static inline int pagecache_has(PageCache *cache, uint32_t pageNo) {
+    PageCacheShard *shard = pagecache_shard(cache, pageNo);
+    int found;
+
+    pagecache_lock(shard);
+    found = pagetable_has(&shard->map, pageNo);
+    pagecache_unlock(shard);
+    return found;
+}
+
+static inline Page* pagecache_get(PageCache *cache, uint32_t pageNo) {
+    PageCacheShard *shard = pagecache_shard(cache, pageNo);
+    Page *page;
+
+    pagecache_lock(shard);
+    page = (Page*)pagetable_get_or(&shard->map, pageNo, NULL);
+    pagecache_unlock(shard);
+    return page;
+}
+
+static inline int pagecache_put(PageCache *cache, Page *page) {
+    int rc;
+    PageCacheShard *shard = pagecache_shard(cache, page->pageNo);
+
+    pagecache_lock(shard);
+    assert(pagetable_get_or(&shard->map, page->pageNo, NULL) == NULL);
+    rc = pagetable_set(&shard->map, page->pageNo, page);
+    if (rc == FABRICDB_OK) {
+        page->lruList = LRU_PROBATION;
+        pagelist_push(&shard->probation, page);
+    }
+    pagecache_unlock(shard);
+    return rc;
+}
+
+/* Returns a page's memory to the pool it came from */
+static void pagecache_free_page(PageCache *cache, Page *page) {
+    if (page->mapped) {
+        if (page->frame != NULL) {
+            free_page(&cache->frames, page->frame);
+        }
+        framepool_release(&cache->mapFrames, page);
+    } else {
+        free_page(&cache->frames, page);
+    }
+}
+
+static inline void pagecache_unlink(PageCacheShard *shard, Page *page) {
+    pagelist_unlink(pagecache_list(shard, page), page);
+    page->lruList = LRU_NONE;
+    pagetable_remove(&shard->map, page->pageNo);
+}
+
+static inline void pagecache_remove(PageCache *cache, Page *page) {
+    PageCacheShard *shard = pagecache_shard(cache, page->pageNo);
+
+    pagecache_lock(shard);
+    pagecache_unlink(shard, page);
+    pagecache_unlock(shard);
+}
+
+/* Records a cache hit on the page.  The first re-reference moves the
+   page from probation to the protected list, any later re-reference
+   moves it to the front of the protected list.  If the protected list
+   grows past its share of the shard, its least recently used page is
+   demoted back to probation. */
+static void pagecache_touch(PageCacheShard *shard, Page *page, uint32_t shardSize) {
+    Page *demoted;
+    uint32_t maxProtected = (uint32_t)(((uint64_t)shardSize * PROTECTED_CACHE_PERCENT) / 100);
+
+    pagelist_unlink(pagecache_list(shard, page), page);
+
+    /* Reading a page ahead is not a reference, so a scan can not push
+       its pages onto the protected list */
+    if (page->prefetched) {
+        page->prefetched = 0;
+        page->lruList = LRU_PROBATION;
+        pagelist_push(&shard->probation, page);
+        return;
+    }
+
+    page->lruList = LRU_PROTECTED;
+    pagelist_push(&shard->protected, page);
+
+    while (shard->protected.count > maxProtected && shard->protected.tail != page) {
+        demoted = shard->protected.tail;
+        pagelist_unlink(&shard->protected, demoted);
+        demoted->lruList = LRU_PROBATION;
+        pagelist_push(&shard->probation, demoted);
+    }
+}
+
+/* The pages each shard may hold */
+static inline uint32_t pagecache_shard_size(PageCache *cache, uint32_t cacheSize) {
+    return (cacheSize + cache->numShards - 1) >> cache->shardBits;
+}
+
+/* Looks a page up, counting and recording a hit if it is there.  The
+   page is pinned if pin is set, before any other thread can evict it. */
+static Page* pagecache_lookup(PageCache *cache, uint32_t pageNo, uint32_t cacheSize, int pin) {
+    PageCacheShard *shard = pagecache_shard(cache, pageNo);
+    Page *page;
+
+    pagecache_lock(shard);
+    page = (Page*)pagetable_get_or(&shard->map, pageNo, NULL);
+    if (page != NULL) {
+        shard->hits++;
+        pagecache_touch(shard, page, pagecache_shard_size(cache, cacheSize));
+        if (pin) {
+            page->refCount++;
+        }
+    }
+    pagecache_unlock(shard);
+    return page;
+}
+
+/* Takes a page that was just read ahead for the fetch that missed it.
+   The miss is not a second reference, so the page stays on probation. */
+static Page* pagecache_claim(PageCache *cache, uint32_t pageNo, int pin) {
+    PageCacheShard *shard = pagecache_shard(cache, pageNo);
+    Page *page;
+
+    pagecache_lock(shard);
+    page = (Page*)pagetable_get_or(&shard->map, pageNo, NULL);
+    if (page != NULL) {
+        page->prefetched = 0;
+        if (pin) {
+            page->refCount++;
+        }
+    }
+    pagecache_unlock(shard);
+    return page;
+}
+
+static inline void pagecache_unpin(PageCache *cache, Page *page) {
+    PageCacheShard *shard = pagecache_shard(cache, page->pageNo);
+
+    pagecache_lock(shard);
+    assert(page->refCount > 0);
+    page->refCount--;
+    pagecache_unlock(shard);
+}
+
+/* Finds the least valuable page in a shard that is not pinned, passing
+   over dirty pages if keepDirty is set.
+   Returns NULL if every page in the shard is pinned. */
+static Page* pagecache_find_victim(PageCacheShard *shard, int keepDirty) {
+    Page *page = shard->probation.tail;
+    while (page != NULL) {
+        if (page->refCount == 0 && !(keepDirty && page->dirty)) {
+            return page;
+        }
+        page = page->lruPrev;
+    }
+
+    page = shard->protected.tail;
+    while (page != NULL) {
+        if (page->refCount == 0 && !(keepDirty && page->dirty)) {
+            return page;
+        }
+        page = page->lruPrev;
+    }
+
+    return NULL;
+}
+
+/* Removes the page to evict from a shard that is full.  Once it is
+   out of the shard no other thread can find and pin it.
+   Returns NULL if the shard has room or every page in it is pinned. */
+static Page* pagecache_take_victim(PageCacheShard *shard, uint32_t shardSize, int keepDirty) {
+    Page *victim = NULL;
+
+    pagecache_lock(shard);
+    if (pagetable_count(&shard->map) >= shardSize) {
+        victim = pagecache_find_victim(shard, keepDirty);
+        if (victim != NULL) {
+            pagecache_unlink(shard, victim);
+        }
+    }
+    pagecache_unlock(shard);
+    return victim;
+}
+
+static inline uint32_t pagecache_count(PageCache *cache) {
+    uint32_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < cache->numShards; i++) {
+        count += pagetable_count(&cache->shards[i].map);
+    }
+    return count;
+}
+
+static inline uint64_t pagecache_hits(PageCache *cache) {
+    uint64_t hits = 0;
+    uint32_t i;
+
+    for (i = 0; i < cache->numShards; i++) {
+        hits += cache->shards[i].hits;
+    }
+    return hits;
+}
+
+/* Frees every page on a list */
+static void pagecache_free_list(PageCache *cache, PageList *list) {
+    Page *current = list->head;
+    Page *next;
+
+    while (current != NULL) {
+        next = current->lruNext;
+        pagecache_free_page(cache, current);
+        current = next;
+    }
+    pagelist_init(list);
+}
+
+static inline void pagecache_deinit(PageCache *cache) {
+    pagecache_free_shards(cache->shards, cache->numShards);
+    cache->shards = NULL;
+    cache->numShards = 0;
+    fdb_free_mutex(cache->loadLock);
+    cache->loadLock = NULL;
+    framepool_deinit(&cache->frames);
+    framepool_deinit(&cache->mapFrames);
+}
+
+static inline int pagecache_clear(PageCache *cache) {
+    PageCacheShard *shard;
+    uint32_t i;
+    int rc = FABRICDB_OK;
+
+    if (!cache || cache->shards == NULL) {
+        return FABRICDB_OK;
+    }
+
+    for (i = 0; i < cache->numShards && rc == FABRICDB_OK; i++) {
+        shard = &cache->shards[i];
+        pagecache_free_list(cache, &shard->probation);
+        pagecache_free_list(cache, &shard->protected);
+        rc = pagetable_reinit(&shard->map, shard->map.size);
+    }
+
+    return rc;
+}
+
+/* Spreads the cached pages over a new set of shards.  Only clean pages
+   are cached outside a transaction, so a page that can not be moved is
+   dropped.  No other thread may use the cache while this runs. */
+static int pagecache_reshard(PageCache *cache, uint32_t size, uint32_t numShards) {
+    PageCacheShard *old = cache->shards;
+    PageCacheShard *shard;
+    uint32_t oldCount = cache->numShards;
+    FdbMutex *loadLock = cache->loadLock;
+    PageList *lists[2];
+    Page *page;
+    uint32_t i;
+    int j;
+    int rc;
+
+    if (numShards > 0 && loadLock == NULL) {
+        loadLock = fdb_alloc_mutex();
+        if (loadLock == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+    }
+    rc = pagecache_make_shards(cache, size, numShards);
+    if (rc != FABRICDB_OK) {
+        if (loadLock != cache->loadLock) {
+            fdb_free_mutex(loadLock);
+        }
+        return rc;
+    }
+
+    for (i = 0; i < oldCount; i++) {
+        lists[0] = &old[i].protected;
+        lists[1] = &old[i].probation;
+        for (j = 0; j < 2; j++) {
+            /* Oldest first, so each list keeps its order */
+            while ((page = lists[j]->tail) != NULL) {
+                pagelist_unlink(lists[j], page);
+                if (pagecache_put(cache, page) != FABRICDB_OK) {
+                    pagecache_free_page(cache, page);
+                } else if (j == 0) {
+                    shard = pagecache_shard(cache, page->pageNo);
+                    pagelist_unlink(&shard->probation, page);
+                    page->lruList = LRU_PROTECTED;
+                    pagelist_push(&shard->protected, page);
+                }
+            }
+        }
+        cache->shards[0].hits += old[i].hits;
+    }
+    pagecache_free_shards(old, oldCount);
+
+    if (numShards == 0) {
+        fdb_free_mutex(loadLock);
+        loadLock = NULL;
+    }
+    cache->loadLock = loadLock;
+    return FABRICDB_OK;
+}
+
+/*****************************************************************
+ * Shared cache routines.
+ *****************************************************************/
+
+/* Joins the cache the other connections to the file share, creating it
+   for the first one.  A shared cache always has locks, as the
+   connections that use it may be on different threads. */
+static int sharedcache_attach(Pager *pager, uint32_t pageSize) {
+    SharedCache *shared;
+    int rc = FABRICDB_OK;
+
+    fdb_enter_file_mutex(pager->dbfh);
+    shared = fdb_get_file_data(pager->dbfh);
+    if (shared == NULL) {
+        shared = fdbmalloczerotag(sizeof(SharedCache), FDB_MEM_CACHE);
+        if (shared == NULL) {
+            rc = FABRICDB_ENOMEM;
+            goto attach_done;
+        }
+        rc = pagecache_create(&shared->cache, pager->pragma.cacheSize, pageSize,
+                              pager->pragma.cacheShards > 0 ? pager->pragma.cacheShards : 1);
+        if (rc != FABRICDB_OK) {
+            pagecache_deinit(&shared->cache);
+            fdbfree(shared);
+            goto attach_done;
+        }
+        shared->cacheSize = pager->pragma.cacheSize;
+        fdb_set_file_data(pager->dbfh, shared);
+    }
+    shared->refCount++;
+    pager->sharedCache = shared;
+    pager->pageCache = &shared->cache;
+
+    attach_done:
+    fdb_leave_file_mutex(pager->dbfh);
+    return rc;
+}
+
+/* Leaves the shared cache, which is freed once no connection uses it */
+static void sharedcache_detach(Pager *pager) {
+    SharedCache *shared = pager->sharedCache;
+
+    if (shared == NULL) {
+        return;
+    }
+
+    fdb_enter_file_mutex(pager->dbfh);
+    if (--shared->refCount == 0) {
+        fdb_set_file_data(pager->dbfh, NULL);
+        pagecache_clear(&shared->cache);
+        pagecache_deinit(&shared->cache);
+        fdbfree(shared);
+    }
+    fdb_leave_file_mutex(pager->dbfh);
+
+    pager->sharedCache = NULL;
+    pager->pageCache = &pager->localCache;
+}
+
+/* Caches a front page that was just read from the file.  If the file
+   has changed since the shared pages were read they are dropped first,
+   which no reader can notice: every connection that started reading
+   since the change had to get here first.  The page is freed if the
+   cache already holds it.  The caller holds the load lock. */
+static int sharedcache_put_front_page(SharedCache *shared, Page *front_page) {
+    int rc = FABRICDB_OK;
+    uint32_t changeCounter = pager_get32(front_page->data + FDB_CHANGE_COUNTER_OFFSET);
+
+    if (changeCounter != shared->fileChangeCounter) {
+        rc = pagecache_clear(&shared->cache);
+        shared->fileChangeCounter = changeCounter;
+    }
+    if (rc == FABRICDB_OK && !pagecache_has(&shared->cache, 1)) {
+        rc = pagecache_put(&shared->cache, front_page);
+        if (rc == FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    free_page(&shared->cache.frames, front_page);
+    return rc;
+}
+
+/* Brings the shared pages up to the version a write transaction has
+   just committed.  Its pages are copied over the shared ones.  The
+   caller holds the exclusive lock on the file, so no connection is
+   reading. */
+static void sharedcache_publish(Pager *pager) {
+    SharedCache *shared = pager->sharedCache;
+    PageCache *local = &pager->localCache;
+    PageList *lists[2];
+    Page *page;
+    Page *cached;
+    uint32_t i;
+    int j;
+
+    fdb_lock_mutex(shared->cache.loadLock);
+    /* Nothing to copy if the transaction did not change anything */
+    for (i = 0; i < local->numShards && pager->dbstate.fileChangeCounter != shared->fileChangeCounter; i++) {
+        lists[0] = &local->shards[i].probation;
+        lists[1] = &local->shards[i].protected;
+        for (j = 0; j < 2; j++) {
+            for (page = lists[j]->head; page != NULL; page = page->lruNext) {
+                cached = pagecache_get(&shared->cache, page->pageNo);
+                if (cached != NULL) {
+                    memcpy(cached->data, page->data, page->pageSize);
+                    cached->pageType = page->pageType;
+                }
+            }
+        }
+    }
+    shared->fileChangeCounter = pager->dbstate.fileChangeCounter;
+    fdb_unlock_mutex(shared->cache.loadLock);
+}
+
+/* Ends a write transaction on a shared cache.  Its pages are dropped
+   and the connection goes back to fetching from the shared cache. */
+static void sharedcache_end_write(Pager *pager) {
+    pagecache_clear(&pager->localCache);
+    pager->pageCache = &pager->sharedCache->cache;
+}
+
+/*****************************************************************
+ * FileMap routines.
+ *****************************************************************/
+static inline void filemap_init(FileMap *map) {
+    map->data = NULL;
+    map->size = 0;
+    map->fileSize = 0;
+    map->retired = NULL;
+}
+
+static void filemap_deinit(FileMap *map) {
+    RetiredMap *retired = map->retired;
+    RetiredMap *next;
+
+    while (retired != NULL) {
+        next = retired->next;
+        fdb_unmap_file(retired->data, retired->size);
+        fdbfree(retired);
+        retired = next;
+    }
+    if (map->data != NULL) {
+        fdb_unmap_file(map->data, map->size);
+    }
+    filemap_init(map);
+}
+
+/* Points every cached page that is read straight from the mapping
+   at the current mapping. */
+static void filemap_repoint(FileMap *map, PageList *list) {
+    Page *page;
+    for (page = list->head; page != NULL; page = page->lruNext) {
+        if (page->mapped && page->frame == NULL) {
+            page->data = map->data + (off_t)(page->pageNo - 1) * page->pageSize;
+        }
+    }
+}
+
+/* Maps at least minSize bytes of the file.  The mapping grows at least
+   geometrically so that a file that is being appended to is not
+   remapped for every new page. */
+static int filemap_grow(Pager *pager, off_t minSize) {
+    int rc;
+    FileMap *map = &pager->fileMap;
+    RetiredMap *retired = NULL;
+    PageCacheShard *shard;
+    uint8_t *data;
+    off_t size = map->size * 2;
+    uint32_t i;
+
+    if (size < minSize) {
+        size = minSize;
+    }
+
+    if (map->data != NULL) {
+        retired = fdbmalloctag(sizeof(RetiredMap), FDB_MEM_PAGER);
+        if (retired == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+    }
+
+    rc = fdb_map_file(pager->dbfh, size, &data);
+    if (rc != FABRICDB_OK) {
+        fdbfree(retired);
+        return rc;
+    }
+
+    if (retired != NULL) {
+        retired->data = map->data;
+        retired->size = map->size;
+        retired->next = map->retired;
+        map->retired = retired;
+    }
+    map->data = data;
+    map->size = size;
+
+    /* The old mapping is retired rather than unmapped, so a reader that
+       still holds a page from it can go on reading */
+    for (i = 0; i < pager->pageCache->numShards; i++) {
+        shard = &pager->pageCache->shards[i];
+        pagecache_lock(shard);
+        filemap_repoint(map, &shard->probation);
+        filemap_repoint(map, &shard->protected);
+        pagecache_unlock(shard);
+    }
+
+    return FABRICDB_OK;
+}
+
+/* Creates a page whose data points into the file map */
+static int map_page(Pager *pager, uint32_t pageNo, uint8_t pageType, Page **pagep) {
+    int rc;
+    Page *page;
+    FileMap *map = &pager->fileMap;
+    uint32_t pageSize = pager->pageCache->frames.pageSize;
+    off_t offset = (off_t)(pageNo - 1) * pageSize;
+
+    *pagep = NULL;
+
+    /* Touching the mapping past the end of the file raises SIGBUS,
+       so fail the same way a short read would. */
+    if (offset + pageSize > map->fileSize) {
+        rc = fdb_file_size(pager->dbfh, &map->fileSize);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        if (offset + pageSize > map->fileSize) {
+            return FABRICDB_ESHORTREAD;
+        }
+    }
+
+    if (offset + pageSize > map->size) {
+        rc = filemap_grow(pager, map->fileSize);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    page = framepool_alloc(&pager->pageCache->mapFrames);
+    if (page == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    init_page(page, pageSize, pageNo, pager->pragma.pageSize, pageType, 1);
+    page->data = map->data + offset;
+    *pagep = page;
+
+    return FABRICDB_OK;
+}
+
+/* Frees a page that was just loaded if it fails its checksum */
+static int pager_verify_loaded(Pager *pager, Page **pagep) {
+    int rc = verify_page(pager, *pagep);
+    if (rc != FABRICDB_OK) {
+        pagecache_free_page(pager->pageCache, *pagep);
+        *pagep = NULL;
+    }
+    return rc;
+}
+
+/* Loads a page as of the current snapshot.  In WAL mode the newest
+   version of a page may be in the log instead of the database file.
+   A write transaction may use pages past the end of the database,
+   they start out zero filled. */
+static int pager_load_page(Pager *pager, uint32_t pageNo, uint8_t pageType, int allowMap, Page **pagep) {
+    int rc;
+    uint32_t frame;
+    FramePool *pool = &pager->pageCache->frames;
+
+    rc = compressed_cache_take(pager, pageNo, pageType, pagep);
+    if (rc != FABRICDB_OK || *pagep != NULL) {
+        return rc;
+    }
+
+    if (pager->wal != NULL && pager->txnState != TXN_NONE) {
+        frame = fdb_wal_find_frame(pager->wal, pageNo);
+        if (frame != 0) {
+            rc = read_wal_page(pool, pager->wal, frame, pageNo, pager->pragma.pageSize, pageType, pagep);
+            return rc == FABRICDB_OK ? pager_verify_loaded(pager, pagep) : rc;
+        }
+    }
+    if (pager->txnState == TXN_WRITE && pageNo > pager->dbstate.filePageCount) {
+        return new_page(pool, pageNo, pager->pragma.pageSize, pageType, pagep);
+    }
+    if (allowMap && PAGER_MAPS_PAGES(pager)) {
+        rc = map_page(pager, pageNo, pageType, pagep);
+    } else {
+        rc = read_page(pool, pager->dbfh, pageNo, pager->pragma.pageSize, pageType, pagep);
+        if (rc == FABRICDB_OK) {
+            rc = expand_page(pager, *pagep);
+            if (rc != FABRICDB_OK) {
+                free_page(pool, *pagep);
+                *pagep = NULL;
+                return rc;
+            }
+        }
+    }
+    if (rc == FABRICDB_OK) {
+        return pager_verify_loaded(pager, pagep);
+    }
+
+    /* In WAL mode the database file only grows at checkpoints.  A page
+       inside the database that no commit has written yet, because a
+       later page was committed first, is not in the log or the file. */
+    if (rc == FABRICDB_ESHORTREAD && pager->wal != NULL && pageNo <= pager->dbstate.filePageCount) {
+        rc = new_page(pool, pageNo, pager->pragma.pageSize, pageType, pagep);
+    }
+    return rc;
+}
+
+
+/*****************************************************************
+ * PageTypeCache routines.
+ *****************************************************************/
+
+/* The page type map starts after the file header on the front page and
+   has one byte per page.  The last byte of each map page describes the
+   next map page, a P_PAGE that continues the map from its first byte,
+   so map pages sit at fixed places in the file. */
+static void typemap_locate(uint32_t usableSize, uint32_t pageNo, uint32_t *mapPageNo, uint32_t *offset) {
+    uint32_t frontPages = usableSize - FDB_FILE_HEADER_SIZE;
+
+    if (pageNo <= frontPages) {
+        *mapPageNo = 1;
+        *offset = FDB_FILE_HEADER_SIZE + pageNo - 1;
+    } else {
+        *mapPageNo = frontPages + (pageNo - frontPages - 1) / usableSize * usableSize;
+        *offset = (pageNo - frontPages - 1) % usableSize;
+    }
+}
+
+static int typemap_is_map_page(uint32_t usableSize, uint32_t pageNo) {
+    uint32_t mapPageNo;
+    uint32_t offset;
+
+    typemap_locate(usableSize, pageNo, &mapPageNo, &offset);
+    return pageNo > 1 && offset == usableSize - 1;
+}
+
+/* Map pages are numbered from 0 for the front page */
+static uint32_t typemap_chunk(uint32_t usableSize, uint32_t pageNo) {
+    uint32_t frontPages = usableSize - FDB_FILE_HEADER_SIZE;
+
+    return pageNo <= frontPages ? 0 : 1 + (pageNo - frontPages - 1) / usableSize;
+}
+
+/* The pages a map page describes and where their types start on it */
+static void typemap_chunk_range(uint32_t usableSize, uint32_t chunk, uint32_t *mapPageNo,
+                                uint32_t *first, uint32_t *last, uint32_t *offset) {
+    uint32_t frontPages = usableSize - FDB_FILE_HEADER_SIZE;
+
+    if (chunk == 0) {
+        *mapPageNo = 1;
+        *first = 1;
+        *last = frontPages;
+        *offset = FDB_FILE_HEADER_SIZE;
+    } else {
+        *mapPageNo = frontPages + (chunk - 1) * usableSize;
+        *first = *mapPageNo + 1;
+        *last = *mapPageNo + usableSize;
+        *offset = 0;
+    }
+}
+
+/* Types are kept four bits to a page in segments that are allocated
+   when a page in them first gets a type, and each type has a summary
+   bit per block of pages that says whether the block holds a page of
+   the type.  A segment covers a whole summary word. */
+#define TYPECACHE_BLOCK_PAGES 64
+#define TYPECACHE_SEGMENT_PAGES (TYPECACHE_BLOCK_PAGES * 64)
+
+#define TYPECACHE_BIT(words, n) (((words)[(n) / 64] >> ((n) % 64)) & 1)
+#define TYPECACHE_SET_BIT(words, n) ((words)[(n) / 64] |= (uint64_t)1 << ((n) % 64))
+#define TYPECACHE_CLEAR_BIT(words, n) ((words)[(n) / 64] &= ~((uint64_t)1 << ((n) % 64)))
+
+static void pagetypecache_init(PageTypeCache *cache, uint32_t usableSize) {
+    memset(cache, 0, sizeof(PageTypeCache));
+    cache->usableSize = usableSize;
+}
+
+static void pagetypecache_deinit(PageTypeCache *cache) {
+    uint32_t i;
+
+    for (i = 0; i < cache->capacity / TYPECACHE_SEGMENT_PAGES; i++) {
+        fdbfree(cache->types[i]);
+    }
+    fdbfree(cache->types);
+    fdbfree(cache->loaded);
+    for (i = 0; i < PAGE_TYPE_COUNT; i++) {
+        fdbfree(cache->blocks[i]);
+    }
+    pagetypecache_init(cache, cache->usableSize);
+}
+
+/* Forgets every type, they are read from the map again when needed */
+static void pagetypecache_reset(PageTypeCache *cache) {
+    pagetypecache_deinit(cache);
+}
+
+static uint32_t pagetypecache_loaded_words(PageTypeCache *cache, uint32_t capacity) {
+    return capacity == 0 ? 0 : (typemap_chunk(cache->usableSize, capacity - 1) / 64) + 1;
+}
+
+static int pagetypecache_resize(void **data, size_t size) {
+    void *resized = *data == NULL ? fdbmalloczerotag(size, FDB_MEM_CACHE) : fdbrealloczero(*data, size);
+
+    if (resized == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+    *data = resized;
+    return FABRICDB_OK;
+}
+
+/* Makes room for pages up to and including pageNo */
+static int pagetypecache_grow(PageTypeCache *cache, uint32_t pageNo) {
+    uint64_t capacity;
+    int rc;
+    int i;
+
+    if (pageNo < cache->capacity) {
+        return FABRICDB_OK;
+    }
+
+    capacity = ((uint64_t)pageNo / TYPECACHE_SEGMENT_PAGES + 1) * TYPECACHE_SEGMENT_PAGES;
+    if (capacity < (uint64_t)cache->capacity * 2) {
+        capacity = (uint64_t)cache->capacity * 2;
+    }
+    if (capacity > (uint64_t)UINT32_MAX + 1 - TYPECACHE_SEGMENT_PAGES) {
+        capacity = (uint64_t)UINT32_MAX + 1 - TYPECACHE_SEGMENT_PAGES;
+        if (pageNo >= capacity) {
+            return FABRICDB_EOVERFLOW;
+        }
+    }
+
+    rc = pagetypecache_resize((void**)&cache->types, capacity / TYPECACHE_SEGMENT_PAGES * sizeof(uint8_t*));
+    for (i = 0; i < PAGE_TYPE_COUNT && rc == FABRICDB_OK; i++) {
+        rc = pagetypecache_resize((void**)&cache->blocks[i], capacity / TYPECACHE_SEGMENT_PAGES * sizeof(uint64_t));
+    }
+    if (rc == FABRICDB_OK) {
+        rc = pagetypecache_resize((void**)&cache->loaded,
+                                  pagetypecache_loaded_words(cache, (uint32_t)capacity) * sizeof(uint64_t));
+    }
+    if (rc == FABRICDB_OK) {
+        cache->capacity = (uint32_t)capacity;
+    }
+
+    return rc;
+}
+
+static inline uint8_t pagetypecache_raw(PageTypeCache *cache, uint32_t pageNo) {
+    uint8_t *segment;
+
+    if (pageNo >= cache->capacity || (segment = cache->types[pageNo / TYPECACHE_SEGMENT_PAGES]) == NULL) {
+        return UNUSED_PAGE;
+    }
+    pageNo %= TYPECACHE_SEGMENT_PAGES;
+    return (segment[pageNo / 2] >> (pageNo % 2 * 4)) & 0xf;
+}
+
+/* Changes a type in the cache.  The summary bit of the old type is
+   kept if another page in the block still has that type. */
+static int pagetypecache_store(PageTypeCache *cache, uint32_t pageNo, uint8_t pageType) {
+    uint8_t **segment = &cache->types[pageNo / TYPECACHE_SEGMENT_PAGES];
+    uint8_t *byte;
+    uint8_t oldType = pagetypecache_raw(cache, pageNo);
+    uint32_t block = pageNo / TYPECACHE_BLOCK_PAGES;
+    uint32_t first = block * TYPECACHE_BLOCK_PAGES;
+    uint32_t i;
+
+    if (oldType == pageType) {
+        return FABRICDB_OK;
+    }
+    if (*segment == NULL) {
+        *segment = fdbmalloczerotag(TYPECACHE_SEGMENT_PAGES / 2, FDB_MEM_CACHE);
+        if (*segment == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+    }
+    byte = &(*segment)[pageNo % TYPECACHE_SEGMENT_PAGES / 2];
+    *byte = pageNo % 2 ? (*byte & 0x0f) | (pageType << 4) : (*byte & 0xf0) | pageType;
+    if (pageType != UNUSED_PAGE) {
+        TYPECACHE_SET_BIT(cache->blocks[pageType], block);
+    }
+    if (oldType == UNUSED_PAGE) {
+        return FABRICDB_OK;
+    }
+    for (i = first; i < first + TYPECACHE_BLOCK_PAGES; i++) {
+        if (pagetypecache_raw(cache, i) == oldType) {
+            return FABRICDB_OK;
+        }
+    }
+    TYPECACHE_CLEAR_BIT(cache->blocks[oldType], block);
+    return FABRICDB_OK;
+}
+
+/* Reads the types on one map page into the cache.  A map page that is
+   past the end of the file has not been written, so its pages are all
+   unused. */
+static int pagetypecache_load_chunk(PageTypeCache *cache, Pager *pager, uint32_t chunk) {
+    uint32_t mapPageNo;
+    uint32_t first;
+    uint32_t last;
+    uint32_t offset;
+    uint32_t pageNo;
+    uint8_t type;
+    Page *page;
+    Page *loaded = NULL;
+    int rc;
+
+    typemap_chunk_range(cache->usableSize, chunk, &mapPageNo, &first, &last, &offset);
+    rc = pagetypecache_grow(cache, last);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    page = pagecache_get(pager->pageCache, mapPageNo);
+    if (page == NULL && (chunk == 0 || mapPageNo <= pager->dbstate.filePageCount)) {
+        rc = pager_load_page(pager, mapPageNo, chunk == 0 ? HEADER_PAGE : P_PAGE, 0, &loaded);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        page = loaded;
+    }
+
+    for (pageNo = first; page != NULL && pageNo <= last; pageNo++) {
+        type = page->data[offset + pageNo - first];
+        if (type >= PAGE_TYPE_COUNT) {
+            rc = FABRICDB_ECORRUPT;
+            break;
+        }
+        if (type != UNUSED_PAGE) {
+            rc = pagetypecache_store(cache, pageNo, type);
+            if (rc != FABRICDB_OK) {
+                break;
+            }
+            if (pageNo > cache->maxPage) {
+                cache->maxPage = pageNo;
+            }
+        }
+    }
+    if (loaded != NULL) {
+        free_page(&pager->pageCache->frames, loaded);
+    }
+    if (rc == FABRICDB_OK) {
+        TYPECACHE_SET_BIT(cache->loaded, chunk);
+    }
+
+    return rc;
+}
+
+static inline int pagetypecache_ensure(PageTypeCache *cache, Pager *pager, uint32_t pageNo) {
+    uint32_t chunk = typemap_chunk(cache->usableSize, pageNo);
+
+    if (pageNo < cache->capacity && TYPECACHE_BIT(cache->loaded, chunk)) {
+        return FABRICDB_OK;
+    }
+    return pagetypecache_load_chunk(cache, pager, chunk);
+}
+
+/* Returns the type of a page, or UNUSED_PAGE if it cannot be read */
+static uint8_t pagetypecache_get_type(PageTypeCache *cache, Pager *pager, uint32_t pageNo) {
+    if (pageNo == 0 || pagetypecache_ensure(cache, pager, pageNo) != FABRICDB_OK) {
+        return UNUSED_PAGE;
+    }
+    return pagetypecache_raw(cache, pageNo);
+}
+
+/* Changes the type of a page */
+static int pagetypecache_set(PageTypeCache *cache, Pager *pager, uint32_t pageNo, uint8_t pageType) {
+    int rc = pagetypecache_ensure(cache, pager, pageNo);
+
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    rc = pagetypecache_store(cache, pageNo, pageType);
+    if (rc == FABRICDB_OK && pageType != UNUSED_PAGE && pageNo > cache->maxPage) {
+        cache->maxPage = pageNo;
+    }
+    cache->dirty = 1;
+
+    return rc;
+}
+
+static inline uint32_t pagetypecache_lowest_bit(uint64_t word) {
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_ctzll(word);
+#else
+    uint32_t n = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Finds the first block from block to lastBlock with a page of the
+   type, or returns UINT32_MAX */
+static uint32_t pagetypecache_next_block(PageTypeCache *cache, uint8_t pageType, uint32_t block, uint32_t lastBlock) {
+    uint64_t *words = cache->blocks[pageType];
+    uint64_t word;
+    uint32_t w = block / 64;
+
+    word = words[w] & (~(uint64_t)0 << (block % 64));
+    while (word == 0) {
+        if (++w > lastBlock / 64) {
+            return UINT32_MAX;
+        }
+        word = words[w];
+    }
+    block = w * 64 + pagetypecache_lowest_bit(word);
+    return block <= lastBlock ? block : UINT32_MAX;
+}
+
+/* Finds the first page of a type after the given page, 0 if there are
+   none.  Only the blocks that hold the type are looked at, and map
+   pages are read as the search reaches the pages they describe. */
+static int pagetypecache_find_next(PageTypeCache *cache, Pager *pager, uint8_t pageType,
+                                   uint32_t after, uint32_t *pageNop) {
+    uint32_t limit = pager->dbstate.filePageCount;
+    uint32_t pageNo;
+    uint32_t block;
+    uint32_t mapPageNo;
+    uint32_t first;
+    uint32_t last;
+    uint32_t offset;
+    int rc;
+
+    *pageNop = 0;
+    if (pageType == UNUSED_PAGE || pageType >= PAGE_TYPE_COUNT) {
+        return FABRICDB_OK;
+    }
+
+    pageNo = after + 1;
+    while (pageNo != 0 && pageNo <= (limit > cache->maxPage ? limit : cache->maxPage)) {
+        rc = pagetypecache_ensure(cache, pager, pageNo);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        typemap_chunk_range(cache->usableSize, typemap_chunk(cache->usableSize, pageNo),
+                            &mapPageNo, &first, &last, &offset);
+
+        block = pageNo / TYPECACHE_BLOCK_PAGES;
+        while ((block = pagetypecache_next_block(cache, pageType, block, last / TYPECACHE_BLOCK_PAGES)) != UINT32_MAX) {
+            if (pageNo < block * TYPECACHE_BLOCK_PAGES) {
+                pageNo = block * TYPECACHE_BLOCK_PAGES;
+            }
+            for (; pageNo <= last && pageNo / TYPECACHE_BLOCK_PAGES == block; pageNo++) {
+                if (pagetypecache_raw(cache, pageNo) == pageType) {
+                    *pageNop = pageNo;
+                    return FABRICDB_OK;
+                }
+            }
+            block++;
+        }
+        pageNo = last + 1;
+    }
+
+    return FABRICDB_OK;
+}
+
+/* Returns the first page of a type after the given page, or 0 if there
+   are none or the map cannot be read */
+static uint32_t pagetypecache_next(PageTypeCache *cache, Pager *pager, uint8_t pageType, uint32_t after) {
+    uint32_t pageNo;
+
+    return pagetypecache_find_next(cache, pager, pageType, after, &pageNo) == FABRICDB_OK ? pageNo : 0;
+}
+
+
+/*******************************************************************
+ * Busy handling.
+ *******************************************************************/
+
+/* The busy handler fdb_pager_set_busy_timeout() installs.  Backs off
+   exponentially with jitter until the timeout has passed. */
+static int pager_busy_backoff(void *arg, uint32_t attempt) {
+    Pager *pager = (Pager*)arg;
+    uint64_t now = fdb_now_us();
+    uint64_t delay;
+    uint64_t x;
+
+    if (attempt == 0) {
+        pager->busyDeadline = now + (uint64_t)pager->pragma.busyTimeout * 1000;
+    }
+    if (now >= pager->busyDeadline) {
+        return 0;
+    }
+
+    delay = attempt < 16 ? (uint64_t)FDB_BUSY_MIN_DELAY << attempt : FDB_BUSY_MAX_DELAY;
+    if (delay > FDB_BUSY_MAX_DELAY) {
+        delay = FDB_BUSY_MAX_DELAY;
+    }
+
+    /* xorshift64 */
+    x = pager->busyRandom;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    pager->busyRandom = x;
+    delay = delay / 2 + x % (delay / 2 + 1);
+
+    if (delay > pager->busyDeadline - now) {
+        delay = pager->busyDeadline - now;
+    }
+    fdb_sleep_us(delay);
+    return 1;
+}
+
+/* Asks the busy handler whether a busy lock should be tried again */
+static inline int pager_busy(Pager *pager, uint32_t attempt) {
+    return pager->busyHandler != NULL && pager->busyHandler(pager->busyArg, attempt);
+}
+
+
+/*******************************************************************
+ * Pager creation and initialization routines.
+ *******************************************************************/
+
+/* Preallocates what a cache of cacheSize pages needs.  In mmap mode
+   clean pages only need a header, the data stays in the mapping. */
+static int pager_reserve_frames(Pager *pager, uint32_t cacheSize) {
+    if (PAGER_MAPS_PAGES(pager)) {
+        return framepool_reserve(&pager->pageCache->mapFrames, cacheSize);
+    }
+    return framepool_reserve(&pager->pageCache->frames, cacheSize);
+}
+
+int fdb_pager_create(const char* filepath, Pager **pagerp) {
+    *pagerp = NULL;
+
+    Pager *pager = fdbmalloczerotag(sizeof(Pager), FDB_MEM_PAGER);
+    if (pager == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    /* Copy the file path */
+    size_t path_len = strlen(filepath);
+    char* new_filepath = fdbmalloctag(path_len + 1, FDB_MEM_PAGER);
+    if (new_filepath == NULL) {
+        fdbfree(pager);
+        return FABRICDB_ENOMEM;
+    }
+    memcpy(new_filepath, filepath, path_len);
+    new_filepath[path_len] = '\0';
+
+    pager->filePath = new_filepath;
+    pager->dbfh = NULL;
+    pager->jfh = NULL;
+
+    /* Defaults */
+    pager->dbstate.fileChangeCounter = 0;
+    pager->dbstate.filePageCount = 0;
+    pager->dbstate.fileFreePageCount = 0;
+    pager->dbstate.freeTrunkPage = 0;
+    pager->dbstate.schemaCookie = 0;
+
+    /* Defaults */
+    pager->pragma.applicationId = 0;
+    pager->pragma.applicationVersion = 0;
+    pager->pragma.pageSize = FDB_DEFAULT_PAGE_SIZE;
+    pager->pragma.fileFormatWriteVersion = 1;
+    pager->pragma.fileFormatReadVersion = 1;
+    pager->pragma.bytesReserved = 0;
+    pager->pragma.defCacheSize = FDB_DEFAULT_CACHE_SIZE;
+    pager->pragma.defAutoVacuum = 0;
+    pager->pragma.defAutoVacuumThreshold = 0;
+    pager->pragma.pageChecksums = 0;
+    pager->pragma.compression = FDB_COMPRESSION_NONE;
+    pager->pragma.autoVacuum = 0;
+    pager->pragma.autoVacuumThreshold = 0;
+    pager->pragma.cacheSize = FDB_DEFAULT_CACHE_SIZE;
+    pager->pragma.mmapMode = 0;
+    pager->pragma.walAutoCheckpoint = FDB_DEFAULT_WAL_AUTO_CHECKPOINT;
+    pager->pragma.groupCommitDelay = FDB_DEFAULT_GROUP_COMMIT_DELAY;
+    pager->pragma.groupCommitBatch = FDB_DEFAULT_GROUP_COMMIT_BATCH;
+    pager->pragma.readAhead = FDB_DEFAULT_READ_AHEAD;
+    pager->pragma.verifyChecksums = 1;
+    pager->pragma.compressedCacheSize = 0;
+    pager->pragma.cacheShards = 0;
+    pager->pragma.sharedCache = 0;
+    pager->pragma.busyTimeout = 0;
+
+    pager->pageCache = &pager->localCache;
+    filemap_init(&pager->fileMap);
+    memset(&pager->readAhead, 0, sizeof(ReadAhead));
+    pager->ioq = NULL;
+    pager->compressBuffer = NULL;
+    pager->commitError = FABRICDB_OK;
+    pager->relocate = NULL;
+    pager->relocateArg = NULL;
+    pager->busyHandler = NULL;
+    pager->busyArg = NULL;
+    pager->busyRandom = (fdb_now_us() ^ (uint64_t)(uintptr_t)pager) | 1;
+    pager->wal = NULL;
+    pager->txnState = TXN_NONE;
+
+    *pagerp = pager;
+
+    return FABRICDB_OK;
+}
+
+/* Reads the values that change with every transaction from the front page */
+static void read_dbstate(DBState *dbstate, uint8_t *fp_data) {
+    dbstate->fileChangeCounter = letohu32(*((uint32_t*)(fp_data + FDB_CHANGE_COUNTER_OFFSET)));
+    dbstate->filePageCount = letohu32(*((uint32_t*)(fp_data + FDB_PAGE_COUNT_OFFSET)));
+    dbstate->fileFreePageCount = letohu32(*((uint32_t*)(fp_data + FDB_FREE_PAGE_COUNT_OFFSET)));
+    dbstate->freeTrunkPage = letohu32(*((uint32_t*)(fp_data + FDB_FREE_TRUNK_OFFSET)));
+}
+
+/* Opens the -wal and -shm files that sit next to the database file.
+   A new database starts with an empty log. */
+static int pager_open_wal(Pager *pager, uint32_t pageSize, int newFile) {
+    int rc;
+    size_t pathLen = strlen(pager->filePath);
+    char *walPath = fdbmalloctag(pathLen + 5, FDB_MEM_PAGER);
+    char *shmPath = fdbmalloctag(pathLen + 5, FDB_MEM_PAGER);
+
+    if (walPath == NULL || shmPath == NULL) {
+        fdbfree(walPath);
+        fdbfree(shmPath);
+        return FABRICDB_ENOMEM;
+    }
+    memcpy(walPath, pager->filePath, pathLen);
+    memcpy(walPath + pathLen, "-wal", 5);
+    memcpy(shmPath, pager->filePath, pathLen);
+    memcpy(shmPath + pathLen, "-shm", 5);
+
+    rc = fdb_open_or_create_file(walPath, &pager->jfh);
+    if (rc == FABRICDB_OK && newFile) {
+        rc = fdb_truncate_file(pager->jfh, 0);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_wal_open(pager->jfh, shmPath, pageSize, &pager->wal);
+    }
+
+    fdbfree(walPath);
+    fdbfree(shmPath);
+    return rc;
+}
+
+static int fdb_pager_init_from_file(Pager *pager, int newFile) {
+    int rc = FABRICDB_OK;
+    int changed;
+    uint32_t attempt = 0;
+    Page *front_page = NULL;
+    uint8_t *fp_data;
+    int64_t file_size;
+    uint8_t header_string[16];
+    uint32_t page_size;
+    uint8_t num_reserved_bytes;
+    uint8_t write_version;
+    FdbMutex *loadLock = NULL;
+
+    page_size = 0;
+
+    /* Make sure the file is at least FABRICDB_MIN_PAGE_SIZE */
+    rc = fdb_file_size(pager->dbfh, &file_size);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    if (file_size < FDB_MIN_PAGE_SIZE) {
+        rc = FABRICDB_EINVALID_FILE;
+        goto pager_init_done;
+    }
+
+    /* Verify that the 16 byte header string is valid */
+    rc = fdb_read(pager->dbfh, header_string, 0, 16);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    if (memcmp(header_string, HEADER_STRING, 16) != 0) {
+        rc = FABRICDB_EINVALID_FILE;
+        goto pager_init_done;
+    }
+
+    /* Seems to be a valid FabricDB file
+       Get a shared lock and make sure page size is valid */
+    while ((rc = fdb_acquire_shared_lock(pager->dbfh)) == FABRICDB_BUSY && pager_busy(pager, attempt)) {
+        attempt++;
+    }
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
     }
     rc = fdb_read(pager->dbfh, (uint8_t*) &page_size, FDB_PAGE_SIZE_OFFSET, 4);
     if (rc != FABRICDB_OK){
         page_size = 1; /* indicate lock is acquired */
         goto pager_init_done;
     }
-    page_size = letohu32(page_size);
+    page_size = letohu32(page_size);
+
+    if (!VALID_PAGE_SIZE(page_size)) {
+        rc = FABRICDB_EINVALID_FILE;
+        page_size = 1;  /* indicate lock is acquired */
+        goto pager_init_done;
+    }
+
+    /* The number of reserved bytes needs to be added to the page size */
+    rc = fdb_read(pager->dbfh, &num_reserved_bytes, FDB_BYTES_RESERVED_OFFSET, 1);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+
+    /* Checksums and compression have to be known before the front page is read */
+    rc = fdb_read(pager->dbfh, &pager->pragma.pageChecksums, FDB_PAGE_CHECKSUMS_OFFSET, 1);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    rc = fdb_read(pager->dbfh, &pager->pragma.compression, FDB_COMPRESSION_OFFSET, 1);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    if (pager->pragma.compression > FDB_COMPRESSION_LZ4) {
+        rc = FABRICDB_EINVALID_FILE;
+        goto pager_init_done;
+    }
+
+    /* In WAL mode the front page itself may be in the log */
+    rc = fdb_read(pager->dbfh, &write_version, FDB_FILE_FORMAT_WRITE_VERSION_OFFSET, 1);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    if (write_version == FDB_FORMAT_WAL) {
+        rc = pager_open_wal(pager, page_size + num_reserved_bytes, newFile);
+        if (rc == FABRICDB_OK) {
+            rc = fdb_wal_begin_read(pager->wal, &changed);
+        }
+        if (rc != FABRICDB_OK) {
+            goto pager_init_done;
+        }
+        pager->txnState = TXN_READ;
+    }
+
+    /* Initialize the cache.  The map is sized from the default cache
+       size until the real one has been read from the front page.  A
+       connection that shares its cache only keeps the pages of its
+       write transactions here. */
+    rc = pagecache_create(&pager->localCache, pager->pragma.cacheSize, page_size + num_reserved_bytes,
+                          pager->pragma.sharedCache ? 0 : pager->pragma.cacheShards);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+    if (pager->pragma.sharedCache && pager->wal == NULL) {
+        rc = sharedcache_attach(pager, page_size + num_reserved_bytes);
+        if (rc != FABRICDB_OK) {
+            goto pager_init_done;
+        }
+        loadLock = pager->pageCache->loadLock;
+        fdb_lock_mutex(loadLock);
+    }
+
+    /* Read the first page */
+    pager->pragma.pageSize = page_size;
+    rc = pager_load_page(pager, 1, HEADER_PAGE, 0, &front_page);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+
+    fp_data = front_page->data;
+
+    /* Read first page and set values from file */
+    read_dbstate(&pager->dbstate, fp_data);
+
+    pager->pragma.applicationId = letohu32(*((uint32_t*)(fp_data + FDB_APPLICATION_ID_OFFSET)));
+    pager->pragma.applicationVersion = letohu32(*((uint32_t*)(fp_data + FDB_APPLICATION_VERSION_OFFSET)));
+    pager->pragma.pageSize = page_size;
+    pager->pragma.fileFormatWriteVersion = *((uint8_t*)(fp_data + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET));
+    pager->pragma.fileFormatReadVersion = *((uint8_t*)(fp_data + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET));
+    pager->pragma.bytesReserved = *((uint8_t*)(fp_data + FDB_BYTES_RESERVED_OFFSET));
+    pager->pragma.defCacheSize = *((uint8_t*)(fp_data + FDB_DEFAULT_CACHE_SIZE_OFFSET));
+    pager->pragma.defAutoVacuum = *((uint8_t*)(fp_data + FDB_DEFAULT_AUTO_VACUUM_OFFSET));
+    pager->pragma.defAutoVacuumThreshold = *((uint8_t*)(fp_data + FDB_DEFAULT_AUTO_VACUUM_THRESHOLD_OFFSET));
+
+    pager->pragma.autoVacuum = pager->pragma.defAutoVacuum;
+    pager->pragma.autoVacuumThreshold = pager->pragma.defAutoVacuumThreshold;
+    pager->pragma.cacheSize = pager->pragma.defCacheSize;
+    if (pager->sharedCache != NULL) {
+        pager->sharedCache->cacheSize = pager->pragma.cacheSize;
+    }
+    rc = pager_reserve_frames(pager, pager->pragma.cacheSize);
+    if (rc != FABRICDB_OK) {
+        goto pager_init_done;
+    }
+
+    /* The rest of the front page (after the header) contains data
+       that describes how every page is used.  The map is read one map
+       page at a time as pages are looked up, so opening a large file
+       does not walk the whole map.  Once a map page is read, every
+       lookup by id of the pages it describes takes O(1) time because
+       the exact position in the datafile can be calculated. */
+    pagetypecache_init(&pager->pageTypeCache, page_size);
+
+    /* Ignore error code */
+    if (pager->sharedCache != NULL) {
+        sharedcache_put_front_page(pager->sharedCache, front_page);
+    } else {
+        pagecache_put(pager->pageCache, front_page);
+    }
+
+    pager_init_done:
+    if (page_size != 0) {
+        /* Release lock */
+        fdb_unlock(pager->dbfh);
+    }
+    if (pager->txnState == TXN_READ) {
+        fdb_wal_end_read(pager->wal);
+        pager->txnState = TXN_NONE;
+    }
+
+    /* Clean up memory */
+    if (rc != FABRICDB_OK && front_page != NULL) {
+        free_page(&pager->pageCache->frames, front_page);
+    }
+    if (loadLock != NULL) {
+        fdb_unlock_mutex(loadLock);
+    }
+
+    if(rc != FABRICDB_OK){
+        sharedcache_detach(pager);
+        if (pager->wal != NULL) {
+            fdb_wal_close(pager->wal, pager->dbfh);
+            pager->wal = NULL;
+        }
+        if (pager->jfh != NULL) {
+            fdb_close_file(pager->jfh);
+            pager->jfh = NULL;
+        }
+        if (pager->dbfh != NULL) {
+            fdb_close_file(pager->dbfh);
+            pager->dbfh = NULL;
+        }
+        pagecache_deinit(&pager->localCache);
+    }
+
+    return rc;
+}
+
+int fdb_pager_init(Pager *pager) {
+    int rc;
+
+    rc = fdb_open_file_rdwr(pager->filePath, &pager->dbfh);
+    if (rc != FABRICDB_OK ) {
+        return rc;
+    }
+
+    return fdb_pager_init_from_file(pager, 0);
+}
+
+int fdb_pager_init_file(Pager *pager) {
+    int rc;
+    uint32_t v32;
+
+    uint8_t *buffer;
+    uint8_t needReserved = 0;
+
+    if (pager->pragma.pageChecksums) {
+        needReserved += FDB_CHECKSUM_SIZE;
+    }
+    if (pager->pragma.compression != FDB_COMPRESSION_NONE) {
+        needReserved += FDB_STORAGE_FLAG_SIZE;
+    }
+    if (pager->pragma.bytesReserved < needReserved) {
+        pager->pragma.bytesReserved = needReserved;
+    }
+
+    buffer = fdbmalloczerotag(pager->pragma.pageSize + pager->pragma.bytesReserved, FDB_MEM_PAGER);
+    if (buffer == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    /* Create the file */
+    rc = fdb_create_file(pager->filePath, &pager->dbfh);
+    if (rc != FABRICDB_OK) {
+        fdbfree(buffer);
+        return rc;
+    }
+
+    /* Write persistent pragma values */
+    memcpy(buffer, HEADER_STRING, 16);
+    v32 = htoleu32(pager->pragma.applicationId);
+    memcpy(buffer + FDB_APPLICATION_ID_OFFSET, &v32, 4);
+    v32 = htoleu32(pager->pragma.applicationVersion);
+    memcpy(buffer + FDB_APPLICATION_VERSION_OFFSET, &v32, 4);
+    v32 = htoleu32(pager->pragma.pageSize);
+    memcpy(buffer + FDB_PAGE_SIZE_OFFSET, &v32, 4);
+    *(buffer + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET) = pager->pragma.fileFormatWriteVersion;
+    *(buffer + FDB_FILE_FORMAT_READ_VERSION_OFFSET) = pager->pragma.fileFormatReadVersion;
+    *(buffer + FDB_BYTES_RESERVED_OFFSET) = pager->pragma.bytesReserved;
+    *(buffer + FDB_DEFAULT_CACHE_SIZE_OFFSET) = pager->pragma.defCacheSize;
+    *(buffer + FDB_DEFAULT_AUTO_VACUUM_OFFSET) = pager->pragma.defAutoVacuum;
+    *(buffer + FDB_DEFAULT_AUTO_VACUUM_THRESHOLD_OFFSET) = pager->pragma.defAutoVacuumThreshold;
+    *(buffer + FDB_PAGE_CHECKSUMS_OFFSET) = pager->pragma.pageChecksums;
+    *(buffer + FDB_COMPRESSION_OFFSET) = pager->pragma.compression;
+
+    /* Set page count to 1 */
+    v32 = htoleu32(1);
+    memcpy(buffer + FDB_PAGE_COUNT_OFFSET, &v32, 4);
+
+    /* set the first page to HEADER_PAGE */
+    *(buffer + FDB_FILE_HEADER_SIZE) = HEADER_PAGE;
+
+    stamp_storage(pager, buffer, pager->pragma.pageSize + pager->pragma.bytesReserved);
+    if (pager->pragma.pageChecksums) {
+        stamp_checksum(1, buffer, pager->pragma.pageSize + pager->pragma.bytesReserved);
+    }
+
+    /* Write to disk and sync */
+    rc = fdb_write(pager->dbfh, buffer, 0, pager->pragma.pageSize + pager->pragma.bytesReserved);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_sync(pager->dbfh);
+    }
+
+    fdbfree(buffer);
+    if (rc != FABRICDB_OK) {
+        fdb_close_file(pager->dbfh);
+        pager->dbfh = NULL;
+        return rc;
+    }
+
+    return fdb_pager_init_from_file(pager, 1);
+}
+
+void fdb_pager_destroy(Pager *pager) {
+    if(pager->filePath) {
+        fdbfree(pager->filePath);
+    }
+    if (pager->txnState == TXN_WRITE) {
+        fdb_pager_rollback(pager);
+    }
+    fdb_pager_end_read(pager);
+    sharedcache_detach(pager);
+    if (pager->wal) {
+        /* The last connection checkpoints the log into the file */
+        fdb_wal_close(pager->wal, pager->dbfh);
+    }
+    if (pager->dbfh) {
+        fdb_close_file(pager->dbfh);
+    }
+    if (pager->jfh) {
+        fdb_close_file(pager->jfh);
+    }
+    fdb_ioqueue_close(pager->ioq);
+    compressed_cache_clear(&pager->compressedCache);
+    pagetable_deinit(&pager->compressedCache.map);
+    fdbfree(pager->compressBuffer);
+    pagecache_clear(&pager->localCache);
+    pagecache_deinit(&pager->localCache);
+    pagetypecache_deinit(&pager->pageTypeCache);
+    filemap_deinit(&pager->fileMap);
+    fdbfree(pager);
+}
+
+/* Whether dirty pages must stay in the cache.  In WAL mode the database
+   file is only written by checkpoints, and in a write transaction an
+   uncommitted page written to the file would be seen by readers and
+   survive a rollback, so dirty pages stay until the transaction ends. */
+static inline int pager_keeps_dirty(Pager *pager) {
+    return pager->wal != NULL || pager->txnState == TXN_WRITE;
+}
+
+/* Frees a page that was taken out of the cache, writing it to the file
+   first if it is dirty.  A clean page is kept in the compressed tier
+   if compress is set. */
+static int pager_evict(Pager *pager, Page *victim, int compress) {
+    int rc;
+    PageCache *cache = pager->pageCache;
+
+    if (victim->dirty) {
+        assert(!pager_keeps_dirty(pager));
+        rc = write_page(pager, victim);
+        if (rc != FABRICDB_OK) {
+            pagecache_put(cache, victim);
+            return rc;
+        }
+        victim->dirty = 0;
+    } else if (compress && !victim->mapped) {
+        compressed_cache_store(pager, victim);
+    }
+
+    pagecache_free_page(cache, victim);
+    cache->evictions++;
+    return FABRICDB_OK;
+}
+
+/* Memory is shed to 1/PAGER_RELEASE_HEADROOM under the soft heap limit */
+#define PAGER_RELEASE_HEADROOM 16
+
+static int compare_slabs_by_free(const void *a, const void *b) {
+    uint32_t x = (*(FrameSlab* const*)a)->numFree;
+    uint32_t y = (*(FrameSlab* const*)b)->numFree;
+    return x > y ? -1 : x < y;
+}
+
+/* Evicts the pages of the pool's slabs, the emptiest slab first, until
+   freeing the slabs that are left with no pages in use would bring the
+   library back under its soft heap limit, and then frees them.  This
+   lets go of far fewer pages than evicting by recency would, as pages
+   evicted one by one rarely empty a whole slab. */
+static int pager_empty_slabs(Pager *pager, FramePool *pool) {
+    int rc = FABRICDB_OK;
+    PageCache *cache = pager->pageCache;
+    PageCacheShard *shard;
+    FrameSlab **sorted;
+    FrameSlab *slab;
+    Page *pages;
+    size_t used = fabricdb_mem_used();
+    size_t limit = fabricdb_get_soft_heap_limit();
+    size_t freeing = 0;
+    uint32_t count = 0;
+    uint32_t i;
+    uint32_t j;
+
+    /* Go a little under the limit, so the next slab the pool needs does
+       not put the library straight back over it */
+    limit -= limit / PAGER_RELEASE_HEADROOM;
+    for (slab = pool->slabs; slab != NULL; slab = slab->next) {
+        count++;
+    }
+    if (count == 0) {
+        return FABRICDB_OK;
+    }
+    sorted = fdbmalloctag(sizeof(FrameSlab*) * count, FDB_MEM_CACHE);
+    if (sorted == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+    for (i = 0, slab = pool->slabs; slab != NULL; slab = slab->next) {
+        sorted[i++] = slab;
+    }
+    qsort(sorted, count, sizeof(FrameSlab*), compare_slabs_by_free);
+
+    for (i = 0; i < count && used > limit + freeing && rc == FABRICDB_OK; i++) {
+        slab = sorted[i];
+        pages = (Page*)(slab + 1);
+        for (j = 0; j < slab->numFrames && rc == FABRICDB_OK; j++) {
+            /* Free frames and frames holding copies of mapped pages are
+               on no list, only the pages in the cache are */
+            if (pages[j].lruList == LRU_NONE) {
+                continue;
+            }
+            shard = pagecache_shard(cache, pages[j].pageNo);
+            pagecache_lock(shard);
+            if (pages[j].lruList != LRU_NONE && shard == pagecache_shard(cache, pages[j].pageNo) &&
+                pages[j].refCount == 0 && !(pager_keeps_dirty(pager) && pages[j].dirty)) {
+                pagecache_unlink(shard, &pages[j]);
+                pagecache_unlock(shard);
+                rc = pager_evict(pager, &pages[j], 0);
+            } else {
+                pagecache_unlock(shard);
+            }
+        }
+        if (slab->numFree == slab->numFrames) {
+            freeing += fabricdb_mem_size(slab);
+        }
+    }
+
+    fdbfree(sorted);
+    framepool_trim(pool);
+    return rc;
+}
+
+/* Sheds memory while the library is over its soft heap limit, or all
+   the memory it can if all is set.  The compressed tier goes first and
+   then unpinned pages, with the slabs that held them.  Dirty pages are
+   kept whenever pager_keeps_dirty() says so.  The caller holds
+   the cache's load lock if it has one. */
+static int pager_release_memory(Pager *pager, int all) {
+    int rc = FABRICDB_OK;
+    PageCache *cache = pager->pageCache;
+    Page *victim;
+    uint32_t i;
+
+    compressed_cache_clear(&pager->compressedCache);
+    if (!all) {
+        if (fabricdb_mem_over_limit()) {
+            rc = pager_empty_slabs(pager, &cache->frames);
+        }
+        if (rc == FABRICDB_OK && fabricdb_mem_over_limit()) {
+            rc = pager_empty_slabs(pager, &cache->mapFrames);
+        }
+        return rc;
+    }
+
+    for (i = 0; i < cache->numShards && rc == FABRICDB_OK; i++) {
+        while (rc == FABRICDB_OK && (victim = pagecache_take_victim(&cache->shards[i], 0, pager_keeps_dirty(pager))) != NULL) {
+            rc = pager_evict(pager, victim, 0);
+        }
+    }
+    framepool_trim(&cache->frames);
+    framepool_trim(&cache->mapFrames);
+    return rc;
+}
+
+/* Takes the cache's load lock, if it has one, around a release */
+static int pager_release_locked(Pager *pager, int all) {
+    FdbMutex *loadLock = pager->pageCache->loadLock;
+    int rc;
+
+    if (loadLock != NULL) {
+        fdb_lock_mutex(loadLock);
+    }
+    rc = pager_release_memory(pager, all);
+    if (loadLock != NULL) {
+        fdb_unlock_mutex(loadLock);
+    }
+    return rc;
+}
+
+int fdb_pager_release_memory(Pager *pager) {
+    return pager_release_locked(pager, 1);
+}
+
+/* Evicts unpinned pages until there is room for one more page in the
+   shard pageNo belongs to.  If every page is pinned the cache is
+   allowed to grow past its configured size rather than failing the
+   fetch.  Dirty pages that must stay in the cache count as pinned, so a
+   transaction that dirties more pages than fit grows the cache, and
+   fails with FABRICDB_ENOMEM once no more frames can be allocated. */
+static int pager_make_room(Pager *pager, uint32_t pageNo) {
+    int rc;
+    Page *victim;
+    PageCache *cache = pager->pageCache;
+    PageCacheShard *shard = pagecache_shard(cache, pageNo);
+    uint32_t shardSize = pagecache_shard_size(cache, PAGER_CACHE_SIZE(pager));
+
+    if (fabricdb_mem_over_limit()) {
+        rc = pager_release_memory(pager, 0);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    while ((victim = pagecache_take_victim(shard, shardSize, pager_keeps_dirty(pager))) != NULL) {
+        rc = pager_evict(pager, victim, 1);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    return FABRICDB_OK;
+}
+
+/*****************************************************************
+ * Read-ahead.
+ *****************************************************************/
+
+/* A page can be read ahead if it is not cached in either tier, is part of the
+   database and, in WAL mode, its newest version is in the file. */
+static int can_prefetch(Pager *pager, uint32_t pageNo, uint32_t filePages) {
+    if (pageNo == 0 || pageNo > pager->dbstate.filePageCount || pageNo > filePages) {
+        return 0;
+    }
+    if (pagecache_has(pager->pageCache, pageNo) || pagetable_has(&pager->compressedCache.map, pageNo)) {
+        return 0;
+    }
+    return pager->wal == NULL || fdb_wal_find_frame(pager->wal, pageNo) == 0;
+}
+
+/* Read-ahead only fills half of the part of the cache that is not
+   protected, anything more would evict the pages it just read. */
+static uint32_t prefetch_limit(Pager *pager) {
+    uint32_t protectedCount = 0;
+    uint32_t cacheSize = PAGER_CACHE_SIZE(pager);
+    uint32_t i;
+
+    for (i = 0; i < pager->pageCache->numShards; i++) {
+        pagecache_lock(&pager->pageCache->shards[i]);
+        protectedCount += pager->pageCache->shards[i].protected.count;
+        pagecache_unlock(&pager->pageCache->shards[i]);
+    }
+    return cacheSize > protectedCount ? (cacheSize - protectedCount) / 2 : 0;
+}
+
+/* Adds the pages of every finished read to the cache and releases
+   the frames of reads that failed.  runEnds[i] is one past the last
+   index of the run starting at index i, which is the read's tag. */
+static int prefetch_collect(Pager *pager, FdbIoQueue *queue, Page **pages, uint32_t *pageNos, uint32_t *runEnds) {
+    int rc = FABRICDB_OK;
+    int waitRc;
+    int pageRc;
+    FdbIoCompletion completions[FDB_IO_QUEUE_DEPTH];
+    uint32_t ncompleted;
+    uint32_t start;
+    uint32_t i;
+    uint32_t j;
+    FramePool *pool = &pager->pageCache->frames;
+
+    waitRc = fdb_ioqueue_submit(queue);
+    while (waitRc == FABRICDB_OK) {
+        waitRc = fdb_ioqueue_wait(queue, 1, completions, FDB_IO_QUEUE_DEPTH, &ncompleted);
+        if (waitRc != FABRICDB_OK || ncompleted == 0) {
+            break;
+        }
+        for (i = 0; i < ncompleted; i++) {
+            start = (uint32_t)completions[i].tag;
+            pageRc = completions[i].rc;
+            for (j = start; j < runEnds[start]; j++) {
+                if (pageRc == FABRICDB_OK) {
+                    init_page(pages[j], pool->pageSize, pageNos[j], pager->pragma.pageSize,
+                              pagetypecache_get_type(&pager->pageTypeCache, pager, pageNos[j]), 0);
+                    pages[j]->prefetched = 1;
+                }
+                /* A damaged page is left for the fetch to report */
+                if (pageRc == FABRICDB_OK && expand_page(pager, pages[j]) != FABRICDB_OK) {
+                    framepool_release(pool, pages[j]);
+                    continue;
+                }
+                if (pageRc == FABRICDB_OK && verify_page(pager, pages[j]) != FABRICDB_OK) {
+                    framepool_release(pool, pages[j]);
+                    continue;
+                }
+                if (pageRc == FABRICDB_OK) {
+                    pageRc = pager_make_room(pager, pages[j]->pageNo);
+                }
+                if (pageRc == FABRICDB_OK) {
+                    pageRc = pagecache_put(pager->pageCache, pages[j]);
+                }
+                if (pageRc == FABRICDB_OK) {
+                    pager->pageCache->prefetches++;
+                } else {
+                    framepool_release(pool, pages[j]);
+                }
+            }
+            if (pageRc != FABRICDB_OK && rc == FABRICDB_OK) {
+                rc = pageRc;
+            }
+        }
+    }
+
+    return rc == FABRICDB_OK ? waitRc : rc;
+}
+
+/* Reads the given pages, sorted by page number, into the cache.  Each
+   run of adjacent pages is read with a single request and the runs
+   are kept in flight together.  Pages that can not be read ahead are
+   skipped, a later fetch loads them as usual. */
+static int pager_prefetch_pages(Pager *pager, uint32_t *pageNos, uint32_t count) {
+    int rc;
+    int collectRc;
+    uint32_t start;
+    uint32_t end;
+    uint32_t i;
+    uint32_t filePages;
+    off_t fileSize;
+    FdbIoVec vecs[PAGER_MAX_IO_RUN];
+    FdbIoQueue *queue;
+    uint32_t *runEnds;
+    Page **pages;
+    FramePool *pool = &pager->pageCache->frames;
+
+    if (count == 0) {
+        return FABRICDB_OK;
+    }
+
+    rc = fdb_file_size(pager->dbfh, &fileSize);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    filePages = (uint32_t)(fileSize / pool->pageSize);
+
+    /* Mapped pages are read by the operating system when touched */
+    if (PAGER_MAPS_PAGES(pager)) {
+        for (start = 0; start < count; start = end) {
+            for (end = start + 1; end < count && pageNos[end] == pageNos[end - 1] + 1; end++);
+            if (can_prefetch(pager, pageNos[start], filePages)) {
+                fdb_advise(pager->dbfh, (off_t)(pageNos[start] - 1) * pool->pageSize,
+                           (off_t)(end - start) * pool->pageSize, FDB_ADVISE_WILLNEED);
+            }
+        }
+        return FABRICDB_OK;
+    }
+
+    rc = pager_ioqueue(pager, &queue);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    runEnds = fdbmalloctag(sizeof(uint32_t) * count, FDB_MEM_PAGER);
+    pages = fdbmalloctag(sizeof(Page*) * count, FDB_MEM_PAGER);
+    if (runEnds == NULL || pages == NULL) {
+        fdbfree(runEnds);
+        fdbfree(pages);
+        return FABRICDB_ENOMEM;
+    }
+
+    start = 0;
+    while (start < count && rc == FABRICDB_OK) {
+        if (!can_prefetch(pager, pageNos[start], filePages)) {
+            start++;
+            continue;
+        }
+        end = start + 1;
+        while (end < count && end - start < PAGER_MAX_IO_RUN && pageNos[end] == pageNos[end - 1] + 1 &&
+               can_prefetch(pager, pageNos[end], filePages)) {
+            end++;
+        }
+
+        for (i = start; i < end; i++) {
+            pages[i] = framepool_alloc(pool);
+            if (pages[i] == NULL) {
+                rc = FABRICDB_ENOMEM;
+                break;
+            }
+            vecs[i - start].base = pages[i]->data;
+            vecs[i - start].len = pool->pageSize;
+        }
+        if (rc == FABRICDB_OK && fdb_ioqueue_space(queue) == 0) {
+            rc = prefetch_collect(pager, queue, pages, pageNos, runEnds);
+        }
+        if (rc == FABRICDB_OK) {
+            runEnds[start] = end;
+            rc = fdb_read_async(queue, pager->dbfh, vecs, (int)(end - start),
+                                (off_t)(pageNos[start] - 1) * pool->pageSize, start);
+        }
+        if (rc != FABRICDB_OK) {
+            for (i = start; i < end && pages[i] != NULL; i++) {
+                framepool_release(pool, pages[i]);
+            }
+        }
+        start = end;
+    }
+
+    /* Reads already queued are collected even after a failure, their
+       frames belong to them until then */
+    collectRc = prefetch_collect(pager, queue, pages, pageNos, runEnds);
+    if (rc == FABRICDB_OK) {
+        rc = collectRc;
+    }
+
+    fdbfree(runEnds);
+    fdbfree(pages);
+    return rc;
+}
+
+/* Called on a cache miss.  If the miss continues a scan, the missed
+   page and the next window of pages the scan will want are read ahead
+   together, and the operating system is told about the window after
+   that. */
+static void pager_read_ahead(Pager *pager, uint32_t pageNo, uint8_t pageType) {
+    ReadAhead *ra = &pager->readAhead;
+    PageTypeCache *cache = &pager->pageTypeCache;
+    uint32_t *pageNos;
+    uint32_t count = 0;
+    uint32_t limit;
+    uint32_t next;
+    uint32_t pageSize = pager->pageCache->frames.pageSize;
+    int sequential;
+    int byType = 0;
+
+    limit = prefetch_limit(pager);
+    if (limit > pager->pragma.readAhead) {
+        limit = pager->pragma.readAhead;
+    }
+
+    /* A scan by type reads the pages of one type in page order */
+    sequential = pageNo == ra->lastPageNo + 1;
+    if (!sequential && pageType != UNUSED_PAGE && pageType == ra->lastType && ra->lastPageNo < pageNo) {
+        byType = pagetypecache_next(cache, pager, pageType, ra->lastPageNo) == pageNo;
+    }
+
+    ra->lastPageNo = pageNo;
+    ra->lastType = pageType;
+    if (!sequential && !byType) {
+        ra->streak = 0;
+        ra->window = READ_AHEAD_MIN_WINDOW;
+        return;
+    }
+    ra->byType = !sequential;
+    if (++ra->streak < READ_AHEAD_TRIGGER || limit == 0) {
+        return;
+    }
+
+    if (ra->window > limit) {
+        ra->window = limit;
+    }
+    pageNos = fdbmalloctag(sizeof(uint32_t) * (ra->window + 1), FDB_MEM_PAGER);
+    if (pageNos == NULL) {
+        return;
+    }
+
+    pageNos[count++] = pageNo;
+    if (ra->byType) {
+        next = pageNo;
+        while (count <= ra->window && (next = pagetypecache_next(cache, pager, pageType, next)) != 0) {
+            pageNos[count++] = next;
+        }
+    } else {
+        while (count <= ra->window && pageNo + count <= pager->dbstate.filePageCount) {
+            pageNos[count] = pageNo + count;
+            count++;
+        }
+    }
+
+    /* A failed read-ahead is not an error, the fetch reads the page
+       by itself */
+    pager_prefetch_pages(pager, pageNos, count);
+    ra->lastPageNo = pageNos[count - 1];
+    fdbfree(pageNos);
+
+    ra->window = ra->window * 2 < limit ? ra->window * 2 : limit;
+    if (!ra->byType) {
+        fdb_advise(pager->dbfh, (off_t)ra->lastPageNo * pageSize, (off_t)ra->window * pageSize, FDB_ADVISE_WILLNEED);
+    }
+}
+
+int fdb_pager_prefetch(Pager *pager, uint32_t first, uint32_t count) {
+    int rc;
+    uint32_t i;
+    uint32_t limit;
+    uint32_t *pageNos;
+    uint32_t pageSize = pager->pageCache->frames.pageSize;
+
+    if ((pager->wal != NULL || pager->sharedCache != NULL) && pager->txnState == TXN_NONE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    if (first == 0) {
+        first = 1;
+    }
+    if (first > pager->dbstate.filePageCount) {
+        return FABRICDB_OK;
+    }
+    if (count > pager->dbstate.filePageCount - first + 1) {
+        count = pager->dbstate.filePageCount - first + 1;
+    }
+
+    /* Reading more than the cache holds would evict the start of the
+       range before it is used */
+    limit = prefetch_limit(pager);
+    if (count > limit) {
+        fdb_advise(pager->dbfh, (off_t)(first + limit - 1) * pageSize,
+                   (off_t)(count - limit) * pageSize, FDB_ADVISE_WILLNEED);
+        count = limit;
+    }
+
+    pageNos = fdbmalloctag(sizeof(uint32_t) * (count ? count : 1), FDB_MEM_PAGER);
+    if (pageNos == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+    for (i = 0; i < count; i++) {
+        pageNos[i] = first + i;
+    }
+    if (pager->pageCache->loadLock != NULL) {
+        fdb_lock_mutex(pager->pageCache->loadLock);
+    }
+    rc = pager_prefetch_pages(pager, pageNos, count);
+    if (pager->pageCache->loadLock != NULL) {
+        fdb_unlock_mutex(pager->pageCache->loadLock);
+    }
+    fdbfree(pageNos);
+
+    return rc;
+}
+
+/* Fetches a page, pinning it if pin is set.  A hit only takes the lock
+   of the page's shard.  Misses are loaded one at a time under the load
+   lock, as loading also updates the page type cache, the read-ahead
+   state and the compressed tier. */
+static int pager_fetch_page(Pager *pager, uint32_t pageNo, int pin, Page** pagep) {
+    int rc = FABRICDB_OK;
+    uint8_t pageType;
+    Page* page;
+    PageCache *cache = pager->pageCache;
+
+    page = pagecache_lookup(cache, pageNo, PAGER_CACHE_SIZE(pager), pin);
+    if (page != NULL) {
+        *pagep = page;
+        return rc;
+    }
+
+    /* Another thread may have loaded the page while this one waited */
+    if (cache->loadLock != NULL) {
+        fdb_lock_mutex(cache->loadLock);
+        page = pagecache_lookup(cache, pageNo, PAGER_CACHE_SIZE(pager), pin);
+        if (page != NULL) {
+            fdb_unlock_mutex(cache->loadLock);
+            *pagep = page;
+            return rc;
+        }
+    }
+
+    /* Missed the cache so load it from disc */
+    cache->misses++;
+    pageType = pagetypecache_get_type(&pager->pageTypeCache, pager, pageNo);
+    if (pager->pragma.readAhead > 0) {
+        pager_read_ahead(pager, pageNo, pageType);
+        page = pagecache_claim(cache, pageNo, pin);
+        if (page != NULL) {
+            goto done;
+        }
+    }
+
+    rc = pager_make_room(pager, pageNo);
+    if (rc == FABRICDB_OK) {
+        rc = pager_load_page(pager, pageNo, pageType, 1, &page);
+    }
+
+    if (rc == FABRICDB_OK) {
+        /* Add it to the cache, pinned before any other thread can see it */
+        page->refCount += pin ? 1 : 0;
+        rc = pagecache_put(cache, page);
+        if (rc != FABRICDB_OK) {
+            pagecache_free_page(cache, page);
+            page = NULL;
+        }
+    } else {
+        page = NULL;
+    }
+
+done:
+    if (cache->loadLock != NULL) {
+        fdb_unlock_mutex(cache->loadLock);
+    }
+    *pagep = page;
+    return rc;
+}
+
+int fdb_pager_fetch_page(Pager *pager, uint32_t pageNo, Page** pagep) {
+    /* Without a transaction there is no snapshot to read from, and
+       another connection may empty a shared cache at any time */
+    if ((pager->wal != NULL || pager->sharedCache != NULL) && pager->txnState == TXN_NONE) {
+        *pagep = NULL;
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    /* Pages handed to readers that share the cache are pinned, so no
+       other reader can evict one while it is in use */
+    return pager_fetch_page(pager, pageNo, pager->pageCache->loadLock != NULL, pagep);
+}
+
+/* The cache a fetched page belongs to.  A write transaction on a shared
+   cache keeps its pages in the local cache, but pages fetched before it
+   began are still in the shared cache. */
+static inline PageCache* pager_page_owner(Pager *pager, Page *page) {
+    if (pager->sharedCache != NULL && pagecache_get(&pager->sharedCache->cache, page->pageNo) == page) {
+        return &pager->sharedCache->cache;
+    }
+    return pager->pageCache;
+}
+
+void fdb_pager_release_page(Pager *pager, Page *page) {
+    PageCache *cache;
+
+    if (page == NULL) {
+        return;
+    }
+
+    /* Only pages fetched while the cache has a load lock were pinned,
+       and a write transaction does not pin its own pages */
+    cache = pager_page_owner(pager, page);
+    if (cache->loadLock != NULL) {
+        pagecache_unpin(cache, page);
+    }
+}
+
+void fdb_pager_pin_page(Pager *pager, Page *page) {
+    PageCache *cache = pager_page_owner(pager, page);
+    PageCacheShard *shard = pagecache_shard(cache, page->pageNo);
+
+    pagecache_lock(shard);
+    page->refCount++;
+    pagecache_unlock(shard);
+}
+
+void fdb_pager_unpin_page(Pager *pager, Page *page) {
+    pagecache_unpin(pager_page_owner(pager, page), page);
+}
+
+int fdb_pager_mark_dirty(Pager *pager, Page *page) {
+    Page *frame;
+
+    if (pager->wal != NULL && pager->txnState != TXN_WRITE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    /* The mapping is read only, so writes go to a private copy */
+    if (page->mapped && page->frame == NULL) {
+        frame = framepool_alloc(&pager->pageCache->frames);
+        if (frame == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+        memcpy(frame->data, page->data, page->pageSize);
+        page->frame = frame;
+        page->data = frame->data;
+    }
+
+    page->dirty = 1;
+    return FABRICDB_OK;
+}
+
+
+/*******************************************************************
+ * Page allocation.
+ *******************************************************************/
+
+/* Free pages are kept in a list of trunk pages that starts at the page
+   named in the file header.  Each trunk holds the number of the next
+   trunk and the numbers of up to FREE_TRUNK_CAPACITY leaf pages, which
+   are free pages that hold nothing.  Allocating takes a leaf from the
+   first trunk, or the trunk itself once it is empty, and freeing adds
+   a leaf to the first trunk, or makes the page the new first trunk
+   once it is full, so both touch a fixed number of pages. */
+#define FREE_TRUNK_NEXT_OFFSET 0
+#define FREE_TRUNK_COUNT_OFFSET 4
+#define FREE_TRUNK_LEAVES_OFFSET 8
+#define FREE_TRUNK_CAPACITY(usableSize) (((usableSize) - FREE_TRUNK_LEAVES_OFFSET) / 4)
+
+/* Page types that can be handed out by the allocator */
+#define ALLOCATABLE_PAGE_TYPE(t) ((t) > HEADER_PAGE && (t) < PAGE_TYPE_COUNT && (t) != P_PAGE && (t) != FREE_PAGE)
+
+/* Records the type of a page in the map in the file and in the cache */
+static int pager_set_page_type(Pager *pager, uint32_t pageNo, uint8_t pageType) {
+    int rc;
+    uint32_t mapPageNo;
+    uint32_t offset;
+    Page *map;
+    Page *page;
+
+    typemap_locate(pager->pragma.pageSize, pageNo, &mapPageNo, &offset);
+    rc = pager_fetch_page(pager, mapPageNo, 0, &map);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, map);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    map->data[offset] = pageType;
+    page = pagecache_get(pager->pageCache, pageNo);
+    if (page != NULL) {
+        page->pageType = pageType;
+    }
+    return pagetypecache_set(&pager->pageTypeCache, pager, pageNo, pageType);
+}
+
+/* Picks the leaf of a trunk closest to hint, or the last one */
+static uint32_t free_trunk_pick(Page *trunk, uint32_t count, uint32_t hint) {
+    uint32_t best = count - 1;
+    uint32_t bestDistance = UINT32_MAX;
+    uint32_t distance;
+    uint32_t leaf;
+    uint32_t i;
+
+    if (hint == 0) {
+        return best;
+    }
+    for (i = 0; i < count && bestDistance > 1; i++) {
+        leaf = pager_get32(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * i);
+        distance = leaf > hint ? leaf - hint : hint - leaf;
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+
+    return best;
+}
+
+/* Takes a page off the free list.  *pageNop is left 0 if there are no
+   free pages. */
+static int free_list_take(Pager *pager, Page *front_page, uint32_t hint, uint32_t *pageNop) {
+    int rc;
+    uint32_t trunkNo;
+    uint32_t count;
+    uint32_t pick;
+    uint32_t pageNo;
+    uint32_t pageCount;
+    Page *trunk;
+
+    *pageNop = 0;
+    trunkNo = pager_get32(front_page->data + FDB_FREE_TRUNK_OFFSET);
+    if (trunkNo == 0) {
+        return FABRICDB_OK;
+    }
 
-    if (!VALID_PAGE_SIZE(page_size)) {
-        rc = FABRICDB_EINVALID_FILE;
-        page_size = 1;  /* indicate lock is acquired */
-        goto pager_init_done;
+    pageCount = pager_get32(front_page->data + FDB_PAGE_COUNT_OFFSET);
+    rc = pager_fetch_page(pager, trunkNo, 0, &trunk);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, trunk);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    count = pager_get32(trunk->data + FREE_TRUNK_COUNT_OFFSET);
+    if (count > FREE_TRUNK_CAPACITY(trunk->usableSize)) {
+        return FABRICDB_ECORRUPT;
+    }
+
+    if (count > 0) {
+        /* Fill the hole left by the leaf with the last one */
+        pick = free_trunk_pick(trunk, count, hint);
+        pageNo = pager_get32(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * pick);
+        memcpy(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * pick,
+               trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * (count - 1), 4);
+        pager_put32(trunk->data + FREE_TRUNK_COUNT_OFFSET, count - 1);
+    } else {
+        pageNo = trunkNo;
+        pager_put32(front_page->data + FDB_FREE_TRUNK_OFFSET, pager_get32(trunk->data + FREE_TRUNK_NEXT_OFFSET));
+    }
+    if (pageNo <= 1 || pageNo > pageCount) {
+        return FABRICDB_ECORRUPT;
+    }
+
+    pager_put32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET,
+                pager_get32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET) - 1);
+    *pageNop = pageNo;
+    return FABRICDB_OK;
+}
+
+/* Adds a page to the end of the file, stepping over the place of the
+   next page type map page if the file reaches it */
+static int pager_extend(Pager *pager, Page *front_page, uint32_t *pageNop) {
+    int rc;
+    uint32_t pageNo;
+    Page *map;
+
+    pageNo = pager_get32(front_page->data + FDB_PAGE_COUNT_OFFSET);
+    if (pageNo < pager->dbstate.filePageCount) {
+        pageNo = pager->dbstate.filePageCount;
+    }
+    pageNo++;
+
+    /* A vacuum may have left an old map in the file past the end */
+    if (typemap_is_map_page(pager->pragma.pageSize, pageNo)) {
+        rc = pager_fetch_page(pager, pageNo, 0, &map);
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(pager, map);
+        }
+        if (rc == FABRICDB_OK) {
+            memset(map->data, 0, map->usableSize);
+            rc = pager_set_page_type(pager, pageNo, P_PAGE);
+        }
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        pageNo++;
+    }
+    if (pageNo == 0) {
+        return FABRICDB_EFBIG;
+    }
+
+    pager_put32(front_page->data + FDB_PAGE_COUNT_OFFSET, pageNo);
+    *pageNop = pageNo;
+    return FABRICDB_OK;
+}
+
+int fdb_pager_allocate_page(Pager *pager, uint8_t pageType, uint32_t hint, Page **pagep) {
+    int rc;
+    uint32_t pageNo = 0;
+    Page *front_page;
+    Page *page;
+
+    *pagep = NULL;
+    if (pager->txnState != TXN_WRITE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+    if (!ALLOCATABLE_PAGE_TYPE(pageType)) {
+        return FABRICDB_EINVAL;
+    }
+
+    rc = pager_fetch_page(pager, 1, 0, &front_page);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, front_page);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* The front page is needed again after the other pages are fetched */
+    front_page->refCount++;
+    rc = free_list_take(pager, front_page, hint, &pageNo);
+    if (rc == FABRICDB_OK && pageNo == 0) {
+        rc = pager_extend(pager, front_page, &pageNo);
+    }
+    front_page->refCount--;
+
+    if (rc == FABRICDB_OK) {
+        rc = pager_set_page_type(pager, pageNo, pageType);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = pager_fetch_page(pager, pageNo, 0, &page);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, page);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* A reused page still holds whatever was last written to it */
+    memset(page->data, 0, page->usableSize);
+    *pagep = page;
+
+    return FABRICDB_OK;
+}
+
+int fdb_pager_free_page(Pager *pager, uint32_t pageNo) {
+    int rc;
+    uint32_t trunkNo;
+    uint32_t count;
+    uint32_t pageCount;
+    uint8_t pageType;
+    int added = 0;
+    Page *front_page;
+    Page *trunk;
+
+    if (pager->txnState != TXN_WRITE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    rc = pager_fetch_page(pager, 1, 0, &front_page);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, front_page);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    pageCount = pager_get32(front_page->data + FDB_PAGE_COUNT_OFFSET);
+    pageType = pagetypecache_get_type(&pager->pageTypeCache, pager, pageNo);
+    if (pageNo <= 1 || pageNo > pageCount || !ALLOCATABLE_PAGE_TYPE(pageType)) {
+        return FABRICDB_EINVAL;
+    }
+
+    front_page->refCount++;
+    trunkNo = pager_get32(front_page->data + FDB_FREE_TRUNK_OFFSET);
+    if (trunkNo != 0) {
+        rc = pager_fetch_page(pager, trunkNo, 0, &trunk);
+        if (rc == FABRICDB_OK) {
+            count = pager_get32(trunk->data + FREE_TRUNK_COUNT_OFFSET);
+            if (count < FREE_TRUNK_CAPACITY(trunk->usableSize)) {
+                rc = fdb_pager_mark_dirty(pager, trunk);
+                if (rc == FABRICDB_OK) {
+                    pager_put32(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * count, pageNo);
+                    pager_put32(trunk->data + FREE_TRUNK_COUNT_OFFSET, count + 1);
+                    added = 1;
+                }
+            }
+        }
+    }
+
+    /* Without a trunk with room the page becomes the first trunk */
+    if (rc == FABRICDB_OK && !added) {
+        rc = pager_fetch_page(pager, pageNo, 0, &trunk);
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(pager, trunk);
+        }
+        if (rc == FABRICDB_OK) {
+            memset(trunk->data, 0, trunk->usableSize);
+            pager_put32(trunk->data + FREE_TRUNK_NEXT_OFFSET, trunkNo);
+            pager_put32(front_page->data + FDB_FREE_TRUNK_OFFSET, pageNo);
+        }
+    }
+
+    if (rc == FABRICDB_OK) {
+        pager_put32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET,
+                    pager_get32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET) + 1);
+        rc = pager_set_page_type(pager, pageNo, FREE_PAGE);
+    }
+    front_page->refCount--;
+
+    return rc;
+}
+
+int fdb_pager_next_page(Pager *pager, uint8_t pageType, uint32_t after, uint32_t *pageNop) {
+    int rc;
+
+    *pageNop = 0;
+    if (pager->txnState == TXN_NONE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+    if (pageType == UNUSED_PAGE || pageType >= PAGE_TYPE_COUNT) {
+        return FABRICDB_EINVAL;
+    }
+
+    /* Reading the page type map may load pages */
+    if (pager->pageCache->loadLock != NULL) {
+        fdb_lock_mutex(pager->pageCache->loadLock);
+    }
+    rc = pagetypecache_find_next(&pager->pageTypeCache, pager, pageType, after, pageNop);
+    if (pager->pageCache->loadLock != NULL) {
+        fdb_unlock_mutex(pager->pageCache->loadLock);
+    }
+    return rc;
+}
+
+
+/*******************************************************************
+ * Vacuum.
+ *******************************************************************/
+
+/* Most pages an automatic vacuum cuts off the file in one commit */
+#define FDB_AUTO_VACUUM_MAX_PAGES 128
+
+/* Takes a given page off the free list.  A page near it is taken off
+   the list first, which usually is the page itself when the first
+   trunk holds the end of the file.  Otherwise the list is searched
+   for the page and the page that was taken off takes its place. */
+static int free_list_remove(Pager *pager, Page *front_page, uint32_t pageNo) {
+    int rc;
+    uint32_t other;
+    uint32_t trunkNo;
+    uint32_t prevNo = 0;
+    uint32_t count;
+    uint32_t i;
+    Page *trunk;
+    Page *page;
+
+    rc = free_list_take(pager, front_page, pageNo, &other);
+    if (rc != FABRICDB_OK || other == pageNo) {
+        return rc;
+    }
+    if (other == 0) {
+        return FABRICDB_ECORRUPT;
+    }
+
+    trunkNo = pager_get32(front_page->data + FDB_FREE_TRUNK_OFFSET);
+    while (trunkNo != 0) {
+        rc = pager_fetch_page(pager, trunkNo, 0, &trunk);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+
+        /* The other page becomes the trunk */
+        if (trunkNo == pageNo) {
+            trunk->refCount++;
+            rc = pager_fetch_page(pager, other, 0, &page);
+            if (rc == FABRICDB_OK) {
+                rc = fdb_pager_mark_dirty(pager, page);
+            }
+            if (rc == FABRICDB_OK) {
+                memcpy(page->data, trunk->data, trunk->usableSize);
+            }
+            trunk->refCount--;
+            if (rc == FABRICDB_OK && prevNo == 0) {
+                pager_put32(front_page->data + FDB_FREE_TRUNK_OFFSET, other);
+            } else if (rc == FABRICDB_OK) {
+                rc = pager_fetch_page(pager, prevNo, 0, &trunk);
+                if (rc == FABRICDB_OK) {
+                    rc = fdb_pager_mark_dirty(pager, trunk);
+                }
+                if (rc == FABRICDB_OK) {
+                    pager_put32(trunk->data + FREE_TRUNK_NEXT_OFFSET, other);
+                }
+            }
+            return rc;
+        }
+
+        count = pager_get32(trunk->data + FREE_TRUNK_COUNT_OFFSET);
+        if (count > FREE_TRUNK_CAPACITY(trunk->usableSize)) {
+            return FABRICDB_ECORRUPT;
+        }
+        for (i = 0; i < count; i++) {
+            if (pager_get32(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * i) == pageNo) {
+                rc = fdb_pager_mark_dirty(pager, trunk);
+                if (rc == FABRICDB_OK) {
+                    pager_put32(trunk->data + FREE_TRUNK_LEAVES_OFFSET + 4 * i, other);
+                }
+                return rc;
+            }
+        }
+
+        prevNo = trunkNo;
+        trunkNo = pager_get32(trunk->data + FREE_TRUNK_NEXT_OFFSET);
+    }
+
+    /* The page map says the page is free but the list does not have it */
+    return FABRICDB_ECORRUPT;
+}
+
+/* Copies the last page of the file to a free page and tells the owner
+   of its references where it went */
+static int vacuum_relocate(Pager *pager, Page *front_page, uint32_t pageNo, uint8_t pageType) {
+    int rc;
+    uint32_t newPageNo;
+    Page *from;
+    Page *to;
+
+    rc = free_list_take(pager, front_page, 0, &newPageNo);
+    if (rc == FABRICDB_OK && newPageNo == 0) {
+        rc = FABRICDB_ECORRUPT;
+    }
+    if (rc == FABRICDB_OK) {
+        rc = pager_fetch_page(pager, pageNo, 0, &from);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    from->refCount++;
+    rc = pager_fetch_page(pager, newPageNo, 0, &to);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, to);
+    }
+    if (rc == FABRICDB_OK) {
+        memcpy(to->data, from->data, from->usableSize);
+    }
+    from->refCount--;
+
+    if (rc == FABRICDB_OK) {
+        rc = pager_set_page_type(pager, newPageNo, pageType);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = pager->relocate(pager->relocateArg, pageType, pageNo, newPageNo);
+    }
+
+    return rc;
+}
+
+/* Cuts the last page off the database */
+static int vacuum_truncate(Pager *pager, Page *front_page, uint32_t pageNo) {
+    int rc;
+    Page *page;
+    CompressedPage *entry;
+
+    page = pagecache_get(pager->pageCache, pageNo);
+    if (page != NULL && page->refCount > 0) {
+        return FABRICDB_BUSY;
+    }
+
+    rc = pager_set_page_type(pager, pageNo, UNUSED_PAGE);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* Nothing past the end may be written back or served again */
+    if (page != NULL) {
+        pagecache_remove(pager->pageCache, page);
+        pagecache_free_page(pager->pageCache, page);
+    }
+    entry = pagetable_get_or(&pager->compressedCache.map, pageNo, NULL);
+    if (entry != NULL) {
+        compressed_cache_drop(&pager->compressedCache, entry);
+    }
+
+    pager_put32(front_page->data + FDB_PAGE_COUNT_OFFSET, pageNo - 1);
+    return FABRICDB_OK;
+}
+
+/* Shrinks the database by one page if the free list allows it.  A free
+   last page or an empty page type map is cut off.  Any other page is
+   moved into a free page first, which needs a relocator.  *done is set
+   when there is nothing left to reclaim. */
+static int vacuum_step(Pager *pager, Page *front_page, int *done) {
+    int rc = FABRICDB_OK;
+    uint32_t pageNo;
+    uint8_t pageType;
+
+    pageNo = pager_get32(front_page->data + FDB_PAGE_COUNT_OFFSET);
+    *done = pager_get32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET) == 0 || pageNo <= 1;
+    if (*done) {
+        return FABRICDB_OK;
+    }
+
+    pageType = pagetypecache_get_type(&pager->pageTypeCache, pager, pageNo);
+    if (pageType == FREE_PAGE) {
+        rc = free_list_remove(pager, front_page, pageNo);
+    } else if (ALLOCATABLE_PAGE_TYPE(pageType) && pager->relocate != NULL) {
+        rc = vacuum_relocate(pager, front_page, pageNo, pageType);
+    } else if (pageType != P_PAGE) {
+        /* Nothing knows where the references to this page are */
+        *done = 1;
+        return FABRICDB_OK;
+    }
+
+    if (rc == FABRICDB_OK) {
+        rc = vacuum_truncate(pager, front_page, pageNo);
+    }
+    return rc;
+}
+
+static int pager_vacuum(Pager *pager, uint32_t maxPages) {
+    int rc;
+    int done = 0;
+    uint32_t steps;
+    Page *front_page;
+
+    rc = pager_fetch_page(pager, 1, 0, &front_page);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, front_page);
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    front_page->refCount++;
+    for (steps = 0; rc == FABRICDB_OK && !done && (maxPages == 0 || steps < maxPages); steps++) {
+        rc = vacuum_step(pager, front_page, &done);
+    }
+    front_page->refCount--;
+
+    return rc;
+}
+
+/* Runs a bounded vacuum as part of a commit once enough pages are free */
+static int pager_auto_vacuum(Pager *pager, Page *front_page) {
+    uint32_t freeCount = pager_get32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET);
+
+    if (!pager->pragma.autoVacuum || freeCount == 0 || freeCount < pager->pragma.autoVacuumThreshold) {
+        return FABRICDB_OK;
+    }
+    return pager_vacuum(pager, FDB_AUTO_VACUUM_MAX_PAGES);
+}
+
+int fdb_pager_incremental_vacuum(Pager *pager, uint32_t maxPages) {
+    if (pager->txnState != TXN_WRITE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+    return pager_vacuum(pager, maxPages);
+}
+
+int fdb_pager_set_relocator(Pager *pager, FdbPageRelocator relocate, void *arg) {
+    pager->relocate = relocate;
+    pager->relocateArg = arg;
+    return FABRICDB_OK;
+}
+
+int fdb_pager_set_busy_handler(Pager *pager, FdbBusyHandler handler, void *arg) {
+    pager->busyHandler = handler;
+    pager->busyArg = arg;
+    pager->pragma.busyTimeout = 0;
+    return FABRICDB_OK;
+}
+
+
+/*******************************************************************
+ * Transactions.
+ *******************************************************************/
+
+/* Empties the cache and reloads the front page after another
+   connection has changed the database. */
+static int pager_refresh(Pager *pager) {
+    int rc;
+    Page *front_page;
+
+    compressed_cache_clear(&pager->compressedCache);
+    pagetypecache_reset(&pager->pageTypeCache);
+    if (pager->sharedCache != NULL) {
+        /* Other connections may have caught the shared cache up already */
+        fdb_lock_mutex(pager->pageCache->loadLock);
+        rc = pager_load_page(pager, 1, HEADER_PAGE, 0, &front_page);
+        if (rc == FABRICDB_OK) {
+            read_dbstate(&pager->dbstate, front_page->data);
+            rc = sharedcache_put_front_page(pager->sharedCache, front_page);
+        }
+        fdb_unlock_mutex(pager->pageCache->loadLock);
+        return rc;
+    }
+
+    rc = pagecache_clear(pager->pageCache);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    rc = pager_load_page(pager, 1, HEADER_PAGE, 0, &front_page);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+    read_dbstate(&pager->dbstate, front_page->data);
+
+    rc = pagecache_put(pager->pageCache, front_page);
+    if (rc != FABRICDB_OK) {
+        free_page(&pager->pageCache->frames, front_page);
+    }
+
+    return rc;
+}
+
+int fdb_pager_begin_read(Pager *pager) {
+    int rc;
+    int changed = 0;
+    uint32_t changeCounter;
+    uint32_t attempt = 0;
+
+    if (pager->commitError != FABRICDB_OK) {
+        return pager->commitError;
+    }
+    if (pager->txnState != TXN_NONE) {
+        return FABRICDB_OK;
+    }
+
+    do {
+        if (pager->wal != NULL) {
+            rc = fdb_wal_begin_read(pager->wal, &changed);
+        } else {
+            rc = fdb_acquire_shared_lock(pager->dbfh);
+            if (rc == FABRICDB_OK) {
+                rc = fdb_read(pager->dbfh, (uint8_t*)&changeCounter, FDB_CHANGE_COUNTER_OFFSET, 4);
+                if (rc != FABRICDB_OK) {
+                    fdb_unlock(pager->dbfh);
+                }
+                changed = letohu32(changeCounter) != pager->dbstate.fileChangeCounter;
+            }
+        }
+    } while (rc == FABRICDB_BUSY && pager_busy(pager, attempt++));
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    pager->txnState = TXN_READ;
+    if (changed) {
+        rc = pager_refresh(pager);
+        if (rc != FABRICDB_OK) {
+            fdb_pager_end_read(pager);
+        }
+    }
+
+    return rc;
+}
+
+int fdb_pager_get_snapshot(Pager *pager, PagerSnapshot *snapshot) {
+    if (pager->txnState != TXN_READ) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    memset(snapshot, 0, sizeof(PagerSnapshot));
+    snapshot->fileChangeCounter = pager->dbstate.fileChangeCounter;
+    if (pager->wal != NULL) {
+        snapshot->walHeader = pager->wal->hdr;
+    }
+    return FABRICDB_OK;
+}
+
+int fdb_pager_begin_read_snapshot(Pager *pager, const PagerSnapshot *snapshot) {
+    int rc;
+    int changed = 0;
+
+    if (pager->commitError != FABRICDB_OK) {
+        return pager->commitError;
+    }
+    if (pager->txnState != TXN_NONE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
     }
 
-    /* The number of reserved bytes needs to be added to the page size */
-    rc = fdb_read(pager->dbfh, &num_reserved_bytes, FDB_BYTES_RESERVED_OFFSET, 1);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+    /* Journal mode only ever has the current version */
+    if (pager->wal == NULL) {
+        rc = fdb_pager_begin_read(pager);
+        if (rc == FABRICDB_OK && pager->dbstate.fileChangeCounter != snapshot->fileChangeCounter) {
+            fdb_pager_end_read(pager);
+            rc = FABRICDB_SNAPSHOT_EXPIRED;
+        }
+        return rc;
     }
 
-    /* Read the first page */
-    rc = read_page(pager->dbfh, 1, page_size + num_reserved_bytes, page_size, HEADER_PAGE, &front_page);
+    rc = fdb_wal_begin_read_snapshot(pager->wal, &snapshot->walHeader, &changed);
     if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+        return rc;
     }
 
-    fp_data = front_page->data;
+    pager->txnState = TXN_READ;
+    if (changed) {
+        rc = pager_refresh(pager);
+        if (rc != FABRICDB_OK) {
+            fdb_pager_end_read(pager);
+        }
+    }
 
-    /* Read first page and set values from file */
-    pager->dbstate.fileChangeCounter = letohu32(*((uint32_t*)(fp_data + FDB_CHANGE_COUNTER_OFFSET)));
-    pager->dbstate.filePageCount = letohu32(*((uint32_t*)(fp_data + FDB_PAGE_COUNT_OFFSET)));
-    pager->dbstate.fileFreePageCount = letohu32(*((uint32_t*)(fp_data + FDB_FREE_PAGE_COUNT_OFFSET)));
-    pager->dbstate.filePageCount = letohu32(*((uint32_t*)(fp_data + FDB_PAGE_COUNT_OFFSET)));
+    return rc;
+}
 
-    pager->pragma.applicationId = letohu32(*((uint32_t*)(fp_data + FDB_APPLICATION_ID_OFFSET)));
-    pager->pragma.applicationVersion = letohu32(*((uint32_t*)(fp_data + FDB_APPLICATION_VERSION_OFFSET)));
-    pager->pragma.pageSize = page_size;
-    pager->pragma.fileFormatWriteVersion = *((uint8_t*)(fp_data + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET));
-    pager->pragma.fileFormatReadVersion = *((uint8_t*)(fp_data + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET));
-    pager->pragma.bytesReserved = *((uint8_t*)(fp_data + FDB_BYTES_RESERVED_OFFSET));
-    pager->pragma.defCacheSize = *((uint8_t*)(fp_data + FDB_DEFAULT_CACHE_SIZE_OFFSET));
-    pager->pragma.defAutoVacuum = *((uint8_t*)(fp_data + FDB_DEFAULT_AUTO_VACUUM_OFFSET));
-    pager->pragma.defAutoVacuumThreshold = *((uint8_t*)(fp_data + FDB_DEFAULT_AUTO_VACUUM_THRESHOLD_OFFSET));
+void fdb_pager_end_read(Pager *pager) {
+    if (pager->txnState != TXN_READ) {
+        return;
+    }
 
-    pager->pragma.autoVacuum = pager->pragma.defAutoVacuum;
-    pager->pragma.autoVacuumThreshold = pager->pragma.defAutoVacuumThreshold;
-    pager->pragma.cacheSize = pager->pragma.defCacheSize;
+    if (pager->wal != NULL) {
+        fdb_wal_end_read(pager->wal);
+    } else {
+        fdb_unlock(pager->dbfh);
+    }
+    pager->txnState = TXN_NONE;
 
-    /* Initialize the cache */
-    rc = pagecache_create(&pager->pageCache, pager->pragma.cacheSize);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+    /* Between transactions this connection has no pages pinned or dirty */
+    if (fabricdb_mem_over_limit()) {
+        pager_release_locked(pager, 0);
     }
+}
 
-    /* The rest of the front page (after the header) contains data
-       that describes how every page is used.  After this data is
-       read, every lookup by id in the database takes O(1) time
-       because the exact position in the datafile can be calculated.
-       The downside of this is that the page page has to be maintained. */
-    rc = pagetypecache_init(&pager->pageTypeCache);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+int fdb_pager_begin_write(Pager *pager) {
+    int rc;
+    int startedRead = 0;
+    uint32_t attempt = 0;
+
+    if (pager->commitError != FABRICDB_OK) {
+        return pager->commitError;
     }
-    rc = pagetypecache_load(&pager->pageTypeCache, pager, front_page,1,FDB_FILE_HEADER_SIZE);
-    if (rc != FABRICDB_OK) {
-        goto pager_init_done;
+    if (pager->txnState == TXN_WRITE) {
+        return FABRICDB_OK;
     }
-    /* Ignore error code */
-    pagecache_put(&pager->pageCache, front_page);
 
-    pager_init_done:
-    if (page_size != 0) {
-        /* Release lock */
-        fdb_unlock(pager->dbfh);
-    }
+    /* Only a read transaction started here is given up to wait for the
+       writer.  Waiting while holding the caller's own read could hold up
+       the writer for good, and in WAL mode its snapshot stays out of date. */
+    do {
+        if (pager->txnState == TXN_NONE) {
+            rc = fdb_pager_begin_read(pager);
+            if (rc != FABRICDB_OK) {
+                return rc;
+            }
+            startedRead = 1;
+        }
 
-    if(rc != FABRICDB_OK){
-        /* Clean up memory */
-        if (front_page != NULL) {
-            free_page(front_page);
+        if (pager->wal != NULL) {
+            rc = fdb_wal_begin_write(pager->wal);
+        } else {
+            rc = fdb_acquire_reserved_lock(pager->dbfh);
         }
-        if (pager->dbfh != NULL) {
-            fdb_close_file(pager->dbfh);
-            pager->dbfh = NULL;
+        if (rc != FABRICDB_OK && startedRead) {
+            fdb_pager_end_read(pager);
         }
-        pagecache_deinit(&pager->pageCache);
+    } while (rc == FABRICDB_BUSY && startedRead && pager_busy(pager, attempt++));
+    if (rc != FABRICDB_OK) {
+        return rc;
     }
 
-    return rc;
+    /* Readers of a shared cache must not see what is not committed */
+    if (pager->sharedCache != NULL) {
+        pager->pageCache = &pager->localCache;
+    }
+    pager->txnState = TXN_WRITE;
+    return FABRICDB_OK;
 }
 
-int fdb_pager_init(Pager *pager) {
-    int rc;
+static int compare_page_numbers(const void *a, const void *b) {
+    uint32_t x = (*(Page* const*)a)->pageNo;
+    uint32_t y = (*(Page* const*)b)->pageNo;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
 
-    rc = fdb_open_file_rdwr(pager->filePath, &pager->dbfh);
-    if (rc != FABRICDB_OK ) {
-        return rc;
-    }
+/* Adds the dirty pages in the cache to pages, which may be NULL to only
+   count them.  Returns the number of dirty pages. */
+static uint32_t collect_dirty(PageCache *cache, Page **pages) {
+    Page *page;
+    PageList *lists[2];
+    uint32_t count = 0;
+    uint32_t i;
+    int j;
 
-    return fdb_pager_init_from_file(pager);
+    for (i = 0; i < cache->numShards; i++) {
+        lists[0] = &cache->shards[i].probation;
+        lists[1] = &cache->shards[i].protected;
+        for (j = 0; j < 2; j++) {
+            for (page = lists[j]->head; page != NULL; page = page->lruNext) {
+                if (page->dirty) {
+                    if (pages != NULL) {
+                        pages[count] = page;
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
 }
 
-int fdb_pager_init_file(Pager *pager) {
+/* Writes every dirty page, along with an updated front page.  With
+   group commit the log is not synced here, *ticket is set to what has
+   to be passed to fdb_group_sync() instead. */
+static int pager_write_dirty(Pager *pager, uint64_t *ticket) {
     int rc;
+    uint32_t i;
+    uint32_t count;
+    uint32_t pageCount;
     uint32_t v32;
+    uint32_t attempt;
+    off_t fileSize;
+    Page *front_page;
+    Page **pages;
+    WalFrame *frames;
+    PageCache *cache = pager->pageCache;
 
-    uint8_t *buffer = fdbmalloczero(pager->pragma.pageSize + pager->pragma.bytesReserved);
-    if (buffer == NULL) {
-        return FABRICDB_ENOMEM;
+    count = collect_dirty(cache, NULL);
+    if (count == 0) {
+        return FABRICDB_OK;
     }
 
-    /* Create the file */
-    rc = fdb_create_file(pager->filePath, &pager->dbfh);
+    /* The front page records the size of the database and, for readers
+       in journal mode, that it has changed */
+    rc = pager_fetch_page(pager, 1, 0, &front_page);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, front_page);
+    }
+    if (rc == FABRICDB_OK) {
+        front_page->refCount++;
+        rc = pager_auto_vacuum(pager, front_page);
+        front_page->refCount--;
+    }
     if (rc != FABRICDB_OK) {
-        fdbfree(buffer);
         return rc;
     }
 
-    /* Write persistent pragma values */
-    memcpy(buffer, HEADER_STRING, 16);
-    v32 = htoleu32(pager->pragma.applicationId);
-    memcpy(buffer + FDB_APPLICATION_ID_OFFSET, &v32, 4);
-    v32 = htoleu32(pager->pragma.applicationVersion);
-    memcpy(buffer + FDB_APPLICATION_VERSION_OFFSET, &v32, 4);
-    v32 = htoleu32(pager->pragma.pageSize);
-    memcpy(buffer + FDB_PAGE_SIZE_OFFSET, &v32, 4);
-    *(buffer + FDB_FILE_FORMAT_WRITE_VERSION_OFFSET) = pager->pragma.fileFormatWriteVersion;
-    *(buffer + FDB_FILE_FORMAT_READ_VERSION_OFFSET) = pager->pragma.fileFormatReadVersion;
-    *(buffer + FDB_BYTES_RESERVED_OFFSET) = pager->pragma.bytesReserved;
-    *(buffer + FDB_DEFAULT_CACHE_SIZE_OFFSET) = pager->pragma.defCacheSize;
-    *(buffer + FDB_DEFAULT_AUTO_VACUUM_OFFSET) = pager->pragma.defAutoVacuum;
-    *(buffer + FDB_DEFAULT_AUTO_VACUUM_THRESHOLD_OFFSET) = pager->pragma.defAutoVacuumThreshold;
+    /* The allocator and vacuum keep the size on the front page up to date */
+    pageCount = pager_get32(front_page->data + FDB_PAGE_COUNT_OFFSET);
+    count = collect_dirty(cache, NULL);
+    pages = fdbmalloctag(sizeof(Page*) * count, FDB_MEM_PAGER);
+    if (pages == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+    collect_dirty(cache, pages);
+    qsort(pages, count, sizeof(Page*), compare_page_numbers);
+    if (pages[count - 1]->pageNo > pageCount) {
+        pageCount = pages[count - 1]->pageNo;
+    }
 
-    /* Set page count to 1 */
-    v32 = htoleu32(1);
-    memcpy(buffer + FDB_PAGE_COUNT_OFFSET, &v32, 4);
+    v32 = htoleu32(pager->dbstate.fileChangeCounter + 1);
+    memcpy(front_page->data + FDB_CHANGE_COUNTER_OFFSET, &v32, 4);
+    v32 = htoleu32(pageCount);
+    memcpy(front_page->data + FDB_PAGE_COUNT_OFFSET, &v32, 4);
 
-    /* set the first page to HEADER_PAGE */
-    *(buffer + FDB_FILE_HEADER_SIZE) = HEADER_PAGE;
+    for (i = 0; i < count; i++) {
+        stamp_page(pager, pages[i]);
+    }
+
+    if (pager->wal != NULL) {
+        frames = fdbmalloctag(sizeof(WalFrame) * count, FDB_MEM_PAGER);
+        if (frames == NULL) {
+            fdbfree(pages);
+            return FABRICDB_ENOMEM;
+        }
+        for (i = 0; i < count; i++) {
+            frames[i].pageNo = pages[i]->pageNo;
+            frames[i].data = pages[i]->data;
+        }
+        rc = fdb_wal_write_frames(pager->wal, frames, count, pageCount, pager->pragma.groupCommitBatch == 0);
+        if (rc == FABRICDB_OK && pager->pragma.groupCommitBatch > 0) {
+            *ticket = fdb_sync_ticket(pager->jfh);
+        }
+        fdbfree(frames);
+    } else {
+        /* The pending lock keeps new readers out while the old ones finish */
+        attempt = 0;
+        while ((rc = fdb_acquire_exclusive_lock(pager->dbfh)) == FABRICDB_BUSY && pager_busy(pager, attempt)) {
+            attempt++;
+        }
+        if (rc == FABRICDB_OK) {
+            rc = write_pages(pager, pages, count);
+        }
+
+        /* Pages a vacuum cut off are dropped from the file, in WAL mode
+           the checkpoint does this */
+        if (rc == FABRICDB_OK) {
+            rc = fdb_file_size(pager->dbfh, &fileSize);
+        }
+        if (rc == FABRICDB_OK && fileSize > (off_t)pageCount * pager->pageCache->frames.pageSize) {
+            rc = fdb_truncate_file(pager->dbfh, (off_t)pageCount * pager->pageCache->frames.pageSize);
+            if (rc == FABRICDB_OK) {
+                rc = fdb_sync(pager->dbfh);
+            }
+        }
+    }
 
-    /* Write to disk and sync */
-    rc = fdb_write(pager->dbfh, buffer, 0, pager->pragma.pageSize + pager->pragma.bytesReserved);
     if (rc == FABRICDB_OK) {
-        rc = fdb_sync(pager->dbfh);
+        for (i = 0; i < count; i++) {
+            pages[i]->dirty = 0;
+        }
+        pager->dbstate.fileChangeCounter++;
+        pager->dbstate.filePageCount = pageCount;
+        pager->dbstate.fileFreePageCount = pager_get32(front_page->data + FDB_FREE_PAGE_COUNT_OFFSET);
+        pager->dbstate.freeTrunkPage = pager_get32(front_page->data + FDB_FREE_TRUNK_OFFSET);
+        pager->pageTypeCache.dirty = 0;
     }
 
-    fdbfree(buffer);
+    fdbfree(pages);
+    return rc;
+}
+
+int fdb_pager_commit(Pager *pager) {
+    int rc;
+    uint64_t ticket = 0;
+
+    if (pager->txnState != TXN_WRITE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+
+    rc = pager_write_dirty(pager, &ticket);
+    if (rc == FABRICDB_BUSY && pager->wal == NULL) {
+        /* Readers still hold the file, the commit can be retried */
+        return rc;
+    }
     if (rc != FABRICDB_OK) {
-        fdb_close_file(pager->dbfh);
-        pager->dbfh = NULL;
+        fdb_pager_rollback(pager);
         return rc;
     }
 
-    return fdb_pager_init_from_file(pager);
-}
+    /* Other connections may read again once the lock is downgraded */
+    if (pager->sharedCache != NULL) {
+        sharedcache_publish(pager);
+        sharedcache_end_write(pager);
+    }
 
-void fdb_pager_destroy(Pager *pager) {
-    if(pager->filePath) {
-        fdbfree(pager->filePath);
+    if (pager->wal != NULL) {
+        fdb_wal_end_write(pager->wal);
+    } else {
+        fdb_downgrade_lock(pager->dbfh);
     }
-    if (pager->dbfh) {
-        fdb_close_file(pager->dbfh);
+    pager->txnState = TXN_READ;
+    fdb_pager_end_read(pager);
+
+    /* With the write lock released other commits can join this sync.
+       The commit is visible by now, so if the sync fails it can not be
+       rolled back and the connection is done for. */
+    if (ticket != 0) {
+        rc = fdb_group_sync(pager->jfh, ticket, pager->pragma.groupCommitDelay, pager->pragma.groupCommitBatch);
+        if (rc != FABRICDB_OK) {
+            pager->commitError = rc;
+            return rc;
+        }
     }
-    if (pager->jfh) {
-        fdb_close_file(pager->jfh);
+
+    /* Not fatal, a checkpoint that is blocked by readers runs later */
+    if (pager->wal != NULL && pager->pragma.walAutoCheckpoint > 0 &&
+        fdb_wal_pending_frames(pager->wal) >= pager->pragma.walAutoCheckpoint) {
+        fdb_wal_checkpoint(pager->wal, pager->dbfh);
     }
-    pagecache_clear(&pager->pageCache);
-    pagecache_deinit(&pager->pageCache);
-    pagetypecache_deinit(&pager->pageTypeCache);
-    fdbfree(pager);
+
+    return FABRICDB_OK;
 }
 
-int fdb_pager_fetch_page(Pager *pager, uint32_t pageNo, Page** pagep) {
-    int rc = FABRICDB_OK;
-    int pageSize;
-    uint8_t pageType;
-    Page* page = pagecache_get(&pager->pageCache, pageNo);
+void fdb_pager_rollback(Pager *pager) {
+    Page *page;
+    Page *next;
+    PageList *lists[2];
+    uint32_t shard;
+    int i;
 
-    if (page != NULL) {
-        *pagep = page;
-        return rc;
+    if (pager->txnState != TXN_WRITE) {
+        return;
     }
 
-    /* Missed the cache so load it from disc */
-    pageSize = pager->pragma.pageSize + pager->pragma.bytesReserved;
-    pageType = pagetypecache_get_type(&pager->pageTypeCache, pageNo);
-    rc = read_page(pager->dbfh, pageNo, pageSize, pager->pragma.pageSize, pageType, &page);
-    if (pagecache_count(&pager->pageCache) >= pager->pragma.cacheSize) {
-        /* TODO: need to clear the cache, but which to get rid of?? */
+    /* The next fetch of a dropped page reads the committed version */
+    for (shard = 0; shard < pager->pageCache->numShards; shard++) {
+        lists[0] = &pager->pageCache->shards[shard].probation;
+        lists[1] = &pager->pageCache->shards[shard].protected;
+        for (i = 0; i < 2; i++) {
+            page = lists[i]->head;
+            while (page != NULL) {
+                next = page->lruNext;
+                if (page->dirty) {
+                    pagecache_remove(pager->pageCache, page);
+                    pagecache_free_page(pager->pageCache, page);
+                }
+                page = next;
+            }
+        }
     }
 
-    if (rc == FABRICDB_OK) {
-        /* Add it to the cache */
-        rc = pagecache_put(&pager->pageCache, page);
-        if (rc != FABRICDB_OK) {
-            fdbfree(page);
-            page = NULL;
-        }
+    /* Page types changed by the transaction are read back from the map */
+    if (pager->pageTypeCache.dirty) {
+        pagetypecache_reset(&pager->pageTypeCache);
     }
 
-    *pagep = page;
-    return rc;
+    if (pager->sharedCache != NULL) {
+        sharedcache_end_write(pager);
+    }
+
+    if (pager->wal != NULL) {
+        fdb_wal_end_write(pager->wal);
+    } else {
+        fdb_downgrade_lock(pager->dbfh);
+    }
+    pager->txnState = TXN_READ;
+    fdb_pager_end_read(pager);
+}
+
+int fdb_pager_checkpoint(Pager *pager) {
+    if (pager->wal == NULL || pager->txnState != TXN_NONE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+    return fdb_wal_checkpoint(pager->wal, pager->dbfh);
 }
 
 
@@ -724,11 +4195,28 @@ uint8_t fdb_pager_get_auto_vacuum_threshold(Pager *pager) {
 }
 
 int fdb_pager_set_cache_size(Pager *pager, uint32_t num_pages) {
+    FdbMutex *loadLock;
+
     if (!VALID_CACHE_SIZE(num_pages)) {
         return FABRICDB_EMISUSE_PRAGMA;
     }
 
     pager->pragma.cacheSize = num_pages;
+    if (PAGER_INITIALIZED(pager)) {
+        loadLock = pager->pageCache->loadLock;
+        if (loadLock != NULL) {
+            fdb_lock_mutex(loadLock);
+        }
+        /* A shared cache holds as many pages as the last connection asked for */
+        if (pager->sharedCache != NULL) {
+            pager->sharedCache->cacheSize = num_pages;
+        }
+        /* Not fatal, the pool grows on demand as well */
+        pager_reserve_frames(pager, num_pages);
+        if (loadLock != NULL) {
+            fdb_unlock_mutex(loadLock);
+        }
+    }
     return FABRICDB_OK;
 }
 
@@ -736,6 +4224,143 @@ uint32_t fdb_pager_get_cache_size(Pager *pager) {
     return pager->pragma.cacheSize;
 }
 
+int fdb_pager_set_mmap_mode(Pager *pager, uint8_t enabled) {
+    pager->pragma.mmapMode = enabled ? 1 : 0;
+    return FABRICDB_OK;
+}
+
+uint8_t fdb_pager_get_mmap_mode(Pager *pager) {
+    return pager->pragma.mmapMode;
+}
+
+int fdb_pager_set_wal_auto_checkpoint(Pager *pager, uint32_t numFrames) {
+    pager->pragma.walAutoCheckpoint = numFrames;
+    return FABRICDB_OK;
+}
+
+uint32_t fdb_pager_get_wal_auto_checkpoint(Pager *pager) {
+    return pager->pragma.walAutoCheckpoint;
+}
+
+int fdb_pager_set_group_commit(Pager *pager, uint32_t maxDelayUs, uint32_t maxBatch) {
+    pager->pragma.groupCommitDelay = maxDelayUs;
+    pager->pragma.groupCommitBatch = maxBatch;
+    return FABRICDB_OK;
+}
+
+uint32_t fdb_pager_get_group_commit_delay(Pager *pager) {
+    return pager->pragma.groupCommitDelay;
+}
+
+uint32_t fdb_pager_get_group_commit_batch(Pager *pager) {
+    return pager->pragma.groupCommitBatch;
+}
+
+int fdb_pager_set_read_ahead(Pager *pager, uint32_t numPages) {
+    pager->pragma.readAhead = numPages;
+    return FABRICDB_OK;
+}
+
+uint32_t fdb_pager_get_read_ahead(Pager *pager) {
+    return pager->pragma.readAhead;
+}
+
+int fdb_pager_set_page_checksums(Pager *pager, uint8_t enabled) {
+    if (PAGER_INITIALIZED(pager)) {
+        return FABRICDB_EMISUSE_PRAGMA;
+    }
+
+    pager->pragma.pageChecksums = enabled ? 1 : 0;
+    return FABRICDB_OK;
+}
+
+uint8_t fdb_pager_get_page_checksums(Pager *pager) {
+    return pager->pragma.pageChecksums;
+}
+
+int fdb_pager_set_verify_checksums(Pager *pager, uint8_t enabled) {
+    pager->pragma.verifyChecksums = enabled ? 1 : 0;
+    return FABRICDB_OK;
+}
+
+uint8_t fdb_pager_get_verify_checksums(Pager *pager) {
+    return pager->pragma.verifyChecksums;
+}
+
+int fdb_pager_set_compression(Pager *pager, uint8_t compression) {
+    if (PAGER_INITIALIZED(pager)) {
+        return FABRICDB_EMISUSE_PRAGMA;
+    }
+    if (compression != FDB_COMPRESSION_NONE && compression != FDB_COMPRESSION_LZ4) {
+        return FABRICDB_EINVAL;
+    }
+
+    pager->pragma.compression = compression;
+    return FABRICDB_OK;
+}
+
+uint8_t fdb_pager_get_compression(Pager *pager) {
+    return pager->pragma.compression;
+}
+
+int fdb_pager_set_compressed_cache_size(Pager *pager, uint64_t numBytes) {
+    pager->pragma.compressedCacheSize = numBytes;
+    compressed_cache_shrink(&pager->compressedCache, numBytes);
+    return FABRICDB_OK;
+}
+
+uint64_t fdb_pager_get_compressed_cache_size(Pager *pager) {
+    return pager->pragma.compressedCacheSize;
+}
+
+int fdb_pager_set_cache_shards(Pager *pager, uint32_t numShards) {
+    int rc;
+
+    if (pager->txnState != TXN_NONE) {
+        return FABRICDB_EMISUSE_TRANSACTION;
+    }
+    if (numShards > PAGECACHE_MAX_SHARDS) {
+        return FABRICDB_EINVAL;
+    }
+
+    /* A shared cache is split once, by the connection that creates it */
+    if (PAGER_INITIALIZED(pager) && pager->sharedCache == NULL) {
+        rc = pagecache_reshard(pager->pageCache, pager->pragma.cacheSize, numShards);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+    pager->pragma.cacheShards = numShards;
+    return FABRICDB_OK;
+}
+
+uint32_t fdb_pager_get_cache_shards(Pager *pager) {
+    return pager->pragma.cacheShards;
+}
+
+int fdb_pager_set_shared_cache(Pager *pager, uint8_t enabled) {
+    if (PAGER_INITIALIZED(pager)) {
+        return FABRICDB_EMISUSE_PRAGMA;
+    }
+
+    pager->pragma.sharedCache = enabled ? 1 : 0;
+    return FABRICDB_OK;
+}
+
+uint8_t fdb_pager_get_shared_cache(Pager *pager) {
+    return pager->pragma.sharedCache;
+}
+
+int fdb_pager_set_busy_timeout(Pager *pager, uint32_t ms) {
+    fdb_pager_set_busy_handler(pager, ms > 0 ? pager_busy_backoff : NULL, pager);
+    pager->pragma.busyTimeout = ms;
+    return FABRICDB_OK;
+}
+
+uint32_t fdb_pager_get_busy_timeout(Pager *pager) {
+    return pager->pragma.busyTimeout;
+}
+
 
  #ifdef FABRICDB_TESTING
  #include "../test/test_pager.c"
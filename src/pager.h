@@ -21,36 +21,216 @@
 
 #include <stdint.h>
 
+#include "mutex.h"
 #include "os.h"
-#include "ptrmap.h"
-#include "u8array.h"
-#include "u32array.h"
+#include "pagetable.h"
+#include "wal.h"
 
 typedef struct Page {
     uint32_t pageSize;       /* The size of the page - equal to the pragma's pageSize + bytesReserved */
     uint32_t usableSize;     /* Equal to the pragma's pageSize */
     uint32_t pageNo;
-    uint32_t refCount;
+    uint32_t refCount;       /* The page is pinned and will not be evicted while this is > 0 */
     uint8_t *data;           /* The data for the page, identical to what is on disc */
     uint8_t pageType;        /* The type of page this is */
     uint8_t dirty;           /* Set to 1 if the page needs to be written to disc */
+    uint8_t lruList;         /* The replacement list the page is on */
+    uint8_t mapped;          /* Set to 1 if the page was read through the file map */
+    uint8_t prefetched;      /* Set to 1 until a page that was read ahead is first fetched */
+    struct Page *lruPrev;    /* Towards the most recently used end of the list */
+    struct Page *lruNext;    /* Towards the least recently used end of the list */
+    struct Page *frame;      /* Holds a writable copy of a mapped page, or NULL */
+    struct FrameSlab *slab;  /* The slab the page's frame was carved from */
 } Page;
 
-typedef ptrmap PageCache;
+typedef struct PageList {
+    Page *head;              /* Most recently used page */
+    Page *tail;              /* Least recently used page */
+    uint32_t count;
+} PageList;
 
+/*
+ * Pages are carved out of slabs instead of being allocated one at a
+ * time.  A slab holds the Page headers for a run of frames followed by
+ * their data buffers, which start on a FRAME_ALIGNMENT boundary.  When
+ * a page leaves the cache its frame goes on the free list and is reused
+ * by the next read, so a cache miss does not touch the allocator.
+ */
+typedef struct FrameSlab {
+    struct FrameSlab *next;
+    uint32_t numFrames;
+    uint32_t numFree;        /* Frames of this slab on the pool's free list */
+} FrameSlab;
+
+typedef struct FramePool {
+    uint32_t pageSize;       /* The size of the page held in each frame */
+    uint32_t frameSize;      /* Distance between frame buffers */
+    uint32_t numFrames;      /* Number of frames in all slabs */
+    uint32_t numFree;        /* Number of frames on the free list */
+    Page *freeList;          /* Unused frames, linked through lruNext */
+    FrameSlab *slabs;
+} FramePool;
+
+/*
+ * The page cache uses a segmented LRU replacement policy.  A page
+ * that is loaded from disc starts on the probation list and is only
+ * moved to the protected list once it is referenced a second time.
+ * Victims are taken from the probation list first, so a single large
+ * scan can not flush out the pages that are actually being reused.
+ *
+ * Pages are spread over one or more shards by page number, and each
+ * shard has its own lists and evicts its own pages.  When reader
+ * threads share the cache every shard has a lock, so fetches of pages
+ * in different shards do not wait for each other.
+ */
+typedef struct PageCacheShard {
+    FdbMutex *lock;          /* Held while the shard is used, NULL if threads do not share the cache */
+    pagetable map;           /* Maps page numbers to pages */
+    PageList probation;      /* Pages that have been referenced once */
+    PageList protected;      /* Pages that have been referenced more than once */
+    uint64_t hits;           /* Number of fetches served from the shard */
+} PageCacheShard;
+
+typedef struct PageCache {
+    PageCacheShard *shards;
+    uint32_t numShards;      /* A power of two */
+    uint32_t shardBits;      /* log2(numShards) */
+    FdbMutex *loadLock;      /* Held while pages are loaded, NULL if threads do not share the cache */
+    FramePool frames;        /* Where page memory comes from */
+    FramePool mapFrames;     /* Headers (without buffers) for mapped pages */
+    uint64_t misses;         /* Number of fetches that had to read from disc */
+    uint64_t evictions;      /* Number of pages removed to make room for others */
+    uint64_t prefetches;     /* Number of pages read before they were asked for */
+} PageCache;
+
+/*
+ * A page cache shared by every connection in the process that opened
+ * the same file with the shared cache pragma set.  It is found through
+ * the file's inode, so different paths to one file share it too.
+ *
+ * The cached pages are the committed pages of the version of the file
+ * the change counter names.  A connection that finds the file has
+ * moved on when it starts reading empties the cache, which is safe as
+ * no other connection can be reading at that point.  A write
+ * transaction keeps its pages in the connection's own cache, and its
+ * commit copies them over the shared pages before any other
+ * connection can read again.
+ */
+typedef struct SharedCache {
+    PageCache cache;
+    uint32_t cacheSize;          /* Most pages the cache holds */
+    uint32_t fileChangeCounter;  /* The version of the file the cached pages belong to */
+    uint32_t refCount;           /* Connections using the cache */
+} SharedCache;
+
+/*
+ * Clean pages evicted from the cache can be kept compressed in memory,
+ * so that a second read of them costs a decompression instead of a
+ * trip to the file.  A page lives in either the cache or this tier,
+ * never both.
+ */
+typedef struct CompressedPage {
+    uint32_t pageNo;
+    uint32_t size;                      /* Bytes of compressed data */
+    struct CompressedPage *lruPrev;     /* Towards the most recently stored */
+    struct CompressedPage *lruNext;     /* Towards the least recently stored */
+    uint8_t data[];
+} CompressedPage;
+
+typedef struct CompressedCache {
+    pagetable map;           /* Maps page numbers to compressed pages */
+    CompressedPage *head;    /* Most recently stored page */
+    CompressedPage *tail;    /* Least recently stored page, evicted first */
+    uint64_t bytes;          /* Memory held by the stored pages */
+    uint64_t stores;         /* Number of evicted pages kept compressed */
+    uint64_t hits;           /* Number of misses served from this tier */
+} CompressedCache;
+
+/*
+ * In mmap mode clean pages point straight into a shared, read only
+ * mapping of the database file instead of holding a copy of it.  The
+ * mapping is grown as the file grows.  Older mappings are kept until
+ * the pager is destroyed because a caller may still hold a pointer
+ * into one of them.
+ */
+typedef struct RetiredMap {
+    uint8_t *data;
+    off_t size;
+    struct RetiredMap *next;
+} RetiredMap;
+
+typedef struct FileMap {
+    uint8_t *data;           /* The current mapping, NULL if there is none */
+    off_t size;              /* Number of bytes mapped */
+    off_t fileSize;          /* Size of the file when it was last checked */
+    RetiredMap *retired;     /* Mappings replaced by a larger one */
+} FileMap;
+
+/*
+ * Tracks cache misses to spot scans.  A miss continues a scan if it is
+ * for the page after the last one read, or for the next page of the
+ * same type as listed in the PageTypeCache.  Once a scan is spotted the
+ * pages it will want next are read in runs of adjacent pages, and the
+ * window grows each time the scan keeps going.
+ */
+typedef struct ReadAhead {
+    uint32_t lastPageNo;     /* The last page the scan read */
+    uint8_t lastType;        /* The type of lastPageNo */
+    uint8_t byType;          /* 1 if the scan follows a type's page list */
+    uint32_t streak;         /* Misses in a row that continued the scan */
+    uint32_t window;         /* Pages to read the next time the scan misses */
+} ReadAhead;
+
+/* Page types */
+#define HEADER_PAGE 1  /* The type of the first page of the file */
+#define TYPE_PAGE 2    /* A page of type definitions (unused) */
+#define RECORD_PAGE 3  /* A page of record data (unused) */
+#define VERTEX_PAGE 4  /* A page of vertex data */
+#define EDGE_PAGE 5    /* A page of edge data */
+#define SYMBOL_PAGE 6  /* A page of symbol data */
+#define STRING_PAGE 7  /* A page for string data */
+#define DOC_PAGE 8     /* For document data */
+#define ARR_PAGE 9     /* For array data */
+#define IND_PAGE 10    /* For indexes */
+#define P_PAGE   11    /* Keeps track of page types */
+#define CONT_PAGE 12   /* A continuation page */
+#define FREE_PAGE 13   /* A free page */
+
+#define UNUSED_PAGE 0  /* A page that has never been used */
+#define PAGE_TYPE_COUNT 14
+
+/*
+ * The type of every page, kept in memory so a page's type is known
+ * before the page is read.  Types take four bits per page, in segments
+ * of 4096 pages that are only allocated once a page in them has a type.
+ * For each type a summary bitmap has one bit per block of 64 pages that
+ * holds a page of the type, so the next page of a type can be found
+ * without looking at the pages in between.  The map in the file is read
+ * one map page at a time, the first time one of the pages it describes
+ * is looked up.
+ */
 typedef struct PageTypeCache {
-    u8array allPages;
-    u32array pageTypes[14];
-    uint8_t dirty;
+    uint8_t **types;                     /* Segments of two page types per byte */
+    uint64_t *blocks[PAGE_TYPE_COUNT];   /* Blocks that hold a page of each type */
+    uint64_t *loaded;                    /* Map pages that have been read */
+    uint32_t capacity;                   /* The number of pages there is room for */
+    uint32_t maxPage;                    /* The highest page that has a type */
+    uint32_t usableSize;                 /* The map bytes on a map page */
+    uint8_t dirty;                       /* 1 if a transaction changed a type */
 } PageTypeCache;
 
 typedef struct DBState {
     uint32_t fileChangeCounter;   /* Incremented every time a write transaction completes */
     uint32_t filePageCount;       /* The number of pages contained in the file */
     uint32_t fileFreePageCount;   /* The number of pages that are no longer in use */
+    uint32_t freeTrunkPage;       /* The first page of the free list, 0 if there are no free pages */
     uint32_t schemaCookie;        /* Tracks changes to the database schema */
 } DBState;
 
+/* How pages are compressed in the database file */
+#define FDB_COMPRESSION_NONE 0
+#define FDB_COMPRESSION_LZ4 1
+
 typedef struct Pragma {
     /* Persistent pragmas
        Thes can only be set when creating a new database file and can not
@@ -59,12 +239,14 @@ typedef struct Pragma {
     uint32_t applicationId;            /* Application defined idenitifier */
     uint32_t applicationVersion;       /* Application definfed version number */
     uint32_t pageSize;                 /* The size of a database page */
-    uint8_t fileFormatWriteVersion;    /* Always 1, for now : 1 = journal */
-    uint8_t fileFormatReadVersion;     /* Always 1, for now : 1 = journal */
+    uint8_t fileFormatWriteVersion;    /* 1 = journal, 2 = write-ahead log */
+    uint8_t fileFormatReadVersion;     /* 1 = journal, 2 = write-ahead log */
     uint8_t bytesReserved;             /* The number of bytes reserved at the end of each page, typically 0 */
     uint8_t defCacheSize;              /* The suggested cache size */
     uint8_t defAutoVacuum;             /* Suggestion for whether the database should be automatically vacuumed */
     uint8_t defAutoVacuumThreshold;    /* Suggestion for the number of empty pages before a vacuum operation is run */
+    uint8_t pageChecksums;             /* Whether every page ends with a CRC32C of its contents */
+    uint8_t compression;               /* How pages are compressed in the file, FDB_COMPRESSION_* */
 
     /* Non-persistent pragmas
        These can be altered at run time and do not persist across
@@ -73,16 +255,66 @@ typedef struct Pragma {
     uint8_t autoVacuum;               /* Whether or not to automatically vacuum */
     uint8_t autoVacuumThreshold;      /* The number of free pages that will trigger a vacuum operation */
     uint32_t cacheSize;               /* The number of pages the cache will hold */
+    uint8_t mmapMode;                 /* Whether or not to read pages through a memory map */
+    uint32_t walAutoCheckpoint;       /* Checkpoint once the log holds this many frames, 0 = never */
+    uint32_t groupCommitDelay;        /* Microseconds a commit waits for others to share its sync */
+    uint32_t groupCommitBatch;        /* Most commits that share a sync, 0 = sync alone */
+    uint32_t readAhead;               /* Most pages a scan reads ahead, 0 = no read-ahead */
+    uint8_t verifyChecksums;          /* Whether page checksums are checked when pages are read */
+    uint64_t compressedCacheSize;     /* Bytes kept for compressed evicted pages, 0 = none */
+    uint32_t cacheShards;             /* Shards reader threads fetch from at once, 0 = one thread */
+    uint8_t sharedCache;              /* Whether connections to the same file share one page cache */
+    uint32_t busyTimeout;             /* Milliseconds to wait for a busy lock, 0 = fail at once */
 } Pragma;
 
+/*
+ * Called when a vacuum moves a page, so that whatever refers to the
+ * page can be pointed at its new place.  Returns FABRICDB_OK, or an
+ * error code that fails the vacuum.
+ */
+typedef int (*FdbPageRelocator)(void *arg, uint8_t pageType, uint32_t fromPageNo, uint32_t toPageNo);
+
+/*
+ * Called when a lock on the database is held by another connection.
+ * attempt counts the calls made while waiting for the same lock,
+ * starting at 0.  Returns non-zero to try the lock again, or 0 to give
+ * up and return FABRICDB_BUSY.
+ */
+typedef int (*FdbBusyHandler)(void *arg, uint32_t attempt);
+
+/*
+ * A committed version of the database that read transactions can be
+ * started on again later, see fdb_pager_get_snapshot().
+ */
+typedef struct PagerSnapshot {
+    uint32_t fileChangeCounter;  /* The file change counter of the version */
+    WalIndexHeader walHeader;    /* The end of the version in the log, WAL mode only */
+} PagerSnapshot;
+
 typedef struct Pager {
     char* filePath;
     FileHandle *dbfh;          /* File handle for the database */
     FileHandle *jfh;           /* File handle for the journal */
     DBState dbstate;
     Pragma pragma;
-    PageCache pageCache;
+    PageCache *pageCache;      /* The cache pages are fetched from, localCache or the shared cache */
+    PageCache localCache;      /* The connection's own cache, and the write transaction's if the cache is shared */
+    SharedCache *sharedCache;  /* NULL unless the cache is shared with other connections */
     PageTypeCache pageTypeCache;
+    FileMap fileMap;
+    ReadAhead readAhead;
+    FdbIoQueue *ioq;           /* Reads and writes kept in flight together, opened on first use */
+    CompressedCache compressedCache;
+    uint8_t *compressBuffer;   /* One page of scratch space for compression, allocated on first use */
+    FdbPageRelocator relocate; /* Updates references to pages moved by a vacuum, NULL if none */
+    void *relocateArg;
+    FdbBusyHandler busyHandler; /* Decides whether to wait for a busy lock, NULL to fail at once */
+    void *busyArg;
+    uint64_t busyDeadline;     /* When the default busy handler gives up, in microseconds */
+    uint64_t busyRandom;       /* Jitter for the default busy handler's backoff */
+    Wal *wal;                  /* The write-ahead log, NULL in journal mode */
+    int commitError;           /* A commit others may have seen failed to sync, later transactions fail with it */
+    uint8_t txnState;          /* No transaction, reading or writing */
 } Pager;
 
 
@@ -138,6 +370,349 @@ int fdb_pager_init_file(Pager *pager);
  */
 void fdb_pager_destroy(Pager *pager);
 
+/**
+ * Fetches a page from the database.
+ *
+ * The page is returned from the page cache if it is there, otherwise
+ * it is read from the database file and added to the cache.  If the
+ * cache is full, an unpinned page is evicted first.  During a write
+ * transaction, and always in WAL mode, dirty pages stay resident until
+ * the transaction ends and the cache grows instead of evicting them.
+ * Otherwise dirty pages are written back to the database file before
+ * they are evicted.
+ *
+ * The returned page is owned by the cache.  Unless it is pinned with
+ * fdb_pager_pin_page(), it may be evicted by any later call to this
+ * function.
+ *
+ * Once the cache is split into shards with fdb_pager_set_cache_shards()
+ * several threads may fetch pages from one read transaction at once.
+ * The page is then returned pinned and must be handed back with
+ * fdb_pager_release_page().
+ *
+ * @param pager The pager structure for a database connection.
+ * @param pageNo The number of the page to fetch, starting at 1.
+ * @param pagep OUT A pointer to where the page pointer will be stored.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_fetch_page(Pager *pager, uint32_t pageNo, Page **pagep);
+
+/**
+ * Unpins a page returned by fdb_pager_fetch_page() while the cache is
+ * split into shards, after which the page may be evicted.  Does
+ * nothing otherwise.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param page A page returned by fdb_pager_fetch_page().
+ */
+void fdb_pager_release_page(Pager *pager, Page *page);
+
+/**
+ * Pins a page so it stays in the cache, and page->data stays valid,
+ * until it is unpinned.  Records can then be decoded straight from the
+ * page while other pages are fetched.  Pins nest, a page is unpinned
+ * once fdb_pager_unpin_page() has been called as often as this.
+ *
+ * Every pin must be dropped before the transaction ends, as a commit
+ * or rollback may empty the cache.  In mmap mode fdb_pager_mark_dirty()
+ * moves page->data to a private copy, so pointers into the page should
+ * be taken after it has been marked dirty.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param page A page returned by fdb_pager_fetch_page().
+ */
+void fdb_pager_pin_page(Pager *pager, Page *page);
+
+/**
+ * Drops a pin taken with fdb_pager_pin_page().
+ *
+ * @param pager The pager structure for a database connection.
+ * @param page A page pinned with fdb_pager_pin_page().
+ */
+void fdb_pager_unpin_page(Pager *pager, Page *page);
+
+/**
+ * Reads a range of pages into the cache ahead of a scan.
+ *
+ * Pages that are already cached are skipped and the rest are read in
+ * one call per run of adjacent pages.  At most half of the cache outside
+ * the protected list is filled, the operating system is told the rest
+ * of the range will be needed soon.  Like a fetch, this may evict
+ * unpinned pages.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param first The first page of the range.
+ * @param count The number of pages in the range.  Pages past the end
+ *        of the database are ignored.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_prefetch(Pager *pager, uint32_t first, uint32_t count);
+
+/**
+ * Frees the memory the pager's cache can do without.
+ *
+ * The compressed tier is emptied and every unpinned page is evicted,
+ * except dirty pages in WAL mode or during a write transaction.
+ * Otherwise a dirty page is written to the file first, as it would be
+ * to make room for another.
+ * The frames the pages were in are given back a slab at a time.
+ *
+ * A pager also does this by itself, until the library is back under
+ * its soft heap limit, when it misses its cache or ends a transaction
+ * while over the limit (see fabricdb_set_soft_heap_limit()).  Calling
+ * this lets an application shed the memory of connections that are
+ * idle.  Like every other call, it must not run while another thread
+ * uses the pager.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return FABRICDB_OK on success, other status code if a dirty page
+ *         could not be written.
+ */
+int fdb_pager_release_memory(Pager *pager);
+
+/**
+ * Marks a page as modified so it is written back to the database file.
+ *
+ * This must be called before a page's data is changed.  In mmap mode
+ * the data of a clean page points into a read only mapping of the file,
+ * so it is first copied into a buffer owned by the cache and page->data
+ * is moved to the copy.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param page A page returned by fdb_pager_fetch_page().
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_mark_dirty(Pager *pager, Page *page);
+
+/**
+ * Allocates a page for new data.
+ *
+ * A page is taken from the free list if there is one, preferring a
+ * free page close to hint, otherwise the database grows by a page.
+ * Only the first trunk page of the free list is searched for a page
+ * near the hint, so allocation touches a fixed number of pages however
+ * large the list is.  The page's type is recorded in the page type map
+ * and the returned page is dirty and zero filled.
+ *
+ * This must be called inside a write transaction.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param pageType The type of the new page, e.g. VERTEX_PAGE or EDGE_PAGE.
+ * @param hint A page the new page should be close to, 0 for any page.
+ * @param pagep OUT A pointer to where the page pointer will be stored.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_allocate_page(Pager *pager, uint8_t pageType, uint32_t hint, Page **pagep);
+
+/**
+ * Returns a page to the free list so a later allocation can reuse it.
+ *
+ * The page's type becomes FREE_PAGE.  Its contents are not kept, and
+ * the database file does not shrink.
+ *
+ * This must be called inside a write transaction.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param pageNo A page handed out by fdb_pager_allocate_page().
+ * @return FABRICDB_OK on success, FABRICDB_EINVAL if the page is not
+ *         an allocated page, other status code on failure.
+ */
+int fdb_pager_free_page(Pager *pager, uint32_t pageNo);
+
+/**
+ * Finds the first page of a type after a given page.
+ *
+ * Pages come back in page number order, so every page of a type can be
+ * visited by starting after page 0 and passing each page found back
+ * in.  Only the page type map pages the search reaches are read.
+ *
+ * This must be called inside a transaction.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param pageType The type of page to look for, e.g. VERTEX_PAGE.
+ * @param after The page to start after, 0 to start at the front.
+ * @param pageNop OUT The page found, 0 if there are no more.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_next_page(Pager *pager, uint8_t pageType, uint32_t after, uint32_t *pageNop);
+
+/**
+ * Shrinks the database file by up to maxPages pages.
+ *
+ * Free pages and empty page type map pages at the end of the file are
+ * cut off.  Other pages at the end are copied into free pages lower
+ * down and the relocator set with fdb_pager_set_relocator() is told
+ * where they went.  Without a relocator the vacuum stops at the first
+ * such page.  The file itself shrinks when the transaction commits, or
+ * in WAL mode at the next checkpoint.
+ *
+ * When autoVacuum is on, each commit that leaves at least
+ * autoVacuumThreshold free pages runs a vacuum of a bounded size.
+ *
+ * This must be called inside a write transaction.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param maxPages The most pages to cut off, 0 for no limit.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_incremental_vacuum(Pager *pager, uint32_t maxPages);
+
+/**
+ * Sets the function that updates references to pages moved by a vacuum.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param relocate The function to call, NULL if pages can not be moved.
+ * @param arg Passed to every call of relocate.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_set_relocator(Pager *pager, FdbPageRelocator relocate, void *arg);
+
+/**
+ * Sets the function called when a lock on the database can not be
+ * taken because another connection holds it.  This replaces the
+ * handler of fdb_pager_set_busy_timeout().
+ *
+ * The handler is called when a read transaction starts, when a write
+ * transaction that also starts its read transaction begins, and when a
+ * journal mode commit waits for readers to finish.  A connection that
+ * already reads and wants to write is not made to wait, as the writer
+ * in its way may be waiting for it to finish reading.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param handler The function to call, NULL to return FABRICDB_BUSY
+ *        at once.
+ * @param arg Passed to every call of handler.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_set_busy_handler(Pager *pager, FdbBusyHandler handler, void *arg);
+
+/**
+ * Starts a read transaction.
+ *
+ * Every page fetched during the transaction comes from the same
+ * snapshot of the database.  If another connection has committed
+ * since the last transaction the page cache is emptied first.
+ *
+ * In WAL mode (file format write version 2) readers never wait for
+ * the writer, and pages can only be fetched inside a transaction.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return FABRICDB_OK on success, FABRICDB_BUSY if the database is
+ *         locked, other status code on failure.
+ */
+int fdb_pager_begin_read(Pager *pager);
+
+/**
+ * Ends a read transaction.
+ *
+ * A write transaction must be committed or rolled back instead.
+ *
+ * @param pager The pager structure for a database connection.
+ */
+void fdb_pager_end_read(Pager *pager);
+
+/**
+ * Saves the snapshot the current read transaction is reading, so more
+ * read transactions, on this or other connections to the file, can
+ * see exactly the same version of the database.
+ *
+ * A long traversal can then be split into short read transactions
+ * that do not hold up checkpoints between them, or spread over several
+ * connections that each read part of it.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param snapshot OUT Where the snapshot is stored.
+ * @return FABRICDB_OK on success, FABRICDB_EMISUSE_TRANSACTION if no
+ *         read transaction is open.
+ */
+int fdb_pager_get_snapshot(Pager *pager, PagerSnapshot *snapshot);
+
+/**
+ * Starts a read transaction on a snapshot saved with
+ * fdb_pager_get_snapshot().
+ *
+ * In WAL mode older versions of pages are kept in the log, so the
+ * snapshot can be read while writers carry on committing, until a
+ * checkpoint copies newer pages over it into the database file.  While
+ * a transaction has it open, checkpoints stop short of it.  In journal
+ * mode there is only the current version, so the snapshot expires with
+ * the next commit.
+ *
+ * Writes can not be made from an older snapshot, fdb_pager_begin_write()
+ * returns FABRICDB_BUSY.
+ *
+ * @param pager The pager structure for a database connection, without
+ *        a transaction open.
+ * @param snapshot The snapshot to read.
+ * @return FABRICDB_OK on success, FABRICDB_SNAPSHOT_EXPIRED if the
+ *         snapshot can no longer be read, FABRICDB_BUSY if the database
+ *         is locked, other status code on failure.
+ */
+int fdb_pager_begin_read_snapshot(Pager *pager, const PagerSnapshot *snapshot);
+
+/**
+ * Starts a write transaction.
+ *
+ * A read transaction is started first if one is not open.  There is
+ * only one writer at a time.  In WAL mode FABRICDB_BUSY is also
+ * returned if another connection committed after the read transaction
+ * started, the read transaction has to be ended before trying again.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return FABRICDB_OK on success, FABRICDB_BUSY if another connection
+ *         is writing, other status code on failure.
+ */
+int fdb_pager_begin_write(Pager *pager);
+
+/**
+ * Commits the write transaction and ends it.
+ *
+ * Dirty pages are written in page number order.  In WAL mode they are
+ * appended to the log and the log is checkpointed once it holds more
+ * than walAutoCheckpoint frames.
+ *
+ * With group commit on (the default) the write lock is released before
+ * the log is synced, so commits from other threads can be appended
+ * while this one waits and then share a single sync.  The commit may be
+ * seen by other connections before it is durable, but this function
+ * does not return until it is.  With group commit off the log is
+ * synced before the commit becomes visible.
+ *
+ * If that sync fails the commit can no longer be taken back, other
+ * connections may already have read it.  The error is returned, and
+ * from then on the connection is unusable.  Every transaction it starts
+ * fails with the same error, so it has to be destroyed.  Every other
+ * commit still waiting to sync to the log fails with it too.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_commit(Pager *pager);
+
+/**
+ * Throws away the changes made in the write transaction and ends it.
+ *
+ * Dirty pages never reach the database file or the log before the
+ * commit, so dropping them from the cache is all it takes.
+ *
+ * @param pager The pager structure for a database connection.
+ */
+void fdb_pager_rollback(Pager *pager);
+
+/**
+ * Copies the pages in the write-ahead log back into the database file.
+ *
+ * Frames that are still part of another connection's snapshot are
+ * left for a later checkpoint.
+ *
+ * @param pager The pager structure for a database connection, without
+ *        a transaction open.
+ * @return FABRICDB_OK on success, FABRICDB_BUSY if another connection is
+ *         checkpointing, FABRICDB_EMISUSE_TRANSACTION if a transaction is
+ *         open or the database is not in WAL mode.
+ */
+int fdb_pager_checkpoint(Pager *pager);
+
 /**
  * Sets the page size for the database.
  *
@@ -225,8 +800,7 @@ uint32_t fdb_pager_get_application_id(Pager *pager);
 /**
  * Sets the databases file format write version.
  *
- * Currently this value must be 1.  It exists to support future updates
- * to the library.
+ * 1 uses a rollback journal, 2 uses a write-ahead log.
  *
  * This value may only be set when a new database is being created.
  *
@@ -252,8 +826,7 @@ uint8_t fdb_pager_get_file_format_write_version(Pager *pager);
 /**
  * Sets the databases file format read version.
  *
- * Currently this value must be 1.  It exists to support future updates
- * to the library.
+ * This must match the write version.
  *
  * This value may only be set when a new database is being created.
  *
@@ -304,7 +877,9 @@ uint8_t fdb_pager_get_bytes_reserved_space(Pager *pager);
  * Sets whether or not the connection should use auto vacuum.
  *
  * A database that uses auto vacuum will remove empty database
- * pages as soon as a set threshold is reached.
+ * pages as soon as a set threshold is reached.  Each commit shrinks
+ * the file by a bounded number of pages, see
+ * fdb_pager_incremental_vacuum().
  *
  * The default value is 0.
  *
@@ -378,7 +953,9 @@ uint32_t fdb_pager_get_def_cache_size(Pager *pager);
  * Sets whether or not the connection should use auto vacuum.
  *
  * A database that uses auto vacuum will remove empty database
- * pages as soon as a set threshold is reached.
+ * pages as soon as a set threshold is reached.  Each commit shrinks
+ * the file by a bounded number of pages, see
+ * fdb_pager_incremental_vacuum().
  *
  * The default value is 0.
  *
@@ -448,4 +1025,302 @@ int fdb_pager_set_cache_size(Pager *pager, uint32_t num_pages);
  */
 uint32_t fdb_pager_get_cache_size(Pager *pager);
 
+/**
+ * Sets whether pages are read through a memory map of the database file.
+ *
+ * In mmap mode clean pages share memory with the operating system's
+ * file cache instead of being copied into the page cache.  Pages that
+ * are already cached are not affected.
+ *
+ * This is a non-persistent pragma and is off by default.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param enabled 1 to read pages through a memory map, 0 to copy them.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_mmap_mode(Pager *pager, uint8_t enabled);
+
+/**
+ * Gets whether pages are read through a memory map.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return 1 if mmap mode is on, 0 otherwise.
+ */
+uint8_t fdb_pager_get_mmap_mode(Pager *pager);
+
+/**
+ * Sets how many frames the write-ahead log may hold before a commit
+ * checkpoints it.
+ *
+ * This is a non-persistent pragma.  The default value is 1000.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param numFrames The number of frames, 0 to never checkpoint
+ *        automatically.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_wal_auto_checkpoint(Pager *pager, uint32_t numFrames);
+
+/**
+ * Gets the number of frames that triggers an automatic checkpoint.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The number of frames, 0 if automatic checkpoints are off.
+ */
+uint32_t fdb_pager_get_wal_auto_checkpoint(Pager *pager);
+
+/**
+ * Sets how committers in WAL mode share syncs of the log.
+ *
+ * The first commit to need a sync waits up to maxDelayUs for up to
+ * maxBatch commits (itself included) to be ready, then syncs once for
+ * all of them.  Commits that arrive while a sync is running share the
+ * next one even with no delay.  A larger delay gives bigger batches and
+ * fewer syncs at the cost of commit latency.
+ *
+ * This is a non-persistent pragma.  The defaults are 0 and 64.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param maxDelayUs The longest time to wait for a batch to fill.
+ * @param maxBatch The batch size that ends the wait early, 0 to turn
+ *        group commit off.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_group_commit(Pager *pager, uint32_t maxDelayUs, uint32_t maxBatch);
+
+/**
+ * Gets the longest time a commit waits for a batch to fill.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The delay in microseconds.
+ */
+uint32_t fdb_pager_get_group_commit_delay(Pager *pager);
+
+/**
+ * Gets the batch size that ends a group commit wait.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The batch size, 0 if group commit is off.
+ */
+uint32_t fdb_pager_get_group_commit_batch(Pager *pager);
+
+/**
+ * Sets the most pages read ahead when a fetch misses the cache during
+ * a scan.
+ *
+ * Scans are spotted from misses for adjacent pages, or for pages of
+ * the same type in page number order.  The read-ahead window starts
+ * small and doubles up to this limit while the scan goes on.  It never
+ * takes more than half of the cache outside the protected list.
+ *
+ * This is a non-persistent pragma.  The default value is 32.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param numPages The most pages to read ahead, 0 to turn read-ahead off.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_read_ahead(Pager *pager, uint32_t numPages);
+
+/**
+ * Gets the most pages read ahead during a scan.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The number of pages, 0 if read-ahead is off.
+ */
+uint32_t fdb_pager_get_read_ahead(Pager *pager);
+
+/**
+ * Sets whether every page of the database carries a checksum.
+ *
+ * The checksum is a CRC32C of the page and its page number, stored
+ * in the last 4 bytes of the reserved space at the end of the page.
+ * If fewer than 4 bytes are reserved when the file is created, 4 are
+ * reserved.  A page whose checksum does not match fails to load with
+ * FABRICDB_ECHECKSUM.
+ *
+ * This value may only be set when a new database is being created.
+ * The default is 0.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param enabled 1 to checksum pages, 0 not to.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_set_page_checksums(Pager *pager, uint8_t enabled);
+
+/**
+ * Gets whether the pages of the database carry checksums.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return 1 if pages carry checksums, otherwise 0.
+ */
+uint8_t fdb_pager_get_page_checksums(Pager *pager);
+
+/**
+ * Sets whether page checksums are checked when pages are read.
+ *
+ * Pages are still stamped with checksums when they are written.
+ *
+ * This is a non-persistent pragma.  The default value is 1.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param enabled 1 to check checksums on read, 0 not to.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_verify_checksums(Pager *pager, uint8_t enabled);
+
+/**
+ * Gets whether page checksums are checked when pages are read.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return 1 if checksums are checked, otherwise 0.
+ */
+uint8_t fdb_pager_get_verify_checksums(Pager *pager);
+
+/**
+ * Sets how pages are compressed in the database file.
+ *
+ * With FDB_COMPRESSION_LZ4 a page that shrinks by at least an eighth
+ * is written compressed at the start of its usual place in the file.
+ * The rest of that place is zero filled and handed back to the file
+ * system where it supports holes, so the file keeps its layout but
+ * takes less disc space.  This only saves space when pages are larger
+ * than the file system block.  The front page is never compressed,
+ * and in mmap mode pages are read rather than mapped.
+ *
+ * Whether a page is stored compressed is recorded in one reserved byte,
+ * just before the checksum if pages carry one.  A byte is reserved for
+ * it when the file is created if there is no room for it.  A compressed
+ * page whose image is damaged fails to load with FABRICDB_ECORRUPT.
+ *
+ * This value may only be set when a new database is being created.
+ * The default is FDB_COMPRESSION_NONE.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param compression FDB_COMPRESSION_NONE or FDB_COMPRESSION_LZ4.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_pager_set_compression(Pager *pager, uint8_t compression);
+
+/**
+ * Gets how pages are compressed in the database file.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return FDB_COMPRESSION_NONE or FDB_COMPRESSION_LZ4.
+ */
+uint8_t fdb_pager_get_compression(Pager *pager);
+
+/**
+ * Sets the memory used to keep clean pages compressed after they are
+ * evicted from the cache.
+ *
+ * A miss on a page held in this tier decompresses it instead of
+ * reading the file.  Pages that do not shrink by at least an eighth
+ * are not kept.  The least recently stored pages are dropped first.
+ * This tier works whether or not the file itself is compressed.
+ *
+ * This is a non-persistent pragma.  The default value is 0.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param numBytes The most bytes of compressed pages, 0 to turn the tier off.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_compressed_cache_size(Pager *pager, uint64_t numBytes);
+
+/**
+ * Gets the memory used to keep evicted pages compressed.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The number of bytes, 0 if the tier is off.
+ */
+uint64_t fdb_pager_get_compressed_cache_size(Pager *pager);
+
+/**
+ * Splits the page cache into shards so that several threads can fetch
+ * pages at once.
+ *
+ * A hit only locks the shard the page belongs to.  Misses are still
+ * read one at a time.  Each shard evicts on its own, so the rounded up
+ * number of shards should be well below the cache size.  Only reads
+ * may run on several threads, a write transaction needs the pager to
+ * itself.  A shared cache is split by the connection that creates it
+ * and keeps its shards until the last connection to it closes.
+ *
+ * This is a non-persistent pragma and can not be changed during a
+ * transaction.  The default value is 0.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param numShards The number of shards, rounded up to a power of two,
+ *                  at most 64.  0 for a cache used by one thread, which
+ *                  takes no locks.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_cache_shards(Pager *pager, uint32_t numShards);
+
+/**
+ * Gets the number of shards the page cache was asked to be split into.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The number of shards, 0 if the cache is used by one thread.
+ */
+uint32_t fdb_pager_get_cache_shards(Pager *pager);
+
+/**
+ * Sets whether the connection shares its page cache with the other
+ * connections in the process that have the same file open, so a page
+ * that several of them read is only held once.
+ *
+ * Connections that share the cache may run on different threads.  They
+ * have to be in a transaction to fetch pages, and must hand every page
+ * back with fdb_pager_release_page(), also the pages fetched before a
+ * write transaction was begun.  The pages of a write transaction are
+ * kept in the connection's own cache until it commits.  The cache is
+ * not shared in WAL mode, where readers may see different versions of
+ * the file, and pages are never read through a mapping of the file.
+ *
+ * This is a non-persistent pragma that has to be set before the pager
+ * is initialized.  The default value is 0.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param enabled 1 to share the cache, 0 to keep one of its own.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_shared_cache(Pager *pager, uint8_t enabled);
+
+/**
+ * Gets whether the connection shares its page cache.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return 1 if the cache is shared, or will be once the pager is initialized.
+ */
+uint8_t fdb_pager_get_shared_cache(Pager *pager);
+
+/**
+ * Sets how long to wait for a lock held by another connection before
+ * returning FABRICDB_BUSY.
+ *
+ * The lock is tried again after a delay that starts at 50 microseconds
+ * and doubles with every attempt, up to 20 milliseconds.  Each delay is
+ * picked at random from the upper half of that range, so connections
+ * that found the lock busy at the same time do not all retry together.
+ * This installs the busy handler, see fdb_pager_set_busy_handler() for
+ * when it is called.
+ *
+ * This is a non-persistent pragma.  The default value is 0.
+ *
+ * @param pager The pager structure for a database connection.
+ * @param ms The longest wait in milliseconds, 0 to return
+ *        FABRICDB_BUSY at once.
+ * @return FABRIC_OK on success, other status code on failure.
+ */
+int fdb_pager_set_busy_timeout(Pager *pager, uint32_t ms);
+
+/**
+ * Gets how long the connection waits for a busy lock.
+ *
+ * @param pager The pager structure for a database connection.
+ * @return The timeout in milliseconds, 0 if it does not wait or a
+ *         busy handler of the caller's own is set.
+ */
+uint32_t fdb_pager_get_busy_timeout(Pager *pager);
+
 #endif /* __FABRICDB_PAGER_H */
@@ -0,0 +1,346 @@
+/*****************************************************************
+ * FabricDB Library pagetable Implementation
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Generated: 2016-07-04
+ * Author: Mark Wardle
+ *
+ ******************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include "pagetable.h"
+#include "fabric.h"
+#include "mem.h"
+
+/* Slots store their probe distance plus one so that zero means empty.
+   Slots in the old table that have been migrated or removed keep their
+   distance, so lookups can still probe past them, but are flagged. */
+#define pagetable_MOVED 0x80000000
+#define pagetable_DIST(s) ((s)->dist & ~pagetable_MOVED)
+#define pagetable_MIN_SIZE 8
+#define pagetable_MIGRATE_STEP 4
+
+/* Maximum fill before growing, in eighths */
+#define pagetable_MAX_FILL 7
+
+static inline uint32_t pagetable_index(uint32_t key, uint32_t shift) {
+    /* Fibonacci hashing spreads sequential page numbers apart */
+    return (uint32_t)(key * 2654435769u) >> shift;
+}
+
+/* Rounds up to a power of 2 that can hold count items */
+static inline uint32_t pagetable_round_size(uint32_t size, uint32_t count, uint32_t *shift) {
+    uint32_t rounded = pagetable_MIN_SIZE;
+    *shift = 29;
+    while ((rounded < size || (uint64_t)count * 8 >= (uint64_t)rounded * pagetable_MAX_FILL) && rounded < 0x80000000u) {
+        rounded <<= 1;
+        (*shift)--;
+    }
+    return rounded;
+}
+
+/* Inserts into the current table, which must have room.
+   The key must not already be in the current table. */
+static void pagetable_insert_slot(pagetable* map, uint32_t key, void* value) {
+    uint32_t mask = map->size - 1;
+    uint32_t index = pagetable_index(key, map->shift);
+    pagetable_slot entry;
+    pagetable_slot tmp;
+    pagetable_slot* slot;
+
+    entry.key = key;
+    entry.dist = 1;
+    entry.value = value;
+
+    while (1) {
+        slot = &map->slots[index];
+        if (slot->dist == 0) {
+            *slot = entry;
+            map->count++;
+            return;
+        }
+        if (slot->dist < entry.dist) {
+            /* Rob from the rich: the resident is closer to home */
+            tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+        }
+        entry.dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+static pagetable_slot* pagetable_find_current(pagetable* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t dist = 1;
+    pagetable_slot* slot;
+
+    if (map->slots == NULL) {
+        return NULL;
+    }
+
+    mask = map->size - 1;
+    index = pagetable_index(key, map->shift);
+    while (1) {
+        slot = &map->slots[index];
+        if (slot->dist < dist) {
+            return NULL;
+        }
+        if (slot->key == key) {
+            return slot;
+        }
+        dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+static pagetable_slot* pagetable_find_old(pagetable* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t dist = 1;
+    pagetable_slot* slot;
+
+    if (map->oldSlots == NULL) {
+        return NULL;
+    }
+
+    mask = map->oldSize - 1;
+    index = pagetable_index(key, map->oldShift);
+    while (1) {
+        slot = &map->oldSlots[index];
+        if (pagetable_DIST(slot) < dist) {
+            return NULL;
+        }
+        if (slot->key == key && !(slot->dist & pagetable_MOVED)) {
+            return slot;
+        }
+        dist++;
+        index = (index + 1) & mask;
+    }
+}
+
+/* Moves up to num slots from the old table into the current one. */
+static void pagetable_migrate(pagetable* map, uint32_t num) {
+    pagetable_slot* slot;
+
+    while (map->oldSlots != NULL && num > 0) {
+        if (map->migrated == map->oldSize || map->oldCount == 0) {
+            fdbfree(map->oldSlots);
+            map->oldSlots = NULL;
+            map->oldSize = 0;
+            map->oldCount = 0;
+            map->migrated = 0;
+            break;
+        }
+
+        slot = &map->oldSlots[map->migrated];
+        if (slot->dist != 0 && !(slot->dist & pagetable_MOVED)) {
+            pagetable_insert_slot(map, slot->key, slot->value);
+            slot->dist |= pagetable_MOVED;
+            map->oldCount--;
+        }
+        map->migrated++;
+        num--;
+    }
+}
+
+int pagetable_set_size(pagetable* map, uint32_t size) {
+    uint32_t index;
+    uint32_t oldSize;
+    uint32_t shift;
+    pagetable_slot* oldSlots;
+    pagetable_slot* newSlots;
+    pagetable_slot* slot;
+
+    /* Finish any resize that is in progress */
+    pagetable_migrate(map, 0xFFFFFFFF);
+
+    size = pagetable_round_size(size, map->slots != NULL ? map->count : 0, &shift);
+    newSlots = (pagetable_slot*)fdbmalloczerotag(sizeof(pagetable_slot) * size, FDB_MEM_CACHE);
+    if (newSlots == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    oldSlots = map->slots;
+    oldSize = map->size;
+
+    map->slots = newSlots;
+    map->size = size;
+    map->shift = shift;
+    map->count = 0;
+
+    if (oldSlots != NULL) {
+        for (index = 0; index < oldSize; index++) {
+            slot = &oldSlots[index];
+            if (slot->dist != 0) {
+                pagetable_insert_slot(map, slot->key, slot->value);
+            }
+        }
+        fdbfree(oldSlots);
+    }
+
+    return FABRICDB_OK;
+}
+
+void pagetable_deinit(pagetable* map) {
+    fdbfree(map->slots);
+    fdbfree(map->oldSlots);
+    map->slots = NULL;
+    map->oldSlots = NULL;
+    map->size = 0;
+    map->count = 0;
+    map->oldSize = 0;
+    map->oldCount = 0;
+    map->migrated = 0;
+}
+
+int pagetable_reinit(pagetable* map, uint32_t size) {
+    pagetable_deinit(map);
+    return pagetable_set_size(map, size);
+}
+
+int pagetable_has(pagetable* map, uint32_t key) {
+    return pagetable_find_current(map, key) != NULL || pagetable_find_old(map, key) != NULL;
+}
+
+void* pagetable_get_or(pagetable* map, uint32_t key, void* def) {
+    pagetable_slot* slot = pagetable_find_current(map, key);
+    if (slot == NULL) {
+        slot = pagetable_find_old(map, key);
+        if (slot == NULL) {
+            return def;
+        }
+    }
+
+    return slot->value;
+}
+
+void** pagetable_get_ref(pagetable* map, uint32_t key) {
+    pagetable_slot* slot = pagetable_find_current(map, key);
+    if (slot == NULL) {
+        slot = pagetable_find_old(map, key);
+        if (slot == NULL) {
+            return NULL;
+        }
+    }
+
+    return &slot->value;
+}
+
+/* Starts an incremental resize.  The current slots become the old
+   table and are moved over a few at a time by later writes. */
+static int pagetable_grow(pagetable* map) {
+    uint32_t shift;
+    uint32_t size;
+    pagetable_slot* newSlots;
+
+    /* Only one resize can be in progress at a time */
+    pagetable_migrate(map, 0xFFFFFFFF);
+
+    size = pagetable_round_size(map->size * 2, 0, &shift);
+    newSlots = (pagetable_slot*)fdbmalloczerotag(sizeof(pagetable_slot) * size, FDB_MEM_CACHE);
+    if (newSlots == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    map->oldSlots = map->slots;
+    map->oldSize = map->size;
+    map->oldShift = map->shift;
+    map->oldCount = map->count;
+    map->migrated = 0;
+
+    map->slots = newSlots;
+    map->size = size;
+    map->shift = shift;
+    map->count = 0;
+
+    return FABRICDB_OK;
+}
+
+int pagetable_set(pagetable* map, uint32_t key, void* value) {
+    int rc;
+    pagetable_slot* slot;
+
+    if (map->slots == NULL) {
+        rc = pagetable_set_size(map, pagetable_MIN_SIZE);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    slot = pagetable_find_current(map, key);
+    if (slot != NULL) {
+        slot->value = value;
+        return FABRICDB_OK;
+    }
+
+    slot = pagetable_find_old(map, key);
+    if (slot != NULL) {
+        slot->dist |= pagetable_MOVED;
+        map->oldCount--;
+    }
+
+    if ((map->count + map->oldCount + 1) * 8 > map->size * pagetable_MAX_FILL) {
+        rc = pagetable_grow(map);
+        if (rc != FABRICDB_OK) {
+            if (slot != NULL) {
+                /* Put the old entry back */
+                slot->dist &= ~pagetable_MOVED;
+                map->oldCount++;
+            }
+            return rc;
+        }
+    }
+
+    pagetable_insert_slot(map, key, value);
+    pagetable_migrate(map, pagetable_MIGRATE_STEP);
+
+    return FABRICDB_OK;
+}
+
+int pagetable_remove(pagetable* map, uint32_t key) {
+    uint32_t mask;
+    uint32_t index;
+    uint32_t next;
+    pagetable_slot* slot = pagetable_find_current(map, key);
+
+    if (slot == NULL) {
+        slot = pagetable_find_old(map, key);
+        if (slot == NULL) {
+            return 0;
+        }
+        slot->dist |= pagetable_MOVED;
+        map->oldCount--;
+        pagetable_migrate(map, pagetable_MIGRATE_STEP);
+        return 1;
+    }
+
+    /* Shift the following displaced entries back by one */
+    mask = map->size - 1;
+    index = (uint32_t)(slot - map->slots);
+    next = (index + 1) & mask;
+    while (map->slots[next].dist > 1) {
+        map->slots[index] = map->slots[next];
+        map->slots[index].dist--;
+        index = next;
+        next = (next + 1) & mask;
+    }
+    map->slots[index].dist = 0;
+    map->count--;
+
+    pagetable_migrate(map, pagetable_MIGRATE_STEP);
+
+    return 1;
+}
+
+#ifdef FABRICDB_TESTING
+#include "../test/test_pagetable.c"
+#endif
+
@@ -0,0 +1,55 @@
+/*****************************************************************
+ * FabricDB Library pagetable Interface
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Generated: 2016-07-04
+ * Author: Mark Wardle
+ *
+ ******************************************************************/
+#ifndef __FABRICDB_pagetable_H
+#define __FABRICDB_pagetable_H
+
+/*
+ * An open addressed hash map using Robin Hood hashing.
+ *
+ * Items are stored inline in a single array of slots, so inserts
+ * never allocate and lookups touch as few cache lines as possible.
+ * When the map needs to grow, the old slots are kept and moved into
+ * the new array a few at a time by later writes instead of all at once.
+ */
+typedef struct pagetable_slot {
+    uint32_t key;
+    uint32_t dist;         /* Probe distance + 1, 0 when the slot is empty */
+    void* value;
+} pagetable_slot;
+
+typedef struct pagetable {
+    uint32_t size;         /* Number of slots, always a power of 2 */
+    uint32_t count;        /* Count of items in the current slots */
+    uint32_t shift;        /* Hash shift for the current slots */
+    pagetable_slot* slots;      /* The current slots */
+    uint32_t oldSize;      /* Number of slots being migrated */
+    uint32_t oldCount;     /* Count of items not yet migrated */
+    uint32_t oldShift;     /* Hash shift for the old slots */
+    uint32_t migrated;     /* Index of the next old slot to migrate */
+    pagetable_slot* oldSlots;   /* Slots being migrated, NULL if not resizing */
+} pagetable;
+
+#define pagetable_count(map) ((map)->count + (map)->oldCount)
+
+int pagetable_set_size(pagetable* map, uint32_t size);
+void pagetable_deinit(pagetable* map);
+int pagetable_reinit(pagetable* map, uint32_t size);
+int pagetable_has(pagetable* map, uint32_t key);
+void* pagetable_get_or(pagetable* map, uint32_t key, void* def);
+void** pagetable_get_ref(pagetable* map, uint32_t key);
+int pagetable_set(pagetable* map, uint32_t key, void* value);
+int pagetable_remove(pagetable* map, uint32_t key);
+
+#endif /* __FABRICDB_pagetable_H */
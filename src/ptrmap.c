@@ -71,7 +71,7 @@ static void ptrmap_free_item(ptrmap_entry* item) {
         ptrmap_free_item(item->next);
     }
 
-    fdbfree(item);
+    fdbobjfree(item, sizeof(ptrmap_entry), FDB_MEM_GENERAL);
 }
 
 void ptrmap_deinit(ptrmap* map) {
@@ -153,7 +153,7 @@ int ptrmap_set(ptrmap* map, uint32_t key, void* value) {
     uint32_t index;
     int rc = FABRICDB_OK;
 
-    entry = fdbmalloc(sizeof(ptrmap_entry));
+    entry = fdbobjalloc(sizeof(ptrmap_entry), FDB_MEM_GENERAL);
     if (entry == NULL) {
         return FABRICDB_ENOMEM;
     }
@@ -161,7 +161,7 @@ int ptrmap_set(ptrmap* map, uint32_t key, void* value) {
     if (map->resizeRatio < map->fillRatio) {
         rc = ptrmap_set_size(map, map->size * 2 + 1);
         if (rc != FABRICDB_OK) {
-            fdbfree(entry);
+            fdbobjfree(entry, sizeof(ptrmap_entry), FDB_MEM_GENERAL);
             return rc;
         }
     }
@@ -200,6 +200,34 @@ int ptrmap_set(ptrmap* map, uint32_t key, void* value) {
     return FABRICDB_OK;
 }
 
+int ptrmap_remove(ptrmap* map, uint32_t key) {
+    uint32_t index;
+    ptrmap_entry* current;
+    ptrmap_entry* prev;
+
+    index = key % map->size;
+    current = map->items[index];
+    prev = NULL;
+
+    while(current != NULL) {
+        if(current->key == key) {
+            if (prev == NULL) {
+                map->items[index] = current->next;
+            } else {
+                prev->next = current->next;
+            }
+            fdbobjfree(current, sizeof(ptrmap_entry), FDB_MEM_GENERAL);
+            map->count--;
+            map->fillRatio = (float) map->count / (float) map->size;
+            return 1;
+        }
+        prev = current;
+        current = current->next;
+    }
+
+    return 0;
+}
+
 #ifdef FABRICDB_TESTING
 #include "../test/test_ptrmap.c"
 #endif
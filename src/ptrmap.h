@@ -35,5 +35,6 @@ int ptrmap_has(ptrmap* map, uint32_t key);
 void* ptrmap_get_or(ptrmap* map, uint32_t key, void* def);
 void** ptrmap_get_ref(ptrmap* map, uint32_t key);
 int ptrmap_set(ptrmap* map, uint32_t key, void* value);
+int ptrmap_remove(ptrmap* map, uint32_t key);
 
 #endif /* __FABRICDB_ptrmap_H */
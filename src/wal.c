@@ -0,0 +1,1096 @@
+/*****************************************************************
+ * FabricDB Library Write-Ahead Log Implementation
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Created: July 4, 2016
+ * Modified: July 4, 2016
+ * Author: Mark Wardle
+ * Description:
+ *     Implements the write-ahead log.  The design closely follows
+ *     the sqlite3 WAL, again there is no point in solving a solved
+ *     problem differently.
+ *
+ ******************************************************************/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <assert.h>
+
+#include "byteorder.h"
+#include "fabric.h"
+#include "mem.h"
+#include "os.h"
+#include "wal.h"
+
+/*******************************************************************
+ * WAL FILE FORMAT
+ *
+ * The -wal file starts with a 32 byte header followed by zero or
+ * more frames.  Every value is stored little endian.
+ *
+ * +-----+------+--------------------------------
+ * | pos | size | description
+ * +-----+------+--------------------------------
+ * |   0 |    4 | Magic number 0x46444257
+ * |   4 |    4 | WAL format version (1)
+ * |   8 |    4 | Page size, including reserved bytes
+ * |  12 |    4 | Checkpoint sequence number
+ * |  16 |    4 | Salt 1
+ * |  20 |    4 | Salt 2
+ * |  24 |    4 | Checksum 1 of bytes 0 - 23
+ * |  28 |    4 | Checksum 2 of bytes 0 - 23
+ * +-----+------+--------------------------------
+ *
+ * Each frame is a 24 byte frame header followed by a page image.
+ *
+ * +-----+------+--------------------------------
+ * | pos | size | description
+ * +-----+------+--------------------------------
+ * |   0 |    4 | Page number
+ * |   4 |    4 | Database size in pages for a commit frame, else 0
+ * |   8 |    4 | Salt 1, copied from the WAL header
+ * |  12 |    4 | Salt 2, copied from the WAL header
+ * |  16 |    4 | Checksum 1
+ * |  20 |    4 | Checksum 2
+ * +-----+------+--------------------------------
+ *
+ * The checksum of a frame covers the first 8 bytes of its header and
+ * the page image, and starts from the checksum of the previous frame
+ * (or the WAL header for the first frame).  A frame is only valid if
+ * its salts match the header and every checksum up to it is correct,
+ * so frames left over from before the log was restarted are ignored.
+ *******************************************************************/
+#define WAL_MAGIC 0x46444257
+#define WAL_FORMAT_VERSION 1
+#define WAL_HEADER_SIZE 32
+#define WAL_FRAME_HEADER_SIZE 24
+
+#define WAL_FRAME_OFFSET(wal, frame) \
+    (WAL_HEADER_SIZE + (off_t)((frame) - 1) * (WAL_FRAME_HEADER_SIZE + (wal)->pageSize))
+
+/*******************************************************************
+ * WAL INDEX FORMAT
+ *
+ * The -shm file is mapped in 32KB regions.  Region 0 holds the two
+ * copies of the index header and the checkpoint info.  Region n + 1
+ * indexes frames n * 4096 + 1 to (n + 1) * 4096: an array of the page
+ * number of each frame followed by an open addressed hash table of
+ * 8192 slots.  A hash slot holds the index of a frame in the page
+ * number array plus 1, or 0 if it is empty.
+ *******************************************************************/
+#define WAL_INDEX_VERSION 1
+#define WAL_REGION_SIZE 32768
+#define WAL_SEGMENT_FRAMES 4096
+#define WAL_HASH_SLOTS 8192
+#define WAL_READMARK_NOT_USED 0xffffffff
+
+/* The most adjacent pages a checkpoint copies with one write */
+#define WAL_BACKFILL_RUN 64
+
+/* Lock slots */
+#define WAL_WRITE_LOCK 0
+#define WAL_CKPT_LOCK 1
+#define WAL_DMS_LOCK 2
+#define WAL_READ_LOCK(i) (3 + (i))
+
+/* How many times a reader tries to pin a snapshot */
+#define WAL_MAX_READ_ATTEMPTS 100
+
+/* Internal status meaning "start again" */
+#define WAL_RETRY (-1)
+
+#define WAL_CKPT_INFO(wal) \
+    ((volatile WalCheckpointInfo*)((wal)->header + 2 * sizeof(WalIndexHeader)))
+
+static void wal_checksum(const uint8_t *data, uint32_t size, const uint32_t *in, uint32_t *out) {
+    uint32_t s1 = in[0];
+    uint32_t s2 = in[1];
+    uint32_t x;
+    uint32_t y;
+    uint32_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&x, data + i, 4);
+        memcpy(&y, data + i + 4, 4);
+        s1 += letohu32(x) + s2;
+        s2 += letohu32(y) + s1;
+    }
+    for (; i < size; i++) {
+        s1 += data[i] + s2;
+        s2 += s1;
+    }
+
+    out[0] = s1;
+    out[1] = s2;
+}
+
+static inline void wal_put32(uint8_t *dest, uint32_t v) {
+    v = htoleu32(v);
+    memcpy(dest, &v, 4);
+}
+
+static inline uint32_t wal_get32(const uint8_t *src) {
+    uint32_t v;
+    memcpy(&v, src, 4);
+    return letohu32(v);
+}
+
+
+/*****************************************************************
+ * Index routines.
+ *****************************************************************/
+static inline uint32_t wal_hash(uint32_t pageNo) {
+    return (pageNo * 383) & (WAL_HASH_SLOTS - 1);
+}
+
+/* Maps the index segment for frames seg * 4096 + 1 onwards */
+static int wal_segment(Wal *wal, uint32_t seg, uint32_t **pageNos, uint16_t **hash) {
+    int rc;
+    uint8_t *region;
+
+    rc = fdb_shm_map(wal->shm, seg + 1, WAL_REGION_SIZE, &region);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    *pageNos = (uint32_t*)region;
+    *hash = (uint16_t*)(region + WAL_SEGMENT_FRAMES * sizeof(uint32_t));
+    return FABRICDB_OK;
+}
+
+static int wal_index_append(Wal *wal, uint32_t frame, uint32_t pageNo) {
+    int rc;
+    uint32_t seg = (frame - 1) / WAL_SEGMENT_FRAMES;
+    uint32_t idx = (frame - 1) % WAL_SEGMENT_FRAMES;
+    uint32_t slot;
+    uint32_t *pageNos;
+    uint16_t *hash;
+
+    rc = wal_segment(wal, seg, &pageNos, &hash);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* The first frame of a segment clears whatever an earlier
+       generation of the log left there */
+    if (idx == 0) {
+        memset(pageNos, 0, WAL_REGION_SIZE);
+    }
+
+    pageNos[idx] = pageNo;
+    slot = wal_hash(pageNo);
+    while (hash[slot] != 0) {
+        slot = (slot + 1) & (WAL_HASH_SLOTS - 1);
+    }
+    hash[slot] = (uint16_t)(idx + 1);
+
+    return FABRICDB_OK;
+}
+
+/* Removes index entries for frames after mxFrame, which were left by a
+   commit that failed after updating the index.  Entries are added in
+   frame order, so removing the newest ones never breaks the probe
+   sequence of an older one. */
+static int wal_index_cleanup(Wal *wal, uint32_t mxFrame) {
+    int rc;
+    uint32_t seg = mxFrame / WAL_SEGMENT_FRAMES;
+    uint32_t limit = mxFrame % WAL_SEGMENT_FRAMES;
+    uint32_t i;
+    uint32_t *pageNos;
+    uint16_t *hash;
+
+    if (limit == 0) {
+        /* The next frame starts a new segment, which clears it */
+        return FABRICDB_OK;
+    }
+
+    rc = wal_segment(wal, seg, &pageNos, &hash);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    for (i = 0; i < WAL_HASH_SLOTS; i++) {
+        if (hash[i] > limit) {
+            hash[i] = 0;
+        }
+    }
+    memset(pageNos + limit, 0, (WAL_SEGMENT_FRAMES - limit) * sizeof(uint32_t));
+
+    return FABRICDB_OK;
+}
+
+static void wal_header_checksum(WalIndexHeader *hdr, uint32_t *out) {
+    uint32_t zero[2] = {0, 0};
+    wal_checksum((const uint8_t*)hdr, offsetof(WalIndexHeader, checksum), zero, out);
+}
+
+/* Reads the index header without taking a lock.
+   Returns 1 if the header is valid and 0 if it is being written or
+   has never been initialized. */
+static int wal_read_header(Wal *wal, WalIndexHeader *hdr) {
+    WalIndexHeader h1;
+    WalIndexHeader h2;
+    uint32_t checksum[2];
+    volatile WalIndexHeader *shared = (volatile WalIndexHeader*)wal->header;
+
+    memcpy(&h1, (void*)&shared[0], sizeof(WalIndexHeader));
+    fdb_memory_barrier();
+    memcpy(&h2, (void*)&shared[1], sizeof(WalIndexHeader));
+
+    if (memcmp(&h1, &h2, sizeof(WalIndexHeader)) != 0 || !h1.isInit) {
+        return 0;
+    }
+    wal_header_checksum(&h1, checksum);
+    if (checksum[0] != h1.checksum[0] || checksum[1] != h1.checksum[1]) {
+        return 0;
+    }
+
+    *hdr = h1;
+    return 1;
+}
+
+/* Publishes wal->hdr.  Only the writer may call this. */
+static void wal_write_header(Wal *wal) {
+    volatile WalIndexHeader *shared = (volatile WalIndexHeader*)wal->header;
+
+    wal->hdr.version = WAL_INDEX_VERSION;
+    wal->hdr.isInit = 1;
+    wal->hdr.change++;
+    wal_header_checksum(&wal->hdr, wal->hdr.checksum);
+
+    memcpy((void*)&shared[1], &wal->hdr, sizeof(WalIndexHeader));
+    fdb_memory_barrier();
+    memcpy((void*)&shared[0], &wal->hdr, sizeof(WalIndexHeader));
+}
+
+/* Finds the newest frame for a page that is no later than mxFrame */
+static uint32_t wal_index_find(Wal *wal, uint32_t pageNo, uint32_t mxFrame) {
+    uint32_t seg;
+    uint32_t slot;
+    uint32_t idx;
+    uint32_t frame;
+    uint32_t best;
+    uint32_t probes;
+    uint32_t *pageNos;
+    uint16_t *hash;
+
+    if (mxFrame == 0) {
+        return 0;
+    }
+
+    seg = (mxFrame - 1) / WAL_SEGMENT_FRAMES + 1;
+    while (seg-- > 0) {
+        if (wal_segment(wal, seg, &pageNos, &hash) != FABRICDB_OK) {
+            return 0;
+        }
+
+        best = 0;
+        slot = wal_hash(pageNo);
+        for (probes = 0; probes < WAL_HASH_SLOTS && hash[slot] != 0; probes++) {
+            idx = hash[slot] - 1u;
+            frame = seg * WAL_SEGMENT_FRAMES + idx + 1;
+            if (frame <= mxFrame && frame > best && pageNos[idx] == pageNo) {
+                best = frame;
+            }
+            slot = (slot + 1) & (WAL_HASH_SLOTS - 1);
+        }
+        if (best != 0) {
+            return best;
+        }
+    }
+
+    return 0;
+}
+
+
+/*****************************************************************
+ * Recovery.
+ *****************************************************************/
+
+/* Rebuilds the index from the log.  The caller must hold the write
+   lock. */
+static int wal_recover(Wal *wal) {
+    int rc = FABRICDB_OK;
+    uint8_t header[WAL_HEADER_SIZE];
+    uint8_t *frameBuf = NULL;
+    uint32_t checksum[2];
+    uint32_t zero[2] = {0, 0};
+    uint32_t frame;
+    uint32_t pageNo;
+    uint32_t dbSize;
+    uint32_t change = wal->hdr.change;
+    uint32_t i;
+    off_t walSize;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    memset(&wal->hdr, 0, sizeof(WalIndexHeader));
+    wal->hdr.change = change;
+    wal->hdr.pageSize = wal->pageSize;
+
+    rc = fdb_file_size(wal->walfh, &walSize);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    if (walSize >= WAL_HEADER_SIZE) {
+        rc = fdb_read(wal->walfh, header, 0, WAL_HEADER_SIZE);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+
+        wal_checksum(header, 24, zero, checksum);
+        if (wal_get32(header) != WAL_MAGIC ||
+            wal_get32(header + 4) != WAL_FORMAT_VERSION ||
+            wal_get32(header + 8) != wal->pageSize ||
+            wal_get32(header + 24) != checksum[0] ||
+            wal_get32(header + 28) != checksum[1]) {
+            /* Not a usable log, treat it as empty */
+            walSize = 0;
+        }
+    } else {
+        walSize = 0;
+    }
+
+    if (walSize > 0) {
+        wal->hdr.checkpointSeq = wal_get32(header + 12);
+        wal->hdr.salt[0] = wal_get32(header + 16);
+        wal->hdr.salt[1] = wal_get32(header + 20);
+        wal->hdr.frameChecksum[0] = checksum[0];
+        wal->hdr.frameChecksum[1] = checksum[1];
+
+        frameBuf = fdbmalloctag(WAL_FRAME_HEADER_SIZE + wal->pageSize, FDB_MEM_PAGER);
+        if (frameBuf == NULL) {
+            return FABRICDB_ENOMEM;
+        }
+
+        for (frame = 1; WAL_FRAME_OFFSET(wal, frame + 1) <= walSize; frame++) {
+            rc = fdb_read(wal->walfh, frameBuf, WAL_FRAME_OFFSET(wal, frame), WAL_FRAME_HEADER_SIZE + wal->pageSize);
+            if (rc != FABRICDB_OK) {
+                break;
+            }
+
+            pageNo = wal_get32(frameBuf);
+            dbSize = wal_get32(frameBuf + 4);
+            if (pageNo == 0 ||
+                wal_get32(frameBuf + 8) != wal->hdr.salt[0] ||
+                wal_get32(frameBuf + 12) != wal->hdr.salt[1]) {
+                break;
+            }
+            wal_checksum(frameBuf, 8, checksum, checksum);
+            wal_checksum(frameBuf + WAL_FRAME_HEADER_SIZE, wal->pageSize, checksum, checksum);
+            if (wal_get32(frameBuf + 16) != checksum[0] || wal_get32(frameBuf + 20) != checksum[1]) {
+                break;
+            }
+
+            rc = wal_index_append(wal, frame, pageNo);
+            if (rc != FABRICDB_OK) {
+                break;
+            }
+
+            if (dbSize != 0) {
+                wal->hdr.mxFrame = frame;
+                wal->hdr.nPage = dbSize;
+                wal->hdr.frameChecksum[0] = checksum[0];
+                wal->hdr.frameChecksum[1] = checksum[1];
+            }
+        }
+        fdbfree(frameBuf);
+
+        /* A short read just means the last frame was torn */
+        if (rc == FABRICDB_ESHORTREAD) {
+            rc = FABRICDB_OK;
+        }
+        if (rc == FABRICDB_OK) {
+            rc = wal_index_cleanup(wal, wal->hdr.mxFrame);
+        }
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+    }
+
+    info->nBackfill = 0;
+    info->readMark[0] = 0;
+    info->readMark[1] = wal->hdr.mxFrame;
+    for (i = 2; i < WAL_NREADER; i++) {
+        info->readMark[i] = WAL_READMARK_NOT_USED;
+    }
+    wal_write_header(wal);
+
+    return FABRICDB_OK;
+}
+
+
+/*****************************************************************
+ * Opening and closing.
+ *****************************************************************/
+int fdb_wal_open(FileHandle *walfh, const char *shmPath, uint32_t pageSize, Wal **walp) {
+    int rc;
+    uint8_t *region;
+    Wal *wal;
+
+    *walp = NULL;
+    wal = fdbmalloczerotag(sizeof(Wal), FDB_MEM_PAGER);
+    if (wal == NULL) {
+        return FABRICDB_ENOMEM;
+    }
+
+    wal->walfh = walfh;
+    wal->pageSize = pageSize;
+    wal->readLock = -1;
+    wal->writeLock = 0;
+
+    rc = fdb_shm_open(shmPath, &wal->shm);
+    if (rc != FABRICDB_OK) {
+        fdbfree(wal);
+        return rc;
+    }
+
+    /* The first connection to open the index throws away whatever
+       is in it, the index is rebuilt from the log by the first read.
+       Every connection holds a shared lock on the DMS slot for as long
+       as it is open so later connections can tell they are not first. */
+    rc = fdb_shm_lock(wal->shm, WAL_DMS_LOCK, 1, FDB_SHM_EXCLUSIVE);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_shm_truncate(wal->shm);
+    } else if (rc == FABRICDB_BUSY) {
+        rc = FABRICDB_OK;
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_shm_lock(wal->shm, WAL_DMS_LOCK, 1, FDB_SHM_SHARED);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_shm_map(wal->shm, 0, WAL_REGION_SIZE, &region);
+    }
+    if (rc != FABRICDB_OK) {
+        fdb_shm_close(wal->shm);
+        fdbfree(wal);
+        return rc;
+    }
+
+    wal->header = region;
+    *walp = wal;
+    return FABRICDB_OK;
+}
+
+void fdb_wal_close(Wal *wal, FileHandle *dbfh) {
+    if (wal->writeLock) {
+        fdb_wal_end_write(wal);
+    }
+    if (wal->readLock >= 0) {
+        fdb_wal_end_read(wal);
+    }
+
+    /* The last connection out copies everything into the database
+       and empties the log */
+    if (fdb_shm_lock(wal->shm, WAL_DMS_LOCK, 1, FDB_SHM_EXCLUSIVE) == FABRICDB_OK) {
+        if (fdb_wal_checkpoint(wal, dbfh) == FABRICDB_OK &&
+            wal_read_header(wal, &wal->hdr) &&
+            WAL_CKPT_INFO(wal)->nBackfill == wal->hdr.mxFrame) {
+            fdb_truncate_file(wal->walfh, 0);
+            fdb_shm_lock(wal->shm, WAL_DMS_LOCK, 1, FDB_SHM_UNLOCK);
+        }
+    }
+
+    fdb_shm_close(wal->shm);
+    fdbfree(wal);
+}
+
+
+/*****************************************************************
+ * Read transactions.
+ *****************************************************************/
+static int wal_try_begin_read(Wal *wal, WalIndexHeader *hdr) {
+    int rc;
+    int i;
+    int mxI = -1;
+    uint32_t mxReadMark = 0;
+    uint32_t mark;
+    WalIndexHeader check;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    if (!wal_read_header(wal, hdr)) {
+        /* Either a writer is half way through updating the header or
+           the index needs to be rebuilt.  Taking the write lock tells
+           the two apart. */
+        rc = fdb_shm_lock(wal->shm, WAL_WRITE_LOCK, 1, FDB_SHM_EXCLUSIVE);
+        if (rc == FABRICDB_BUSY) {
+            return WAL_RETRY;
+        }
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        if (!wal_read_header(wal, hdr)) {
+            rc = wal_recover(wal);
+        }
+        fdb_shm_lock(wal->shm, WAL_WRITE_LOCK, 1, FDB_SHM_UNLOCK);
+        return rc == FABRICDB_OK ? WAL_RETRY : rc;
+    }
+
+    /* Every frame is already in the database, so read it directly */
+    if (hdr->mxFrame == info->nBackfill) {
+        rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(0), 1, FDB_SHM_SHARED);
+        if (rc == FABRICDB_BUSY) {
+            return WAL_RETRY;
+        }
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+        fdb_memory_barrier();
+        if (!wal_read_header(wal, &check) || memcmp(&check, hdr, sizeof(WalIndexHeader)) != 0) {
+            fdb_shm_lock(wal->shm, WAL_READ_LOCK(0), 1, FDB_SHM_UNLOCK);
+            return WAL_RETRY;
+        }
+        wal->readLock = 0;
+        return FABRICDB_OK;
+    }
+
+    /* Find the slot with the newest snapshot that is not newer than
+       this one */
+    for (i = 1; i < WAL_NREADER; i++) {
+        mark = info->readMark[i];
+        if (mark != WAL_READMARK_NOT_USED && mark <= hdr->mxFrame && (mxI < 0 || mark > mxReadMark)) {
+            mxReadMark = mark;
+            mxI = i;
+        }
+    }
+
+    /* Try to claim a slot for exactly this snapshot */
+    if (mxI < 0 || mxReadMark < hdr->mxFrame) {
+        for (i = 1; i < WAL_NREADER; i++) {
+            rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_EXCLUSIVE);
+            if (rc == FABRICDB_OK) {
+                info->readMark[i] = hdr->mxFrame;
+                mxReadMark = hdr->mxFrame;
+                mxI = i;
+                fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_UNLOCK);
+                break;
+            } else if (rc != FABRICDB_BUSY) {
+                return rc;
+            }
+        }
+    }
+    if (mxI < 0) {
+        return WAL_RETRY;
+    }
+
+    rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(mxI), 1, FDB_SHM_SHARED);
+    if (rc == FABRICDB_BUSY) {
+        return WAL_RETRY;
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* Make sure nothing moved while the lock was being taken */
+    fdb_memory_barrier();
+    if (info->readMark[mxI] != mxReadMark ||
+        !wal_read_header(wal, &check) ||
+        memcmp(&check, hdr, sizeof(WalIndexHeader)) != 0) {
+        fdb_shm_lock(wal->shm, WAL_READ_LOCK(mxI), 1, FDB_SHM_UNLOCK);
+        return WAL_RETRY;
+    }
+
+    wal->readLock = mxI;
+    return FABRICDB_OK;
+}
+
+int fdb_wal_begin_read(Wal *wal, int *changed) {
+    int rc = WAL_RETRY;
+    int attempt;
+    WalIndexHeader hdr;
+
+    assert(wal->readLock < 0);
+
+    for (attempt = 0; attempt < WAL_MAX_READ_ATTEMPTS && rc == WAL_RETRY; attempt++) {
+        rc = wal_try_begin_read(wal, &hdr);
+    }
+    if (rc == WAL_RETRY) {
+        return FABRICDB_BUSY;
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    *changed = wal->hdr.change != hdr.change ||
+               wal->hdr.mxFrame != hdr.mxFrame ||
+               wal->hdr.salt[0] != hdr.salt[0] ||
+               wal->hdr.salt[1] != hdr.salt[1];
+    wal->hdr = hdr;
+
+    return FABRICDB_OK;
+}
+
+/* Pins a read mark that keeps a checkpoint from copying frames past an
+   older snapshot into the database.  The caller holds the checkpoint
+   lock, so the marks and nBackfill can not move under it. */
+static int wal_pin_snapshot(Wal *wal, const WalIndexHeader *snapshot) {
+    int rc;
+    int i;
+    int mxI = -1;
+    uint32_t mxReadMark = 0;
+    uint32_t mark;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    /* Any slot whose mark is not newer than the snapshot will do */
+    for (i = 1; i < WAL_NREADER; i++) {
+        mark = info->readMark[i];
+        if (mark != WAL_READMARK_NOT_USED && mark <= snapshot->mxFrame && (mxI < 0 || mark > mxReadMark)) {
+            mxReadMark = mark;
+            mxI = i;
+        }
+    }
+    if (mxI >= 0) {
+        rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(mxI), 1, FDB_SHM_SHARED);
+        if (rc == FABRICDB_OK && info->readMark[mxI] == mxReadMark) {
+            wal->readLock = mxI;
+            return FABRICDB_OK;
+        }
+        if (rc == FABRICDB_OK) {
+            fdb_shm_lock(wal->shm, WAL_READ_LOCK(mxI), 1, FDB_SHM_UNLOCK);
+        } else if (rc != FABRICDB_BUSY) {
+            return rc;
+        }
+    }
+
+    /* Otherwise claim a free slot and move its mark back */
+    for (i = 1; i < WAL_NREADER; i++) {
+        rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_EXCLUSIVE);
+        if (rc == FABRICDB_OK) {
+            info->readMark[i] = snapshot->mxFrame;
+            fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_UNLOCK);
+            rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_SHARED);
+            if (rc == FABRICDB_OK && info->readMark[i] == snapshot->mxFrame) {
+                wal->readLock = i;
+                return FABRICDB_OK;
+            }
+            if (rc == FABRICDB_OK) {
+                fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_UNLOCK);
+            }
+            return rc == FABRICDB_OK || rc == FABRICDB_BUSY ? WAL_RETRY : rc;
+        } else if (rc != FABRICDB_BUSY) {
+            return rc;
+        }
+    }
+    return WAL_RETRY;
+}
+
+int fdb_wal_begin_read_snapshot(Wal *wal, const WalIndexHeader *snapshot, int *changed) {
+    int rc;
+    int attempt;
+    WalIndexHeader hdr;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    assert(wal->readLock < 0);
+
+    rc = WAL_RETRY;
+    for (attempt = 0; attempt < WAL_MAX_READ_ATTEMPTS && rc == WAL_RETRY; attempt++) {
+        rc = fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_SHARED);
+        if (rc != FABRICDB_OK) {
+            return rc;
+        }
+
+        /* The frames of the snapshot are still there as long as the log
+           has not started over, and none of the database file is newer
+           than the snapshot as long as no checkpoint has gone past it */
+        if (!wal_read_header(wal, &hdr)) {
+            rc = WAL_RETRY;
+        } else if (hdr.salt[0] != snapshot->salt[0] ||
+                   hdr.salt[1] != snapshot->salt[1] ||
+                   hdr.checkpointSeq != snapshot->checkpointSeq ||
+                   hdr.mxFrame < snapshot->mxFrame ||
+                   info->nBackfill > snapshot->mxFrame) {
+            rc = FABRICDB_SNAPSHOT_EXPIRED;
+        } else {
+            rc = wal_pin_snapshot(wal, snapshot);
+        }
+
+        fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_UNLOCK);
+    }
+    if (rc == WAL_RETRY) {
+        return FABRICDB_BUSY;
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    *changed = memcmp(&wal->hdr, snapshot, sizeof(WalIndexHeader)) != 0;
+    wal->hdr = *snapshot;
+
+    return FABRICDB_OK;
+}
+
+void fdb_wal_end_read(Wal *wal) {
+    if (wal->readLock >= 0) {
+        fdb_shm_lock(wal->shm, WAL_READ_LOCK(wal->readLock), 1, FDB_SHM_UNLOCK);
+        wal->readLock = -1;
+    }
+}
+
+uint32_t fdb_wal_find_frame(Wal *wal, uint32_t pageNo) {
+    assert(wal->readLock >= 0);
+
+    /* Slot 0 readers use the database file only */
+    if (wal->readLock == 0 && !wal->writeLock) {
+        return 0;
+    }
+    return wal_index_find(wal, pageNo, wal->hdr.mxFrame);
+}
+
+int fdb_wal_read_frame(Wal *wal, uint32_t frame, uint8_t *dest) {
+    return fdb_read(wal->walfh, dest, WAL_FRAME_OFFSET(wal, frame) + WAL_FRAME_HEADER_SIZE, wal->pageSize);
+}
+
+uint32_t fdb_wal_db_size(Wal *wal) {
+    return wal->hdr.mxFrame > 0 ? wal->hdr.nPage : 0;
+}
+
+uint32_t fdb_wal_pending_frames(Wal *wal) {
+    uint32_t nBackfill = WAL_CKPT_INFO(wal)->nBackfill;
+    return wal->hdr.mxFrame > nBackfill ? wal->hdr.mxFrame - nBackfill : 0;
+}
+
+
+/*****************************************************************
+ * Write transactions.
+ *****************************************************************/
+int fdb_wal_begin_write(Wal *wal) {
+    int rc;
+    WalIndexHeader hdr;
+
+    assert(wal->readLock >= 0);
+    assert(!wal->writeLock);
+
+    rc = fdb_shm_lock(wal->shm, WAL_WRITE_LOCK, 1, FDB_SHM_EXCLUSIVE);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* Writing on top of an old snapshot would lose the commits that
+       came after it */
+    if (!wal_read_header(wal, &hdr) || memcmp(&hdr, &wal->hdr, sizeof(WalIndexHeader)) != 0) {
+        fdb_shm_lock(wal->shm, WAL_WRITE_LOCK, 1, FDB_SHM_UNLOCK);
+        return FABRICDB_BUSY;
+    }
+
+    wal->writeLock = 1;
+    return FABRICDB_OK;
+}
+
+void fdb_wal_end_write(Wal *wal) {
+    if (wal->writeLock) {
+        fdb_shm_lock(wal->shm, WAL_WRITE_LOCK, 1, FDB_SHM_UNLOCK);
+        wal->writeLock = 0;
+    }
+}
+
+/* Starts the log over from the first frame if every frame has been
+   copied into the database and no reader is using the log.  Readers
+   of slot 0 only use the database file so they do not get in the way. */
+static int wal_restart(Wal *wal) {
+    int rc;
+    uint32_t i;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    if (wal->readLock != 0 || wal->hdr.mxFrame == 0 || info->nBackfill != wal->hdr.mxFrame) {
+        return FABRICDB_OK;
+    }
+
+    rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(1), WAL_NREADER - 1, FDB_SHM_EXCLUSIVE);
+    if (rc == FABRICDB_BUSY) {
+        return FABRICDB_OK;
+    }
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    wal->hdr.mxFrame = 0;
+    wal->hdr.checkpointSeq++;
+    wal_write_header(wal);
+    info->nBackfill = 0;
+    info->readMark[1] = 0;
+    for (i = 2; i < WAL_NREADER; i++) {
+        info->readMark[i] = WAL_READMARK_NOT_USED;
+    }
+
+    fdb_shm_lock(wal->shm, WAL_READ_LOCK(1), WAL_NREADER - 1, FDB_SHM_UNLOCK);
+    return FABRICDB_OK;
+}
+
+/* Writes the WAL file header for a new generation of the log */
+static int wal_write_file_header(Wal *wal) {
+    uint8_t header[WAL_HEADER_SIZE];
+    uint32_t checksum[2];
+    uint32_t zero[2] = {0, 0};
+
+    /* New salts invalidate every frame of the previous generation */
+    wal->hdr.salt[0]++;
+    wal->hdr.salt[1] = (uint32_t)time(NULL) * 2654435761u ^ (uint32_t)clock() ^ (wal->hdr.salt[1] << 7);
+
+    wal_put32(header, WAL_MAGIC);
+    wal_put32(header + 4, WAL_FORMAT_VERSION);
+    wal_put32(header + 8, wal->pageSize);
+    wal_put32(header + 12, wal->hdr.checkpointSeq);
+    wal_put32(header + 16, wal->hdr.salt[0]);
+    wal_put32(header + 20, wal->hdr.salt[1]);
+    wal_checksum(header, 24, zero, checksum);
+    wal_put32(header + 24, checksum[0]);
+    wal_put32(header + 28, checksum[1]);
+
+    wal->hdr.frameChecksum[0] = checksum[0];
+    wal->hdr.frameChecksum[1] = checksum[1];
+
+    return fdb_write(wal->walfh, header, 0, WAL_HEADER_SIZE);
+}
+
+int fdb_wal_write_frames(Wal *wal, WalFrame *frames, uint32_t count, uint32_t dbSize, int sync) {
+    int rc;
+    uint32_t i;
+    uint32_t frame;
+    uint32_t checksum[2];
+    uint8_t *frameHeaders;
+    uint8_t *frameHeader;
+    FdbIoVec *vecs;
+    WalIndexHeader hdr;
+
+    assert(wal->writeLock);
+    assert(count > 0);
+
+    rc = wal_restart(wal);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    /* Work on a copy so a failure leaves the snapshot untouched */
+    hdr = wal->hdr;
+    if (wal->hdr.mxFrame == 0) {
+        rc = wal_write_file_header(wal);
+        if (rc != FABRICDB_OK) {
+            wal->hdr = hdr;
+            return rc;
+        }
+    }
+
+    rc = wal_index_cleanup(wal, wal->hdr.mxFrame);
+    if (rc != FABRICDB_OK) {
+        wal->hdr = hdr;
+        return rc;
+    }
+
+    /* The frames are adjacent in the log, so the page images are
+       written straight from the caller's buffers, interleaved with
+       their headers, in one vectored write */
+    frameHeaders = fdbmalloctag(WAL_FRAME_HEADER_SIZE * count, FDB_MEM_PAGER);
+    vecs = fdbmalloctag(sizeof(FdbIoVec) * 2 * count, FDB_MEM_PAGER);
+    if (frameHeaders == NULL || vecs == NULL) {
+        fdbfree(frameHeaders);
+        fdbfree(vecs);
+        wal->hdr = hdr;
+        return FABRICDB_ENOMEM;
+    }
+
+    checksum[0] = wal->hdr.frameChecksum[0];
+    checksum[1] = wal->hdr.frameChecksum[1];
+    for (i = 0; i < count; i++) {
+        frameHeader = frameHeaders + WAL_FRAME_HEADER_SIZE * i;
+        wal_put32(frameHeader, frames[i].pageNo);
+        wal_put32(frameHeader + 4, i == count - 1 ? dbSize : 0);
+        wal_put32(frameHeader + 8, wal->hdr.salt[0]);
+        wal_put32(frameHeader + 12, wal->hdr.salt[1]);
+        wal_checksum(frameHeader, 8, checksum, checksum);
+        wal_checksum(frames[i].data, wal->pageSize, checksum, checksum);
+        wal_put32(frameHeader + 16, checksum[0]);
+        wal_put32(frameHeader + 20, checksum[1]);
+
+        vecs[2 * i].base = frameHeader;
+        vecs[2 * i].len = WAL_FRAME_HEADER_SIZE;
+        vecs[2 * i + 1].base = frames[i].data;
+        vecs[2 * i + 1].len = wal->pageSize;
+    }
+    rc = fdb_writev(wal->walfh, vecs, (int)(2 * count), WAL_FRAME_OFFSET(wal, wal->hdr.mxFrame + 1));
+    fdbfree(frameHeaders);
+    fdbfree(vecs);
+
+    if (rc == FABRICDB_OK && sync) {
+        rc = fdb_datasync(wal->walfh);
+    }
+
+    /* The frames are durable, now index them and make them visible */
+    frame = wal->hdr.mxFrame;
+    for (i = 0; i < count && rc == FABRICDB_OK; i++) {
+        rc = wal_index_append(wal, ++frame, frames[i].pageNo);
+    }
+    if (rc != FABRICDB_OK) {
+        wal->hdr = hdr;
+        return rc;
+    }
+
+    wal->hdr.mxFrame = frame;
+    wal->hdr.nPage = dbSize;
+    wal->hdr.frameChecksum[0] = checksum[0];
+    wal->hdr.frameChecksum[1] = checksum[1];
+    wal_write_header(wal);
+
+    return FABRICDB_OK;
+}
+
+
+/*****************************************************************
+ * Checkpoints.
+ *****************************************************************/
+static int wal_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Copies the newest version of every page in frames first to last
+   into the database file.  Runs of adjacent pages are gathered into
+   one buffer and written with a single call. */
+static int wal_backfill(Wal *wal, FileHandle *dbfh, uint32_t first, uint32_t last) {
+    int rc = FABRICDB_OK;
+    uint32_t frame;
+    uint32_t count = 0;
+    uint32_t unique = 0;
+    uint32_t start;
+    uint32_t end;
+    uint32_t i;
+    uint32_t pageNo;
+    uint32_t *pageNos;
+    uint16_t *hash;
+    uint64_t *order;
+    uint8_t *buffer;
+
+    order = fdbmalloctag(sizeof(uint64_t) * (last - first + 1), FDB_MEM_PAGER);
+    buffer = fdbmalloctag(wal->pageSize * WAL_BACKFILL_RUN, FDB_MEM_PAGER);
+    if (order == NULL || buffer == NULL) {
+        fdbfree(order);
+        fdbfree(buffer);
+        return FABRICDB_ENOMEM;
+    }
+
+    /* Sorting by page then frame puts the newest version of each page
+       last and makes the writes to the database sequential */
+    for (frame = first; frame <= last && rc == FABRICDB_OK; frame++) {
+        rc = wal_segment(wal, (frame - 1) / WAL_SEGMENT_FRAMES, &pageNos, &hash);
+        if (rc == FABRICDB_OK) {
+            pageNo = pageNos[(frame - 1) % WAL_SEGMENT_FRAMES];
+            order[count++] = ((uint64_t)pageNo << 32) | frame;
+        }
+    }
+    qsort(order, count, sizeof(uint64_t), wal_compare_u64);
+
+    /* Keep only the newest frame of each page */
+    for (i = 0; i < count; i++) {
+        if (i + 1 < count && (order[i + 1] >> 32) == (order[i] >> 32)) {
+            continue;
+        }
+        order[unique++] = order[i];
+    }
+
+    for (start = 0; start < unique && rc == FABRICDB_OK; start = end) {
+        end = start + 1;
+        while (end < unique && end - start < WAL_BACKFILL_RUN &&
+               (order[end] >> 32) == (order[end - 1] >> 32) + 1) {
+            end++;
+        }
+        for (i = start; i < end && rc == FABRICDB_OK; i++) {
+            rc = fdb_wal_read_frame(wal, (uint32_t)order[i], buffer + (size_t)(i - start) * wal->pageSize);
+        }
+        if (rc == FABRICDB_OK) {
+            pageNo = (uint32_t)(order[start] >> 32);
+            rc = fdb_write(dbfh, buffer, (off_t)(pageNo - 1) * wal->pageSize, (size_t)(end - start) * wal->pageSize);
+        }
+    }
+
+    fdbfree(order);
+    fdbfree(buffer);
+    return rc;
+}
+
+int fdb_wal_checkpoint(Wal *wal, FileHandle *dbfh) {
+    int rc;
+    uint32_t i;
+    uint32_t mark;
+    uint32_t mxSafe;
+    uint32_t nBackfill;
+    off_t dbSize;
+    WalIndexHeader hdr;
+    volatile WalCheckpointInfo *info = WAL_CKPT_INFO(wal);
+
+    /* This connection's own read lock would be converted, not waited on */
+    assert(wal->readLock < 0);
+
+    rc = fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_EXCLUSIVE);
+    if (rc != FABRICDB_OK) {
+        return rc;
+    }
+
+    if (!wal_read_header(wal, &hdr)) {
+        fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_UNLOCK);
+        return FABRICDB_BUSY;
+    }
+
+    /* Stop at the oldest snapshot a reader is still using.  Slots that
+       are not in use are moved up to the newest frame on the way. */
+    mxSafe = hdr.mxFrame;
+    for (i = 1; i < WAL_NREADER; i++) {
+        mark = info->readMark[i];
+        if (mark == WAL_READMARK_NOT_USED || mark >= mxSafe) {
+            continue;
+        }
+        rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_EXCLUSIVE);
+        if (rc == FABRICDB_OK) {
+            info->readMark[i] = i == 1 ? mxSafe : WAL_READMARK_NOT_USED;
+            fdb_shm_lock(wal->shm, WAL_READ_LOCK(i), 1, FDB_SHM_UNLOCK);
+        } else if (rc == FABRICDB_BUSY) {
+            mxSafe = mark;
+        } else {
+            fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_UNLOCK);
+            return rc;
+        }
+    }
+
+    rc = FABRICDB_OK;
+    nBackfill = info->nBackfill;
+    if (nBackfill < mxSafe) {
+        /* Readers of slot 0 read the database file directly */
+        rc = fdb_shm_lock(wal->shm, WAL_READ_LOCK(0), 1, FDB_SHM_EXCLUSIVE);
+        if (rc == FABRICDB_OK) {
+            rc = fdb_sync(wal->walfh);
+            if (rc == FABRICDB_OK) {
+                rc = wal_backfill(wal, dbfh, nBackfill + 1, mxSafe);
+            }
+            if (rc == FABRICDB_OK && mxSafe == hdr.mxFrame) {
+                /* The database may have shrunk */
+                rc = fdb_file_size(dbfh, &dbSize);
+                if (rc == FABRICDB_OK && dbSize > (off_t)hdr.nPage * wal->pageSize) {
+                    rc = fdb_truncate_file(dbfh, (off_t)hdr.nPage * wal->pageSize);
+                }
+            }
+            if (rc == FABRICDB_OK) {
+                rc = fdb_sync(dbfh);
+            }
+            if (rc == FABRICDB_OK) {
+                info->nBackfill = mxSafe;
+            }
+            fdb_shm_lock(wal->shm, WAL_READ_LOCK(0), 1, FDB_SHM_UNLOCK);
+        }
+    }
+
+    fdb_shm_lock(wal->shm, WAL_CKPT_LOCK, 1, FDB_SHM_UNLOCK);
+    return rc;
+}
+
+#ifdef FABRICDB_TESTING
+#include "../test/test_wal.c"
+#endif
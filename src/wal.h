@@ -0,0 +1,227 @@
+/*****************************************************************
+ * FabricDB Library Write-Ahead Log Interface
+ *
+ * Copyright (c) 2016, Mark Wardle <mwwardle@gmail.com>
+ *
+ * This file may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ ******************************************************************
+ *
+ * Created: July 4, 2016
+ * Modified: July 4, 2016
+ * Author: Mark Wardle
+ * Description:
+ *     Declares the write-ahead log used by databases with a file
+ *     format write version of 2.
+ *
+ ******************************************************************/
+
+#ifndef __FABRICDB_WAL_H
+#define __FABRICDB_WAL_H
+
+#include <stdint.h>
+
+#include "os.h"
+
+/* The number of read marks, and so the number of distinct snapshots
+   that readers can hold at one time. */
+#define WAL_NREADER 8
+
+/*
+ * The WAL index header.  Two copies are kept at the start of shared
+ * memory.  A writer updates the second copy and then the first, a
+ * reader reads them in the opposite order and only trusts the header
+ * if both copies match.
+ */
+typedef struct WalIndexHeader {
+    uint32_t version;            /* WAL index format version */
+    uint32_t change;             /* Incremented every time the header changes */
+    uint32_t isInit;             /* 1 once the header has been written */
+    uint32_t pageSize;           /* The size of a page, including reserved bytes */
+    uint32_t mxFrame;            /* The last committed frame in the WAL */
+    uint32_t nPage;              /* Size of the database in pages as of mxFrame */
+    uint32_t frameChecksum[2];   /* Checksum of frame mxFrame */
+    uint32_t salt[2];            /* Copied from the WAL file header */
+    uint32_t checkpointSeq;      /* Incremented every time the WAL restarts */
+    uint32_t checksum[2];        /* Checksum of the fields above */
+} WalIndexHeader;
+
+/* Follows the two header copies in shared memory */
+typedef struct WalCheckpointInfo {
+    uint32_t nBackfill;               /* Frames already copied into the database */
+    uint32_t readMark[WAL_NREADER];   /* mxFrame of the snapshot readers of each slot use */
+} WalCheckpointInfo;
+
+/* A page image to be appended to the log */
+typedef struct WalFrame {
+    uint32_t pageNo;
+    uint8_t *data;
+} WalFrame;
+
+/*
+ * A connection's handle on the write-ahead log.
+ *
+ * Committed page images are appended to the -wal file.  The -shm file
+ * indexes them by page number so a reader can find the newest version
+ * of a page in its snapshot without scanning the log.  A checkpoint
+ * copies the pages back into the database file.
+ */
+typedef struct Wal {
+    FileHandle *walfh;           /* The -wal file, owned by the caller */
+    ShmHandle *shm;              /* The -shm file that holds the index */
+    uint32_t pageSize;
+    volatile uint8_t *header;    /* The first region of shared memory */
+    WalIndexHeader hdr;          /* The snapshot this connection is using */
+    int readLock;                /* Read mark slot held, -1 if none */
+    uint8_t writeLock;           /* 1 while this connection is the writer */
+} Wal;
+
+/**
+ * Opens the write-ahead log for a database.
+ *
+ * @param walfh An open handle on the -wal file.  It is not closed by
+ *        fdb_wal_close().
+ * @param shmPath The path of the -shm file, it is created if needed.
+ * @param pageSize The size of a page including any reserved bytes.
+ * @param walp OUT Where the new WAL handle is stored.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_wal_open(FileHandle *walfh, const char *shmPath, uint32_t pageSize, Wal **walp);
+
+/**
+ * Closes the write-ahead log.
+ *
+ * If this is the last connection to the database, the log is
+ * checkpointed and emptied first.
+ *
+ * @param wal The WAL handle.
+ * @param dbfh The database file, used for the final checkpoint.
+ */
+void fdb_wal_close(Wal *wal, FileHandle *dbfh);
+
+/**
+ * Starts a read transaction on the latest committed snapshot.
+ *
+ * Readers never wait for the writer.  FABRICDB_BUSY is only returned
+ * if the snapshot could not be pinned after several attempts, which
+ * takes a checkpoint or recovery to be running at the same time.
+ *
+ * @param wal The WAL handle.
+ * @param changed OUT Set to 1 if the database may have changed since
+ *        this connection's last snapshot.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_wal_begin_read(Wal *wal, int *changed);
+
+/**
+ * Starts a read transaction on an older snapshot, a copy of wal->hdr
+ * taken during an earlier read transaction.
+ *
+ * The snapshot can be returned to as long as the log has not started
+ * over and no checkpoint has copied frames newer than it into the
+ * database.  Once pinned, checkpoints stop short of it again.
+ *
+ * @param wal The WAL handle.
+ * @param snapshot The snapshot to read.
+ * @param changed OUT Set to 1 if the snapshot is not the one this
+ *        connection used last.
+ * @return FABRICDB_OK on success, FABRICDB_SNAPSHOT_EXPIRED if the
+ *         snapshot is no longer available, FABRICDB_BUSY if a
+ *         checkpoint is running, other status code on failure.
+ */
+int fdb_wal_begin_read_snapshot(Wal *wal, const WalIndexHeader *snapshot, int *changed);
+
+/**
+ * Ends a read transaction.
+ */
+void fdb_wal_end_read(Wal *wal);
+
+/**
+ * Finds the frame holding the newest version of a page in the current
+ * snapshot.
+ *
+ * @param wal The WAL handle, with a read transaction open.
+ * @param pageNo The page to look for.
+ * @return The frame number, or 0 if the page must be read from the
+ *         database file.
+ */
+uint32_t fdb_wal_find_frame(Wal *wal, uint32_t pageNo);
+
+/**
+ * Reads the page image stored in a frame.
+ *
+ * @param wal The WAL handle.
+ * @param frame A frame number returned by fdb_wal_find_frame().
+ * @param dest Where to copy pageSize bytes of page data.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_wal_read_frame(Wal *wal, uint32_t frame, uint8_t *dest);
+
+/**
+ * Returns the size of the database in pages as of the current
+ * snapshot, or 0 if the log does not hold any committed frames.
+ */
+uint32_t fdb_wal_db_size(Wal *wal);
+
+/**
+ * Returns the number of frames in the log that have not been
+ * copied back into the database yet.
+ */
+uint32_t fdb_wal_pending_frames(Wal *wal);
+
+/**
+ * Starts a write transaction.
+ *
+ * There is only ever one writer.  FABRICDB_BUSY is returned if another
+ * connection is writing, or if another connection has committed since
+ * this connection's read transaction started.  In the second case the
+ * read transaction needs to be restarted before trying again.
+ *
+ * @param wal The WAL handle, with a read transaction open.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_wal_begin_write(Wal *wal);
+
+/**
+ * Ends a write transaction.
+ */
+void fdb_wal_end_write(Wal *wal);
+
+/**
+ * Appends a committed transaction to the log.
+ *
+ * The frames are written in the order given, the last one is marked
+ * as the commit frame.  Once the frames are written (and synced if
+ * sync is set) they are added to the index and made visible to new
+ * readers.
+ *
+ * Without sync the commit is visible before it is durable.  The caller
+ * has to sync the log, for example with fdb_group_sync(), before it
+ * reports the commit as done.  Checkpoints sync the log before copying
+ * anything, so the database file never gets ahead of the log.
+ *
+ * @param wal The WAL handle, with a write transaction open.
+ * @param frames The pages to append.
+ * @param count The number of frames, at least 1.
+ * @param dbSize The size of the database in pages after the commit.
+ * @param sync 1 to sync the log before the commit is made visible.
+ * @return FABRICDB_OK on success, other status code on failure.
+ */
+int fdb_wal_write_frames(Wal *wal, WalFrame *frames, uint32_t count, uint32_t dbSize, int sync);
+
+/**
+ * Copies committed frames back into the database file.
+ *
+ * Frames that are part of a snapshot an active reader is using are
+ * left alone.  Once every frame has been copied the next writer
+ * starts the log over from the beginning.
+ *
+ * @param wal The WAL handle, without a read transaction open.
+ * @param dbfh The database file.
+ * @return FABRICDB_OK on success, FABRICDB_BUSY if another connection
+ *         is checkpointing, other status code on failure.
+ */
+int fdb_wal_checkpoint(Wal *wal, FileHandle *dbfh);
+
+#endif /* __FABRICDB_WAL_H */
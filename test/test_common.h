@@ -24,11 +24,15 @@ extern int asserts_run;
 
 void test_mem();
 void test_byteorder();
+void test_crc32c();
+void test_lz4();
 void test_mutex();
 void test_os_unix();
 void test_u8array();
 void test_u32array();
 void test_ptrmap();
+void test_pagetable();
+void test_wal();
 void test_pager();
 void test_property();
 void test_fstring();
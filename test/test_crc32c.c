@@ -0,0 +1,68 @@
+#include "test_common.h"
+
+void test_crc32c_known_values() {
+    uint8_t zeros[32];
+    uint8_t ones[32];
+    uint8_t ascending[32];
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        zeros[i] = 0;
+        ones[i] = 0xff;
+        ascending[i] = (uint8_t)i;
+    }
+
+    /* the check value and the test vectors from RFC 3720 */
+    fdb_assert("Wrong check value", fdb_crc32c(0, (const uint8_t*)"123456789", 9) == 0xE3069283);
+    fdb_assert("Wrong crc of zeros", fdb_crc32c(0, zeros, 32) == 0x8A9136AA);
+    fdb_assert("Wrong crc of ones", fdb_crc32c(0, ones, 32) == 0x62A8AB43);
+    fdb_assert("Wrong crc of ascending bytes", fdb_crc32c(0, ascending, 32) == 0x46DD794E);
+    fdb_assert("Wrong crc of nothing", fdb_crc32c(0, zeros, 0) == 0);
+
+    fdb_assert("Wrong software check value", fdb_crc32c_sw(0, (const uint8_t*)"123456789", 9) == 0xE3069283);
+    fdb_assert("Wrong software crc of ascending bytes", fdb_crc32c_sw(0, ascending, 32) == 0x46DD794E);
+
+    fdb_passed;
+}
+
+void test_crc32c_hw_matches_sw() {
+    uint8_t data[1031];
+    uint32_t seed = 12345;
+    size_t offset;
+    size_t len;
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+
+    /* every alignment and a spread of lengths */
+    for (offset = 0; offset < 8; offset++) {
+        for (len = 0; len + offset <= sizeof(data); len += 37) {
+            fdb_assert("Implementations disagree",
+                       fdb_crc32c(0, data + offset, len) == fdb_crc32c_sw(0, data + offset, len));
+        }
+    }
+
+    fdb_passed;
+}
+
+void test_crc32c_continue() {
+    const uint8_t *data = (const uint8_t*)"The quick brown fox jumps over the lazy dog";
+    uint32_t whole = fdb_crc32c(0, data, 43);
+    size_t split;
+
+    for (split = 0; split <= 43; split++) {
+        fdb_assert("Continued crc differs", fdb_crc32c(fdb_crc32c(0, data, split), data + split, 43 - split) == whole);
+        fdb_assert("Continued software crc differs", fdb_crc32c_sw(fdb_crc32c_sw(0, data, split), data + split, 43 - split) == whole);
+    }
+
+    fdb_passed;
+}
+
+void test_crc32c() {
+    fdb_runtest("Known values", test_crc32c_known_values);
+    fdb_runtest("Hardware matches software", test_crc32c_hw_matches_sw);
+    fdb_runtest("Continue a checksum", test_crc32c_continue);
+}
@@ -50,23 +50,20 @@ void test_fstring_tocstring() {
     char* text = "Cats and dogs, living together, mass hysteria!";
     uint32_t size = strlen(text);
     int error;
-    char** out;
-    char* result;
+    char* result = NULL;
 
     str.id = 2;
     str.size = size;
     str.data = (uint8_t*) text;
 
-    error = fdb_fstring_tocstring(&str, out);
+    error = fdb_fstring_tocstring(&str, &result);
 
 
     fdb_assert("Error occurred", error == FABRICDB_OK);
-    fdb_assert("Out is null", out != NULL);
-    result = *out;
     fdb_assert("Out is null", result != NULL);
     fdb_assert("Returned original data", (void*) result != (void*) text);
     fdb_assert("Wrong length for c string", strlen(result) == size);
-    fdb_assert("Not null terminated", result[size + 1] == '\0');
+    fdb_assert("Not null terminated", result[size] == '\0');
     fdb_assert("Cstring is wrong", memcmp(result, text, size) == 0);
 
     fdb_assert("Wrong amount of memory allocated", fabricdb_mem_size(result) == size + 1);
@@ -76,8 +73,34 @@ void test_fstring_tocstring() {
     fdb_passed;
 }
 
+void test_fstring_tocstring_arena() {
+    FString str;
+    FdbArena arena;
+    char* text = "Cats and dogs, living together, mass hysteria!";
+    uint32_t size = strlen(text);
+    char* result = NULL;
+
+    str.id = 2;
+    str.size = size;
+    str.data = (uint8_t*) text;
+
+    fabricdb_arena_init(&arena, 0, FDB_MEM_SCRATCH);
+    fdb_assert("Error occurred", fdb_fstring_tocstring_arena(&str, &arena, &result) == FABRICDB_OK);
+    fdb_assert("Out is null", result != NULL);
+    fdb_assert("Returned original data", (void*) result != (void*) text);
+    fdb_assert("Wrong length for c string", strlen(result) == size);
+    fdb_assert("Cstring is wrong", memcmp(result, text, size) == 0);
+    fdb_assert("Did not allocate from the arena", (uint8_t*) result == (uint8_t*)(arena.blocks + 1));
+
+    fabricdb_arena_free(&arena);
+    fdb_assert("Did not deallocate", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
 void test_fstring() {
     fdb_runtest("fstring load", test_fstring_load);
     fdb_runtest("fstring unload", test_fstring_unload);
     fdb_runtest("fstring to cstring", test_fstring_tocstring);
+    fdb_runtest("fstring to cstring in an arena", test_fstring_tocstring_arena);
 }
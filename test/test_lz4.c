@@ -0,0 +1,100 @@
+#include "test_common.h"
+
+/* Compresses and decompresses len bytes and checks they come back */
+static int lz4_roundtrip(const uint8_t *data, uint32_t len, uint32_t *compressedLen) {
+    uint8_t compressed[9000];
+    uint8_t out[8192];
+
+    *compressedLen = fdb_lz4_compress(data, len, compressed, sizeof(compressed));
+    if (*compressedLen == 0) {
+        return 0;
+    }
+    if (fdb_lz4_decompress(compressed, *compressedLen, out, len) != FABRICDB_OK) {
+        return 0;
+    }
+    return memcmp(data, out, len) == 0;
+}
+
+void test_lz4_roundtrip() {
+    uint8_t data[8192];
+    uint32_t compressedLen;
+    uint32_t seed = 99;
+    uint32_t len;
+    uint32_t i;
+
+    memset(data, 0, sizeof(data));
+    fdb_assert("Zeros did not round trip", lz4_roundtrip(data, 8192, &compressedLen));
+    fdb_assert("Zeros did not compress", compressedLen < 64);
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)("edge vertex property "[i % 21]);
+    }
+    fdb_assert("Text did not round trip", lz4_roundtrip(data, 8192, &compressedLen));
+    fdb_assert("Text did not compress", compressedLen < 200);
+
+    for (i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    fdb_assert("Noise did not round trip", lz4_roundtrip(data, 8192, &compressedLen));
+    fdb_assert("Noise grew too much", compressedLen <= 8192 + 8192 / 255 + 16);
+
+    /* records with a few changing bytes between runs of zeros */
+    memset(data, 0, sizeof(data));
+    for (i = 0; i + 64 <= sizeof(data); i += 64) {
+        memcpy(data + i, &i, 4);
+        data[i + 8] = (uint8_t)(i / 64);
+    }
+    fdb_assert("Records did not round trip", lz4_roundtrip(data, 8192, &compressedLen));
+    fdb_assert("Records did not compress", compressedLen < 4096);
+
+    /* every short length, where the end of block rules matter most */
+    for (len = 0; len <= 40; len++) {
+        fdb_assert("Short input did not round trip", lz4_roundtrip(data + 60, len, &compressedLen));
+    }
+
+    fdb_passed;
+}
+
+void test_lz4_capacity() {
+    uint8_t data[1024];
+    uint8_t compressed[1024];
+    uint32_t seed = 7;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    fdb_assert("Wrote past the capacity", fdb_lz4_compress(data, 1024, compressed, 1000) == 0);
+    fdb_assert("Wrote past the capacity", fdb_lz4_compress(data, 1024, compressed, 0) == 0);
+
+    fdb_passed;
+}
+
+void test_lz4_decompress() {
+    /* "a", then a match of 5 at offset 1, then 5 literals */
+    uint8_t block[] = {0x11, 'a', 0x01, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a'};
+    uint8_t badOffset[] = {0x11, 'a', 0x02, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a'};
+    uint8_t longLiterals[] = {0xF0, 0x01, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p'};
+    uint8_t out[32];
+
+    fdb_assert("Could not decompress", fdb_lz4_decompress(block, sizeof(block), out, 11) == FABRICDB_OK);
+    fdb_assert("Decompressed incorrectly", memcmp(out, "aaaaaaaaaaa", 11) == 0);
+    fdb_assert("Could not decompress", fdb_lz4_decompress(longLiterals, sizeof(longLiterals), out, 16) == FABRICDB_OK);
+    fdb_assert("Decompressed incorrectly", memcmp(out, "abcdefghijklmnop", 16) == 0);
+
+    fdb_assert("Accepted the wrong size", fdb_lz4_decompress(block, sizeof(block), out, 12) == FABRICDB_ECORRUPT);
+    fdb_assert("Wrote past the output", fdb_lz4_decompress(block, sizeof(block), out, 10) == FABRICDB_ECORRUPT);
+    fdb_assert("Accepted a truncated block", fdb_lz4_decompress(block, 3, out, 11) == FABRICDB_ECORRUPT);
+    fdb_assert("Accepted truncated literals", fdb_lz4_decompress(longLiterals, 10, out, 16) == FABRICDB_ECORRUPT);
+    fdb_assert("Read before the output", fdb_lz4_decompress(badOffset, sizeof(badOffset), out, 11) == FABRICDB_ECORRUPT);
+
+    fdb_passed;
+}
+
+void test_lz4() {
+    fdb_runtest("Round trip", test_lz4_roundtrip);
+    fdb_runtest("Capacity", test_lz4_capacity);
+    fdb_runtest("Decompress", test_lz4_decompress);
+}
@@ -8,11 +8,15 @@
 void all_tests() {
     fdb_runsuite("Mem", test_mem);
     fdb_runsuite("Byte Order", test_byteorder);
+    fdb_runsuite("CRC32C", test_crc32c);
+    fdb_runsuite("LZ4", test_lz4);
     fdb_runsuite("Mutex", test_mutex);
     fdb_runsuite("OS UNIX", test_os_unix);
     fdb_runsuite("u32array", test_u32array);
     fdb_runsuite("u8array", test_u8array);
     fdb_runsuite("ptrmap", test_ptrmap);
+    fdb_runsuite("pagetable", test_pagetable);
+    fdb_runsuite("WAL", test_wal);
     fdb_runsuite("Pager", test_pager);
     fdb_runsuite("Property", test_property);
     fdb_runsuite("FString", test_fstring);
@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include "test_common.h"
 
 typedef struct MemTestStruct {
@@ -7,25 +8,28 @@ typedef struct MemTestStruct {
 } MemTestStruct;
 
 void test_update_memused_alloc() {
-    used_memory = 0;
-    update_memused_alloc(10);
-    fdb_assert("Failed to update used_memory with positive value", fabricdb_mem_used() == 10);
-    update_memused_alloc(-6);
-    fdb_assert("Failed to update used memory with negative value", fabricdb_mem_used() == 4);
+    size_t used = fabricdb_mem_used();
+    update_memused_alloc(10, FDB_MEM_GENERAL);
+    fdb_assert("Failed to update used_memory with positive value", fabricdb_mem_used() == used + 10);
+    update_memused_alloc(-6, FDB_MEM_GENERAL);
+    fdb_assert("Failed to update used memory with negative value", fabricdb_mem_used() == used + 4);
+    update_memused_free(4, FDB_MEM_GENERAL);
     fdb_passed;
 }
 
 void test_update_memused_free() {
-    used_memory = 100;
-    update_memused_free(10);
-    fdb_assert("Failed to update used_memory with positive value", fabricdb_mem_used() == 90);
-    update_memused_free(-6);
-    fdb_assert("Failed to update used memory with negative value", fabricdb_mem_used() == 96);
+    size_t used = fabricdb_mem_used();
+    update_memused_alloc(100, FDB_MEM_GENERAL);
+    update_memused_free(10, FDB_MEM_GENERAL);
+    fdb_assert("Failed to update used_memory with positive value", fabricdb_mem_used() == used + 90);
+    update_memused_free(-6, FDB_MEM_GENERAL);
+    fdb_assert("Failed to update used memory with negative value", fabricdb_mem_used() == used + 96);
+    update_memused_free(96, FDB_MEM_GENERAL);
     fdb_passed;
 }
 
 void test_fabricdb_malloc() {
-    used_memory = 0;
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
     int s = sizeof(MemTestStruct) + FABRICDB_MEM_PREFIX_SIZE;
 
     MemTestStruct *t1 = fdbmalloc(sizeof(MemTestStruct));
@@ -45,7 +49,7 @@ void test_fabricdb_malloc() {
 }
 
 void test_fabricdb_realloc() {
-    used_memory = 0;
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
     int s1 = 3200 + FABRICDB_MEM_PREFIX_SIZE;
     int s2 = 4300 + FABRICDB_MEM_PREFIX_SIZE;
 
@@ -63,11 +67,351 @@ void test_fabricdb_realloc() {
     fdb_passed;
 }
 
+void test_fabricdb_malloc_tagged() {
+    FdbMemStats stats;
+    int s1 = 3200 + FABRICDB_MEM_PREFIX_SIZE;
+    int s2 = 4300 + FABRICDB_MEM_PREFIX_SIZE;
+
+    void *t1 = fdbmalloctag(3200, FDB_MEM_CACHE);
+    void *t2 = fdbmalloczerotag(3200, FDB_MEM_STRING);
+    fdb_assert("Returned null pointer", t1 && t2);
+    fdb_assert("Tag leaked into the size", fabricdb_mem_size(t1) == 3200);
+    fdb_assert("Memory not zeroed", ((uint8_t*)t2)[3199] == 0);
+
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Did not update memory used", stats.used == s1 * 2);
+    fdb_assert("Did not count the cache tag", stats.usedByTag[FDB_MEM_CACHE] == s1);
+    fdb_assert("Did not count the string tag", stats.usedByTag[FDB_MEM_STRING] == s1);
+    fdb_assert("Counted an untagged allocation", stats.usedByTag[FDB_MEM_GENERAL] == 0);
+
+    t1 = fabricdb_realloc(t1, 4300);
+    fdb_assert("Returned null pointer", t1);
+    fdb_assert("Realloc size wrong", fabricdb_mem_size(t1) == 4300);
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Realloc lost the tag", stats.usedByTag[FDB_MEM_CACHE] == s2);
+
+    fdbfree(t1);
+    fdbfree(t2);
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Did not update memory used", stats.used == 0);
+    fdb_assert("Did not update the cache tag", stats.usedByTag[FDB_MEM_CACHE] == 0);
+    fdb_assert("Did not update the string tag", stats.usedByTag[FDB_MEM_STRING] == 0);
+
+    fdb_passed;
+}
+
+void test_mem_highwater() {
+    FdbMemStats stats;
+    size_t s = 4 * FABRICDB_MEM_SAMPLE_INTERVAL + FABRICDB_MEM_PREFIX_SIZE;
+    void *t1;
+
+    fabricdb_mem_reset_highwater();
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Reset did not lower the high-water mark", stats.highwater == 0);
+
+    /* A large allocation is sampled as soon as it is made */
+    t1 = fdbmalloctag(4 * FABRICDB_MEM_SAMPLE_INTERVAL, FDB_MEM_PAGER);
+    fdb_assert("Returned null pointer", t1);
+    fdbfree(t1);
+
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Memory still used", stats.used == 0);
+    fdb_assert("Missed the high-water mark", stats.highwater == s);
+    fdb_assert("Missed the tag's high-water mark", stats.highwaterByTag[FDB_MEM_PAGER] == s);
+    fdb_assert("Raised another tag's high-water mark", stats.highwaterByTag[FDB_MEM_CACHE] == 0);
+
+    fabricdb_mem_reset_highwater();
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Reset did not lower the high-water mark", stats.highwater == 0);
+    fdb_assert("Reset did not lower the tag's high-water mark", stats.highwaterByTag[FDB_MEM_PAGER] == 0);
+
+    fdb_passed;
+}
+
+void test_soft_heap_limit_flag() {
+    void *t1;
+
+    fdb_assert("Started with a limit", fabricdb_get_soft_heap_limit() == 0);
+    fdb_assert("Over no limit", !fabricdb_mem_over_limit());
+
+    /* A large allocation is checked against the limit at once */
+    fdb_assert("Had a limit", fabricdb_set_soft_heap_limit(1024) == 0);
+    t1 = fdbmalloc(2 * FABRICDB_MEM_SAMPLE_INTERVAL);
+    fdb_assert("Returned null pointer", t1);
+    fdb_assert("Not over the limit", fabricdb_mem_over_limit());
+
+    /* Once over, the check adds memory up again */
+    fdbfree(t1);
+    fdb_assert("Still over the limit", !fabricdb_mem_over_limit());
+
+    fdb_assert("Wrong previous limit", fabricdb_set_soft_heap_limit(0) == 1024);
+    fdb_passed;
+}
+
+#define MEM_TEST_THREADS 4
+#define MEM_TEST_ALLOCS 1000
+
+/* Frees what another thread allocated and allocates more of its own */
+static void *mem_thread(void *arg) {
+    void **ptrs = arg;
+    uint32_t i;
+
+    for (i = 0; i < MEM_TEST_ALLOCS; i++) {
+        fdbfree(ptrs[i]);
+        ptrs[i] = fdbmalloctag(16 + i, FDB_MEM_RECORD);
+    }
+    return NULL;
+}
+
+void test_mem_threads() {
+    pthread_t threads[MEM_TEST_THREADS];
+    void *ptrs[MEM_TEST_THREADS][MEM_TEST_ALLOCS];
+    size_t expected = 0;
+    uint32_t i;
+    uint32_t j;
+
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
+
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        for (j = 0; j < MEM_TEST_ALLOCS; j++) {
+            ptrs[i][j] = fdbmalloc(8);
+        }
+    }
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, mem_thread, ptrs[i]);
+    }
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (j = 0; j < MEM_TEST_ALLOCS; j++) {
+        expected += 16 + j + FABRICDB_MEM_PREFIX_SIZE;
+    }
+    fdb_assert("Threads lost count of memory", fabricdb_mem_used() == MEM_TEST_THREADS * expected);
+
+    /* Memory freed by a thread other than the one that allocated it */
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        for (j = 0; j < MEM_TEST_ALLOCS; j++) {
+            fdbfree(ptrs[i][j]);
+        }
+    }
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+void test_arena() {
+    FdbArena arena;
+    FdbMemStats stats;
+    uint8_t *a;
+    uint8_t *b;
+    uint8_t *big;
+    size_t oneBlock = sizeof(FdbArenaBlock) + 1024 + FABRICDB_MEM_PREFIX_SIZE;
+    uint32_t i;
+
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
+
+    fabricdb_arena_init(&arena, 1024, FDB_MEM_RECORD);
+    fdb_assert("Allocated before first use", fabricdb_mem_used() == 0);
+
+    a = fabricdb_arena_alloc(&arena, 3);
+    b = fabricdb_arena_alloc(&arena, 8);
+    fdb_assert("Returned null pointer", a && b);
+    fdb_assert("Not aligned", ((uintptr_t)a & 7) == 0 && ((uintptr_t)b & 7) == 0);
+    fdb_assert("Did not bump", b == a + 8);
+    fdb_assert("Did not count the block", fabricdb_mem_used() == oneBlock);
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Counted against the wrong tag", stats.usedByTag[FDB_MEM_RECORD] == oneBlock);
+
+    /* A large allocation leaves the current block to bump from */
+    big = fabricdb_arena_alloc(&arena, 2000);
+    fdb_assert("Returned null pointer", big);
+    fdb_assert("Did not give it a block", fabricdb_mem_used() == oneBlock + sizeof(FdbArenaBlock) + 2000 + FABRICDB_MEM_PREFIX_SIZE);
+    fdb_assert("Did not keep bumping", fabricdb_arena_alloc(&arena, 8) == b + 8);
+    memset(big, 1, 2000);
+
+    /* Filling the block moves on to another */
+    for (i = 0; i < 200; i++) {
+        a = fabricdb_arena_alloc(&arena, 16);
+        fdb_assert("Returned null pointer", a);
+        memset(a, 2, 16);
+    }
+    fdb_assert("Did not grow", arena.blocks->next != NULL);
+
+    /* Reset keeps one block and reuses it */
+    fabricdb_arena_reset(&arena);
+    fdb_assert("Kept more than one block", fabricdb_mem_used() == oneBlock);
+    a = fabricdb_arena_alloc(&arena, 8);
+    fdb_assert("Did not reuse the block", a == (uint8_t*)(arena.blocks + 1));
+    fdb_assert("Allocated after reset", fabricdb_mem_used() == oneBlock);
+
+    fabricdb_arena_free(&arena);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fabricdb_arena_free(&arena);
+
+    fdb_passed;
+}
+
+static void* arena_thread(void *arg) {
+    FdbArena *arena = fabricdb_arena_thread();
+
+    *(FdbArena**)arg = arena;
+    if (fabricdb_arena_alloc(arena, 64) == NULL || arena->tag != FDB_MEM_SCRATCH) {
+        *(FdbArena**)arg = NULL;
+    }
+    fabricdb_arena_thread_free();
+    return NULL;
+}
+
+void test_arena_thread() {
+    FdbArena *arena;
+    FdbArena *other = NULL;
+    pthread_t thread;
+
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
+
+    arena = fabricdb_arena_thread();
+    fdb_assert("Returned null arena", arena != NULL);
+    fdb_assert("Not the same arena", fabricdb_arena_thread() == arena);
+    fdb_assert("Could not allocate", fabricdb_arena_alloc(arena, 64) != NULL);
+
+    pthread_create(&thread, NULL, arena_thread, &other);
+    pthread_join(thread, NULL);
+    fdb_assert("Other thread could not allocate", other != NULL);
+    fdb_assert("Threads shared an arena", other != arena);
+
+    fabricdb_arena_thread_free();
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+void test_obj_pool() {
+    FdbMemStats stats;
+    void *objs[1000];
+    void *obj;
+    void *big;
+    uint32_t i;
+
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
+
+    obj = fdbobjalloc(24, FDB_MEM_RECORD);
+    fdb_assert("Returned null pointer", obj);
+    fdb_assert("Not aligned", ((uintptr_t)obj & 7) == 0);
+    fdb_assert("Not counted at its class size", fabricdb_mem_used() == 32);
+    fabricdb_mem_stats(&stats);
+    fdb_assert("Counted against the wrong tag", stats.usedByTag[FDB_MEM_RECORD] == 32);
+    fdbobjfree(obj, 24, FDB_MEM_RECORD);
+    fdb_assert("Did not update memory used", fabricdb_mem_used() == 0);
+    fdb_assert("Did not reuse the object", fdbobjalloc(24, FDB_MEM_RECORD) == obj);
+    fdbobjfree(obj, 24, FDB_MEM_RECORD);
+
+    fdb_assert("Allocated nothing", fdbobjalloc(0, FDB_MEM_RECORD) == NULL);
+
+    /* Enough objects to go through the shared free lists and new slabs */
+    for (i = 0; i < 1000; i++) {
+        objs[i] = fdbobjalloc(1 + i % 256, FDB_MEM_RECORD);
+        fdb_assert("Returned null pointer", objs[i]);
+        memset(objs[i], i & 0xFF, 1 + i % 256);
+    }
+    for (i = 0; i < 1000; i++) {
+        fdb_assert("Object was overwritten", ((uint8_t*)objs[i])[i % 256] == (i & 0xFF));
+        fdbobjfree(objs[i], 1 + i % 256, FDB_MEM_RECORD);
+    }
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    /* Larger objects are malloced */
+    big = fdbobjalloc(300, FDB_MEM_RECORD);
+    fdb_assert("Returned null pointer", big);
+    fdb_assert("Did not malloc", fabricdb_mem_size(big) == 300);
+    fdbobjfree(big, 300, FDB_MEM_RECORD);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+#define OBJ_TEST_THREADS 4
+#define OBJ_TEST_OBJECTS 2000
+
+/* Frees the objects it is handed, which another thread allocated, and
+   churns through objects of its own */
+static void* obj_thread(void *arg) {
+    void **objs = arg;
+    void *own[64];
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i < OBJ_TEST_OBJECTS; i++) {
+        fdbobjfree(objs[i], 40, FDB_MEM_GENERAL);
+    }
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < 64; j++) {
+            own[j] = fdbobjalloc(40, FDB_MEM_GENERAL);
+        }
+        for (j = 0; j < 64; j++) {
+            fdbobjfree(own[j], 40, FDB_MEM_GENERAL);
+        }
+    }
+    for (i = 0; i < OBJ_TEST_OBJECTS; i++) {
+        objs[i] = fdbobjalloc(40, FDB_MEM_GENERAL);
+    }
+    return NULL;
+}
+
+void test_obj_pool_threads() {
+    pthread_t threads[OBJ_TEST_THREADS];
+    void *objs[OBJ_TEST_THREADS][OBJ_TEST_OBJECTS];
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+
+    fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
+
+    for (i = 0; i < OBJ_TEST_THREADS; i++) {
+        for (j = 0; j < OBJ_TEST_OBJECTS; j++) {
+            objs[i][j] = fdbobjalloc(40, FDB_MEM_GENERAL);
+        }
+    }
+    for (i = 0; i < OBJ_TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, obj_thread, objs[i]);
+    }
+    for (i = 0; i < OBJ_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    fdb_assert("Threads lost count of memory", fabricdb_mem_used() == OBJ_TEST_THREADS * OBJ_TEST_OBJECTS * 48);
+
+    /* No object was handed out twice */
+    for (i = 0; i < OBJ_TEST_THREADS; i++) {
+        for (j = 0; j < OBJ_TEST_OBJECTS; j++) {
+            fdb_assert("Returned null pointer", objs[i][j]);
+            memset(objs[i][j], 0, 40);
+            *(uint32_t*)objs[i][j] = i * OBJ_TEST_OBJECTS + j;
+        }
+    }
+    for (i = 0; i < OBJ_TEST_THREADS; i++) {
+        for (j = 0; j < OBJ_TEST_OBJECTS; j++) {
+            k = *(uint32_t*)objs[i][j];
+            fdb_assert("Object handed out twice", k == i * OBJ_TEST_OBJECTS + j);
+            fdbobjfree(objs[i][j], 40, FDB_MEM_GENERAL);
+        }
+    }
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
 
 void test_mem() {
     fdb_runtest("Update Memused Alloc", test_update_memused_alloc);
     fdb_runtest("Update Memused Free", test_update_memused_free);
     fdb_runtest("FabricDB Malloc/Free", test_fabricdb_malloc);
     fdb_runtest("FabricDB Realloc", test_fabricdb_realloc);
+    fdb_runtest("FabricDB Malloc Tagged", test_fabricdb_malloc_tagged);
+    fdb_runtest("High-water Marks", test_mem_highwater);
+    fdb_runtest("Soft Heap Limit", test_soft_heap_limit_flag);
+    fdb_runtest("Threads", test_mem_threads);
+    fdb_runtest("Arena", test_arena);
+    fdb_runtest("Thread Arena", test_arena_thread);
+    fdb_runtest("Object Pool", test_obj_pool);
+    fdb_runtest("Object Pool Threads", test_obj_pool_threads);
 
 }
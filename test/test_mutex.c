@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <time.h>
 #include <errno.h>
 #include "test_common.h"
 
@@ -16,25 +17,25 @@ static int t_2result;
 void *thread_increment_test_1(void *t) {
     sleep(1);
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
+    fdb_enter_mutex(FDB_INODE_MUTEX(0));
 
     mutex_test++;
     t_1result = mutex_test == 2;
 
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(FDB_INODE_MUTEX(0));
 
     pthread_exit((void *) 0);
 }
 
 void *thread_increment_test_2(void *t) {
 
-    fdb_enter_mutex(FDB_INODE_MUTEX);
+    fdb_enter_mutex(FDB_INODE_MUTEX(0));
     sleep(2);
 
     mutex_test++;
     t_2result = mutex_test == 1;
 
-    fdb_leave_mutex(FDB_INODE_MUTEX);
+    fdb_leave_mutex(FDB_INODE_MUTEX(0));
 
     pthread_exit((void *) 0);
 }
@@ -83,7 +84,87 @@ void test_enter_mutex() {
 
 }
 
+static int wait_test_flag;
+
+void *thread_notify_test(void *t) {
+    /* usleep is not declared under _XOPEN_SOURCE 700 */
+    struct timespec delay = {0, 100000000};
+    nanosleep(&delay, NULL);
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    wait_test_flag = 1;
+    fdb_notify_mutex(FDB_SYNC_MUTEX);
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    pthread_exit((void *) 0);
+}
+
+void test_wait_mutex() {
+    pthread_t th;
+    int woken = 1;
+
+    fdb_init_mutexes();
+    wait_test_flag = 0;
+
+    /* nobody notifies, so the wait times out */
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    fdb_assert("Wait did not time out", fdb_wait_mutex(FDB_SYNC_MUTEX, 1000) == 0);
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+
+    pthread_create(&th, NULL, thread_notify_test, (void *) 0);
+
+    fdb_enter_mutex(FDB_SYNC_MUTEX);
+    while (!wait_test_flag && woken) {
+        woken = fdb_wait_mutex(FDB_SYNC_MUTEX, 5000000);
+    }
+    fdb_leave_mutex(FDB_SYNC_MUTEX);
+    fdb_assert("Thread exited with bad return code", pthread_join(th, NULL) == 0);
+    fdb_assert("Wait was not notified", wait_test_flag == 1 && woken == 1);
+
+    fdb_passed;
+}
+
+#define COUNTER_THREADS 4
+#define COUNTER_INCREMENTS 100000
+
+static FdbMutex *counter_mutex;
+static int counter;
+
+void *thread_counter_test(void *t) {
+    int i;
+
+    for (i = 0; i < COUNTER_INCREMENTS; i++) {
+        fdb_lock_mutex(counter_mutex);
+        counter++;
+        fdb_unlock_mutex(counter_mutex);
+    }
+
+    pthread_exit((void *) 0);
+}
+
+void test_alloc_mutex() {
+    pthread_t th[COUNTER_THREADS];
+    int i;
+
+    counter_mutex = fdb_alloc_mutex();
+    fdb_assert("Could not allocate mutex", counter_mutex != NULL);
+    counter = 0;
+
+    for (i = 0; i < COUNTER_THREADS; i++) {
+        pthread_create(&th[i], NULL, thread_counter_test, (void *) 0);
+    }
+    for (i = 0; i < COUNTER_THREADS; i++) {
+        fdb_assert("Thread exited with bad return code", pthread_join(th[i], NULL) == 0);
+    }
+    fdb_free_mutex(counter_mutex);
+
+    fdb_assert("Lost an increment", counter == COUNTER_THREADS * COUNTER_INCREMENTS);
+    fdb_passed;
+}
+
 void test_mutex() {
     fdb_runtest("Init mutexes", test_init_mutexes);
     fdb_runtest("Enter / Leave Mutex", test_enter_mutex);
+    fdb_runtest("Wait / Notify Mutex", test_wait_mutex);
+    fdb_runtest("Allocated Mutex", test_alloc_mutex);
 }
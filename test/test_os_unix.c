@@ -1,3 +1,4 @@
+#include <sys/wait.h>
 #include "test_common.h"
 
 static const char* TEMPFILENAME = "./tempfile.tmp";
@@ -93,6 +94,24 @@ void test_open_file_rdonly() {
     fdb_passed;
 }
 
+/* Counts the inode infos on every list */
+static uint32_t inodeinfo_count() {
+    uint32_t count = 0;
+    uint32_t i;
+    InodeInfo *info;
+
+    for (i = 0; i < FDB_INODE_MUTEX_COUNT; i++) {
+        for (info = inodeInfoLists[i]; info != NULL; info = info->next) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static InodeInfo* inodeinfo_list(FileHandle *fh) {
+    return inodeInfoLists[fdb_fileid_shard(fh->inodeInfo->fileId)];
+}
+
 void test_inodeinfo_fetch() {
     FileHandle *fh1;
     FileHandle *fh2;
@@ -103,23 +122,24 @@ void test_inodeinfo_fetch() {
     remove(TEMPFILENAME_3);
 
     fdb_assert("Started test with memory used", fabricdb_mem_used() == 0);
-    fdb_assert("Inode info list is not null", inodeInfoList == NULL);
+    fdb_assert("Inode info lists are not empty", inodeinfo_count() == 0);
 
     fdb_assert("Could not open file", 0 == fdb_open_file_rdwr(TEMPFILENAME, &fh1));
     fdb_assert("Null file handle", fh1);
     fdb_assert("Inode not set", fh1->inodeInfo);
     fdb_assert("Reference count not set", fh1->inodeInfo->refCount == 1);
-    fdb_assert("Inode info list not set", inodeInfoList == fh1->inodeInfo);
-    fdb_assert("Inode prev is not null", inodeInfoList->next == NULL);
-    fdb_assert("Inode next not set", inodeInfoList->next == NULL);
+    fdb_assert("Inode info list not set", inodeinfo_list(fh1) == fh1->inodeInfo);
+    fdb_assert("Inode prev is not null", fh1->inodeInfo->prev == NULL);
+    fdb_assert("Inode next not set", fh1->inodeInfo->next == NULL);
+    fdb_assert("Inode mutex not set",
+               fh1->inodeInfo->mutexId == fdb_inodeinfo_mutex(fh1->inodeInfo->fileId));
 
     fdb_assert("Could not open file", 0 == fdb_open_file_rdwr(TEMPFILENAME, &fh2));
 
     fdb_assert("Null file handle", fh2);
     fdb_assert("Inode not set", fh2->inodeInfo);
     fdb_assert("Reference count not updated", fh2->inodeInfo->refCount == 2);
-    fdb_assert("Inode prev is not null", inodeInfoList->next == NULL);
-    fdb_assert("Inode next not set", inodeInfoList->next == NULL);
+    fdb_assert("Inode info added twice", inodeinfo_count() == 1);
 
     fdb_assert("Have same file descriptor", fh1->fd != fh2->fd);
     fdb_assert("Have different inode infos", fh1->inodeInfo == fh2->inodeInfo);
@@ -131,11 +151,19 @@ void test_inodeinfo_fetch() {
     fdb_assert("Reference count not updated", fh2->inodeInfo->refCount == 2);
     fdb_assert("Reference count not updated", fh3->inodeInfo->refCount == 1);
 
-    fdb_assert("Inode list not updated", inodeInfoList == fh3->inodeInfo);
-    fdb_assert("Inode prev is not null", inodeInfoList->prev == NULL);
-    fdb_assert("Inode next not set", inodeInfoList->next == fh2->inodeInfo);
-    fdb_assert("Inode prev not set", inodeInfoList->next->prev == inodeInfoList);
-    fdb_assert("Inode next set", inodeInfoList->next->next == NULL);
+    fdb_assert("Inode info not added", inodeinfo_count() == 2);
+    fdb_assert("Inode list not updated", inodeinfo_list(fh3) == fh3->inodeInfo);
+    fdb_assert("Inode prev is not null", fh3->inodeInfo->prev == NULL);
+    if (inodeinfo_list(fh2) == inodeinfo_list(fh3)) {
+        /* Both files hashed to the same list */
+        fdb_assert("Inode next not set", fh3->inodeInfo->next == fh2->inodeInfo);
+        fdb_assert("Inode prev not set", fh2->inodeInfo->prev == fh3->inodeInfo);
+    }
+    else {
+        fdb_assert("Inode next set", fh3->inodeInfo->next == NULL);
+        fdb_assert("Inode list changed", inodeinfo_list(fh2) == fh2->inodeInfo);
+    }
+    fdb_assert("Inode next set", fh2->inodeInfo->next == NULL);
 
     fdb_open_file_rdwr(TEMPFILENAME, &fh4);
     fdb_assert("Inode not found correctly", fh4->inodeInfo == fh1->inodeInfo);
@@ -144,9 +172,10 @@ void test_inodeinfo_fetch() {
     fdb_close_file(fh4);
 
     fdb_close_file(fh3);
-    fdb_assert("Inode list not updated", inodeInfoList == fh1->inodeInfo);
-    fdb_assert("Inode prev is not null", inodeInfoList->prev == NULL);
-    fdb_assert("Inode next is not null", inodeInfoList->next == NULL);
+    fdb_assert("Inode info not removed", inodeinfo_count() == 1);
+    fdb_assert("Inode list not updated", inodeinfo_list(fh1) == fh1->inodeInfo);
+    fdb_assert("Inode prev is not null", fh1->inodeInfo->prev == NULL);
+    fdb_assert("Inode next is not null", fh1->inodeInfo->next == NULL);
 
     fdb_close_file(fh1);
     // no locks yet
@@ -156,7 +185,7 @@ void test_inodeinfo_fetch() {
     fdb_close_file(fh2);
 
     fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
-    fdb_assert("Inode info list is not null", inodeInfoList == NULL);
+    fdb_assert("Inode info lists are not empty", inodeinfo_count() == 0);
 
     fdb_passed;
 }
@@ -192,7 +221,7 @@ void test_close_file() {
 
     /* The file descriptor should still be open */
     fdb_assert("File descriptor was closed", fstat(fd1, &st) != -1);
-    fdb_assert("Unused file handle's fd not set properly", fh1->inodeInfo->unusedFiles->fd == fd1);
+    fdb_assert("Unused file handle's fd not set properly", fh2->inodeInfo->unusedFiles->fd == fd1);
 
     /* remove fake lock */
     fh2->inodeInfo->lockCount--;
@@ -280,6 +309,228 @@ void test_read() {
     fdb_passed;
 }
 
+void test_writev() {
+    remove(TEMPFILENAME);
+
+    FileHandle *fh;
+    off_t size;
+    uint8_t *bytes = (uint8_t*) "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint8_t buff[26];
+    uint8_t *many;
+    FdbIoVec vecs[3];
+    FdbIoVec *manyVecs;
+    int i;
+
+    fdb_assert("Could not create file", fdb_create_file(TEMPFILENAME, &fh) == FABRICDB_OK);
+
+    /* the buffers land back to back */
+    vecs[0].base = bytes;
+    vecs[0].len = 10;
+    vecs[1].base = bytes + 10;
+    vecs[1].len = 6;
+    vecs[2].base = bytes + 16;
+    vecs[2].len = 10;
+    fdb_assert("Could not write", fdb_writev(fh, vecs, 3, 4) == FABRICDB_OK);
+    fdb_assert("Size failed", fdb_file_size(fh, &size) == FABRICDB_OK);
+    fdb_assert("File not right size", size == 30);
+    fdb_assert("Could not read", fdb_read(fh, buff, 4, 26) == FABRICDB_OK);
+    fdb_assert("Wrote incorrectly", memcmp(bytes, buff, 26) == 0);
+
+    /* more buffers than one system call takes */
+    many = fdbmalloc(5000);
+    manyVecs = fdbmalloc(sizeof(FdbIoVec) * 5000);
+    for (i = 0; i < 5000; i++) {
+        many[i] = (uint8_t)i;
+        manyVecs[i].base = many + i;
+        manyVecs[i].len = 1;
+    }
+    fdb_assert("Could not write", fdb_writev(fh, manyVecs, 5000, 0) == FABRICDB_OK);
+    fdb_assert("Size failed", fdb_file_size(fh, &size) == FABRICDB_OK);
+    fdb_assert("File not right size", size == 5000);
+    memset(many, 0, 5000);
+    fdb_assert("Could not read", fdb_read(fh, many, 0, 5000) == FABRICDB_OK);
+    for (i = 0; i < 5000 && many[i] == (uint8_t)i; i++);
+    fdb_assert("Wrote incorrectly", i == 5000);
+    fdbfree(many);
+    fdbfree(manyVecs);
+
+    fdb_close_file(fh);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+void test_readv() {
+    remove(TEMPFILENAME);
+
+    FileHandle *fh;
+    uint8_t *bytes = (uint8_t*) "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint8_t first[10];
+    uint8_t second[6];
+    FdbIoVec vecs[2];
+
+    fdb_assert("Could not create file", fdb_create_file(TEMPFILENAME, &fh) == FABRICDB_OK);
+    fdb_assert("Could not write", fdb_write(fh, bytes, 0, 26) == FABRICDB_OK);
+
+    vecs[0].base = first;
+    vecs[0].len = 10;
+    vecs[1].base = second;
+    vecs[1].len = 6;
+    fdb_assert("Could not read", fdb_readv(fh, vecs, 2, 4) == FABRICDB_OK);
+    fdb_assert("Read incorrectly", memcmp(bytes + 4, first, 10) == 0);
+    fdb_assert("Read incorrectly", memcmp(bytes + 14, second, 6) == 0);
+    fdb_assert("Failed to return correct error", fdb_readv(fh, vecs, 2, 20) == FABRICDB_ESHORTREAD);
+
+    fdb_assert("Could not advise", fdb_advise(fh, 0, 26, FDB_ADVISE_WILLNEED) == FABRICDB_OK);
+
+    fdb_close_file(fh);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+/* Finds the completion with the given tag, NULL if there is none */
+static FdbIoCompletion *find_completion(FdbIoCompletion *completions, uint32_t count, uint64_t tag) {
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        if (completions[i].tag == tag) {
+            return &completions[i];
+        }
+    }
+    return NULL;
+}
+
+static void check_ioqueue(FdbIoQueue *queue) {
+    FileHandle *fh;
+    FileHandle *rofh;
+    uint8_t *bytes = (uint8_t*) "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint8_t first[10];
+    uint8_t second[16];
+    FdbIoVec vecs[2];
+    FdbIoCompletion completions[8];
+    uint32_t count;
+
+    remove(TEMPFILENAME);
+    fdb_assert("Could not create file", fdb_create_file(TEMPFILENAME, &fh) == FABRICDB_OK);
+
+    /* two writes and a sync that waits for them */
+    vecs[0].base = bytes;
+    vecs[0].len = 10;
+    vecs[1].base = bytes + 10;
+    vecs[1].len = 16;
+    fdb_assert("Could not queue write", fdb_write_async(queue, fh, vecs, 2, 0, 1) == FABRICDB_OK);
+    fdb_assert("Could not queue write", fdb_write_async(queue, fh, vecs, 1, 26, 2) == FABRICDB_OK);
+    fdb_assert("Could not queue sync", fdb_sync_async(queue, fh, 3) == FABRICDB_OK);
+    fdb_assert("Wrong space", fdb_ioqueue_space(queue) == 1);
+    fdb_assert("Could not submit", fdb_ioqueue_submit(queue) == FABRICDB_OK);
+    fdb_assert("Could not wait", fdb_ioqueue_wait(queue, 3, completions, 8, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 3);
+    fdb_assert("Write failed", find_completion(completions, count, 1)->rc == FABRICDB_OK);
+    fdb_assert("Write failed", find_completion(completions, count, 2)->rc == FABRICDB_OK);
+    fdb_assert("Sync failed", find_completion(completions, count, 3)->rc == FABRICDB_OK);
+    fdb_assert("Slots not freed", fdb_ioqueue_space(queue) == 4);
+
+    /* reads, one of them running into the end of the file */
+    vecs[0].base = first;
+    vecs[0].len = 10;
+    vecs[1].base = second;
+    vecs[1].len = 16;
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 4, 4) == FABRICDB_OK);
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs + 1, 1, 30, 5) == FABRICDB_OK);
+    fdb_assert("Could not submit", fdb_ioqueue_submit(queue) == FABRICDB_OK);
+    fdb_assert("Could not wait", fdb_ioqueue_wait(queue, 2, completions, 8, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 2);
+    fdb_assert("Read failed", find_completion(completions, count, 4)->rc == FABRICDB_OK);
+    fdb_assert("Read incorrectly", memcmp(bytes + 4, first, 10) == 0);
+    fdb_assert("Failed to return correct error", find_completion(completions, count, 5)->rc == FABRICDB_ESHORTREAD);
+
+    /* a failed write cancels the sync linked to it */
+    fdb_assert("Could not open file", fdb_open_file_rdonly(TEMPFILENAME, &rofh) == FABRICDB_OK);
+    fdb_assert("Could not queue write", fdb_write_async(queue, rofh, vecs, 1, 0, 6) == FABRICDB_OK);
+    fdb_assert("Could not queue sync", fdb_sync_async(queue, rofh, 7) == FABRICDB_OK);
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 8) == FABRICDB_OK);
+    fdb_assert("Could not submit", fdb_ioqueue_submit(queue) == FABRICDB_OK);
+    fdb_assert("Could not wait", fdb_ioqueue_wait(queue, 3, completions, 8, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 3);
+    fdb_assert("Failed to return correct error", find_completion(completions, count, 6)->rc == FABRICDB_EBADF);
+    fdb_assert("Sync was not cancelled", find_completion(completions, count, 7)->rc == FABRICDB_ECANCELED);
+    fdb_assert("Unlinked read was cancelled", find_completion(completions, count, 8)->rc == FABRICDB_OK);
+    fdb_assert("Read incorrectly", memcmp(bytes, first, 10) == 0);
+
+    /* the queue only holds depth requests */
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 9) == FABRICDB_OK);
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 10) == FABRICDB_OK);
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 11) == FABRICDB_OK);
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 12) == FABRICDB_OK);
+    fdb_assert("Queued past the depth", fdb_read_async(queue, fh, vecs, 1, 0, 13) == FABRICDB_BUSY);
+    fdb_assert("Could not submit", fdb_ioqueue_submit(queue) == FABRICDB_OK);
+    fdb_assert("Could not wait", fdb_ioqueue_wait(queue, 2, completions, 2, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 2);
+    fdb_assert("Could not wait", fdb_ioqueue_wait(queue, 8, completions, 8, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 2);
+    fdb_assert("Waited for nothing", fdb_ioqueue_wait(queue, 1, completions, 8, &count) == FABRICDB_OK);
+    fdb_assert("Wrong completion count", count == 0);
+
+    /* requests still in flight are waited for on close */
+    fdb_assert("Could not queue read", fdb_read_async(queue, fh, vecs, 1, 0, 14) == FABRICDB_OK);
+    fdb_assert("Could not submit", fdb_ioqueue_submit(queue) == FABRICDB_OK);
+
+    fdb_ioqueue_close(queue);
+    fdb_close_file(rofh);
+    fdb_close_file(fh);
+}
+
+void test_ioqueue() {
+    FdbIoQueue *queue;
+
+    fdb_assert("Could not open queue", fdb_ioqueue_open(4, &queue) == FABRICDB_OK);
+    check_ioqueue(queue);
+
+    /* the same again without io_uring */
+    fdb_assert("Could not open queue", fdb_ioqueue_open(4, &queue) == FABRICDB_OK);
+#ifdef FDB_HAVE_IO_URING
+    ioqueue_ring_close(queue);
+#endif
+    fdb_assert("Queue is asynchronous", !fdb_ioqueue_is_async(queue));
+    check_ioqueue(queue);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
+void test_map_file() {
+    remove(TEMPFILENAME);
+
+    FileHandle *fh;
+    uint8_t *map;
+    uint8_t *bytes = (uint8_t*) "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    fdb_assert("Could not create file", fdb_create_file(TEMPFILENAME, &fh) == FABRICDB_OK);
+    fdb_assert("Could not write", fdb_write(fh, bytes, 0, 26) == FABRICDB_OK);
+
+    /* the mapping may extend past the end of the file */
+    fdb_assert("Could not map", fdb_map_file(fh, 8192, &map) == FABRICDB_OK);
+    fdb_assert("Map is null", map != NULL);
+    fdb_assert("Mapped incorrectly", memcmp(bytes, map, 26) == 0);
+
+    /* writes show up in a shared mapping */
+    fdb_assert("Could not write", fdb_write(fh, bytes, 26, 26) == FABRICDB_OK);
+    fdb_assert("Did not see write", memcmp(bytes, map + 26, 26) == 0);
+
+    fdb_assert("Could not unmap", fdb_unmap_file(map, 8192) == FABRICDB_OK);
+    fdb_assert("Mapped an empty range", fdb_map_file(fh, 0, &map) != FABRICDB_OK);
+    fdb_assert("Map not null", map == NULL);
+
+    fdb_close_file(fh);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+
+    fdb_passed;
+}
+
 void test_sync() {
     FileHandle *fh;
     int fd;
@@ -300,6 +551,48 @@ void test_sync() {
     fdb_passed;
 }
 
+void test_group_sync_failure() {
+    FileHandle *fh1;
+    FileHandle *fh2;
+    uint64_t ticket1;
+    uint64_t ticket2;
+    uint64_t ticket3;
+    uint64_t syncs;
+    int fd;
+
+    remove(TEMPFILENAME);
+    fdb_assert("Could not create file", fdb_create_file(TEMPFILENAME, &fh1) == FABRICDB_OK);
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh2) == FABRICDB_OK);
+
+    ticket1 = fdb_sync_ticket(fh1);
+    fdb_assert("Group sync failed", fdb_group_sync(fh1, ticket1, 0, 1) == FABRICDB_OK);
+
+    /* the leader's sync covers both tickets and fails */
+    ticket2 = fdb_sync_ticket(fh1);
+    ticket3 = fdb_sync_ticket(fh2);
+    fd = fh1->fd;
+    fh1->fd = -1;
+    fdb_assert("Failed to return error code", fdb_group_sync(fh1, ticket2, 0, 1) != FABRICDB_OK);
+    fh1->fd = fd;
+
+    /* the other ticket fails too, without a second sync vouching for it */
+    syncs = fdb_sync_count(fh2);
+    fdb_assert("Covered ticket reported durable", fdb_group_sync(fh2, ticket3, 0, 1) != FABRICDB_OK);
+    fdb_assert("Later ticket reported durable", fdb_group_sync(fh2, fdb_sync_ticket(fh2), 0, 1) != FABRICDB_OK);
+    fdb_assert("Synced after a failure", fdb_sync_count(fh2) == syncs);
+    fdb_assert("Durable ticket lost", fdb_group_sync(fh1, ticket1, 0, 1) == FABRICDB_OK);
+
+    /* a fresh open starts over */
+    fdb_close_file(fh2);
+    fdb_close_file(fh1);
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh1) == FABRICDB_OK);
+    fdb_assert("Group sync failed", fdb_group_sync(fh1, fdb_sync_ticket(fh1), 0, 1) == FABRICDB_OK);
+    fdb_close_file(fh1);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
 static int get_lock(int fd, off_t start, int *out){
     struct flock lock;
     pid_t pid;
@@ -955,7 +1248,12 @@ void test_os_unix() {
     fdb_runtest("Close File", test_close_file);
     fdb_runtest("Truncate", test_truncate);
     fdb_runtest("Read", test_read);
+    fdb_runtest("Vectored Write", test_writev);
+    fdb_runtest("Vectored Read", test_readv);
+    fdb_runtest("I/O Queue", test_ioqueue);
+    fdb_runtest("Map File", test_map_file);
     fdb_runtest("Sync", test_sync);
+    fdb_runtest("Group sync failure", test_group_sync_failure);
     fdb_runtest("Acquire shared lock 1", test_acquire_shared_lock_1);
     fdb_runtest("Acquire shared lock 2", test_acquire_shared_lock_2);
     fdb_runtest("Acquire reserved lock 1",test_acquire_reserved_lock_1);
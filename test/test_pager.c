@@ -1,3 +1,6 @@
+#include <pthread.h>
+#include <sched.h>
+
 #include "test_common.h"
 
 static const char* TEMPFILENAME = "./tempfile.tmp";
@@ -7,6 +10,7 @@ static const int TESTSTRING_SIZE= 36;
 
 void test_read_page() {
     FileHandle *fh;
+    FramePool pool;
     Page* page;
     // uint8_t* buffer[TESTSTRING_SIZE];
 
@@ -18,7 +22,8 @@ void test_read_page() {
     fdb_assert("Lock level wrong", fdb_get_lock_level(fh) == FDB_NO_LOCK);
     fdb_assert("Could not write file", fdb_write(fh, (uint8_t*)TESTSTRING, 0, TESTSTRING_SIZE) == FABRICDB_OK);
 
-    fdb_assert("Could not read page", read_page(fh, 1, TESTSTRING_SIZE, TESTSTRING_SIZE, 1, &page) == FABRICDB_OK);
+    fdb_assert("Could not create frame pool", framepool_init(&pool, TESTSTRING_SIZE, 1) == FABRICDB_OK);
+    fdb_assert("Could not read page", read_page(&pool, fh, 1, TESTSTRING_SIZE, 1, &page) == FABRICDB_OK);
     fdb_assert("Page was null", page);
     fdb_assert("Page size was wrong", page->pageSize == TESTSTRING_SIZE);
     fdb_assert("Page number was wrong", page->pageNo == 1);
@@ -27,7 +32,8 @@ void test_read_page() {
     fdb_assert("Page marked as dirty", page->dirty == 0);
     fdb_assert("Did not read correct values", memcmp(TESTSTRING, page->data, TESTSTRING_SIZE) == 0);
 
-    free_page(page);
+    free_page(&pool, page);
+    framepool_deinit(&pool);
     fdb_assert("Lock level wrong", fdb_get_lock_level(fh) == FDB_NO_LOCK);
     fdb_close_file(fh);
 
@@ -35,6 +41,49 @@ void test_read_page() {
     fdb_passed;
 }
 
+void test_frame_pool() {
+    FramePool pool;
+    Page *pages[FRAMEPOOL_SLAB_FRAMES + 1];
+    Page *page;
+    uint32_t i;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    fdb_assert("Could not create frame pool", framepool_init(&pool, 1024 + 8, 10) == FABRICDB_OK);
+    fdb_assert("Did not preallocate the frames", pool.numFrames == 10);
+    fdb_assert("Frames not free", pool.numFree == 10);
+    fdb_assert("Frame size not rounded", pool.frameSize == 1088);
+
+    for (i = 0; i < 10; i++) {
+        pages[i] = framepool_alloc(&pool);
+        fdb_assert("Could not allocate frame", pages[i] != NULL);
+        fdb_assert("Frames overlap", i == 0 || pages[i]->data != pages[i-1]->data);
+        fdb_assert("Frame not aligned", ((uintptr_t)pages[i]->data % FRAME_STRIDE) == 0);
+    }
+    fdb_assert("Grew the pool too early", pool.numFrames == 10);
+    fdb_assert("Free count wrong", pool.numFree == 0);
+
+    /* a released frame is the next one handed out */
+    page = pages[3];
+    framepool_release(&pool, page);
+    fdb_assert("Free count wrong", pool.numFree == 1);
+    pages[3] = framepool_alloc(&pool);
+    fdb_assert("Did not reuse the frame", pages[3] == page);
+
+    /* an empty pool grows by a slab */
+    pages[10] = framepool_alloc(&pool);
+    fdb_assert("Could not grow the pool", pages[10] != NULL);
+    fdb_assert("Did not grow by a slab", pool.numFrames == 10 + FRAMEPOOL_SLAB_FRAMES);
+    fdb_assert("Free count wrong", pool.numFree == FRAMEPOOL_SLAB_FRAMES - 1);
+    fdb_assert("Frame not page aligned", ((uintptr_t)pages[10]->data % FRAME_ALIGNMENT) == 0);
+
+    fdb_assert("Could not reserve frames", framepool_reserve(&pool, 200) == FABRICDB_OK);
+    fdb_assert("Did not reserve the frames", pool.numFrames == 200);
+
+    framepool_deinit(&pool);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
 void test_create_destroy_database() {
     Pager* pager;
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
@@ -82,24 +131,22 @@ void test_init_file() {
     fdb_assert("Not all bytes written", fileSize == pager->pragma.pageSize);
 
     /* check page cache */
-    fdb_assert("Front page not set", pager->pageCache.count == 1);
-    fdb_assert("Page cache does not have front page", pagecache_has(&pager->pageCache, 1) == 1);
-    fdb_assert("Page cache does not have front page", pagecache_get(&pager->pageCache, 1) != NULL);
-    fdb_assert("First page is not header page", pagecache_get(&pager->pageCache, 1)->pageType == HEADER_PAGE);
-    fdb_assert("Page cache has second page", pagecache_has(&pager->pageCache, 2) == 0);
-    fdb_assert("Page cache does not have front page", pagecache_get(&pager->pageCache, 2) == NULL);
-    fdb_assert("Page cache has conflicting page", pagecache_has(&pager->pageCache, 1+pager->pageCache.size) == 0);
+    fdb_assert("Front page not set", pagecache_count(pager->pageCache) == 1);
+    fdb_assert("Page cache does not have front page", pagecache_has(pager->pageCache, 1) == 1);
+    fdb_assert("Page cache does not have front page", pagecache_get(pager->pageCache, 1) != NULL);
+    fdb_assert("First page is not header page", pagecache_get(pager->pageCache, 1)->pageType == HEADER_PAGE);
+    fdb_assert("Page cache has second page", pagecache_has(pager->pageCache, 2) == 0);
+    fdb_assert("Page cache does not have front page", pagecache_get(pager->pageCache, 2) == NULL);
+    fdb_assert("Page cache has conflicting page", pagecache_has(pager->pageCache, 1+pager->pageCache->shards[0].map.size) == 0);
 
     /* check page type cache */
-    fdb_assert("Page types not set", pager->pageTypeCache.allPages.data != NULL);
-    fdb_assert("Page types not set", pager->pageTypeCache.allPages.count == 3);
-    fdb_assert("Page types have no size", pager->pageTypeCache.allPages.size > 0);
-    fdb_assert("First value isn't 0", u8array_get_or(&(pager->pageTypeCache.allPages), 0, 100) == 0);
-    fdb_assert("Second value isn't 1", u8array_get_or(&(pager->pageTypeCache.allPages), 1, 0) == 1);
-    fdb_assert("Third value is set", u8array_get_or(&(pager->pageTypeCache.allPages), 2, 0) == 0);
-    fdb_assert("Front page not added to header pages", pager->pageTypeCache.pageTypes[HEADER_PAGE].count == 1);
-    fdb_assert("Second page not added to unused pages", pager->pageTypeCache.pageTypes[UNUSED_PAGE].count == 1);
-    fdb_assert("Had a vertex page", pager->pageTypeCache.pageTypes[VERTEX_PAGE].count == 0);
+    fdb_assert("Map read before it was needed", pager->pageTypeCache.types == NULL);
+    fdb_assert("Page 0 has a type", pagetypecache_get_type(&pager->pageTypeCache, pager, 0) == UNUSED_PAGE);
+    fdb_assert("Front page not a header page", pagetypecache_get_type(&pager->pageTypeCache, pager, 1) == HEADER_PAGE);
+    fdb_assert("Second page is used", pagetypecache_get_type(&pager->pageTypeCache, pager, 2) == UNUSED_PAGE);
+    fdb_assert("Front page map not read", pager->pageTypeCache.loaded[0] == 1);
+    fdb_assert("Had a vertex page", pagetypecache_next(&pager->pageTypeCache, pager, VERTEX_PAGE, 0) == 0);
+    fdb_assert("Front page not a header page", pagetypecache_next(&pager->pageTypeCache, pager, HEADER_PAGE, 0) == 1);
 
     fdb_pager_destroy(pager);
     fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
@@ -150,8 +197,8 @@ void test_init_file_2() {
     fdb_assert("Did not get correct version", fdb_pager_get_application_version(pager) == 12);
     fdb_assert("Did not get correct id", fdb_pager_get_application_id(pager) == 24);
 
-    fdb_assert("Set write version didn't fail", fdb_pager_set_file_format_write_version(pager, 2) == FABRICDB_EMISUSE_PRAGMA);
-    fdb_assert("Set read version didn't fail", fdb_pager_set_file_format_read_version(pager, 2) == FABRICDB_EMISUSE_PRAGMA);
+    fdb_assert("Set write version didn't fail", fdb_pager_set_file_format_write_version(pager, 3) == FABRICDB_EMISUSE_PRAGMA);
+    fdb_assert("Set read version didn't fail", fdb_pager_set_file_format_read_version(pager, 3) == FABRICDB_EMISUSE_PRAGMA);
     fdb_assert("Set write version failed", fdb_pager_set_file_format_write_version(pager, 1) == FABRICDB_OK);
     fdb_assert("Set read version failed", fdb_pager_set_file_format_read_version(pager, 1) == FABRICDB_OK);
     fdb_assert("Got wrong value for write version", fdb_pager_get_file_format_write_version(pager) == 1);
@@ -247,9 +294,1806 @@ void test_init_file_2() {
     fdb_passed;
 }
 
+/* Grows the database file to hold numPages pages.  Page n is filled
+   with the byte value n so that its contents can be recognized. */
+static int grow_test_file(Pager *pager, uint32_t numPages) {
+    uint32_t pageNo;
+    uint32_t pageSize = pager->pragma.pageSize + pager->pragma.bytesReserved;
+    uint8_t *buffer = fdbmalloc(pageSize);
+    int rc = FABRICDB_OK;
+
+    for (pageNo = 2; pageNo <= numPages && rc == FABRICDB_OK; pageNo++) {
+        memset(buffer, (uint8_t)pageNo, pageSize);
+        rc = fdb_write(pager->dbfh, buffer, (pageNo - 1) * pageSize, pageSize);
+    }
+
+    fdbfree(buffer);
+    return rc;
+}
+
+void test_fetch_page_eviction() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    uint32_t numFrames;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 64) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 10) == FABRICDB_OK);
+    numFrames = pager->pageCache->frames.numFrames;
+
+    for (pageNo = 1; pageNo <= 64; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Fetched wrong page", page->pageNo == pageNo);
+        fdb_assert("Cache grew past its size", pagecache_count(pager->pageCache) <= 10);
+    }
+    fdb_assert("Did not read the right data", page->data[0] == 64);
+    fdb_assert("Did not count misses", pager->pageCache->misses == 63);
+    fdb_assert("Did not count evictions", pager->pageCache->evictions == 54);
+    fdb_assert("Did not reuse evicted frames", pager->pageCache->frames.numFrames == numFrames);
+
+    /* a cached page is served without another miss */
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 64, &page) == FABRICDB_OK);
+    fdb_assert("Did not count hit", pagecache_hits(pager->pageCache) == 2);
+    fdb_assert("Did not count misses", pager->pageCache->misses == 63);
+
+    /* shrinking the cache takes effect on the next miss */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 4) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Cache did not shrink", pagecache_count(pager->pageCache) == 4);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_fetch_page_scan_resistance() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 100) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 10) == FABRICDB_OK);
+
+    /* pages 2 and 3 are referenced twice and become protected */
+    for (pageNo = 2; pageNo <= 3; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Page not protected", page->lruList == LRU_PROTECTED);
+    }
+
+    /* a long scan does not push them out */
+    for (pageNo = 10; pageNo <= 100; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+    }
+    fdb_assert("Scan evicted protected page", pagecache_has(pager->pageCache, 2));
+    fdb_assert("Scan evicted protected page", pagecache_has(pager->pageCache, 3));
+    fdb_assert("Scan page was not evicted", !pagecache_has(pager->pageCache, 10));
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_fetch_page_pinned_and_dirty() {
+    Pager *pager;
+    Page *page;
+    Page *pinned;
+    uint32_t pageNo;
+    uint8_t byte;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 40) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 4) == FABRICDB_OK);
+
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 5, &pinned) == FABRICDB_OK);
+    fdb_pager_pin_page(pager, pinned);
+    fdb_pager_pin_page(pager, pinned);
+    fdb_assert("Page not pinned", pinned->refCount == 2);
+    fdb_pager_unpin_page(pager, pinned);
+    fdb_assert("Pins did not nest", pinned->refCount == 1);
+
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 6, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    page->data[0] = 0xAB;
+
+    for (pageNo = 10; pageNo <= 40; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+    }
+
+    fdb_assert("Pinned page was evicted", pagecache_get(pager->pageCache, 5) == pinned);
+    fdb_assert("Dirty page was not evicted", !pagecache_has(pager->pageCache, 6));
+    fdb_assert("Could not read file", fdb_read(pager->dbfh, &byte, 5 * pager->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Dirty page was not written back", byte == 0xAB);
+
+    /* with every page pinned the cache grows instead of failing */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 1) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 7, &page) == FABRICDB_OK);
+    fdb_assert("Pinned page was evicted", pagecache_get(pager->pageCache, 5) == pinned);
+    fdb_assert("Cache did not grow", pagecache_count(pager->pageCache) == 2);
+    fdb_assert("Pinned page was changed", pinned->pageNo == 5 && pinned->data[0] == 5);
+
+    /* once unpinned the page can be evicted again */
+    fdb_pager_unpin_page(pager, pinned);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 8, &page) == FABRICDB_OK);
+    fdb_assert("Unpinned page was not evicted", !pagecache_has(pager->pageCache, 5));
+    fdb_assert("Cache did not shrink", pagecache_count(pager->pageCache) == 1);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_fetch_page_mmap() {
+    Pager *pager;
+    Page *page;
+    Page *first;
+    uint8_t *oldMap;
+    uint8_t byte;
+    uint32_t pageSize;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("mmap mode on by default", fdb_pager_get_mmap_mode(pager) == 0);
+    fdb_assert("Could not set mmap mode", fdb_pager_set_mmap_mode(pager, 1) == FABRICDB_OK);
+    fdb_assert("mmap mode not set", fdb_pager_get_mmap_mode(pager) == 1);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 8) == FABRICDB_OK);
+    pageSize = pager->pragma.pageSize + pager->pragma.bytesReserved;
+
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &first) == FABRICDB_OK);
+    fdb_assert("Page not mapped", first->mapped == 1);
+    fdb_assert("Page not in the map", first->data == pager->fileMap.data + pageSize);
+    fdb_assert("Did not read the right data", first->data[0] == 2 && first->data[pageSize - 1] == 2);
+    fdb_assert("Fetched past the end of the file", fdb_pager_fetch_page(pager, 9, &page) == FABRICDB_ESHORTREAD);
+
+    /* the map grows with the file and cached pages follow it */
+    oldMap = pager->fileMap.data;
+    fdb_assert("Could not grow file", grow_test_file(pager, 40) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 40, &page) == FABRICDB_OK);
+    fdb_assert("Did not read the right data", page->data[0] == 40);
+    fdb_assert("Map did not grow", pager->fileMap.size >= 40 * pageSize);
+    fdb_assert("Old map was not kept", pager->fileMap.retired != NULL && pager->fileMap.retired->data == oldMap);
+    fdb_assert("Cached page not moved to the new map", first->data == pager->fileMap.data + pageSize);
+
+    /* writing a page copies it out of the read only map */
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, first) == FABRICDB_OK);
+    fdb_assert("Page not dirty", first->dirty == 1);
+    fdb_assert("Page was not copied", first->frame != NULL && first->data == first->frame->data);
+    fdb_assert("Copy is wrong", first->data[0] == 2 && first->data[pageSize - 1] == 2);
+    first->data[0] = 0xAB;
+    fdb_assert("Map was changed", pager->fileMap.data[pageSize] == 2);
+
+    /* the dirty copy is written back when evicted */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 1) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_OK);
+    fdb_assert("Dirty page was not evicted", !pagecache_has(pager->pageCache, 2));
+    fdb_assert("Could not read file", fdb_read(pager->dbfh, &byte, pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Dirty page was not written back", byte == 0xAB);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Map does not see the write", page->mapped && page->data[0] == 0xAB);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+/* Opens a second connection to the test database */
+static int open_test_pager(Pager **pagerp) {
+    int rc = fdb_pager_create(TEMPFILENAME, pagerp);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init(*pagerp);
+    }
+    return rc;
+}
+
+static void remove_wal_test_files() {
+    remove(TEMPFILENAME);
+    remove("./tempfile.tmp-wal");
+    remove("./tempfile.tmp-shm");
+}
+
+void test_wal_mode() {
+    Pager *writer;
+    Pager *reader;
+    Page *page;
+    uint8_t byte;
+    off_t size;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove_wal_test_files();
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &writer) == FABRICDB_OK);
+    fdb_assert("Could not set write version", fdb_pager_set_file_format_write_version(writer, 2) == FABRICDB_OK);
+    fdb_assert("Could not set read version", fdb_pager_set_file_format_read_version(writer, 2) == FABRICDB_OK);
+    fdb_assert("Unknown write version allowed", fdb_pager_set_file_format_write_version(writer, 3) == FABRICDB_EMISUSE_PRAGMA);
+    fdb_assert("Init file failed", fdb_pager_init_file(writer) == FABRICDB_OK);
+    fdb_assert("Log not opened", writer->wal != NULL && writer->jfh != NULL);
+    fdb_assert("Could not open second pager", open_test_pager(&reader) == FABRICDB_OK);
+    fdb_assert("Log not opened", reader->wal != NULL);
+
+    /* pages can only be used inside a transaction */
+    fdb_assert("Fetched without a transaction", fdb_pager_fetch_page(writer, 1, &page) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_assert("Committed without a transaction", fdb_pager_commit(writer) == FABRICDB_EMISUSE_TRANSACTION);
+
+    /* the writer adds two pages */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(writer, 2, &page) == FABRICDB_OK);
+    fdb_assert("New page not zeroed", page->data[0] == 0 && page->data[page->pageSize - 1] == 0);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    memset(page->data, 0x22, page->pageSize);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(writer, 3, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    memset(page->data, 0x33, page->pageSize);
+
+    /* a reader started before the commit does not see it */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Second writer allowed", fdb_pager_begin_write(reader) == FABRICDB_BUSY);
+    fdb_assert("Could not commit", fdb_pager_commit(writer) == FABRICDB_OK);
+    fdb_assert("Page count not updated", writer->dbstate.filePageCount == 3);
+    fdb_assert("Reader saw the commit", reader->dbstate.filePageCount == 1);
+    fdb_pager_end_read(reader);
+
+    /* nothing has reached the database file yet */
+    fdb_assert("Could not get file size", fdb_file_size(writer->dbfh, &size) == FABRICDB_OK);
+    fdb_assert("Wrote to the database file", size == writer->pragma.pageSize);
+
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Reader missed the commit", reader->dbstate.filePageCount == 3);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(reader, 3, &page) == FABRICDB_OK);
+    fdb_assert("Reader missed the commit", page->data[0] == 0x33);
+    fdb_assert("Checkpoint inside a transaction", fdb_pager_checkpoint(reader) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_pager_end_read(reader);
+
+    /* a rolled back change is not seen by anyone */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(writer, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    page->data[0] = 0x44;
+    fdb_pager_rollback(writer);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(writer, 2, &page) == FABRICDB_OK);
+    fdb_assert("Rollback was kept", page->data[0] == 0x22);
+    fdb_pager_end_read(writer);
+
+    /* a page skipped over by a later page is in neither file */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(writer, 5, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(writer) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Reader missed the commit", reader->dbstate.filePageCount == 5);
+    fdb_assert("Could not fetch skipped page", fdb_pager_fetch_page(reader, 4, &page) == FABRICDB_OK);
+    fdb_assert("Skipped page not zeroed", page->data[0] == 0 && page->data[page->pageSize - 1] == 0);
+    fdb_pager_end_read(reader);
+
+    /* a checkpoint copies the pages into the database file */
+    fdb_assert("Could not checkpoint", fdb_pager_checkpoint(writer) == FABRICDB_OK);
+    fdb_assert("Could not read file", fdb_read(writer->dbfh, &byte, 2 * writer->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Page not checkpointed", byte == 0x33);
+
+    fdb_pager_destroy(reader);
+    fdb_pager_destroy(writer);
+
+    /* after the last connection closes the file holds everything */
+    fdb_assert("Could not open pager", open_test_pager(&reader) == FABRICDB_OK);
+    fdb_assert("Log not emptied", fdb_file_size(reader->jfh, &size) == FABRICDB_OK && size == 0);
+    fdb_assert("Page count lost", reader->dbstate.filePageCount == 5);
+    fdb_assert("Change counter not updated", reader->dbstate.fileChangeCounter == 2);
+    fdb_pager_destroy(reader);
+
+    remove_wal_test_files();
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+#define GROUP_COMMIT_THREADS 4
+#define GROUP_COMMIT_COMMITS 10
+
+/* Each thread commits to its own page through its own connection */
+static void *group_commit_thread(void *arg) {
+    Pager *pager = (Pager*)arg;
+    Page *page;
+    uint32_t pageNo = 2 + (uint32_t)(pager->pragma.applicationVersion);
+    int i;
+    int rc = FABRICDB_OK;
+
+    for (i = 0; i < GROUP_COMMIT_COMMITS && rc == FABRICDB_OK; i++) {
+        while ((rc = fdb_pager_begin_write(pager)) == FABRICDB_BUSY) {
+            sched_yield();
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_fetch_page(pager, pageNo, &page);
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_pager_mark_dirty(pager, page);
+        }
+        if (rc == FABRICDB_OK) {
+            page->data[0]++;
+            rc = fdb_pager_commit(pager);
+        } else {
+            fdb_pager_rollback(pager);
+        }
+    }
+
+    return (void*)(intptr_t)rc;
+}
+
+/* Commits one byte to the start of a page */
+static int commit_test_byte(Pager *pager, uint32_t pageNo, uint8_t byte) {
+    Page *page;
+    int rc = fdb_pager_begin_write(pager);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_fetch_page(pager, pageNo, &page);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_mark_dirty(pager, page);
+    }
+    if (rc == FABRICDB_OK) {
+        page->data[0] = byte;
+        rc = fdb_pager_commit(pager);
+    }
+    return rc;
+}
+
+void test_snapshot_reads() {
+    Pager *writer;
+    Pager *reader;
+    Pager *second;
+    Page *page;
+    PagerSnapshot snapshot;
+    uint8_t byte;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove_wal_test_files();
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &writer) == FABRICDB_OK);
+    fdb_assert("Could not set write version", fdb_pager_set_file_format_write_version(writer, 2) == FABRICDB_OK);
+    fdb_assert("Could not set read version", fdb_pager_set_file_format_read_version(writer, 2) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(writer) == FABRICDB_OK);
+    fdb_assert("Could not open second pager", open_test_pager(&reader) == FABRICDB_OK);
+    fdb_assert("Could not open third pager", open_test_pager(&second) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_byte(writer, 2, 0x22) == FABRICDB_OK);
+
+    fdb_assert("Snapshot without a transaction", fdb_pager_get_snapshot(reader, &snapshot) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Could not get snapshot", fdb_pager_get_snapshot(reader, &snapshot) == FABRICDB_OK);
+    fdb_pager_end_read(reader);
+
+    /* the writer carries on while the snapshot is read */
+    fdb_assert("Could not commit", commit_test_byte(writer, 2, 0x55) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read_snapshot(reader, &snapshot) == FABRICDB_OK);
+    fdb_assert("Snapshot inside a transaction", fdb_pager_begin_read_snapshot(reader, &snapshot) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_assert("Could not commit", commit_test_byte(writer, 3, 0x33) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(reader, 2, &page) == FABRICDB_OK);
+    fdb_assert("Read past the snapshot", page->data[0] == 0x22);
+    fdb_assert("Read past the snapshot", reader->dbstate.filePageCount == 2);
+    fdb_assert("Read past the snapshot", reader->dbstate.fileChangeCounter == snapshot.fileChangeCounter);
+    fdb_assert("Wrote from an old snapshot", fdb_pager_begin_write(reader) == FABRICDB_BUSY);
+
+    /* other connections can read the same version */
+    fdb_assert("Could not begin read", fdb_pager_begin_read_snapshot(second, &snapshot) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(second, 2, &page) == FABRICDB_OK);
+    fdb_assert("Read past the snapshot", page->data[0] == 0x22);
+    fdb_pager_end_read(second);
+
+    /* the checkpoint stops short of it */
+    fdb_assert("Could not checkpoint", fdb_pager_checkpoint(writer) == FABRICDB_OK);
+    fdb_assert("Could not read file", fdb_read(writer->dbfh, &byte, writer->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Checkpoint went past the snapshot", byte == 0x22);
+    fdb_pager_end_read(reader);
+
+    /* a new transaction sees the latest version again */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(reader, 2, &page) == FABRICDB_OK);
+    fdb_assert("Missed the commit", page->data[0] == 0x55 && reader->dbstate.filePageCount == 3);
+    fdb_pager_end_read(reader);
+
+    /* once the database file is newer the snapshot is gone */
+    fdb_assert("Could not checkpoint", fdb_pager_checkpoint(writer) == FABRICDB_OK);
+    fdb_assert("Read an expired snapshot", fdb_pager_begin_read_snapshot(reader, &snapshot) == FABRICDB_SNAPSHOT_EXPIRED);
+    fdb_assert("Transaction left open", reader->txnState == TXN_NONE);
+
+    fdb_pager_destroy(second);
+    fdb_pager_destroy(reader);
+    fdb_pager_destroy(writer);
+    remove_wal_test_files();
+
+    /* in journal mode a snapshot lasts until the next commit */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &writer) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(writer) == FABRICDB_OK);
+    fdb_assert("Could not open second pager", open_test_pager(&reader) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Could not get snapshot", fdb_pager_get_snapshot(reader, &snapshot) == FABRICDB_OK);
+    fdb_pager_end_read(reader);
+    fdb_assert("Could not begin read", fdb_pager_begin_read_snapshot(reader, &snapshot) == FABRICDB_OK);
+    fdb_pager_end_read(reader);
+    fdb_assert("Could not commit", commit_test_byte(writer, 2, 0x22) == FABRICDB_OK);
+    fdb_assert("Read an expired snapshot", fdb_pager_begin_read_snapshot(reader, &snapshot) == FABRICDB_SNAPSHOT_EXPIRED);
+    fdb_assert("Transaction left open", reader->txnState == TXN_NONE);
+
+    fdb_pager_destroy(reader);
+    fdb_pager_destroy(writer);
+    remove_wal_test_files();
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_wal_group_commit() {
+    Pager *pager;
+    Pager *pagers[GROUP_COMMIT_THREADS];
+    pthread_t threads[GROUP_COMMIT_THREADS];
+    Page *page;
+    void *result;
+    uint64_t syncs;
+    uint32_t i;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove_wal_test_files();
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Group commit off by default", fdb_pager_get_group_commit_batch(pager) > 0);
+    fdb_assert("Could not set write version", fdb_pager_set_file_format_write_version(pager, 2) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+
+    /* a lone commit syncs by itself */
+    fdb_assert("Could not set group commit", fdb_pager_set_group_commit(pager, 0, 1) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    syncs = fdb_sync_count(pager->jfh);
+    fdb_assert("Commit was not synced", syncs == 1);
+
+    /* a long enough delay lets concurrent commits share syncs */
+    for (i = 0; i < GROUP_COMMIT_THREADS; i++) {
+        fdb_assert("Could not open pager", open_test_pager(&pagers[i]) == FABRICDB_OK);
+        pagers[i]->pragma.applicationVersion = i;
+        fdb_assert("Could not set group commit", fdb_pager_set_group_commit(pagers[i], 20000, GROUP_COMMIT_THREADS) == FABRICDB_OK);
+        fdb_assert("Group commit delay not set", fdb_pager_get_group_commit_delay(pagers[i]) == 20000);
+    }
+    for (i = 0; i < GROUP_COMMIT_THREADS; i++) {
+        pthread_create(&threads[i], NULL, group_commit_thread, pagers[i]);
+    }
+    for (i = 0; i < GROUP_COMMIT_THREADS; i++) {
+        fdb_assert("Could not join thread", pthread_join(threads[i], &result) == 0);
+        fdb_assert("Commit failed", (intptr_t)result == FABRICDB_OK);
+    }
+    fdb_assert("Syncs were not shared", fdb_sync_count(pager->jfh) - syncs < GROUP_COMMIT_THREADS * GROUP_COMMIT_COMMITS);
+
+    /* every commit made it */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(pager) == FABRICDB_OK);
+    for (i = 0; i < GROUP_COMMIT_THREADS; i++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2 + i, &page) == FABRICDB_OK);
+        fdb_assert("Lost a commit", page->data[0] == GROUP_COMMIT_COMMITS);
+    }
+    fdb_pager_end_read(pager);
+
+    for (i = 0; i < GROUP_COMMIT_THREADS; i++) {
+        fdb_pager_destroy(pagers[i]);
+    }
+    fdb_pager_destroy(pager);
+    remove_wal_test_files();
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+#define CONCURRENT_FETCH_THREADS 4
+#define CONCURRENT_FETCH_PAGES 200
+#define CONCURRENT_FETCHES 5000
+
+/* Each thread fetches random pages from the shared pager and checks
+   what it reads.  Returns the number of bad pages. */
+static void *concurrent_fetch_thread(void *arg) {
+    Pager *pager = (Pager*)arg;
+    Page *page;
+    uint32_t seed = (uint32_t)(uintptr_t)pthread_self();
+    uint32_t pageNo;
+    intptr_t errors = 0;
+    int i;
+
+    for (i = 0; i < CONCURRENT_FETCHES; i++) {
+        seed = seed * 1103515245 + 12345;
+        pageNo = 2 + (seed >> 8) % (CONCURRENT_FETCH_PAGES - 1);
+        if (fdb_pager_fetch_page(pager, pageNo, &page) != FABRICDB_OK) {
+            errors++;
+            continue;
+        }
+        if (page->pageNo != pageNo || page->data[0] != (uint8_t)pageNo || page->data[100] != (uint8_t)pageNo) {
+            errors++;
+        }
+        fdb_pager_release_page(pager, page);
+    }
+
+    return (void*)errors;
+}
+
+static uint32_t count_pinned_pages(PageCache *cache) {
+    uint32_t count = 0;
+    uint32_t i;
+    Page *page;
+
+    for (i = 0; i < cache->numShards; i++) {
+        for (page = cache->shards[i].probation.head; page != NULL; page = page->lruNext) {
+            count += page->refCount > 0;
+        }
+        for (page = cache->shards[i].protected.head; page != NULL; page = page->lruNext) {
+            count += page->refCount > 0;
+        }
+    }
+    return count;
+}
+
+void test_wal_group_commit_sync_failure() {
+    Pager *pager;
+    Pager *other;
+    Page *page;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove_wal_test_files();
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set write version", fdb_pager_set_file_format_write_version(pager, 2) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not set group commit", fdb_pager_set_group_commit(pager, 0, 1) == FABRICDB_OK);
+    fdb_assert("Could not open pager", open_test_pager(&other) == FABRICDB_OK);
+    fdb_assert("Could not set group commit", fdb_pager_set_group_commit(other, 0, 1) == FABRICDB_OK);
+
+    /* the sync after the commit became visible fails */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    page->data[0] = 0x42;
+    fdb_set_sync_fault(pager->jfh, FABRICDB_EIO);
+    fdb_assert("Failed sync not reported", fdb_pager_commit(pager) == FABRICDB_EIO);
+    fdb_set_sync_fault(pager->jfh, FABRICDB_OK);
+
+    /* it can not be taken back, so the connection refuses to go on */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(other) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(other, 2, &page) == FABRICDB_OK);
+    fdb_assert("Commit was not visible", page->data[0] == 0x42);
+    fdb_pager_end_read(other);
+    fdb_assert("Read after a lost commit", fdb_pager_begin_read(pager) == FABRICDB_EIO);
+    fdb_assert("Wrote after a lost commit", fdb_pager_begin_write(pager) == FABRICDB_EIO);
+
+    /* a sync that works again can not vouch for the log any more */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(other) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(other, 3, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(other, page) == FABRICDB_OK);
+    fdb_assert("Later commit reported durable", fdb_pager_commit(other) == FABRICDB_EIO);
+    fdb_pager_destroy(other);
+    fdb_pager_destroy(pager);
+
+    /* the failure is forgotten once the log is closed */
+    fdb_assert("Could not open pager", open_test_pager(&pager) == FABRICDB_OK);
+    fdb_assert("Could not set group commit", fdb_pager_set_group_commit(pager, 0, 1) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 4, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+
+    remove_wal_test_files();
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_concurrent_fetches() {
+    Pager *pager;
+    Page *page;
+    Page *pinned;
+    pthread_t threads[CONCURRENT_FETCH_THREADS];
+    void *result;
+    uint32_t pageNo;
+    uint32_t i;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Cache sharded by default", fdb_pager_get_cache_shards(pager) == 0);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, CONCURRENT_FETCH_PAGES) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 32) == FABRICDB_OK);
+    fdb_assert("Unsharded cache has locks", pager->pageCache->loadLock == NULL && pager->pageCache->shards[0].lock == NULL);
+
+    /* the cached front page moves to its new shard */
+    fdb_assert("Too many shards allowed", fdb_pager_set_cache_shards(pager, 65) == FABRICDB_EINVAL);
+    fdb_assert("Could not set cache shards", fdb_pager_set_cache_shards(pager, 6) == FABRICDB_OK);
+    fdb_assert("Cache shards not set", fdb_pager_get_cache_shards(pager) == 6);
+    fdb_assert("Shards not rounded up", pager->pageCache->numShards == 8);
+    fdb_assert("Shards have no locks", pager->pageCache->loadLock != NULL && pager->pageCache->shards[7].lock != NULL);
+    fdb_assert("Lost cached page", pagecache_count(pager->pageCache) == 1 && pagecache_has(pager->pageCache, 1));
+
+    fdb_assert("Could not begin read", fdb_pager_begin_read(pager) == FABRICDB_OK);
+    fdb_assert("Changed shards in a transaction", fdb_pager_set_cache_shards(pager, 2) == FABRICDB_EMISUSE_TRANSACTION);
+
+    /* a page stays pinned until it is released */
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &pinned) == FABRICDB_OK);
+    fdb_assert("Page not pinned", pinned->refCount == 1);
+    for (pageNo = 3; pageNo <= CONCURRENT_FETCH_PAGES; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_pager_release_page(pager, page);
+    }
+    fdb_assert("Evicted a pinned page", pagecache_get(pager->pageCache, 2) == pinned);
+    fdb_pager_release_page(pager, pinned);
+    fdb_assert("Page not released", pinned->refCount == 0);
+
+    for (i = 0; i < CONCURRENT_FETCH_THREADS; i++) {
+        fdb_assert("Could not start thread", pthread_create(&threads[i], NULL, concurrent_fetch_thread, pager) == 0);
+    }
+    for (i = 0; i < CONCURRENT_FETCH_THREADS; i++) {
+        pthread_join(threads[i], &result);
+        fdb_assert("Thread read a wrong page", result == NULL);
+    }
+    fdb_assert("Pages left pinned", count_pinned_pages(pager->pageCache) == 0);
+    fdb_assert("Cache grew past its size", pagecache_count(pager->pageCache) <= 32);
+    fdb_assert("Did not count every fetch", pagecache_hits(pager->pageCache) + pager->pageCache->misses ==
+               CONCURRENT_FETCH_PAGES + CONCURRENT_FETCH_THREADS * CONCURRENT_FETCHES - 1);
+    fdb_pager_end_read(pager);
+
+    /* back to a single thread */
+    fdb_assert("Could not set cache shards", fdb_pager_set_cache_shards(pager, 0) == FABRICDB_OK);
+    fdb_assert("Unsharded cache has locks", pager->pageCache->loadLock == NULL && pager->pageCache->numShards == 1);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Page pinned without shards", page->refCount == 0 && page->data[0] == 2);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+static int open_shared_pager(Pager **pagerp) {
+    int rc = fdb_pager_create(TEMPFILENAME, pagerp);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_set_shared_cache(*pagerp, 1);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_pager_init(*pagerp);
+    }
+    return rc;
+}
+
+void test_shared_cache() {
+    Pager *first;
+    Pager *second;
+    Pager *private;
+    Page *page;
+    Page *shared;
+    uint64_t misses;
+    uint32_t numFrames;
+    uint32_t pageNo;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &first) == FABRICDB_OK);
+    fdb_assert("Cache shared by default", fdb_pager_get_shared_cache(first) == 0);
+    fdb_assert("Could not set shared cache", fdb_pager_set_shared_cache(first, 1) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(first) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(first, 20) == FABRICDB_OK);
+    fdb_assert("Shared cache set after init", fdb_pager_set_shared_cache(first, 0) == FABRICDB_EMISUSE_PRAGMA);
+    fdb_assert("Could not open pager", open_shared_pager(&second) == FABRICDB_OK);
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &private) == FABRICDB_OK);
+    fdb_assert("Could not init pager", fdb_pager_init(private) == FABRICDB_OK);
+
+    fdb_assert("Cache not shared", first->sharedCache != NULL && first->sharedCache == second->sharedCache);
+    fdb_assert("Wrong connection count", first->sharedCache->refCount == 2);
+    fdb_assert("Private cache shared", private->sharedCache == NULL && private->pageCache == &private->localCache);
+    fdb_assert("Fetched outside a transaction", fdb_pager_fetch_page(first, 2, &page) == FABRICDB_EMISUSE_TRANSACTION);
+
+    /* a page read by one connection is a hit for the other */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(first) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(first, 5, &shared) == FABRICDB_OK);
+    fdb_assert("Page not pinned", shared->refCount == 1);
+    fdb_pager_release_page(first, shared);
+    fdb_pager_end_read(first);
+    misses = first->pageCache->misses;
+    numFrames = first->pageCache->frames.numFrames;
+
+    fdb_assert("Could not begin read", fdb_pager_begin_read(second) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(second, 5, &page) == FABRICDB_OK);
+    fdb_assert("Page not shared", page == shared && page->data[0] == 5);
+    fdb_assert("Shared page was a miss", second->pageCache->misses == misses);
+    fdb_pager_release_page(second, page);
+    fdb_pager_end_read(second);
+
+    /* a write is kept from the other connection until it commits */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(second) == FABRICDB_OK);
+    fdb_assert("Write uses the shared cache", second->pageCache == &second->localCache);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(second, 5, &page) == FABRICDB_OK);
+    fdb_assert("Write got the shared page", page != shared);
+    fdb_pager_pin_page(second, page);
+    fdb_assert("Write page not pinned", page->refCount == 1 && shared->refCount == 0);
+    fdb_assert("Could not mark page dirty", fdb_pager_mark_dirty(second, page) == FABRICDB_OK);
+    page->data[0] = 55;
+    fdb_pager_unpin_page(second, page);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(first) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(first, 5, &page) == FABRICDB_OK);
+    fdb_assert("Saw an uncommitted write", page == shared && page->data[0] == 5);
+    fdb_pager_release_page(first, page);
+    fdb_pager_end_read(first);
+
+    fdb_assert("Could not commit", fdb_pager_commit(second) == FABRICDB_OK);
+    fdb_assert("Did not go back to the shared cache", second->pageCache == &second->sharedCache->cache);
+    fdb_assert("Kept the pages of the write", pagecache_count(&second->localCache) == 0);
+
+    /* the commit brought the shared page up to date */
+    misses = first->pageCache->misses;
+    fdb_assert("Could not begin read", fdb_pager_begin_read(first) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(first, 5, &page) == FABRICDB_OK);
+    fdb_assert("Did not see the commit", page == shared && page->data[0] == 55);
+    fdb_assert("Committed page was a miss", first->pageCache->misses == misses);
+    fdb_assert("Did not see the new file version", first->dbstate.fileChangeCounter == second->dbstate.fileChangeCounter);
+    fdb_pager_release_page(first, page);
+    fdb_pager_end_read(first);
+
+    /* a connection with its own cache notices the commit as usual */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(private) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(private, 5, &page) == FABRICDB_OK);
+    fdb_assert("Private cache missed the commit", page != shared && page->data[0] == 55);
+    fdb_pager_end_read(private);
+
+    /* a rolled back write leaves the shared pages alone */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(first) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(first, 5, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark page dirty", fdb_pager_mark_dirty(first, page) == FABRICDB_OK);
+    page->data[0] = 77;
+    fdb_pager_rollback(first);
+    fdb_assert("Did not go back to the shared cache", first->pageCache == &first->sharedCache->cache);
+    fdb_assert("Rollback changed a shared page", shared->data[0] == 55);
+
+    /* a write transaction larger than the cache keeps its pages until the commit */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(first, 4) == FABRICDB_OK);
+    fdb_assert("Cache size not shared", second->sharedCache->cacheSize == 4);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(second) == FABRICDB_OK);
+    for (pageNo = 2; pageNo <= 4; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(second, pageNo, &page) == FABRICDB_OK);
+        fdb_pager_release_page(second, page);
+    }
+    fdb_pager_end_read(second);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(first) == FABRICDB_OK);
+    for (pageNo = 2; pageNo <= 12; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(first, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Could not mark page dirty", fdb_pager_mark_dirty(first, page) == FABRICDB_OK);
+        page->data[0] = (uint8_t)(100 + pageNo);
+    }
+    fdb_assert("Dirty pages were evicted", pagecache_count(first->pageCache) >= 11);
+    fdb_assert("Could not commit", fdb_pager_commit(first) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(second) == FABRICDB_OK);
+    for (pageNo = 2; pageNo <= 12; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(second, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Did not see the commit", page->data[0] == (uint8_t)(100 + pageNo));
+        fdb_pager_release_page(second, page);
+    }
+    fdb_pager_end_read(second);
+
+    /* the two connections never held more than one cache of frames */
+    fdb_assert("Frames not shared", first->pageCache->frames.numFrames == numFrames);
+
+    fdb_pager_destroy(first);
+    fdb_assert("Shared cache freed early", second->sharedCache->refCount == 1);
+    fdb_pager_destroy(second);
+    fdb_pager_destroy(private);
+    remove(TEMPFILENAME);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_read_ahead() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    uint64_t prefetches;
+    uint64_t hits;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 200) == FABRICDB_OK);
+    pager->dbstate.filePageCount = 200;
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 100) == FABRICDB_OK);
+    fdb_assert("Read-ahead off by default", fdb_pager_get_read_ahead(pager) > 0);
+
+    /* a sequential scan reads ahead and only misses now and then */
+    for (pageNo = 2; pageNo <= 40; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Read the wrong page", page->pageNo == pageNo && page->data[0] == (uint8_t)pageNo);
+        fdb_assert("Read the wrong page", page->data[page->pageSize - 1] == (uint8_t)pageNo);
+    }
+    fdb_assert("Did not read ahead", pager->pageCache->prefetches > 0);
+    fdb_assert("Read ahead did not save misses", pager->pageCache->misses < 20);
+    fdb_assert("Scanned page was protected", pagecache_get(pager->pageCache, 30)->lruList == LRU_PROBATION);
+
+    /* pages of one type are read ahead in page number order */
+    for (pageNo = 3; pageNo < 150; pageNo++) {
+        pagetypecache_set(&pager->pageTypeCache, pager, pageNo, pageNo >= 100 && (pageNo - 100) % 3 == 0 ? VERTEX_PAGE : RECORD_PAGE);
+    }
+    for (pageNo = 100; pageNo <= 106; pageNo += 3) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Read the wrong page", page->data[0] == (uint8_t)pageNo);
+    }
+    fdb_assert("Did not read the next page of the type", pagecache_has(pager->pageCache, 109));
+    fdb_assert("Did not read ahead a window", pagecache_has(pager->pageCache, 118));
+    fdb_assert("Read a page of another type", !pagecache_has(pager->pageCache, 107));
+    fdb_assert("Read the wrong page", pagecache_get(pager->pageCache, 112)->data[0] == 112);
+
+    /* a known range can be read ahead explicitly */
+    prefetches = pager->pageCache->prefetches;
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 170, 10) == FABRICDB_OK);
+    fdb_assert("Did not prefetch the range", pager->pageCache->prefetches == prefetches + 10);
+    hits = pagecache_hits(pager->pageCache);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 175, &page) == FABRICDB_OK);
+    fdb_assert("Prefetched page was not a hit", pagecache_hits(pager->pageCache) == hits + 1);
+    fdb_assert("Read the wrong page", page->data[0] == 175);
+
+    /* cached pages and pages past the end are skipped */
+    prefetches = pager->pageCache->prefetches;
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 178, 1000) == FABRICDB_OK);
+    fdb_assert("Prefetched the wrong pages", pager->pageCache->prefetches == prefetches + 21);
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 500, 10) == FABRICDB_OK);
+
+    /* turning read-ahead off leaves only explicit prefetches */
+    fdb_assert("Could not set read-ahead", fdb_pager_set_read_ahead(pager, 0) == FABRICDB_OK);
+    prefetches = pager->pageCache->prefetches;
+    for (pageNo = 50; pageNo <= 70; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+    }
+    fdb_assert("Read ahead while off", pager->pageCache->prefetches == prefetches);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_transactions_journal_mode() {
+    Pager *pager;
+    Pager *other;
+    Page *page;
+    uint8_t byte;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Checkpoint in journal mode", fdb_pager_checkpoint(pager) == FABRICDB_EMISUSE_TRANSACTION);
+
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    memset(page->data, 0x55, page->pageSize);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Page still dirty", page->dirty == 0);
+    fdb_assert("Could not read file", fdb_read(pager->dbfh, &byte, pager->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Page not written", byte == 0x55);
+    fdb_assert("Lock not released", fdb_get_lock_level(pager->dbfh) == FDB_NO_LOCK);
+
+    /* another connection notices the change counter moved */
+    fdb_assert("Could not open pager", open_test_pager(&other) == FABRICDB_OK);
+    fdb_assert("Page count not written", other->dbstate.filePageCount == 2);
+    fdb_assert("Change counter not written", other->dbstate.fileChangeCounter == 1);
+    fdb_pager_destroy(other);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_transactions_journal_mode_spill() {
+    Pager *pager;
+    Pager *other;
+    Page *page;
+    uint32_t pageNo;
+    uint8_t byte;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 20) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 4) == FABRICDB_OK);
+
+    /* the transaction dirties far more pages than the cache holds */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (pageNo = 2; pageNo <= 20; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+        page->data[0] = 0xEE;
+        fdb_pager_release_page(pager, page);
+    }
+    fdb_assert("Dirty pages were evicted", pagecache_count(pager->pageCache) >= 19);
+    fdb_assert("Could not release memory", fdb_pager_release_memory(pager) == FABRICDB_OK);
+    fdb_assert("Released dirty pages", pagecache_count(pager->pageCache) >= 19);
+
+    /* nothing uncommitted reached the file, so a reader sees the old pages */
+    fdb_assert("Could not read file", fdb_read(pager->dbfh, &byte, 2 * pager->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Uncommitted page written", byte == 3);
+    fdb_assert("Could not open pager", open_test_pager(&other) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(other) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(other, 3, &page) == FABRICDB_OK);
+    fdb_assert("Reader saw an uncommitted page", page->data[0] == 3);
+    fdb_pager_release_page(other, page);
+    fdb_pager_end_read(other);
+    fdb_pager_destroy(other);
+
+    /* after the rollback every page reads back as it was */
+    fdb_pager_rollback(pager);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(pager) == FABRICDB_OK);
+    for (pageNo = 2; pageNo <= 20; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Rollback left an uncommitted page", page->data[0] == (uint8_t)pageNo);
+        fdb_pager_release_page(pager, page);
+    }
+    fdb_pager_end_read(pager);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+typedef struct BusyTest {
+    Pager *reader;       /* Ends its read transaction when called for the releaseAt time */
+    uint32_t releaseAt;
+    uint32_t calls;
+} BusyTest;
+
+static int busy_test_handler(void *arg, uint32_t attempt) {
+    BusyTest *test = (BusyTest*)arg;
+
+    test->calls++;
+    if (attempt == test->releaseAt) {
+        fdb_pager_end_read(test->reader);
+    }
+    return attempt < 3;
+}
+
+void test_busy_handler() {
+    Pager *writer;
+    Pager *reader;
+    Page *page;
+    BusyTest busy;
+    uint64_t start;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &writer) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(writer) == FABRICDB_OK);
+    fdb_assert("Could not open pager", open_test_pager(&reader) == FABRICDB_OK);
+    busy.reader = reader;
+    busy.releaseAt = 100;
+    busy.calls = 0;
+    fdb_assert("Could not set busy handler", fdb_pager_set_busy_handler(writer, busy_test_handler, &busy) == FABRICDB_OK);
+
+    /* the commit waits for the reader until the handler gives up */
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(writer, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    page->data[0] = 0x55;
+    fdb_assert("Committed under a reader", fdb_pager_commit(writer) == FABRICDB_BUSY);
+    fdb_assert("Handler not called for each attempt", busy.calls == 4);
+
+    /* and goes through once the reader is done */
+    busy.calls = 0;
+    busy.releaseAt = 1;
+    fdb_assert("Could not commit", fdb_pager_commit(writer) == FABRICDB_OK);
+    fdb_assert("Handler not called", busy.calls == 2);
+
+    /* a reader that wants to write is not made to wait for the writer */
+    busy.calls = 0;
+    busy.releaseAt = 100;
+    fdb_assert("Could not begin write", fdb_pager_begin_write(reader) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(writer) == FABRICDB_OK);
+    fdb_assert("Second writer allowed", fdb_pager_begin_write(writer) == FABRICDB_BUSY);
+    fdb_assert("Handler called while reading", busy.calls == 0);
+    fdb_pager_end_read(writer);
+
+    /* but one that starts fresh is */
+    busy.reader = writer;
+    fdb_assert("Second writer allowed", fdb_pager_begin_write(writer) == FABRICDB_BUSY);
+    fdb_assert("Handler not called", busy.calls == 4);
+    fdb_assert("Read left open", writer->txnState == TXN_NONE);
+    fdb_pager_rollback(reader);
+
+    /* the timeout backs off until its time is up */
+    fdb_assert("Timeout set", fdb_pager_get_busy_timeout(writer) == 0);
+    fdb_assert("Could not set busy timeout", fdb_pager_set_busy_timeout(writer, 20) == FABRICDB_OK);
+    fdb_assert("Timeout not set", fdb_pager_get_busy_timeout(writer) == 20);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(reader) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(writer) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(writer, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(writer, page) == FABRICDB_OK);
+    start = fdb_now_us();
+    fdb_assert("Committed under a reader", fdb_pager_commit(writer) == FABRICDB_BUSY);
+    fdb_assert("Did not wait out the timeout", fdb_now_us() - start >= 20000);
+    fdb_assert("Waited far past the timeout", fdb_now_us() - start < 1000000);
+    fdb_pager_end_read(reader);
+    fdb_assert("Could not commit", fdb_pager_commit(writer) == FABRICDB_OK);
+
+    fdb_assert("Could not set busy handler", fdb_pager_set_busy_handler(writer, NULL, NULL) == FABRICDB_OK);
+    fdb_assert("Handler did not replace the timeout", fdb_pager_get_busy_timeout(writer) == 0);
+
+    fdb_pager_destroy(reader);
+    fdb_pager_destroy(writer);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_commit_write_back() {
+    Pager *pager;
+    Page *page;
+    uint32_t order[] = {9, 3, 6, 2, 8, 4};
+    uint32_t i;
+    uint8_t byte;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+
+    /* dirtied out of order, with gaps at pages 5 and 7 */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < 6; i++) {
+        fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, order[i], &page) == FABRICDB_OK);
+        fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+        memset(page->data, (int)order[i], page->pageSize);
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Page count not updated", pager->dbstate.filePageCount == 9);
+
+    for (i = 0; i < 6; i++) {
+        fdb_assert("Could not read start of page", fdb_read(pager->dbfh, &byte, (off_t)(order[i] - 1) * pager->pragma.pageSize, 1) == FABRICDB_OK);
+        fdb_assert("Page written to the wrong place", byte == order[i]);
+        fdb_assert("Could not read end of page", fdb_read(pager->dbfh, &byte, (off_t)order[i] * pager->pragma.pageSize - 1, 1) == FABRICDB_OK);
+        fdb_assert("Page not written in full", byte == order[i]);
+    }
+
+    /* the gaps were never written */
+    fdb_assert("Could not read gap", fdb_read(pager->dbfh, &byte, 4 * (off_t)pager->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Gap was written", byte == 0);
+    fdb_assert("Could not read gap", fdb_read(pager->dbfh, &byte, 6 * (off_t)pager->pragma.pageSize, 1) == FABRICDB_OK);
+    fdb_assert("Gap was written", byte == 0);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_page_checksums() {
+    Pager *pager;
+    Page *page;
+    FileHandle *fh;
+    uint8_t buffer[1028];
+    uint32_t pageSize;
+    uint32_t i;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not turn on checksums", fdb_pager_set_page_checksums(pager, 1) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Set checksums after init", fdb_pager_set_page_checksums(pager, 0) == FABRICDB_EMISUSE_PRAGMA);
+    fdb_assert("Did not reserve room for checksums", fdb_pager_get_bytes_reserved_space(pager) == 4);
+    pageSize = pager->pageCache->frames.pageSize;
+    fdb_assert("Wrong page size", pageSize == sizeof(buffer));
+
+    /* pages 2 to 5 are written, 6 is left as a hole before 7 */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 2; i <= 7; i++) {
+        if (i == 6) {
+            continue;
+        }
+        fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, i, &page) == FABRICDB_OK);
+        fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+        memset(page->data, (int)i, page->usableSize);
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+
+    /* the setting is read back from the file */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Checksums not persisted", fdb_pager_get_page_checksums(pager) == 1);
+    fdb_assert("Checksums not verified by default", fdb_pager_get_verify_checksums(pager) == 1);
+    for (i = 2; i <= 7; i++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, i, &page) == FABRICDB_OK);
+        fdb_assert("Wrong page data", page->data[0] == (i == 6 ? 0 : i));
+    }
+    fdb_pager_destroy(pager);
+
+    /* flip a bit in page 3 and write page 2 over page 4 */
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh) == FABRICDB_OK);
+    fdb_assert("Could not read page", fdb_read(fh, buffer, 2 * (off_t)pageSize, pageSize) == FABRICDB_OK);
+    buffer[100] ^= 0x10;
+    fdb_assert("Could not write page", fdb_write(fh, buffer, 2 * (off_t)pageSize, pageSize) == FABRICDB_OK);
+    fdb_assert("Could not read page", fdb_read(fh, buffer, 1 * (off_t)pageSize, pageSize) == FABRICDB_OK);
+    fdb_assert("Could not write page", fdb_write(fh, buffer, 3 * (off_t)pageSize, pageSize) == FABRICDB_OK);
+    fdb_close_file(fh);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Damaged page passed", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_ECHECKSUM);
+    fdb_assert("Page not cleared", page == NULL);
+    fdb_assert("Misplaced page passed", fdb_pager_fetch_page(pager, 4, &page) == FABRICDB_ECHECKSUM);
+
+    /* read-ahead skips damaged pages and leaves them to the fetch */
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 3, 5) == FABRICDB_OK);
+    fdb_assert("Damaged page was cached", !pagecache_has(pager->pageCache, 3));
+    fdb_assert("Good page not cached", pagecache_has(pager->pageCache, 5));
+    fdb_assert("Damaged page passed", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_ECHECKSUM);
+
+    /* with verification off the pages load as they are */
+    fdb_assert("Could not turn off verification", fdb_pager_set_verify_checksums(pager, 0) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[100] == (3 ^ 0x10));
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 4, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[0] == 2);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_page_compression() {
+    Pager *pager;
+    Page *page;
+    FileHandle *fh;
+    uint8_t header[4];
+    uint32_t magic;
+    uint32_t pageSize;
+    uint32_t seed = 1;
+    uint32_t i;
+    uint32_t j;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    /* pages larger than a file system block leave room for holes */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set page size", fdb_pager_set_page_size(pager, 16384) == FABRICDB_OK);
+    fdb_assert("Accepted unknown compression", fdb_pager_set_compression(pager, 7) == FABRICDB_EINVAL);
+    fdb_assert("Could not turn on compression", fdb_pager_set_compression(pager, FDB_COMPRESSION_LZ4) == FABRICDB_OK);
+    fdb_assert("Could not turn on checksums", fdb_pager_set_page_checksums(pager, 1) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Set compression after init", fdb_pager_set_compression(pager, FDB_COMPRESSION_NONE) == FABRICDB_EMISUSE_PRAGMA);
+    pageSize = pager->pageCache->frames.pageSize;
+
+    /* pages 2 to 9 compress well, page 10 does not.  The small cache
+       writes some of them back before the commit. */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 4) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 2; i <= 10; i++) {
+        fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, i, &page) == FABRICDB_OK);
+        fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+        for (j = 0; j < page->usableSize; j++) {
+            seed = seed * 1103515245 + 12345;
+            page->data[j] = i == 10 ? (uint8_t)(seed >> 16) : (uint8_t)(i + j / 512);
+        }
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+
+    /* compressed pages start with the magic number, the others are stored whole */
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh) == FABRICDB_OK);
+    for (i = 1; i <= 10; i++) {
+        fdb_assert("Could not read page", fdb_read(fh, header, (off_t)(i - 1) * pageSize, 4) == FABRICDB_OK);
+        memcpy(&magic, header, 4);
+        magic = letohu32(magic);
+        fdb_assert("Page stored the wrong way", (magic == FDB_COMPRESSED_MAGIC) == (i > 1 && i < 10));
+    }
+    fdb_close_file(fh);
+
+    /* the setting is read back from the file */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not turn on mmap", fdb_pager_set_mmap_mode(pager, 1) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Compression not persisted", fdb_pager_get_compression(pager) == FDB_COMPRESSION_LZ4);
+    seed = 1;
+    for (i = 2; i <= 10; i++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, i, &page) == FABRICDB_OK);
+        fdb_assert("Compressed page was mapped", !page->mapped);
+        for (j = 0; j < page->usableSize; j++) {
+            seed = seed * 1103515245 + 12345;
+            if (page->data[j] != (i == 10 ? (uint8_t)(seed >> 16) : (uint8_t)(i + j / 512))) {
+                break;
+            }
+        }
+        fdb_assert("Wrong page data", j == page->usableSize);
+    }
+
+    /* read-ahead expands pages as well */
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 64) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 2, 8) == FABRICDB_OK);
+    fdb_assert("Page not prefetched", pagecache_has(pager->pageCache, 5));
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 5, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[0] == 5 && page->data[4096] == 13);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_page_compression_storage_flag() {
+    Pager *pager;
+    Page *page;
+    FileHandle *fh;
+    uint8_t byte;
+    uint32_t v32;
+    uint32_t pageSize;
+    uint32_t seed = 7;
+    uint32_t j;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    /* without checksums the header is the only thing guarding a page */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set page size", fdb_pager_set_page_size(pager, 16384) == FABRICDB_OK);
+    fdb_assert("Could not turn on compression", fdb_pager_set_compression(pager, FDB_COMPRESSION_LZ4) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("No byte reserved for the flag", pager->pragma.bytesReserved == FDB_STORAGE_FLAG_SIZE);
+    pageSize = pager->pageCache->frames.pageSize;
+
+    /* page 2 does not compress but starts with a valid looking header,
+       page 3 compresses */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    for (j = 0; j < page->usableSize; j++) {
+        seed = seed * 1103515245 + 12345;
+        page->data[j] = (uint8_t)(seed >> 16);
+    }
+    v32 = htoleu32(FDB_COMPRESSED_MAGIC);
+    memcpy(page->data, &v32, 4);
+    v32 = htoleu32(16);
+    memcpy(page->data + 4, &v32, 4);
+    v32 = htoleu32(fdb_crc32c(0, page->data + FDB_COMPRESSED_HEADER_SIZE, 16));
+    memcpy(page->data + 8, &v32, 4);
+    fdb_assert("Could not fetch new page", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_OK);
+    fdb_assert("Could not mark dirty", fdb_pager_mark_dirty(pager, page) == FABRICDB_OK);
+    memset(page->data, 3, page->usableSize);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh) == FABRICDB_OK);
+    fdb_assert("Could not read flag", fdb_read(fh, &byte, 2 * (off_t)pageSize - 1, 1) == FABRICDB_OK);
+    fdb_assert("Whole page not flagged", byte == FDB_PAGE_STORED_WHOLE);
+    fdb_assert("Could not read flag", fdb_read(fh, &byte, 3 * (off_t)pageSize - 1, 1) == FABRICDB_OK);
+    fdb_assert("Compressed page flagged whole", byte == 0);
+    fdb_close_file(fh);
+
+    fdb_assert("Could not open pager", open_test_pager(&pager) == FABRICDB_OK);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    seed = 7;
+    for (j = 0; j < page->usableSize; j++) {
+        seed = seed * 1103515245 + 12345;
+        if (j >= FDB_COMPRESSED_HEADER_SIZE && page->data[j] != (uint8_t)(seed >> 16)) {
+            break;
+        }
+    }
+    fdb_assert("Whole page was expanded", j == page->usableSize);
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[0] == 3 && page->data[page->usableSize - 1] == 3);
+    fdb_pager_destroy(pager);
+
+    /* a damaged compressed page is reported rather than taken as whole */
+    fdb_assert("Could not open file", fdb_open_file_rdwr(TEMPFILENAME, &fh) == FABRICDB_OK);
+    byte = 0xFF;
+    fdb_assert("Could not damage page", fdb_write(fh, &byte, 2 * (off_t)pageSize + 1, 1) == FABRICDB_OK);
+    fdb_close_file(fh);
+    fdb_assert("Could not open pager", open_test_pager(&pager) == FABRICDB_OK);
+    fdb_assert("Damaged page was loaded", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_ECORRUPT);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_compressed_cache() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 64) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 10) == FABRICDB_OK);
+    fdb_assert("Could not set tier size", fdb_pager_set_compressed_cache_size(pager, 1 << 20) == FABRICDB_OK);
+    fdb_assert("Wrong tier size", fdb_pager_get_compressed_cache_size(pager) == 1 << 20);
+
+    /* every evicted page is kept compressed */
+    for (pageNo = 1; pageNo <= 64; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+    }
+    fdb_assert("Did not count evictions", pager->pageCache->evictions == 54);
+    fdb_assert("Did not store evicted pages", pager->compressedCache.stores == 54);
+    fdb_assert("Wrong number of stored pages", pagetable_count(&pager->compressedCache.map) == 54);
+
+    /* a miss on a stored page is served from memory and leaves the tier */
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[0] == 2 && page->data[page->usableSize - 1] == 2);
+    fdb_assert("Did not count tier hit", pager->compressedCache.hits == 1);
+    fdb_assert("Page still in the tier", !pagetable_has(&pager->compressedCache.map, 2));
+
+    /* read-ahead leaves stored pages alone */
+    fdb_assert("Could not prefetch", fdb_pager_prefetch(pager, 3, 2) == FABRICDB_OK);
+    fdb_assert("Stored page was read ahead", !pagecache_has(pager->pageCache, 3));
+
+    /* shrinking the tier drops the least recently stored pages */
+    fdb_assert("Could not set tier size", fdb_pager_set_compressed_cache_size(pager, 1024) == FABRICDB_OK);
+    fdb_assert("Tier did not shrink", pager->compressedCache.bytes <= 1024);
+    fdb_assert("Dropped the newest page", pagetable_has(&pager->compressedCache.map, 54));
+    fdb_assert("Kept the oldest page", !pagetable_has(&pager->compressedCache.map, 3));
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 3, &page) == FABRICDB_OK);
+    fdb_assert("Wrong page data", page->data[0] == 3);
+    fdb_assert("Could not set tier size", fdb_pager_set_compressed_cache_size(pager, 0) == FABRICDB_OK);
+    fdb_assert("Tier not emptied", pager->compressedCache.bytes == 0 && pager->compressedCache.head == NULL);
+
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_soft_heap_limit() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    size_t used;
+    size_t limit;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not grow file", grow_test_file(pager, 800) == FABRICDB_OK);
+    fdb_assert("Could not set cache size", fdb_pager_set_cache_size(pager, 1000) == FABRICDB_OK);
+
+    for (pageNo = 1; pageNo <= 600; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+    }
+    fdb_assert("Evicted without a limit", pager->pageCache->evictions == 0);
+
+    /* The next miss sheds pages and their slabs until under the limit */
+    used = fabricdb_mem_used();
+    limit = used / 2;
+    fdb_assert("Had a limit", fabricdb_set_soft_heap_limit(limit) == 0);
+    fdb_assert("Limit not set", fabricdb_get_soft_heap_limit() == limit);
+    fdb_assert("Not over the limit", fabricdb_mem_over_limit());
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 601, &page) == FABRICDB_OK);
+    fdb_assert("Fetched wrong page", page->data[0] == (uint8_t)601);
+    fdb_assert("Did not get under the limit", fabricdb_mem_used() <= limit + (128 << 10));
+    fdb_assert("Did not evict", pager->pageCache->evictions > 0);
+    fdb_assert("Evicted too much", pager->pageCache->evictions < 500);
+    fdb_assert("Did not free frames", pager->pageCache->frames.numFrames < 600);
+
+    /* The cache keeps to about the limit as it reads more pages */
+    for (pageNo = 602; pageNo <= 800; pageNo++) {
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, pageNo, &page) == FABRICDB_OK);
+        fdb_assert("Fetched wrong page", page->data[0] == (uint8_t)pageNo);
+        fdb_assert("Went far over the limit", fabricdb_mem_used() <= limit + (512 << 10));
+    }
+
+    /* Releasing by hand sheds everything that is not pinned */
+    fdb_assert("Could not release memory", fdb_pager_release_memory(pager) == FABRICDB_OK);
+    fdb_assert("Pages left in the cache", pagecache_count(pager->pageCache) == 0);
+    fdb_assert("Frames left in the pool", pager->pageCache->frames.numFrames == 0);
+    fdb_assert("Still over the limit", !fabricdb_mem_over_limit());
+    fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, 2, &page) == FABRICDB_OK);
+    fdb_assert("Fetched wrong page", page->data[0] == 2);
+
+    fdb_assert("Wrong previous limit", fabricdb_set_soft_heap_limit(0) == limit);
+    fdb_pager_destroy(pager);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+/* Counts the pages of a type, checking that they come in page order */
+static uint32_t count_pages_of_type(Pager *pager, uint8_t pageType) {
+    uint32_t count = 0;
+    uint32_t pageNo = 0;
+    uint32_t next;
+
+    while ((next = pagetypecache_next(&pager->pageTypeCache, pager, pageType, pageNo)) != 0) {
+        if (next <= pageNo) {
+            return UINT32_MAX;
+        }
+        pageNo = next;
+        count++;
+    }
+    return count;
+}
+
+void test_page_allocator() {
+    Pager *pager;
+    Page *page;
+    uint32_t pageNo;
+    uint32_t i;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    /* with 512 byte pages the front page maps the types of 412 pages */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set page size", fdb_pager_set_page_size(pager, 512) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Allocated outside a transaction", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Allocated a free page", fdb_pager_allocate_page(pager, FREE_PAGE, 0, &page) == FABRICDB_EINVAL);
+
+    /* new pages are added to the end of the file, stepping over the next map page */
+    for (i = 0; i < 420; i++) {
+        fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_OK);
+        fdb_assert("Wrong page allocated", page->pageNo == (i < 410 ? i + 2 : i + 3));
+        fdb_assert("Page not dirty", page->dirty);
+        page->data[0] = (uint8_t)page->pageNo;
+    }
+    fdb_assert("Map page not typed", pagetypecache_get_type(&pager->pageTypeCache, pager, 412) == P_PAGE);
+    fdb_assert("Page not typed", pagetypecache_get_type(&pager->pageTypeCache, pager, 413) == EDGE_PAGE);
+    fdb_assert("Pages not listed", count_pages_of_type(pager, EDGE_PAGE) == 420);
+
+    /* the first freed page becomes a trunk, the next ones its leaves */
+    fdb_assert("Could not free page", fdb_pager_free_page(pager, 100) == FABRICDB_OK);
+    fdb_assert("Could not free page", fdb_pager_free_page(pager, 200) == FABRICDB_OK);
+    fdb_assert("Could not free page", fdb_pager_free_page(pager, 300) == FABRICDB_OK);
+    fdb_assert("Freed a free page", fdb_pager_free_page(pager, 300) == FABRICDB_EINVAL);
+    fdb_assert("Freed the front page", fdb_pager_free_page(pager, 1) == FABRICDB_EINVAL);
+    fdb_assert("Freed a map page", fdb_pager_free_page(pager, 412) == FABRICDB_EINVAL);
+    fdb_assert("Freed past the end", fdb_pager_free_page(pager, 500) == FABRICDB_EINVAL);
+    fdb_assert("Page not typed free", pagetypecache_get_type(&pager->pageTypeCache, pager, 200) == FREE_PAGE);
+    fdb_assert("Page not unlisted", pagetypecache_next(&pager->pageTypeCache, pager, EDGE_PAGE, 199) == 201);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 3);
+    fdb_assert("Wrong first trunk", pager->dbstate.freeTrunkPage == 100);
+    fdb_assert("Wrong page count", pager->dbstate.filePageCount == 422);
+    fdb_pager_destroy(pager);
+
+    /* types and the free list are read back from the file */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Free pages not persisted", pager->dbstate.fileFreePageCount == 3);
+    fdb_assert("Map page not persisted", pagetypecache_get_type(&pager->pageTypeCache, pager, 412) == P_PAGE);
+    fdb_assert("Type not persisted", pagetypecache_get_type(&pager->pageTypeCache, pager, 422) == EDGE_PAGE);
+    fdb_assert("Free type not persisted", pagetypecache_get_type(&pager->pageTypeCache, pager, 300) == FREE_PAGE);
+    fdb_assert("Wrong number of pages listed", count_pages_of_type(pager, EDGE_PAGE) == 417);
+    fdb_assert("Wrong next page", pagetypecache_next(&pager->pageTypeCache, pager, EDGE_PAGE, 411) == 413);
+    fdb_assert("Wrong next page", pagetypecache_next(&pager->pageTypeCache, pager, EDGE_PAGE, 422) == 0);
+
+    /* the free page nearest the hint is reused, then any leaf, then the trunk */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, VERTEX_PAGE, 290, &page) == FABRICDB_OK);
+    fdb_assert("Did not reuse the nearest page", page->pageNo == 300);
+    fdb_assert("Page not cleared", page->data[0] == 0);
+    fdb_assert("Page not retyped", pagetypecache_get_type(&pager->pageTypeCache, pager, 300) == VERTEX_PAGE);
+    fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, VERTEX_PAGE, 0, &page) == FABRICDB_OK);
+    fdb_assert("Did not reuse the leaf", page->pageNo == 200);
+    fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, VERTEX_PAGE, 0, &page) == FABRICDB_OK);
+    fdb_assert("Did not reuse the trunk", page->pageNo == 100);
+    fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, VERTEX_PAGE, 0, &page) == FABRICDB_OK);
+    fdb_assert("Did not grow the file", page->pageNo == 423);
+
+    /* a rollback puts the types and the free list back */
+    fdb_pager_rollback(pager);
+    fdb_assert("Types not restored", pagetypecache_get_type(&pager->pageTypeCache, pager, 300) == FREE_PAGE);
+    fdb_assert("Types not restored", pagetypecache_get_type(&pager->pageTypeCache, pager, 423) == UNUSED_PAGE);
+    fdb_assert("Lists not restored", count_pages_of_type(pager, VERTEX_PAGE) == 0);
+
+    /* freeing more pages than a trunk holds starts a new trunk */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (pageNo = 2; pageNo < 200; pageNo++) {
+        if (pageNo != 100) {
+            fdb_assert("Could not free page", fdb_pager_free_page(pager, pageNo) == FABRICDB_OK);
+        }
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 200);
+    fdb_assert("Did not start a new trunk", pager->dbstate.freeTrunkPage != 100);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < 200; i++) {
+        fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_OK);
+        fdb_assert("Did not reuse a free page", page->pageNo <= 422);
+    }
+    fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_OK);
+    fdb_assert("Did not grow the file", page->pageNo == 423);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Free list not empty", pager->dbstate.fileFreePageCount == 0 && pager->dbstate.freeTrunkPage == 0);
+    fdb_assert("Wrong number of pages listed", count_pages_of_type(pager, EDGE_PAGE) == 421);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+typedef struct TestMoves {
+    uint32_t count;
+    uint32_t from[8];
+    uint32_t to[8];
+} TestMoves;
+
+static int record_move(void *arg, uint8_t pageType, uint32_t fromPageNo, uint32_t toPageNo) {
+    TestMoves *moves = (TestMoves*)arg;
+    if (pageType != EDGE_PAGE || moves->count == 8) {
+        return FABRICDB_EINVAL;
+    }
+    moves->from[moves->count] = fromPageNo;
+    moves->to[moves->count] = toPageNo;
+    moves->count++;
+    return FABRICDB_OK;
+}
+
+static int test_file_pages(Pager *pager, uint32_t *numPages) {
+    off_t size;
+    int rc = fdb_file_size(pager->dbfh, &size);
+    *numPages = (uint32_t)(size / pager->pageCache->frames.pageSize);
+    return rc;
+}
+
+void test_page_type_cache() {
+    Pager *pager;
+    Page *page;
+    PageTypeCache *cache;
+    uint32_t vertices[1000];
+    uint32_t pageNo;
+    uint32_t count = 0;
+    uint32_t i;
+    size_t bytes;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    /* 1000 pages over three map pages, every seventh one a vertex page */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set page size", fdb_pager_set_page_size(pager, 512) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < 1000; i++) {
+        fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, i % 7 ? EDGE_PAGE : VERTEX_PAGE, 0, &page) == FABRICDB_OK);
+        if (i % 7 == 0) {
+            vertices[count++] = page->pageNo;
+        }
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_pager_destroy(pager);
+
+    /* opening the file reads none of the map */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    cache = &pager->pageTypeCache;
+    fdb_assert("Map read at open", cache->types == NULL);
+    fdb_assert("Could not begin read", fdb_pager_begin_read(pager) == FABRICDB_OK);
+
+    /* looking up a page reads only the map page that describes it */
+    fdb_assert("Wrong type", pagetypecache_get_type(cache, pager, 950) == EDGE_PAGE);
+    fdb_assert("Wrong map pages read", cache->loaded[0] == 4);
+    fdb_assert("Wrong type", pagetypecache_get_type(cache, pager, 924) == P_PAGE);
+    fdb_assert("Wrong map pages read", cache->loaded[0] == 6);
+
+    /* the pages of a type are found in order across map pages */
+    for (i = 0; i < count; i++) {
+        fdb_assert("Wrong next page", pagetypecache_next(cache, pager, VERTEX_PAGE, i ? vertices[i - 1] : 0) == vertices[i]);
+    }
+    fdb_assert("Found a page past the last", pagetypecache_next(cache, pager, VERTEX_PAGE, vertices[count - 1]) == 0);
+    fdb_assert("Found a page of an unused type", pagetypecache_next(cache, pager, DOC_PAGE, 0) == 0);
+    fdb_assert("Map pages not found", pagetypecache_next(cache, pager, P_PAGE, 412) == 924);
+    fdb_assert("Wrong map pages read", cache->loaded[0] == 7);
+    fdb_assert("Could not find page", fdb_pager_next_page(pager, VERTEX_PAGE, 0, &pageNo) == FABRICDB_OK);
+    fdb_assert("Wrong next page", pageNo == vertices[0]);
+    fdb_assert("Looked for unused pages", fdb_pager_next_page(pager, UNUSED_PAGE, 0, &pageNo) == FABRICDB_EINVAL);
+    fdb_pager_end_read(pager);
+    fdb_assert("Looked outside a transaction", fdb_pager_next_page(pager, VERTEX_PAGE, 0, &pageNo) == FABRICDB_EMISUSE_TRANSACTION);
+
+    /* types hold less than a byte per page */
+    bytes = fabricdb_mem_size(cache->types) + fabricdb_mem_size(cache->loaded);
+    for (i = 0; i < cache->capacity / 4096; i++) {
+        bytes += fabricdb_mem_size(cache->types[i]);
+    }
+    for (i = 0; i < PAGE_TYPE_COUNT; i++) {
+        bytes += fabricdb_mem_size(cache->blocks[i]);
+    }
+    fdb_assert("Cache too large", bytes < cache->capacity);
+
+    /* a retyped page leaves its old type's blocks once none are left */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < count; i++) {
+        if (vertices[i] >= 128 && vertices[i] < 192) {
+            fdb_assert("Could not free page", fdb_pager_free_page(pager, vertices[i]) == FABRICDB_OK);
+        }
+    }
+    fdb_assert("Block still listed", !TYPECACHE_BIT(cache->blocks[VERTEX_PAGE], 2));
+    fdb_assert("Block not listed", TYPECACHE_BIT(cache->blocks[FREE_PAGE], 2));
+    fdb_assert("Freed page found", pagetypecache_next(cache, pager, VERTEX_PAGE, 127) >= 192);
+    fdb_assert("Free page not found", pagetypecache_next(cache, pager, FREE_PAGE, 0) >= 128);
+
+    /* a rollback reads the map again */
+    fdb_pager_rollback(pager);
+    fdb_assert("Types not reset", cache->types == NULL);
+    fdb_assert("Types not restored", pagetypecache_next(cache, pager, VERTEX_PAGE, 127) == 128);
+    fdb_assert("Types not restored", pagetypecache_next(cache, pager, FREE_PAGE, 0) == 0);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_incremental_vacuum() {
+    Pager *pager;
+    Page *page;
+    TestMoves moves;
+    uint32_t pageNo;
+    uint32_t numPages;
+    uint32_t i;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    remove(TEMPFILENAME);
+
+    /* pages 2 to 452, with the second type map at 412 */
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set page size", fdb_pager_set_page_size(pager, 512) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Vacuumed outside a transaction", fdb_pager_incremental_vacuum(pager, 0) == FABRICDB_EMISUSE_TRANSACTION);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < 450; i++) {
+        fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_OK);
+        pageNo = htoleu32(page->pageNo);
+        memcpy(page->data, &pageNo, 4);
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (pageNo = 413; pageNo <= 452; pageNo++) {
+        fdb_assert("Could not free page", fdb_pager_free_page(pager, pageNo) == FABRICDB_OK);
+    }
+    for (pageNo = 5; pageNo <= 7; pageNo++) {
+        fdb_assert("Could not free page", fdb_pager_free_page(pager, pageNo) == FABRICDB_OK);
+    }
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 43);
+    fdb_assert("Could not get file size", test_file_pages(pager, &numPages) == FABRICDB_OK);
+    fdb_assert("Wrong file size", numPages == 452);
+
+    /* a bounded vacuum cuts off that many free pages */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not vacuum", fdb_pager_incremental_vacuum(pager, 10) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong page count", pager->dbstate.filePageCount == 442);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 33);
+    fdb_assert("Could not get file size", test_file_pages(pager, &numPages) == FABRICDB_OK);
+    fdb_assert("File not truncated", numPages == 442);
+
+    /* without a relocator the vacuum stops at the first live page */
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not vacuum", fdb_pager_incremental_vacuum(pager, 0) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong page count", pager->dbstate.filePageCount == 411);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 3);
+    fdb_assert("Map page not cut off", pagetypecache_get_type(&pager->pageTypeCache, pager, 412) == UNUSED_PAGE);
+
+    /* a rollback leaves the database as it was */
+    moves.count = 0;
+    fdb_assert("Could not set relocator", fdb_pager_set_relocator(pager, record_move, &moves) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not vacuum", fdb_pager_incremental_vacuum(pager, 0) == FABRICDB_OK);
+    fdb_pager_rollback(pager);
+    fdb_assert("Types not restored", pagetypecache_get_type(&pager->pageTypeCache, pager, 411) == EDGE_PAGE);
+    fdb_assert("Types not restored", pagetypecache_get_type(&pager->pageTypeCache, pager, 5) == FREE_PAGE);
+
+    /* live pages are moved into free pages and the relocator is told */
+    moves.count = 0;
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not vacuum", fdb_pager_incremental_vacuum(pager, 2) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Wrong number of moves", moves.count == 2);
+    fdb_assert("Wrong page moved", moves.from[0] == 411 && moves.from[1] == 410);
+    fdb_assert("Wrong page count", pager->dbstate.filePageCount == 409);
+    fdb_assert("Wrong free page count", pager->dbstate.fileFreePageCount == 1);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Init failed", fdb_pager_init(pager) == FABRICDB_OK);
+    fdb_assert("Could not get file size", test_file_pages(pager, &numPages) == FABRICDB_OK);
+    fdb_assert("File not truncated", numPages == 409);
+    for (i = 0; i < moves.count; i++) {
+        fdb_assert("Moved page not typed", pagetypecache_get_type(&pager->pageTypeCache, pager, moves.to[i]) == EDGE_PAGE);
+        fdb_assert("Could not fetch page", fdb_pager_fetch_page(pager, moves.to[i], &page) == FABRICDB_OK);
+        memcpy(&pageNo, page->data, 4);
+        fdb_assert("Page not copied", letohu32(pageNo) == moves.from[i]);
+    }
+    fdb_assert("Cut off page still listed", pagetypecache_next(&pager->pageTypeCache, pager, EDGE_PAGE, 409) == 0);
+
+    /* auto vacuum runs at commit once enough pages are free */
+    moves.count = 0;
+    fdb_assert("Could not set relocator", fdb_pager_set_relocator(pager, record_move, &moves) == FABRICDB_OK);
+    fdb_assert("Could not turn on auto vacuum", fdb_pager_set_auto_vacuum(pager, 1) == FABRICDB_OK);
+    fdb_assert("Could not set threshold", fdb_pager_set_auto_vacuum_threshold(pager, 3) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not free page", fdb_pager_free_page(pager, 100) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Vacuumed below the threshold", pager->dbstate.fileFreePageCount == 2 && moves.count == 0);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    fdb_assert("Could not free page", fdb_pager_free_page(pager, 200) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Did not auto vacuum", pager->dbstate.fileFreePageCount == 0 && moves.count == 3);
+    fdb_assert("Wrong page count", pager->dbstate.filePageCount == 406);
+    fdb_pager_destroy(pager);
+
+    /* in WAL mode the checkpoint shrinks the file */
+    remove(TEMPFILENAME);
+    fdb_assert("Could not create pager", fdb_pager_create(TEMPFILENAME, &pager) == FABRICDB_OK);
+    fdb_assert("Could not set WAL mode", fdb_pager_set_file_format_write_version(pager, 2) == FABRICDB_OK);
+    fdb_assert("Init file failed", fdb_pager_init_file(pager) == FABRICDB_OK);
+    fdb_assert("Could not begin write", fdb_pager_begin_write(pager) == FABRICDB_OK);
+    for (i = 0; i < 20; i++) {
+        fdb_assert("Could not allocate page", fdb_pager_allocate_page(pager, EDGE_PAGE, 0, &page) == FABRICDB_OK);
+    }
+    for (pageNo = 12; pageNo <= 21; pageNo++) {
+        fdb_assert("Could not free page", fdb_pager_free_page(pager, pageNo) == FABRICDB_OK);
+    }
+    fdb_assert("Could not vacuum", fdb_pager_incremental_vacuum(pager, 0) == FABRICDB_OK);
+    fdb_assert("Could not commit", fdb_pager_commit(pager) == FABRICDB_OK);
+    fdb_assert("Could not checkpoint", fdb_pager_checkpoint(pager) == FABRICDB_OK);
+    fdb_assert("Could not get file size", test_file_pages(pager, &numPages) == FABRICDB_OK);
+    fdb_assert("File not truncated", numPages == 11);
+    fdb_pager_destroy(pager);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
 void test_pager() {
     fdb_runtest("Read page", test_read_page);
+    fdb_runtest("Frame pool", test_frame_pool);
     fdb_runtest("Create / Destroy database", test_create_destroy_database);
     fdb_runtest("Init file", test_init_file);
     fdb_runtest("Init file 2", test_init_file_2);
+    fdb_runtest("Fetch page eviction", test_fetch_page_eviction);
+    fdb_runtest("Fetch page scan resistance", test_fetch_page_scan_resistance);
+    fdb_runtest("Fetch page pinned and dirty", test_fetch_page_pinned_and_dirty);
+    fdb_runtest("Fetch page mmap", test_fetch_page_mmap);
+    fdb_runtest("Concurrent fetches", test_concurrent_fetches);
+    fdb_runtest("Shared cache", test_shared_cache);
+    fdb_runtest("Read-ahead", test_read_ahead);
+    fdb_runtest("Transactions in journal mode", test_transactions_journal_mode);
+    fdb_runtest("Journal mode spill and rollback", test_transactions_journal_mode_spill);
+    fdb_runtest("Busy handler", test_busy_handler);
+    fdb_runtest("Commit write back", test_commit_write_back);
+    fdb_runtest("Page checksums", test_page_checksums);
+    fdb_runtest("Page compression", test_page_compression);
+    fdb_runtest("Page compression storage flag", test_page_compression_storage_flag);
+    fdb_runtest("Compressed cache tier", test_compressed_cache);
+    fdb_runtest("Soft heap limit", test_soft_heap_limit);
+    fdb_runtest("Page allocator", test_page_allocator);
+    fdb_runtest("Page type cache", test_page_type_cache);
+    fdb_runtest("Incremental vacuum", test_incremental_vacuum);
+    fdb_runtest("WAL mode", test_wal_mode);
+    fdb_runtest("WAL group commit", test_wal_group_commit);
+    fdb_runtest("WAL group commit sync failure", test_wal_group_commit_sync_failure);
+    fdb_runtest("Snapshot reads", test_snapshot_reads);
 }
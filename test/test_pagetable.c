@@ -0,0 +1,173 @@
+#include "test_common.h"
+
+static void test_pagetable_init(pagetable* map) {
+    map->slots = NULL;
+    map->oldSlots = NULL;
+    map->size = 0;
+    map->count = 0;
+    map->oldSize = 0;
+    map->oldCount = 0;
+    map->migrated = 0;
+}
+
+void test_pagetable_set_size() {
+    pagetable map;
+    uint32_t key;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_pagetable_init(&map);
+
+    fdb_assert("Set size failed", pagetable_set_size(&map, 5) == FABRICDB_OK);
+    fdb_assert("Did not allocate memory", fabricdb_mem_used() > 0);
+    fdb_assert("Did not round size", map.size == 8);
+    fdb_assert("Set count", map.count == 0);
+
+    fdb_assert("Set size failed", pagetable_set_size(&map, 20) == FABRICDB_OK);
+    fdb_assert("Did not round size", map.size == 32);
+
+    for (key = 1; key <= 20; key++) {
+        fdb_assert("Insert failed", pagetable_set(&map, key, (void*)(uintptr_t)(key * 2)) == FABRICDB_OK);
+    }
+    fdb_assert("Count not set", pagetable_count(&map) == 20);
+    fdb_assert("Was resized", map.size == 32);
+
+    /* shrinking rehashes everything at once */
+    fdb_assert("Set size failed", pagetable_set_size(&map, 24) == FABRICDB_OK);
+    fdb_assert("Size not set", map.size == 32);
+    fdb_assert("Set size failed", pagetable_set_size(&map, 64) == FABRICDB_OK);
+    fdb_assert("Size not set", map.size == 64);
+    fdb_assert("Count was changed", pagetable_count(&map) == 20);
+
+    for (key = 1; key <= 20; key++) {
+        fdb_assert("Lost a value", pagetable_get_or(&map, key, 0) == (void*)(uintptr_t)(key * 2));
+    }
+    fdb_assert("Has missing value", pagetable_has(&map, 21) == 0);
+    fdb_assert("Has missing value", pagetable_has(&map, 0) == 0);
+
+    pagetable_deinit(&map);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_pagetable_get_ref() {
+    pagetable map;
+    void** v;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_pagetable_init(&map);
+
+    fdb_assert("Resize failed", pagetable_set_size(&map, 8) == FABRICDB_OK);
+
+    fdb_assert("Insert failed", pagetable_set(&map, 1, (void*)2) == FABRICDB_OK);
+    fdb_assert("Insert failed", pagetable_set(&map, 3, (void*)8) == FABRICDB_OK);
+    fdb_assert("Insert failed", pagetable_set(&map, 9, (void*)1) == FABRICDB_OK);
+
+    v = pagetable_get_ref(&map, 1);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (void*)2);
+    v = pagetable_get_ref(&map, 3);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (void*)8);
+    v = pagetable_get_ref(&map, 9);
+    fdb_assert("Did not return correct reference", v != NULL);
+    fdb_assert("Did not return correct value", *v == (void*)1);
+    *v = (void*)3;
+    fdb_assert("Did not update reference value", pagetable_get_or(&map, 9, 0) == (void*)3);
+    v = pagetable_get_ref(&map, 2);
+    fdb_assert("Did not return null", v == NULL);
+    v = pagetable_get_ref(&map, 6);
+    fdb_assert("Did not return null", v == NULL);
+
+    /* setting an existing key replaces its value */
+    fdb_assert("Insert failed", pagetable_set(&map, 3, (void*)5) == FABRICDB_OK);
+    fdb_assert("Did not replace value", pagetable_get_or(&map, 3, 0) == (void*)5);
+    fdb_assert("Duplicated key", pagetable_count(&map) == 3);
+
+    pagetable_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_pagetable_remove() {
+    pagetable map;
+    uint32_t key;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_pagetable_init(&map);
+
+    fdb_assert("Resize failed", pagetable_set_size(&map, 64) == FABRICDB_OK);
+    for (key = 1; key <= 40; key++) {
+        fdb_assert("Insert failed", pagetable_set(&map, key, (void*)(uintptr_t)key) == FABRICDB_OK);
+    }
+
+    for (key = 1; key <= 40; key += 2) {
+        fdb_assert("Did not remove key", pagetable_remove(&map, key) == 1);
+    }
+    fdb_assert("Removed missing key", pagetable_remove(&map, 1) == 0);
+    fdb_assert("Count not decremented", pagetable_count(&map) == 20);
+
+    for (key = 1; key <= 40; key++) {
+        if (key % 2) {
+            fdb_assert("Still has removed key", pagetable_has(&map, key) == 0);
+        } else {
+            fdb_assert("Lost a key", pagetable_get_or(&map, key, 0) == (void*)(uintptr_t)key);
+        }
+    }
+
+    pagetable_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_pagetable_incremental_resize() {
+    pagetable map;
+    uint32_t key;
+    uint32_t size;
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    test_pagetable_init(&map);
+
+    fdb_assert("Resize failed", pagetable_set_size(&map, 16) == FABRICDB_OK);
+    for (key = 1; key <= 14; key++) {
+        fdb_assert("Insert failed", pagetable_set(&map, key * 7, (void*)(uintptr_t)key) == FABRICDB_OK);
+    }
+    fdb_assert("Resized too early", map.oldSlots == NULL);
+
+    /* this insert starts a resize */
+    fdb_assert("Insert failed", pagetable_set(&map, 15 * 7, (void*)15) == FABRICDB_OK);
+    size = map.size;
+    fdb_assert("Did not grow", size == 32);
+    fdb_assert("Did not keep the old slots", map.oldSlots != NULL);
+    fdb_assert("Migrated everything at once", map.oldCount > 0);
+    fdb_assert("Lost count", pagetable_count(&map) == 15);
+
+    /* every key is visible while the resize is in progress */
+    for (key = 1; key <= 15; key++) {
+        fdb_assert("Lost a key during resize", pagetable_get_or(&map, key * 7, 0) == (void*)(uintptr_t)key);
+    }
+
+    /* updates and removes work on keys that have not been migrated */
+    fdb_assert("Remove failed", pagetable_remove(&map, 14 * 7) == 1);
+    fdb_assert("Insert failed", pagetable_set(&map, 13 * 7, (void*)99) == FABRICDB_OK);
+    fdb_assert("Did not update", pagetable_get_or(&map, 13 * 7, 0) == (void*)99);
+    fdb_assert("Did not remove", pagetable_has(&map, 14 * 7) == 0);
+
+    for (key = 200; key <= 210; key++) {
+        fdb_assert("Insert failed", pagetable_set(&map, key, (void*)(uintptr_t)key) == FABRICDB_OK);
+    }
+    fdb_assert("Did not finish resize", map.oldSlots == NULL);
+    fdb_assert("Lost count", pagetable_count(&map) == 25);
+    fdb_assert("Did not update", pagetable_get_or(&map, 13 * 7, 0) == (void*)99);
+    for (key = 1; key <= 12; key++) {
+        fdb_assert("Lost a key after resize", pagetable_get_or(&map, key * 7, 0) == (void*)(uintptr_t)key);
+    }
+
+    pagetable_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
+void test_pagetable() {
+    fdb_runtest("pagetable set size", test_pagetable_set_size);
+    fdb_runtest("pagetable get ref", test_pagetable_get_ref);
+    fdb_runtest("pagetable remove", test_pagetable_remove);
+    fdb_runtest("pagetable incremental resize", test_pagetable_incremental_resize);
+}
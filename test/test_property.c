@@ -168,7 +168,7 @@ void test_property_tou64() {
 void test_property_tof64() {
     Property prop;
 
-    double ov;
+    double ov = 3.14159;
     double v;
 
     v = htolef64(ov);
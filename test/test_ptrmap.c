@@ -1,6 +1,6 @@
 #include "test_common.h"
 void test_ptrmap_set_size() {
-    ptrmap map;
+    ptrmap map = {0};
     int memUsed;
     int testV;
 
@@ -68,7 +68,7 @@ void test_ptrmap_set_size() {
 }
 
 void test_ptrmap_get_ref() {
-    ptrmap map;
+    ptrmap map = {0};
     void** v;
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
     fdb_assert("Count is set", map.count == 0);
@@ -105,7 +105,43 @@ void test_ptrmap_get_ref() {
     fdb_passed;
 }
 
+void test_ptrmap_remove() {
+    ptrmap map = {0};
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+
+    map.items = NULL;
+    map.count = 0;
+    map.size = 0;
+    fdb_assert("Resize failed", ptrmap_set_size(&map, 3) == FABRICDB_OK);
+
+    fdb_assert("Insert failed", ptrmap_set(&map, 1, (void*)2) == FABRICDB_OK);
+    fdb_assert("Insert failed", ptrmap_set(&map, 4, (void*)8) == FABRICDB_OK);
+    fdb_assert("Insert failed", ptrmap_set(&map, 7, (void*)1) == FABRICDB_OK);
+    fdb_assert("Count not set", map.count == 3);
+
+    /* remove from the middle of a chain */
+    fdb_assert("Did not remove key", ptrmap_remove(&map, 4) == 1);
+    fdb_assert("Count not decremented", map.count == 2);
+    fdb_assert("Still has removed key", ptrmap_has(&map, 4) == 0);
+    fdb_assert("Lost value 1", ptrmap_get_or(&map, 1, 0) == (void*)2);
+    fdb_assert("Lost value 7", ptrmap_get_or(&map, 7, 0) == (void*)1);
+
+    /* remove a missing key */
+    fdb_assert("Removed missing key", ptrmap_remove(&map, 4) == 0);
+    fdb_assert("Count changed", map.count == 2);
+
+    /* remove the head of a chain */
+    fdb_assert("Did not remove key", ptrmap_remove(&map, 1) == 1);
+    fdb_assert("Did not remove key", ptrmap_remove(&map, 7) == 1);
+    fdb_assert("Count not zero", map.count == 0);
+
+    ptrmap_deinit(&map);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    fdb_passed;
+}
+
 void test_ptrmap() {
     fdb_runtest("ptrmap set size", test_ptrmap_set_size);
     fdb_runtest("ptrmap get ref", test_ptrmap_get_ref);
+    fdb_runtest("ptrmap remove", test_ptrmap_remove);
 }
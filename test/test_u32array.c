@@ -15,7 +15,7 @@
 #include "test_common.h"
 
 void test_u32array_set_size() {
-    u32array arr;
+    u32array arr = {0};
 
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
@@ -76,13 +76,9 @@ void test_u32array_set_size() {
 }
 
 void test_u32array_has() {
-    u32array arr;
+    u32array arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", u32array_has(&arr, 0) == 0);
 
     fdb_assert("Could not add a value", u32array_set(&arr, 0, 100) == FABRICDB_OK);
@@ -101,13 +97,9 @@ void test_u32array_has() {
 }
 
 void test_u32array_get_or() {
-    u32array arr;
+    u32array arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", u32array_get_or(&arr, 0, 1) == 1);
 
     fdb_assert("Could not add a value", u32array_set(&arr, 0, 100) == FABRICDB_OK);
@@ -126,14 +118,10 @@ void test_u32array_get_or() {
 }
 
 void test_u32array_get_ref() {
-    u32array arr;
+    u32array arr = {0};
     uint32_t* v;
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
-    fdb_assert("Size not initialized to 0", arr.size == 0);
-    fdb_assert("Count not initialized to 0", arr.count == 0);
-    fdb_assert("Data not initialized to null", arr.data == NULL);
-
     fdb_assert("Has zero but shouldn't", u32array_get_ref(&arr, 0) == NULL);
 
     fdb_assert("Could not add a value", u32array_set(&arr, 0, 100) == FABRICDB_OK);
@@ -158,7 +146,7 @@ void test_u32array_get_ref() {
 }
 
 void test_u32array_pop_or() {
-    u32array arr;
+    u32array arr = {0};
     fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
 
     fdb_assert("Could not push value", u32array_push(&arr, 1) == FABRICDB_OK);
@@ -0,0 +1,328 @@
+#include "test_common.h"
+
+static const char* WAL_DBFILENAME = "./walfile.tmp";
+static const char* WAL_LOGFILENAME = "./walfile.tmp-wal";
+static const char* WAL_SHMFILENAME = "./walfile.tmp-shm";
+
+#define WAL_TEST_PAGE_SIZE 512
+
+static void remove_wal_files() {
+    remove(WAL_DBFILENAME);
+    remove(WAL_LOGFILENAME);
+    remove(WAL_SHMFILENAME);
+}
+
+/* Opens a connection to the test log */
+static int open_test_wal(FileHandle **dbfh, FileHandle **walfh, Wal **wal) {
+    int rc = fdb_open_or_create_file(WAL_DBFILENAME, dbfh);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_open_or_create_file(WAL_LOGFILENAME, walfh);
+    }
+    if (rc == FABRICDB_OK) {
+        rc = fdb_wal_open(*walfh, WAL_SHMFILENAME, WAL_TEST_PAGE_SIZE, wal);
+    }
+    return rc;
+}
+
+static void close_test_wal(FileHandle *dbfh, FileHandle *walfh, Wal *wal) {
+    fdb_wal_close(wal, dbfh);
+    fdb_close_file(walfh);
+    fdb_close_file(dbfh);
+}
+
+/* Drops a connection without the checkpoint a clean close does, the
+   way a crashed process would */
+static void abandon_test_wal(FileHandle *dbfh, FileHandle *walfh, Wal *wal) {
+    fdb_shm_close(wal->shm);
+    fdbfree(wal);
+    fdb_close_file(walfh);
+    fdb_close_file(dbfh);
+}
+
+/* Commits pages first to last, page n is filled with the byte n + fill.
+   The database grows to hold the last page. */
+static int commit_test_pages(Wal *wal, uint32_t first, uint32_t last, uint8_t fill) {
+    int rc;
+    int changed;
+    uint32_t i;
+    uint32_t count = last - first + 1;
+    uint8_t *data = fdbmalloc(WAL_TEST_PAGE_SIZE * count);
+    WalFrame *frames = fdbmalloc(sizeof(WalFrame) * count);
+
+    for (i = 0; i < count; i++) {
+        frames[i].pageNo = first + i;
+        frames[i].data = data + WAL_TEST_PAGE_SIZE * i;
+        memset(frames[i].data, (uint8_t)(first + i + fill), WAL_TEST_PAGE_SIZE);
+    }
+
+    rc = fdb_wal_begin_read(wal, &changed);
+    if (rc == FABRICDB_OK) {
+        rc = fdb_wal_begin_write(wal);
+        if (fdb_wal_db_size(wal) > last) {
+            last = fdb_wal_db_size(wal);
+        }
+        if (rc == FABRICDB_OK) {
+            rc = fdb_wal_write_frames(wal, frames, count, last, 1);
+            fdb_wal_end_write(wal);
+        }
+        fdb_wal_end_read(wal);
+    }
+
+    fdbfree(frames);
+    fdbfree(data);
+    return rc;
+}
+
+/* Returns the first byte of a page as the connection sees it, or 0 */
+static uint8_t read_test_page(Wal *wal, FileHandle *dbfh, uint32_t pageNo) {
+    uint8_t data[WAL_TEST_PAGE_SIZE];
+    uint32_t frame = fdb_wal_find_frame(wal, pageNo);
+
+    if (frame != 0) {
+        if (fdb_wal_read_frame(wal, frame, data) != FABRICDB_OK) {
+            return 0;
+        }
+    } else if (fdb_read(dbfh, data, (off_t)(pageNo - 1) * WAL_TEST_PAGE_SIZE, WAL_TEST_PAGE_SIZE) != FABRICDB_OK) {
+        return 0;
+    }
+    return data[0];
+}
+
+void test_wal_write_read() {
+    FileHandle *dbfh, *walfh, *dbfh2, *walfh2;
+    Wal *wal, *wal2;
+    int changed;
+    uint8_t data[WAL_TEST_PAGE_SIZE];
+    off_t size;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not open second wal", open_test_wal(&dbfh2, &walfh2, &wal2) == FABRICDB_OK);
+
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal, &changed) == FABRICDB_OK);
+    fdb_assert("Empty log has frames", fdb_wal_find_frame(wal, 1) == 0);
+    fdb_assert("Empty log has a size", fdb_wal_db_size(wal) == 0);
+    fdb_assert("Write needs a read", fdb_wal_begin_write(wal) == FABRICDB_OK);
+    fdb_assert("Second writer allowed", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_assert("Second writer allowed", fdb_wal_begin_write(wal2) == FABRICDB_BUSY);
+    fdb_wal_end_read(wal2);
+    fdb_wal_end_write(wal);
+    fdb_wal_end_read(wal);
+
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 3, 0) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 2, 2, 100) == FABRICDB_OK);
+    fdb_assert("Could not get log size", fdb_file_size(walfh, &size) == FABRICDB_OK);
+    fdb_assert("Log size wrong", size == 32 + 4 * (24 + WAL_TEST_PAGE_SIZE));
+
+    /* the other connection sees the newest version of each page */
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_assert("Change not noticed", changed == 1);
+    fdb_assert("Wrong frame", fdb_wal_find_frame(wal2, 1) == 1);
+    fdb_assert("Wrong frame", fdb_wal_find_frame(wal2, 2) == 4);
+    fdb_assert("Wrong frame", fdb_wal_find_frame(wal2, 3) == 3);
+    fdb_assert("Page not in log", fdb_wal_find_frame(wal2, 4) == 0);
+    fdb_assert("Could not read frame", fdb_wal_read_frame(wal2, 4, data) == FABRICDB_OK);
+    fdb_assert("Wrong data", data[0] == 102 && data[WAL_TEST_PAGE_SIZE - 1] == 102);
+    fdb_assert("Wrong size", fdb_wal_db_size(wal2) == 3);
+    fdb_assert("Wrong pending frames", fdb_wal_pending_frames(wal2) == 4);
+    fdb_wal_end_read(wal2);
+
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_assert("Change noticed twice", changed == 0);
+    fdb_wal_end_read(wal2);
+
+    close_test_wal(dbfh2, walfh2, wal2);
+    close_test_wal(dbfh, walfh, wal);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+    fdb_passed;
+}
+
+void test_wal_snapshot() {
+    FileHandle *dbfh, *walfh, *dbfh2, *walfh2;
+    Wal *wal, *wal2;
+    int changed;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not open second wal", open_test_wal(&dbfh2, &walfh2, &wal2) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 2, 0) == FABRICDB_OK);
+
+    /* a reader keeps its snapshot while the writer commits */
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 2, 3, 50) == FABRICDB_OK);
+    fdb_assert("Reader saw the commit", read_test_page(wal2, dbfh2, 2) == 2);
+    fdb_assert("Reader saw the commit", fdb_wal_find_frame(wal2, 3) == 0);
+    fdb_assert("Reader snapshot size wrong", fdb_wal_db_size(wal2) == 2);
+
+    /* a stale reader can not become the writer */
+    fdb_assert("Stale snapshot allowed to write", fdb_wal_begin_write(wal2) == FABRICDB_BUSY);
+
+    /* the checkpoint leaves frames the reader needs alone */
+    fdb_assert("Could not checkpoint", fdb_wal_checkpoint(wal, dbfh) == FABRICDB_OK);
+    fdb_assert("Checkpoint went past the reader", WAL_CKPT_INFO(wal)->nBackfill == 2);
+    fdb_assert("Reader saw the checkpoint", read_test_page(wal2, dbfh2, 2) == 2);
+    fdb_wal_end_read(wal2);
+
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_assert("Change not noticed", changed == 1);
+    fdb_assert("Reader missed the commit", read_test_page(wal2, dbfh2, 2) == 52);
+    fdb_assert("Reader missed the commit", read_test_page(wal2, dbfh2, 3) == 53);
+    fdb_wal_end_read(wal2);
+
+    close_test_wal(dbfh2, walfh2, wal2);
+    close_test_wal(dbfh, walfh, wal);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+    fdb_passed;
+}
+
+void test_wal_snapshot_reopen() {
+    FileHandle *dbfh, *walfh, *dbfh2, *walfh2;
+    Wal *wal, *wal2;
+    WalIndexHeader snapshot;
+    int changed;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not open second wal", open_test_wal(&dbfh2, &walfh2, &wal2) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 2, 0) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    snapshot = wal2->hdr;
+    fdb_wal_end_read(wal2);
+
+    /* an older snapshot is read again after later commits */
+    fdb_assert("Could not commit", commit_test_pages(wal, 2, 3, 50) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal2, &changed) == FABRICDB_OK);
+    fdb_wal_end_read(wal2);
+    fdb_assert("Could not reopen snapshot", fdb_wal_begin_read_snapshot(wal2, &snapshot, &changed) == FABRICDB_OK);
+    fdb_assert("Change not noticed", changed == 1);
+    fdb_assert("Read past the snapshot", read_test_page(wal2, dbfh2, 2) == 2);
+    fdb_assert("Read past the snapshot", fdb_wal_find_frame(wal2, 3) == 0);
+    fdb_assert("Snapshot size wrong", fdb_wal_db_size(wal2) == 2);
+
+    /* the checkpoint leaves frames past it alone */
+    fdb_assert("Could not checkpoint", fdb_wal_checkpoint(wal, dbfh) == FABRICDB_OK);
+    fdb_assert("Checkpoint went past the snapshot", WAL_CKPT_INFO(wal)->nBackfill == 2);
+    fdb_assert("Read past the snapshot", read_test_page(wal2, dbfh2, 2) == 2);
+    fdb_wal_end_read(wal2);
+
+    /* and once it has copied them the snapshot is gone */
+    fdb_assert("Could not checkpoint", fdb_wal_checkpoint(wal, dbfh) == FABRICDB_OK);
+    fdb_assert("Reopened an expired snapshot", fdb_wal_begin_read_snapshot(wal2, &snapshot, &changed) == FABRICDB_SNAPSHOT_EXPIRED);
+    fdb_assert("Read lock left", wal2->readLock < 0);
+
+    close_test_wal(dbfh2, walfh2, wal2);
+    close_test_wal(dbfh, walfh, wal);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+    fdb_passed;
+}
+
+void test_wal_checkpoint() {
+    FileHandle *dbfh, *walfh;
+    Wal *wal;
+    int changed;
+    uint8_t byte;
+    off_t size;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 4, 0) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 3, 3, 10) == FABRICDB_OK);
+
+    fdb_assert("Could not checkpoint", fdb_wal_checkpoint(wal, dbfh) == FABRICDB_OK);
+    fdb_assert("Frames left over", fdb_wal_pending_frames(wal) == 0);
+    fdb_assert("Could not get file size", fdb_file_size(dbfh, &size) == FABRICDB_OK);
+    fdb_assert("Database size wrong", size == 4 * WAL_TEST_PAGE_SIZE);
+    fdb_assert("Could not read file", fdb_read(dbfh, &byte, 2 * WAL_TEST_PAGE_SIZE, 1) == FABRICDB_OK);
+    fdb_assert("Newest version not copied", byte == 13);
+    fdb_assert("Could not read file", fdb_read(dbfh, &byte, 3 * WAL_TEST_PAGE_SIZE, 1) == FABRICDB_OK);
+    fdb_assert("Page not copied", byte == 4);
+
+    /* once everything is copied, readers go straight to the file */
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal, &changed) == FABRICDB_OK);
+    fdb_assert("Reader did not use the file", wal->readLock == 0);
+    fdb_assert("Reader did not use the file", fdb_wal_find_frame(wal, 3) == 0);
+    fdb_wal_end_read(wal);
+
+    /* and the next commit starts the log over */
+    fdb_assert("Could not commit", commit_test_pages(wal, 2, 2, 20) == FABRICDB_OK);
+    fdb_assert("Log did not restart", wal->hdr.mxFrame == 1);
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal, &changed) == FABRICDB_OK);
+    fdb_assert("Old frame visible", fdb_wal_find_frame(wal, 3) == 0);
+    fdb_assert("New frame missing", read_test_page(wal, dbfh, 2) == 22);
+    fdb_assert("Old page lost", read_test_page(wal, dbfh, 3) == 13);
+    fdb_wal_end_read(wal);
+
+    /* the last connection out empties the log */
+    close_test_wal(dbfh, walfh, wal);
+    fdb_assert("Could not open file", fdb_open_file_rdwr(WAL_LOGFILENAME, &walfh) == FABRICDB_OK);
+    fdb_assert("Could not get log size", fdb_file_size(walfh, &size) == FABRICDB_OK);
+    fdb_assert("Log not emptied", size == 0);
+    fdb_close_file(walfh);
+
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+    fdb_passed;
+}
+
+void test_wal_recovery() {
+    FileHandle *dbfh, *walfh;
+    Wal *wal;
+    int changed;
+    uint8_t garbage[100];
+    off_t size;
+
+    fdb_assert("Started with unclean memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 3, 0) == FABRICDB_OK);
+    fdb_assert("Could not commit", commit_test_pages(wal, 1, 1, 30) == FABRICDB_OK);
+    abandon_test_wal(dbfh, walfh, wal);
+
+    /* a torn frame at the end of the log is ignored */
+    memset(garbage, 0xEE, sizeof(garbage));
+    fdb_assert("Could not open file", fdb_open_file_rdwr(WAL_LOGFILENAME, &walfh) == FABRICDB_OK);
+    fdb_assert("Could not get log size", fdb_file_size(walfh, &size) == FABRICDB_OK);
+    fdb_assert("Could not write", fdb_write(walfh, garbage, size, sizeof(garbage)) == FABRICDB_OK);
+    fdb_close_file(walfh);
+
+    /* the index is rebuilt from the log */
+    fdb_assert("Could not open wal", open_test_wal(&dbfh, &walfh, &wal) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal, &changed) == FABRICDB_OK);
+    fdb_assert("Wrong number of frames", wal->hdr.mxFrame == 4);
+    fdb_assert("Wrong size", fdb_wal_db_size(wal) == 3);
+    fdb_assert("Lost a commit", read_test_page(wal, dbfh, 1) == 31);
+    fdb_assert("Lost a commit", read_test_page(wal, dbfh, 3) == 3);
+    fdb_wal_end_read(wal);
+
+    /* a new commit goes after the recovered frames */
+    fdb_assert("Could not commit", commit_test_pages(wal, 2, 2, 40) == FABRICDB_OK);
+    fdb_assert("Could not begin read", fdb_wal_begin_read(wal, &changed) == FABRICDB_OK);
+    fdb_assert("Frame not appended", fdb_wal_find_frame(wal, 2) == 5);
+    fdb_assert("Lost a commit", read_test_page(wal, dbfh, 2) == 42);
+    fdb_wal_end_read(wal);
+
+    close_test_wal(dbfh, walfh, wal);
+    fdb_assert("Did not clean up all the memory", fabricdb_mem_used() == 0);
+    remove_wal_files();
+    fdb_passed;
+}
+
+void test_wal() {
+    fdb_runtest("Write and read", test_wal_write_read);
+    fdb_runtest("Snapshot isolation", test_wal_snapshot);
+    fdb_runtest("Snapshot reopen", test_wal_snapshot_reopen);
+    fdb_runtest("Checkpoint", test_wal_checkpoint);
+    fdb_runtest("Recovery", test_wal_recovery);
+}